@@ -15,7 +15,6 @@ namespace FallbackLayer
     struct BVH
     {
         std::vector<AABBNode>   m_nodes;
-        std::vector<float> m_triangles;
         std::vector<PrimitiveMetaData> m_metadata;
     };
 
@@ -44,9 +43,10 @@ namespace FallbackLayer
         void ComputeBox(
             AABB& overallBox,
             const std::vector<AABB>& boxes,
-            const std::vector<PrimitiveMetaData>& metadata)
+            const PrimitiveMetaData *pMetadata,
+            UINT32 numPrimitives)
     {
-        if (metadata.empty())
+        if (numPrimitives == 0)
         {
             overallBox.max.x = overallBox.min.x = 0;
             overallBox.max.y = overallBox.min.y = 0;
@@ -54,12 +54,11 @@ namespace FallbackLayer
             return;
         }
 
-        overallBox = boxes[metadata[0].PrimitiveIndex];
+        overallBox = boxes[pMetadata[0].PrimitiveIndex];
 
-        const UINT32 numTris = (UINT32)metadata.size();
-        for (UINT32 i = 1; i < numTris; ++i)
+        for (UINT32 i = 1; i < numPrimitives; ++i)
         {
-            const UINT32 triId = metadata[i].PrimitiveIndex;
+            const UINT32 triId = pMetadata[i].PrimitiveIndex;
             assert(triId < boxes.size());
             const AABB& newBox = boxes[triId];
 
@@ -117,15 +116,10 @@ namespace FallbackLayer
     }
 
     static
-        UINT32 BuildBVHAddNode(
-            BVH& bvh,
-            const AABB& box,
-            UINT32 maxDimension)
+        void PackAABBNode(
+            AABBNode& packedBox,
+            const AABB& box)
     {
-        UNREFERENCED_PARAMETER(maxDimension);
-        assert(maxDimension < 3);
-        const UINT32 nodeIndex = (UINT32)bvh.m_nodes.size();
-
         float cX = (box.max.x + box.min.x) * 0.5f;
         float cY = (box.max.y + box.min.y) * 0.5f;
         float cZ = (box.max.z + box.min.z) * 0.5f;
@@ -137,7 +131,6 @@ namespace FallbackLayer
         float dY = max(box.max.y - cY, cY - box.min.y);
         float dZ = max(box.max.z - cZ, cZ - box.min.z);
 
-        AABBNode packedBox;
         packedBox.center[0] = cX;
         packedBox.center[1] = cY;
         packedBox.center[2] = cZ;
@@ -145,173 +138,366 @@ namespace FallbackLayer
         packedBox.halfDim[1] = dY;
         packedBox.halfDim[2] = dZ;
         packedBox.nodeAllBits = 0;
+        packedBox.rightNodeIndex = 0;
+    }
 
-        bvh.m_nodes.push_back(packedBox);
+    static
+        float GetCentroid(
+            const AABB& box,
+            UINT32 axis)
+    {
+        return (box.maxArr[axis] + box.minArr[axis]) * 0.5f;
+    }
 
-        assert(bvh.m_nodes.size() - 1 == nodeIndex);
+    static
+        float ComputeBoxSurfaceArea(
+            const AABB& box)
+    {
+        const float dims[3] =
+        {
+            box.max.x - box.min.x,
+            box.max.y - box.min.y,
+            box.max.z - box.min.z
+        };
 
-        bvh.m_nodes[nodeIndex].internalNode.separatingAxis = 0;
+        return 2 * (dims[0] * dims[1] + dims[0] * dims[2] + dims[1] * dims[2]);
+    }
 
-        return nodeIndex;
+    static
+        void InitBoxToInverseMax(
+            AABB& box)
+    {
+        box.max.x = box.max.y = box.max.z = -10e10f;//FLT_MAX;
+        box.min.x = box.min.y = box.min.z = 10e10f;//FLT_MAX;
     }
 
+    static const UINT NUM_SAH_BINS = 64;
+
+    // Primitives binned per chunk when a node is binned across multiple threads
+    static const UINT SAH_BINNING_CHUNK_SIZE = 16 * 1024;
+
+    struct SahBin
+    {
+        AABB    box;
+        UINT    numTriangles;
+    };
+
+    struct SahBins
+    {
+        SahBin  bins[3][NUM_SAH_BINS];
+    };
+
+    //
+    // Binning parameters shared by every chunk of a node so that
+    // all threads place a given primitive into the same bin
+    //
+    struct SahBinningRange
+    {
+        float   rangeMin[3];
+        float   inverseExtents[3];
+        bool    isAxisValid[3];
+    };
+
     static
-        UINT32 BuildBVHAddLeaf(
-            BVH& bvh,
-            const AABB& box,
-            const std::vector<PrimitiveMetaData>& metadata)
+        void InitSahBinningRange(
+            SahBinningRange& range,
+            const AABB& nodeBox)
     {
-        const UINT32 nodeIndex = BuildBVHAddNode(bvh, box, 0);
+        for (UINT i = 0; i < 3; ++i)
+        {
+            const float extents = nodeBox.maxArr[i] - nodeBox.minArr[i];
+            range.isAxisValid[i] = extents != 0;
+            range.rangeMin[i] = nodeBox.minArr[i];
+            range.inverseExtents[i] = range.isAxisValid[i] ? 1.f / extents : 0.0f;
+        }
+    }
 
-        bvh.m_nodes[nodeIndex].nodeAllBits = 0;
-        bvh.m_nodes[nodeIndex].leaf = true;
+    static
+        UINT GetSahBinIndex(
+            const SahBinningRange& range,
+            UINT32 axis,
+            float centroid)
+    {
+        return std::min(NUM_SAH_BINS - 1,
+            UINT(NUM_SAH_BINS * ((centroid - range.rangeMin[axis]) * range.inverseExtents[axis])));
+    }
 
-        const UINT32 idIndex = (UINT32)bvh.m_metadata.size();
+    static
+        void InitSahBins(
+            SahBins& sahBins)
+    {
+        for (UINT i = 0; i < 3; ++i)
+        {
+            for (UINT j = 0; j < NUM_SAH_BINS; ++j)
+            {
+                sahBins.bins[i][j].numTriangles = 0;
+                InitBoxToInverseMax(sahBins.bins[i][j].box);
+            }
+        }
+    }
 
-        std::copy(metadata.begin(), metadata.end(), std::back_inserter(bvh.m_metadata));
+    static
+        void BinPrimitivesScalar(
+            SahBins& sahBins,
+            const SahBinningRange& range,
+            const PrimitiveMetaData *pMetadata,
+            UINT32 numPrimitives,
+            const std::vector<AABB>& boxes)
+    {
+        for (UINT i = 0; i < 3; ++i)
+        {
+            if (!range.isAxisValid[i])
+                continue;
 
-        assert(metadata.size() < 128);
-        assert(idIndex < (1 << 24));
+            for (UINT j = 0; j < numPrimitives; ++j)
+            {
+                const AABB& triBox = boxes[pMetadata[j].PrimitiveIndex];
 
-        bvh.m_nodes[nodeIndex].leafNode.firstTriangleId = idIndex;
-        bvh.m_nodes[nodeIndex].leafNode.numTriangleIds = (UINT32)metadata.size();
+                const UINT binIndex = GetSahBinIndex(range, i, GetCentroid(triBox, i));
 
-        return nodeIndex;
+                sahBins.bins[i][binIndex].numTriangles++;
+                AddExtentToBox(sahBins.bins[i][binIndex].box, triBox);
+            }
+        }
     }
 
+#if CPU_BVH2_SIMD_BINNING
     //
-    // Sort min to max by centroid
+    // SIMD version of BinPrimitivesScalar. Rather than spreading primitives across lanes, which
+    // would need conflict resolution when two lanes hit the same bin, each primitive's
+    // centroid, bin indices and bounds for all three axes are handled in one vector op.
+    // Operand order of the min/max and bin math matches the scalar kernel exactly so
+    // both produce bit-identical bins.
     //
-
     static
-        void SortByCentroid(
-            std::vector<PrimitiveMetaData>& metadata,
-            const std::vector<AABB>& boxes,
-            UINT32 maxDimension)
+        void BinPrimitivesSimd(
+            SahBins& sahBins,
+            const SahBinningRange& range,
+            const PrimitiveMetaData *pMetadata,
+            UINT32 numPrimitives,
+            const std::vector<AABB>& boxes)
     {
-        struct TriPosition
+        using namespace DirectX;
+
+        XMVECTOR binMin[3][NUM_SAH_BINS];
+        XMVECTOR binMax[3][NUM_SAH_BINS];
+        UINT binCounts[3][NUM_SAH_BINS];
+        for (UINT i = 0; i < 3; ++i)
         {
-            float   pos;
-            UINT32  id;
-        };
+            for (UINT j = 0; j < NUM_SAH_BINS; ++j)
+            {
+                binMin[i][j] = XMLoadFloat3((const XMFLOAT3*)&sahBins.bins[i][j].box.min);
+                binMax[i][j] = XMLoadFloat3((const XMFLOAT3*)&sahBins.bins[i][j].box.max);
+                binCounts[i][j] = sahBins.bins[i][j].numTriangles;
+            }
+        }
 
-        std::vector<TriPosition> sortTris(metadata.size());
+        const XMVECTOR rangeMin = XMVectorSet(range.rangeMin[0], range.rangeMin[1], range.rangeMin[2], 0.0f);
+        const XMVECTOR inverseExtents = XMVectorSet(range.inverseExtents[0], range.inverseExtents[1], range.inverseExtents[2], 0.0f);
+        const XMVECTOR numBins = XMVectorReplicate((float)NUM_SAH_BINS);
+        const XMVECTOR lastBin = XMVectorReplicate((float)(NUM_SAH_BINS - 1));
+        const XMVECTOR half = XMVectorReplicate(0.5f);
 
-        for (UINT32 i = 0; i < metadata.size(); ++i)
+        for (UINT j = 0; j < numPrimitives; ++j)
         {
-            const UINT32 triId = metadata[i].PrimitiveIndex;
-            const AABB& box = boxes[triId];
+            const AABB& triBox = boxes[pMetadata[j].PrimitiveIndex];
 
-            const float boxCenter = (box.maxArr[maxDimension] + box.minArr[maxDimension]) / 2;
+            // The AABB is 6 packed floats, two overlapping loads stay inside it
+            const XMVECTOR boxMin = XMLoadFloat4((const XMFLOAT4*)&triBox.minArr[0]);
+            const XMVECTOR boxMax = XMVectorSwizzle<1, 2, 3, 3>(XMLoadFloat4((const XMFLOAT4*)&triBox.minArr[2]));
 
-            sortTris[i].pos = boxCenter;
-            sortTris[i].id = metadata[i].PrimitiveIndex;
-        }
+            const XMVECTOR centroid = XMVectorMultiply(XMVectorAdd(boxMax, boxMin), half);
 
-        // Split the list into left and right sublists
-        std::sort(sortTris.begin(), sortTris.end(), [](auto&& a, auto&& b) -> bool { return a.pos < b.pos; });
+            // Clamping before truncation is equivalent to clamping after for non-negative values
+            XMVECTOR binIndexF = XMVectorMultiply(numBins, XMVectorMultiply(XMVectorSubtract(centroid, rangeMin), inverseExtents));
+            binIndexF = XMVectorMin(binIndexF, lastBin);
 
-        // Update the output
-        for (UINT32 i = 0; i < metadata.size(); ++i)
+            XMUINT4 binIndex;
+            XMStoreUInt4(&binIndex, XMConvertVectorFloatToUInt(binIndexF, 0));
+
+            const UINT binIndices[3] = { binIndex.x, binIndex.y, binIndex.z };
+            for (UINT i = 0; i < 3; ++i)
+            {
+                const UINT bin = binIndices[i];
+                binCounts[i][bin]++;
+                binMin[i][bin] = XMVectorMin(boxMin, binMin[i][bin]);
+                binMax[i][bin] = XMVectorMax(boxMax, binMax[i][bin]);
+            }
+        }
+
+        for (UINT i = 0; i < 3; ++i)
         {
-            metadata[i].PrimitiveIndex = sortTris[i].id;
+            for (UINT j = 0; j < NUM_SAH_BINS; ++j)
+            {
+                XMStoreFloat3((XMFLOAT3*)&sahBins.bins[i][j].box.min, binMin[i][j]);
+                XMStoreFloat3((XMFLOAT3*)&sahBins.bins[i][j].box.max, binMax[i][j]);
+                sahBins.bins[i][j].numTriangles = binCounts[i][j];
+            }
         }
     }
 
+    //
+    // Running unions of the bins from the left and from the right,
+    // leftBoxes[j] covers bins [0, j] and rightBoxes[j] covers bins [j, NUM_SAH_BINS)
+    //
+    static
+        void ComputeSweepBoxesSimd(
+            const SahBin *pBins,
+            AABB *pLeftBoxes,
+            AABB *pRightBoxes)
+    {
+        using namespace DirectX;
+
+        XMVECTOR leftMin = XMLoadFloat3((const XMFLOAT3*)&pBins[0].box.min);
+        XMVECTOR leftMax = XMLoadFloat3((const XMFLOAT3*)&pBins[0].box.max);
+        XMVECTOR rightMin = XMLoadFloat3((const XMFLOAT3*)&pBins[NUM_SAH_BINS - 1].box.min);
+        XMVECTOR rightMax = XMLoadFloat3((const XMFLOAT3*)&pBins[NUM_SAH_BINS - 1].box.max);
+
+        for (UINT j = 0; j < NUM_SAH_BINS; ++j)
+        {
+            const UINT rightIdx = NUM_SAH_BINS - j - 1;
+            if (j > 0)
+            {
+                leftMin = XMVectorMin(leftMin, XMLoadFloat3((const XMFLOAT3*)&pBins[j].box.min));
+                leftMax = XMVectorMax(leftMax, XMLoadFloat3((const XMFLOAT3*)&pBins[j].box.max));
+                rightMin = XMVectorMin(rightMin, XMLoadFloat3((const XMFLOAT3*)&pBins[rightIdx].box.min));
+                rightMax = XMVectorMax(rightMax, XMLoadFloat3((const XMFLOAT3*)&pBins[rightIdx].box.max));
+            }
+
+            XMStoreFloat3((XMFLOAT3*)&pLeftBoxes[j].min, leftMin);
+            XMStoreFloat3((XMFLOAT3*)&pLeftBoxes[j].max, leftMax);
+            XMStoreFloat3((XMFLOAT3*)&pRightBoxes[rightIdx].min, rightMin);
+            XMStoreFloat3((XMFLOAT3*)&pRightBoxes[rightIdx].max, rightMax);
+        }
+    }
+#endif
 
     static
-        float ComputeBoxSurfaceArea(
-            const AABB& box)
+        void ComputeSweepBoxes(
+            const SahBin *pBins,
+            AABB *pLeftBoxes,
+            AABB *pRightBoxes)
     {
-        const float dims[3] =
+        for (UINT j = 0; j < NUM_SAH_BINS; ++j)
         {
-            box.max.x - box.min.x,
-            box.max.y - box.min.y,
-            box.max.z - box.min.z
-        };
+            const UINT rightIdx = NUM_SAH_BINS - j - 1;
 
-        return 2 * (dims[0] * dims[1] + dims[0] * dims[2] + dims[1] * dims[2]);
+            pRightBoxes[rightIdx] = pBins[rightIdx].box;
+            pLeftBoxes[j] = pBins[j].box;
+
+            if (j > 0)
+            {
+                AddExtentToBox(pLeftBoxes[j], pLeftBoxes[j - 1]);
+                AddExtentToBox(pRightBoxes[rightIdx], pRightBoxes[rightIdx + 1]);
+            }
+        }
     }
 
     static
-        void InitBoxToInverseMax(
-            AABB& box)
+        void BinPrimitives(
+            CpuBvh2BinningKernel kernel,
+            SahBins& sahBins,
+            const SahBinningRange& range,
+            const PrimitiveMetaData *pMetadata,
+            UINT32 numPrimitives,
+            const std::vector<AABB>& boxes)
     {
-        box.max.x = box.max.y = box.max.z = -10e10f;//FLT_MAX;
-        box.min.x = box.min.y = box.min.z = 10e10f;//FLT_MAX;
+#if CPU_BVH2_SIMD_BINNING
+        if (kernel == CpuBvh2BinningKernel::Simd)
+        {
+            BinPrimitivesSimd(sahBins, range, pMetadata, numPrimitives, boxes);
+            return;
+        }
+#else
+        UNREFERENCED_PARAMETER(kernel);
+#endif
+        BinPrimitivesScalar(sahBins, range, pMetadata, numPrimitives, boxes);
+    }
+
+    static
+        void MergeSahBins(
+            SahBins& sahBins,
+            const SahBins& otherBins)
+    {
+        for (UINT i = 0; i < 3; ++i)
+        {
+            for (UINT j = 0; j < NUM_SAH_BINS; ++j)
+            {
+                sahBins.bins[i][j].numTriangles += otherBins.bins[i][j].numTriangles;
+                AddExtentToBox(sahBins.bins[i][j].box, otherBins.bins[i][j].box);
+            }
+        }
     }
 
     //
     // A feeble attempt at a SAH builder
     //
+    // Returns false if no plane separates the primitives, in which case
+    // the caller falls back to a median split along result.SplitAxis.
+    //
 
     static
-        void SahSplit(
-            std::vector<PrimitiveMetaData>& metadata,
-            UINT32& maxDimension,
-            UINT32& numTrisInLeftNode,
+        bool SahSplit(
+            const PrimitiveMetaData *pMetadata,
+            UINT32 numTris,
             const AABB& nodeBox,
-            const std::vector<AABB>& boxes)
+            const std::vector<AABB>& boxes,
+            CpuBvh2BinningKernel kernel,
+            bool bParallelBinning,
+            CpuBvh2SahSplit& result)
     {
-        static const UINT NUM_SAH_BINS = 64;
+        SahBinningRange range;
+        InitSahBinningRange(range, nodeBox);
+
+        SahBins sahBins;
+        InitSahBins(sahBins);
 
-        struct SahBin
+        if (bParallelBinning)
         {
-            AABB    box;
-            UINT    numTriangles;
-        };
+            // Min/max and counts are order independent, so merging per-chunk bins
+            // gives exactly the same result as binning serially
+            const UINT numChunks = (numTris + SAH_BINNING_CHUNK_SIZE - 1) / SAH_BINNING_CHUNK_SIZE;
+            concurrency::combinable<SahBins> chunkBins([]()
+            {
+                SahBins bins;
+                InitSahBins(bins);
+                return bins;
+            });
+
+            concurrency::parallel_for(0u, numChunks, [&](UINT chunk)
+            {
+                const UINT32 firstPrimitive = chunk * SAH_BINNING_CHUNK_SIZE;
+                const UINT32 numPrimitives = std::min(SAH_BINNING_CHUNK_SIZE, numTris - firstPrimitive);
+                BinPrimitives(kernel, chunkBins.local(), range, pMetadata + firstPrimitive, numPrimitives, boxes);
+            });
 
-        // NOTE: use vector if this blows out the stack?
-        SahBin  sahBins[3][NUM_SAH_BINS];
+            chunkBins.combine_each([&](const SahBins& bins) { MergeSahBins(sahBins, bins); });
+        }
+        else
+        {
+            BinPrimitives(kernel, sahBins, range, pMetadata, numTris, boxes);
+        }
 
         // For the score to be meaningful it seems we need to normalize it to something
         const float normalizeToParent = 1.f / ComputeBoxSurfaceArea(nodeBox);
 
-        const UINT numTris = (UINT)metadata.size();
-
         float bestSah = FLT_MAX;
-        maxDimension = 0;
-        //numTrisInLeftNode = triangleIds.size() / 2;
+        bool bFoundSplit = false;
+        result.SplitAxis = 0;
 
         // Compute SAH score per axis
         for (UINT i = 0; i < 3; ++i)
         {
-            const float extents = nodeBox.maxArr[i] - nodeBox.minArr[i];
-            if (extents == 0)
+            if (!range.isAxisValid[i])
                 continue;
 
-            const float rangeMin = nodeBox.minArr[i];
-
-            const float inverseExtents = 1.f / extents;
-
-            // Init boxes
-            for (UINT j = 0; j < NUM_SAH_BINS; ++j)
-            {
-                sahBins[i][j].numTriangles = 0;
-                InitBoxToInverseMax(sahBins[i][j].box);
-            }
-
-            // Place triangles into the buckets
-            for (UINT j = 0; j < metadata.size(); ++j)
-            {
-                const UINT triId = metadata[j].PrimitiveIndex;
-
-                const AABB& triBox = boxes[triId];
-
-                const float centroid = (triBox.maxArr[i] + triBox.minArr[i]) * 0.5f;
-
-                const UINT binIndex = std::min(NUM_SAH_BINS - 1,
-                    UINT(NUM_SAH_BINS * ((centroid - rangeMin) * inverseExtents)));
-
-                sahBins[i][binIndex].numTriangles++;
-                AddExtentToBox(sahBins[i][binIndex].box, triBox);
-            }
+            const SahBin *pBins = sahBins.bins[i];
 
             // Make sure we caught all of them once
             UINT testTris = 0;
             for (UINT j = 0; j < NUM_SAH_BINS; ++j)
             {
-                testTris += sahBins[i][j].numTriangles;
+                testTris += pBins[j].numTriangles;
             }
             assert(testTris == numTris);
 
@@ -320,18 +506,15 @@ namespace FallbackLayer
             AABB leftBoxes[NUM_SAH_BINS];
             AABB rightBoxes[NUM_SAH_BINS];
 
-            for (UINT j = 0; j < NUM_SAH_BINS; ++j)
+#if CPU_BVH2_SIMD_BINNING
+            if (kernel == CpuBvh2BinningKernel::Simd)
             {
-                const UINT rightIdx = NUM_SAH_BINS - j - 1;
-
-                rightBoxes[rightIdx] = sahBins[i][rightIdx].box;
-                leftBoxes[j] = sahBins[i][j].box;
-
-                if (j > 0)
-                {
-                    AddExtentToBox(leftBoxes[j], leftBoxes[j - 1]);
-                    AddExtentToBox(rightBoxes[rightIdx], rightBoxes[rightIdx + 1]);
-                }
+                ComputeSweepBoxesSimd(pBins, leftBoxes, rightBoxes);
+            }
+            else
+#endif
+            {
+                ComputeSweepBoxes(pBins, leftBoxes, rightBoxes);
             }
 
             UINT numTrianglesOnLeft = 0;
@@ -340,14 +523,16 @@ namespace FallbackLayer
             // Find the plane with the best score
             for (UINT j = 0; j < NUM_SAH_BINS - 1; ++j)
             {
-                if (!sahBins[i][j].numTriangles)
+                if (!pBins[j].numTriangles)
                 {
                     continue;
                 }
 
-                numTrianglesOnLeft += sahBins[i][j].numTriangles;
-                numTrianglesOnRight -= sahBins[i][j].numTriangles;
+                numTrianglesOnLeft += pBins[j].numTriangles;
+                numTrianglesOnRight -= pBins[j].numTriangles;
 
+                // A plane with every triangle on the left can still score best, in which
+                // case the caller falls back to a median split along this axis
                 const float sah = (numTrianglesOnLeft * ComputeBoxSurfaceArea(leftBoxes[j]) +
                     numTrianglesOnRight * ComputeBoxSurfaceArea(rightBoxes[j + 1])) *
                     normalizeToParent;
@@ -357,343 +542,1230 @@ namespace FallbackLayer
                 if (sah < bestSah)
                 {
                     bestSah = sah;
-                    maxDimension = i;
-                    numTrisInLeftNode = numTrianglesOnLeft;
+                    bFoundSplit = numTrianglesOnRight != 0;
+                    result.SplitAxis = i;
+                    result.SplitBin = j;
+                    result.NumPrimitivesInLeft = numTrianglesOnLeft;
+                    result.LeftBox = leftBoxes[j];
+                    result.RightBox = rightBoxes[j + 1];
                 }
             }
         }
 
-        //
-        // Split the set to try to get a balanced tree
-        //
+        return bFoundSplit;
+    }
 
-        SortByCentroid(metadata, boxes, maxDimension);
+    bool ComputeCpuBvh2SahSplit(
+        _In_reads_(numPrimitives) const PrimitiveMetaData *pMetadata,
+        UINT numPrimitives,
+        const std::vector<AABB> &boxes,
+        CpuBvh2BinningKernel kernel,
+        _Out_ CpuBvh2SahSplit &split)
+    {
+        AABB nodeBox;
+        ComputeBox(nodeBox, boxes, pMetadata, numPrimitives);
+        return SahSplit(pMetadata, numPrimitives, nodeBox, boxes, kernel, false, split);
     }
 
     //
-    // It's a good idea to do a breadth-first build because then nodes from the same level
-    // get adjacent memory locations. It does take a lot of memory though.
+    // Node of the intermediate hierarchy built before serialization. Children are
+    // always allocated as an adjacent pair after their parent, which lets the
+    // serialization pass walk the pool linearly instead of recursing.
     //
-    // "Uniform BVH"
-    // -- both children are valid for all internal nodes
-    // -- left child's index is +1 of the parent index, right child's index is stored
-    //    in the packed AABB structure.
-    // -- there could be a varaible number of triangles in leaves
+    struct BuildNode
+    {
+        AABB    box;
+        UINT32  firstPrimitive;
+        UINT32  numPrimitives;
+
+        // Left child is firstChild, right child is firstChild + 1. Zero for leaves
+        // since the root can never be a child.
+        UINT32  firstChild;
+
+        // Holds the subtree node count until the node is assigned its output index
+        UINT32  scratch;
+    };
+
+    // IsProceduralGeometryFlag in RayTracingHelper.hlsli
+    static const UINT PROCEDURAL_LEAF_FLAG = 0x40000000;
+
+    struct BuildContext
+    {
+        BuildContext(
+            const std::vector<AABB>& primitiveBoxes,
+            std::vector<PrimitiveMetaData>& primitiveMetaData,
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS& buildInputs,
+            const CpuBvh2BuildSettings& buildSettings) :
+            boxes(primitiveBoxes),
+            metadata(primitiveMetaData),
+            inputs(buildInputs),
+            settings(buildSettings),
+            nodeCount(0) {}
+
+        const std::vector<AABB>& boxes;
+        std::vector<PrimitiveMetaData>& metadata;
+        const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS& inputs;
+        const CpuBvh2BuildSettings& settings;
+
+        std::vector<BuildNode> nodes;
+        std::atomic<UINT32> nodeCount;
+        concurrency::task_group tasks;
+    };
+
+    static
+        bool IsProceduralPrimitive(
+            const BuildContext& context,
+            const PrimitiveMetaData& primitive)
+    {
+        return context.inputs.Type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL &&
+            GetGeometryDesc(context.inputs, primitive.GeometryContributionToHitGroupIndex).Type == D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS;
+    }
+
+    //
+    // The traversal shader calls the intersection shader once per procedural leaf, with the
+    // leaf's first primitive, so procedural primitives have to be alone in their leaf.
     //
     static
-        void BuildBVH(
-            BVH& bvh,
-            const std::vector<AABB>& boxes,
-            const std::vector<PrimitiveMetaData>& primitiveMetaData,
-            UINT32 maxTrisInLeaf)
+        bool IsLeaf(
+            const BuildContext& context,
+            const BuildNode& node)
     {
-        //
-        // These are huge so use pointers
-        //
-        struct StackItem
+        if (node.numPrimitives == 1)
         {
-            std::vector<PrimitiveMetaData> primitiveMetaData;
-            UINT32              parentIndex;
-            UINT                right : 1;
-            UINT                axis : 2;
-        };
+            return true;
+        }
+        if (node.numPrimitives > context.settings.MaxPrimitivesInLeaf)
+        {
+            return false;
+        }
 
-        std::deque<StackItem*>   fifoLefts;
-        std::deque<StackItem*>   fifoRights;
+        const PrimitiveMetaData *pMetadata = context.metadata.data() + node.firstPrimitive;
+        return std::none_of(pMetadata, pMetadata + node.numPrimitives,
+            [&](const PrimitiveMetaData& primitive) { return IsProceduralPrimitive(context, primitive); });
+    }
 
-        StackItem* temp = new StackItem;
-        temp->parentIndex = (UINT)-1;
-        temp->primitiveMetaData = primitiveMetaData;
-        temp->right = false;
-        temp->axis = 0;
-        fifoRights.push_back(temp);
+    //
+    // Splits a node's range of primitives in place. The right child's primitives are moved
+    // to the front of the range, which matches the order leaves are emitted in
+    // (the right child always directly follows its parent), so the partitioned
+    // metadata array is the final leaf metadata without further copies.
+    //
+    static
+        void SplitNode(
+            BuildContext& context,
+            BuildNode& node,
+            UINT32& numTrisInRightNode,
+            AABB& leftBox,
+            AABB& rightBox)
+    {
+        PrimitiveMetaData *pMetadata = context.metadata.data() + node.firstPrimitive;
+        const UINT32 numTris = node.numPrimitives;
+        const std::vector<AABB>& boxes = context.boxes;
 
-        while (!fifoLefts.empty() || !fifoRights.empty())
+        CpuBvh2SahSplit split;
+        const bool bParallelBinning = numTris >= context.settings.ParallelBinningThreshold;
+        if (SahSplit(pMetadata, numTris, node.box, boxes, context.settings.BinningKernel, bParallelBinning, split))
         {
-            // Uniform BVH pops the first left node
-            StackItem* item = nullptr;
+            SahBinningRange range;
+            InitSahBinningRange(range, node.box);
 
-            if (!fifoRights.empty())
+            const UINT32 axis = split.SplitAxis;
+            const UINT32 splitBin = split.SplitBin;
+            PrimitiveMetaData *pLeftStart = std::partition(pMetadata, pMetadata + numTris,
+                [&](const PrimitiveMetaData& primitive)
             {
-                item = fifoRights.back();
-                fifoRights.pop_back();
-            }
+                return GetSahBinIndex(range, axis, GetCentroid(boxes[primitive.PrimitiveIndex], axis)) > splitBin;
+            });
 
-            if (!item)
-            {
-                item = fifoLefts.back();
-                fifoLefts.pop_back();
-            }
+            numTrisInRightNode = (UINT32)(pLeftStart - pMetadata);
+            assert(numTrisInRightNode == numTris - split.NumPrimitivesInLeft);
 
+            leftBox = split.LeftBox;
+            rightBox = split.RightBox;
+        }
+        else
+        {
             //
-            // Compute overall bounding box
+            // Try to balance by using the median if SAH failed. Ties are broken by
+            // primitive index so the result doesn't depend on the incoming order of the range.
             //
-            AABB nodeBox;
-            ComputeBox(nodeBox, boxes, item->primitiveMetaData);
+            const UINT32 axis = split.SplitAxis;
+            numTrisInRightNode = numTris - numTris / 2;
+            std::nth_element(pMetadata, pMetadata + numTrisInRightNode, pMetadata + numTris,
+                [&](const PrimitiveMetaData& a, const PrimitiveMetaData& b) -> bool
+            {
+                const float centroidA = GetCentroid(boxes[a.PrimitiveIndex], axis);
+                const float centroidB = GetCentroid(boxes[b.PrimitiveIndex], axis);
+                if (centroidA != centroidB)
+                {
+                    return centroidA > centroidB;
+                }
+                return a.PrimitiveIndex > b.PrimitiveIndex;
+            });
+
+            ComputeBox(rightBox, boxes, pMetadata, numTrisInRightNode);
+            ComputeBox(leftBox, boxes, pMetadata + numTrisInRightNode, numTris - numTrisInRightNode);
+        }
+    }
+
+    //
+    // Builds the subtree below nodeIndex, using an explicit stack to avoid deep recursion
+    // on degenerate inputs. Children that are still large are handed off as new tasks so
+    // idle worker threads can steal them.
+    //
+    static
+        void BuildSubtree(
+            BuildContext& context,
+            UINT32 subtreeRootIndex)
+    {
+        std::vector<UINT32> stack;
+        stack.push_back(subtreeRootIndex);
 
-            const UINT32 numTrianglesInNode = (UINT32)item->primitiveMetaData.size();
-            const UINT32 parentIndex = item->parentIndex;
+        while (!stack.empty())
+        {
+            const UINT32 nodeIndex = stack.back();
+            stack.pop_back();
 
-            UINT32 thisNodeIndex;
+            BuildNode& node = context.nodes[nodeIndex];
+            node.firstChild = 0;
+            node.scratch = 0;
 
             // Leaf or internal node?
-            if (numTrianglesInNode <= maxTrisInLeaf)
+            if (IsLeaf(context, node))
             {
-                thisNodeIndex = BuildBVHAddLeaf(bvh, nodeBox, item->primitiveMetaData);
+                continue;
             }
-            else
-            {
-                //
-                // Find separating plane. Use Median for speed.
-                // SAH is better but also more expensive to build.
-                //
-
-                UINT splitDimension;
-                UINT leftChildNumNodes;
-
-                SahSplit(item->primitiveMetaData,
-                    splitDimension,
-                    leftChildNumNodes,
-                    nodeBox,
-                    boxes);
-
-                assert(leftChildNumNodes <= item->primitiveMetaData.size());
-
-                // Try to balance by using the median if SAH failed
-                if ((leftChildNumNodes == 0 ||
-                    leftChildNumNodes == item->primitiveMetaData.size()) &&
-                    item->primitiveMetaData.size() > MAX_TRIS_IN_LEAF)
-                {
-                    leftChildNumNodes = (UINT)item->primitiveMetaData.size() / 2;
-                }
 
-                const UINT32 rightChildNumNodes = (UINT32)item->primitiveMetaData.size() - leftChildNumNodes;
+            UINT32 numTrisInRightNode;
+            AABB leftBox, rightBox;
+            SplitNode(context, node, numTrisInRightNode, leftBox, rightBox);
 
+            const UINT32 firstChild = context.nodeCount.fetch_add(2);
+            assert(firstChild + 1 < context.nodes.size());
+            node.firstChild = firstChild;
 
-                //
-                // "Recurse"
-                //
+            BuildNode& leftNode = context.nodes[firstChild];
+            leftNode.box = leftBox;
+            leftNode.firstPrimitive = node.firstPrimitive + numTrisInRightNode;
+            leftNode.numPrimitives = node.numPrimitives - numTrisInRightNode;
 
-                thisNodeIndex = BuildBVHAddNode(bvh, nodeBox, splitDimension);
+            BuildNode& rightNode = context.nodes[firstChild + 1];
+            rightNode.box = rightBox;
+            rightNode.firstPrimitive = node.firstPrimitive;
+            rightNode.numPrimitives = numTrisInRightNode;
 
-                StackItem* leftItem = new StackItem;
-                leftItem->parentIndex = thisNodeIndex;
-                leftItem->primitiveMetaData.resize(leftChildNumNodes);
-                leftItem->right = false;
-                leftItem->axis = splitDimension;
-                for (UINT32 i = 0; i < leftChildNumNodes; ++i)
+            for (UINT32 childIndex = firstChild; childIndex < firstChild + 2; ++childIndex)
+            {
+                if (context.nodes[childIndex].numPrimitives > context.settings.SubtreeTaskThreshold)
                 {
-                    leftItem->primitiveMetaData[i] = item->primitiveMetaData[i];
+                    context.tasks.run([&context, childIndex]() { BuildSubtree(context, childIndex); });
                 }
-
-                StackItem* rightItem = new StackItem;
-                rightItem->parentIndex = thisNodeIndex;
-                rightItem->primitiveMetaData.resize(rightChildNumNodes);
-                rightItem->right = true;
-                rightItem->axis = splitDimension;
-                for (UINT32 i = 0; i < rightChildNumNodes; ++i)
+                else
                 {
-                    rightItem->primitiveMetaData[i] = item->primitiveMetaData[i + leftChildNumNodes];
+                    stack.push_back(childIndex);
                 }
-
-                fifoLefts.push_back(leftItem);
-                fifoRights.push_back(rightItem);
             }
+        }
+    }
+
+    //
+    // Serializes the intermediate hierarchy into a "Uniform BVH":
+    // -- both children are valid for all internal nodes
+    // -- the right child's index is +1 of the parent index and is stored in rightNodeIndex,
+    //    the left child follows the right child's subtree and its index is stored in
+    //    the packed AABB structure.
+    // -- there could be a varaible number of triangles in leaves
+    //
+    // This is the same depth-first layout the original single-threaded builder emitted,
+    // so the output only depends on the tree topology and not on how the build was scheduled.
+    //
+    static
+        void SerializeBVH(
+            BVH& bvh,
+            BuildContext& context)
+    {
+        std::vector<BuildNode>& nodes = context.nodes;
+        const UINT32 numNodes = context.nodeCount;
 
-            // Update child link of the parent
-            if (parentIndex != -1)
+        // Children are always allocated after their parent, so a reverse walk
+        // sees both children before the parent
+        for (UINT32 i = numNodes; i-- > 0;)
+        {
+            BuildNode& node = nodes[i];
+            node.scratch = 1;
+            if (node.firstChild)
             {
-                if (!item->right)
-                {
-                    bvh.m_nodes[parentIndex].internalNode.leftNodeIndex = thisNodeIndex;
-                    bvh.m_nodes[parentIndex].rightNodeIndex = parentIndex + 1;
-                }
+                node.scratch += nodes[node.firstChild].scratch + nodes[node.firstChild + 1].scratch;
             }
-
-            // Free the item after use
-            delete item;
         }
-    }
+        assert(nodes[0].scratch == numNodes);
 
-    void BuildUniformBVH(
-        _In_  UINT NumElements,
-        _In_reads_opt_(NumElements)  const D3D12_RAYTRACING_GEOMETRY_DESC *pGeometries,
-        BVH &bvh)
-    {
-        using namespace DirectX;
-        //
-        // Compute number of triangles
-        //
+        // ...and a forward walk sees a parent before its children. Each node's subtree
+        // count is consumed by its parent right before being replaced with the output index.
+        nodes[0].scratch = 0;
+        for (UINT32 i = 0; i < numNodes; ++i)
+        {
+            const BuildNode& node = nodes[i];
+            if (node.firstChild)
+            {
+                BuildNode& leftNode = nodes[node.firstChild];
+                BuildNode& rightNode = nodes[node.firstChild + 1];
 
-        UINT    totalNumberOfTriangles = 0;
+                const UINT32 rightSubtreeNodeCount = rightNode.scratch;
+                rightNode.scratch = node.scratch + 1;
+                leftNode.scratch = node.scratch + 1 + rightSubtreeNodeCount;
+            }
+        }
 
-        for (UINT i = 0; i < NumElements; ++i)
+        bvh.m_nodes.resize(numNodes);
+        concurrency::parallel_for(0u, numNodes, [&](UINT32 i)
         {
-            auto &geometry = pGeometries[i];
-            if (geometry.Type == D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES)
+            const BuildNode& node = nodes[i];
+            AABBNode& packedBox = bvh.m_nodes[node.scratch];
+            PackAABBNode(packedBox, node.box);
+
+            if (node.firstChild)
             {
-                totalNumberOfTriangles += GetPrimitiveCountFromGeometryDesc(geometry);
+                packedBox.internalNode.leftNodeIndex = nodes[node.firstChild].scratch;
+                packedBox.internalNode.separatingAxis = 0;
+                packedBox.rightNodeIndex = node.scratch + 1;
             }
             else
             {
-                throw - 1; // Intersection shaders not supported yet
-            }
+                assert(node.numPrimitives < 128);
+                assert(node.firstPrimitive < (1 << 24));
 
-        }
+                packedBox.leaf = true;
+                packedBox.leafNode.firstTriangleId = node.firstPrimitive;
+                packedBox.leafNode.numTriangleIds = node.numPrimitives;
+                packedBox.numTriangles = node.numPrimitives;
 
-        //
-        // Create AABBs
-        //
+                if (IsProceduralPrimitive(context, context.metadata[node.firstPrimitive]))
+                {
+                    packedBox.nodeAllBits |= PROCEDURAL_LEAF_FLAG;
+                }
+            }
+        }, concurrency::static_partitioner());
+    }
 
-        std::vector<AABB> boxes;
-        boxes.resize(totalNumberOfTriangles);
+    //
+    // Builds the BVH from a single array of primitive metadata that is partitioned in place.
+    // Large nodes near the top of the tree are binned in parallel, and subtrees below
+    // SubtreeTaskThreshold are built as tasks on the PPL work-stealing scheduler.
+    //
+    static
+        void BuildBVH(
+            BVH& bvh,
+            const std::vector<AABB>& boxes,
+            std::vector<PrimitiveMetaData>& primitiveMetaData,
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+            const CpuBvh2BuildSettings& settings)
+    {
+        if (settings.Algorithm == CpuBvh2BuildAlgorithm::Lbvh)
+        {
+            BuildCpuLbvh(boxes, primitiveMetaData, inputs, bvh.m_nodes);
+            bvh.m_metadata = std::move(primitiveMetaData);
+            return;
+        }
 
-        std::vector<PrimitiveMetaData> primitiveMetaData;
-        primitiveMetaData.resize(totalNumberOfTriangles);
+        BuildContext context(boxes, primitiveMetaData, inputs, settings);
+
+        const UINT32 numPrimitives = (UINT32)primitiveMetaData.size();
+
+        // A binary tree whose leaves all hold at least one primitive can't have more nodes than this
+        context.nodes.resize(numPrimitives ? 2 * numPrimitives - 1 : 1);
+        context.nodeCount = 1;
+
+        BuildNode& root = context.nodes[0];
+        ComputeBox(root.box, boxes, primitiveMetaData.data(), numPrimitives);
+        root.firstPrimitive = 0;
+        root.numPrimitives = numPrimitives;
+
+        context.tasks.run_and_wait([&context]() { BuildSubtree(context, 0); });
+
+        SerializeBVH(bvh, context);
+
+        bvh.m_metadata = std::move(primitiveMetaData);
+    }
+
+    //
+    // Everything needed to read a geometry's primitives straight out of its input buffers.
+    // Primitives are decoded once to compute their bounds and again when the final
+    // primitive array is written, so no intermediate copy of the vertices is kept around.
+    //
+    struct GeometryStream
+    {
+        D3D12_RAYTRACING_GEOMETRY_TYPE  type;
+        D3D12_RAYTRACING_GEOMETRY_FLAGS flags;
+        UINT        firstPrimitive;
+        UINT        numPrimitives;
+
+        const BYTE  *pIndices;
+        DXGI_FORMAT indexFormat;
+        const BYTE  *pVertices;
+        UINT64      vertexStride;
+        DXGI_FORMAT vertexFormat;
+        const float *pTransform;
+
+        const BYTE  *pAABBs;
+        UINT64      aabbStride;
+    };
+
+    static
+        bool IsCpuVertexBufferFormatSupported(
+            DXGI_FORMAT format)
+    {
+        switch (format)
+        {
+        case DXGI_FORMAT_R32G32B32_FLOAT:
+        case DXGI_FORMAT_R32G32B32A32_FLOAT:
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        case DXGI_FORMAT_R16G16B16A16_SNORM:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static
+        float SnormToFp32(
+            SHORT v)
+    {
+        return std::max(v / 32767.0f, -1.0f);
+    }
+
+    static
+        float3 LoadVertex(
+            const GeometryStream& geometry,
+            UINT vertexIndex)
+    {
+        const BYTE *pVertex = geometry.pVertices + vertexIndex * geometry.vertexStride;
+        switch (geometry.vertexFormat)
+        {
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        {
+            const USHORT *pHalfs = (const USHORT *)pVertex;
+            return float3{ Fp16ToFp32(pHalfs[0]), Fp16ToFp32(pHalfs[1]), Fp16ToFp32(pHalfs[2]) };
+        }
+        case DXGI_FORMAT_R16G16B16A16_SNORM:
+        {
+            const SHORT *pSnorms = (const SHORT *)pVertex;
+            return float3{ SnormToFp32(pSnorms[0]), SnormToFp32(pSnorms[1]), SnormToFp32(pSnorms[2]) };
+        }
+        default:
+        {
+            assert(geometry.vertexFormat == DXGI_FORMAT_R32G32B32_FLOAT ||
+                geometry.vertexFormat == DXGI_FORMAT_R32G32B32A32_FLOAT);
+            const float *pFloats = (const float *)pVertex;
+            return float3{ pFloats[0], pFloats[1], pFloats[2] };
+        }
+        }
+    }
 
-        std::vector<float>  triangleVertices;
-        triangleVertices.resize(totalNumberOfTriangles * 9);
+    static
+        UINT LoadIndex(
+            const GeometryStream& geometry,
+            UINT readIndex)
+    {
+        switch (geometry.indexFormat)
+        {
+        case DXGI_FORMAT_R32_UINT:
+            return ((const UINT32 *)geometry.pIndices)[readIndex];
+        case DXGI_FORMAT_R16_UINT:
+            return ((const UINT16 *)geometry.pIndices)[readIndex];
+        default:
+            assert(geometry.indexFormat == DXGI_FORMAT_UNKNOWN);
+            return readIndex;
+        }
+    }
 
-        UINT triangleIndex = 0;
-        for (UINT i = 0; i < NumElements; ++i)
+    //
+    // Transform3x4 is a row-major 3x4 matrix applied to column vectors, same as the GPU loader
+    //
+    static
+        float3 TransformVertex(
+            const float3& v,
+            _In_reads_(12) const float *pTransform)
+    {
+        return float3
         {
-            auto &geometry = pGeometries[i];
-            if (geometry.Type != D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES)
+            pTransform[0] * v.x + pTransform[1] * v.y + pTransform[2] * v.z + pTransform[3],
+            pTransform[4] * v.x + pTransform[5] * v.y + pTransform[6] * v.z + pTransform[7],
+            pTransform[8] * v.x + pTransform[9] * v.y + pTransform[10] * v.z + pTransform[11]
+        };
+    }
+
+    static
+        void LoadTriangle(
+            const GeometryStream& geometry,
+            UINT localPrimitiveIndex,
+            Triangle& tri)
+    {
+        for (UINT i = 0; i < 3; ++i)
+        {
+            tri.v[i] = LoadVertex(geometry, LoadIndex(geometry, localPrimitiveIndex * 3 + i));
+            if (geometry.pTransform)
             {
-                throw - 1; // Intersection shaders not supported yet
+                tri.v[i] = TransformVertex(tri.v[i], geometry.pTransform);
             }
+        }
+    }
 
-            auto &triangles = geometry.Triangles;
-            if (GetPrimitiveCountFromGeometryDesc(geometry) == 0)
+    static
+        void LoadProceduralAABB(
+            const GeometryStream& geometry,
+            UINT localPrimitiveIndex,
+            AABB& aabb)
+    {
+        const D3D12_RAYTRACING_AABB *pAABB =
+            (const D3D12_RAYTRACING_AABB *)(geometry.pAABBs + localPrimitiveIndex * geometry.aabbStride);
+        aabb.min = float3{ pAABB->MinX, pAABB->MinY, pAABB->MinZ };
+        aabb.max = float3{ pAABB->MaxX, pAABB->MaxY, pAABB->MaxZ };
+    }
 
+    static
+        void ComputeTriangleBox(
+            const Triangle& tri,
+            AABB& box)
+    {
+        const float *v0 = &tri.v0.x;
+        const float *v1 = &tri.v1.x;
+        const float *v2 = &tri.v2.x;
+        for (UINT k = 0; k < 3; ++k)
+        {
+#define AABB_Min_Padding 0.001f
+            box.minArr[k] = std::min(v2[k], std::min(v0[k], v1[k]));
+            box.maxArr[k] = std::max(v2[k], std::max(v0[k], v1[k])) + AABB_Min_Padding;
+
+            if (_isnan(box.minArr[k]) ||
+                _isnan(box.maxArr[k]))
             {
-                continue;
+                box.minArr[k] = 0;
+                box.maxArr[k] = 0;
             }
+        }
+    }
 
-            // 
-            const UINT64 vertexStrideDwords = triangles.VertexBuffer.StrideInBytes / 4;
-            const UINT numTris = GetPrimitiveCountFromGeometryDesc(geometry);
+    static
+        void ComputePrimitiveBox(
+            const GeometryStream& geometry,
+            UINT localPrimitiveIndex,
+            AABB& box)
+    {
+        if (geometry.type == D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS)
+        {
+            LoadProceduralAABB(geometry, localPrimitiveIndex, box);
+            return;
+        }
 
-            float *pVertexData = (float *)geometry.Triangles.VertexBuffer.StartAddress;
-            float *pIndexData = (float *)geometry.Triangles.IndexBuffer;
+        Triangle tri;
+        LoadTriangle(geometry, localPrimitiveIndex, tri);
+        ComputeTriangleBox(tri, box);
+    }
 
-            const float* pVertices = (float*)(pVertexData);
-            const UINT16* pIndices = (UINT16*)(pIndexData);
+    static
+        UINT InitGeometryStreams(
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+            std::vector<GeometryStream>& geometries)
+    {
+        UINT totalNumberOfPrimitives = 0;
 
-            for (UINT j = 0; j < numTris; ++j)
+        geometries.resize(inputs.NumDescs);
+        for (UINT i = 0; i < inputs.NumDescs; ++i)
+        {
+            const D3D12_RAYTRACING_GEOMETRY_DESC &geometryDesc = GetGeometryDesc(inputs, i);
+            GeometryStream& geometry = geometries[i];
+            geometry = {};
+            geometry.type = geometryDesc.Type;
+            geometry.flags = geometryDesc.Flags;
+            geometry.firstPrimitive = totalNumberOfPrimitives;
+            geometry.numPrimitives = GetPrimitiveCountFromGeometryDesc(geometryDesc);
+
+            if (geometryDesc.Type == D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES)
             {
-                const UINT16 i0 = pIndices[j * 3 + 0];
-                const UINT16 i1 = pIndices[j * 3 + 1];
-                const UINT16 i2 = pIndices[j * 3 + 2];
+                const D3D12_RAYTRACING_GEOMETRY_TRIANGLES_DESC &triangles = geometryDesc.Triangles;
+                if (triangles.IndexBuffer == 0 && triangles.IndexFormat != DXGI_FORMAT_UNKNOWN)
+                {
+                    ThrowFailure(E_INVALIDARG, L"If the index buffer is null, the Index format must be DXGI_FORMAT_UNKNOWN");
+                }
+                if (!IsCpuVertexBufferFormatSupported(triangles.VertexFormat))
+                {
+                    ThrowFailure(E_INVALIDARG, L"Invalid vertex format provided. Supported is limited to DXGI_FORMAT_R32G32B32_FLOAT/DXGI_FORMAT_R32G32B32A32_FLOAT/DXGI_FORMAT_R16G16B16A16_FLOAT/DXGI_FORMAT_R16G16B16A16_SNORM");
+                }
 
-                const float* v0 = &pVertices[i0 * vertexStrideDwords];
-                const float* v1 = &pVertices[i1 * vertexStrideDwords];
-                const float* v2 = &pVertices[i2 * vertexStrideDwords];
+                geometry.pIndices = (const BYTE *)triangles.IndexBuffer;
+                geometry.indexFormat = triangles.IndexFormat;
+                geometry.pVertices = (const BYTE *)triangles.VertexBuffer.StartAddress;
+                geometry.vertexStride = triangles.VertexBuffer.StrideInBytes;
+                geometry.vertexFormat = triangles.VertexFormat;
+                geometry.pTransform = (const float *)triangles.Transform3x4;
+            }
+            else
+            {
+                const D3D12_RAYTRACING_GEOMETRY_AABBS_DESC &aabbs = geometryDesc.AABBs;
+                if (aabbs.AABBs.StartAddress == 0 && aabbs.AABBCount > 0)
+                {
+                    ThrowFailure(E_INVALIDARG, L"Non-zero AABBCount provided with a null AABB buffer");
+                }
 
-                float* pTriVerts = &triangleVertices[triangleIndex * 9];
+                geometry.pAABBs = (const BYTE *)aabbs.AABBs.StartAddress;
+                geometry.aabbStride = aabbs.AABBs.StrideInBytes;
+            }
 
-                pTriVerts[0] = v0[0];
-                pTriVerts[1] = v0[1];
-                pTriVerts[2] = v0[2];
+            totalNumberOfPrimitives += geometry.numPrimitives;
+        }
 
-                pTriVerts[3] = v1[0];
-                pTriVerts[4] = v1[1];
-                pTriVerts[5] = v1[2];
+        return totalNumberOfPrimitives;
+    }
 
-                pTriVerts[6] = v2[0];
-                pTriVerts[7] = v2[1];
-                pTriVerts[8] = v2[2];
+    //
+    // During the build PrimitiveIndex holds the index across all geometries so it can address
+    // the box array directly, it's converted back to the geometry-local index on output
+    //
+    static
+        void LoadPrimitives(
+            const std::vector<GeometryStream>& geometries,
+            UINT totalNumberOfPrimitives,
+            std::vector<AABB>& boxes,
+            std::vector<PrimitiveMetaData>& primitiveMetaData)
+    {
+        boxes.resize(totalNumberOfPrimitives);
+        primitiveMetaData.resize(totalNumberOfPrimitives);
 
-                AABB& box = boxes[triangleIndex];
-                for (UINT k = 0; k < 3; ++k)
-                {
-#define AABB_Min_Padding 0.001f
-                    box.minArr[k] = std::min(v2[k], std::min(v0[k], v1[k]));
-                    box.maxArr[k] = std::max(v2[k], std::max(v0[k], v1[k])) + AABB_Min_Padding;
-
-                    if (_isnan(box.minArr[k]) ||
-                        _isnan(box.maxArr[k]))
-                    {
-                        box.minArr[k] = 0;
-                        box.maxArr[k] = 0;
-                    }
-                }
+        for (UINT i = 0; i < (UINT)geometries.size(); ++i)
+        {
+            const GeometryStream& geometry = geometries[i];
+            concurrency::parallel_for(0u, geometry.numPrimitives, [&](UINT j)
+            {
+                const UINT primitiveIndex = geometry.firstPrimitive + j;
+                ComputePrimitiveBox(geometry, j, boxes[primitiveIndex]);
 
-                // Create out internal triangle indices.
-                PrimitiveMetaData metadata;
+                PrimitiveMetaData& metadata = primitiveMetaData[primitiveIndex];
                 metadata.GeometryContributionToHitGroupIndex = i;
-                metadata.PrimitiveIndex = triangleIndex;
-                metadata.GeometryFlags = geometry.Flags;
-                primitiveMetaData[triangleIndex] = metadata;
+                metadata.PrimitiveIndex = primitiveIndex;
+                metadata.GeometryFlags = geometry.flags;
+            }, concurrency::static_partitioner());
+        }
+    }
 
-                // Next triangle
-                triangleIndex++;
+    //
+    // Writes the primitives in leaf order, reading them again from the input buffers
+    //
+    static
+        void WritePrimitives(
+            const std::vector<GeometryStream>& geometries,
+            const std::vector<PrimitiveMetaData>& buildMetaData,
+            Primitive *pPrimitives,
+            PrimitiveMetaData *pPrimitiveMetaData)
+    {
+        concurrency::parallel_for(0u, (UINT)buildMetaData.size(), [&](UINT i)
+        {
+            PrimitiveMetaData metadata = buildMetaData[i];
+            const GeometryStream& geometry = geometries[metadata.GeometryContributionToHitGroupIndex];
+            const UINT localPrimitiveIndex = metadata.PrimitiveIndex - geometry.firstPrimitive;
+
+            Primitive& primitive = pPrimitives[i];
+            ZeroMemory(&primitive, sizeof(primitive));
+            if (geometry.type == D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS)
+            {
+                primitive.PrimitiveType = PROCEDURAL_PRIMITIVE_TYPE;
+                LoadProceduralAABB(geometry, localPrimitiveIndex, primitive.aabb);
+            }
+            else
+            {
+                primitive.PrimitiveType = TRIANGLE_TYPE;
+                LoadTriangle(geometry, localPrimitiveIndex, primitive.triangle);
             }
-        }
+
+            metadata.PrimitiveIndex = localPrimitiveIndex;
+            pPrimitiveMetaData[i] = metadata;
+        }, concurrency::static_partitioner());
+    }
+
+    void BuildUniformBVH(
+        _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+        const CpuBvh2BuildSettings& settings,
+        BVH &bvh,
+        std::vector<GeometryStream>& geometries,
+        CpuBvh2BuildStatistics *pStatistics)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        std::vector<AABB> boxes;
+        std::vector<PrimitiveMetaData> primitiveMetaData;
+        const UINT totalNumberOfPrimitives = InitGeometryStreams(inputs, geometries);
+        LoadPrimitives(geometries, totalNumberOfPrimitives, boxes, primitiveMetaData);
+
+        auto loadEndTime = std::chrono::high_resolution_clock::now();
 
         //
         // Create a BVH
         //
 
-        BuildBVH(bvh, boxes, primitiveMetaData, MAX_TRIS_IN_LEAF);
+        BuildBVH(bvh, boxes, primitiveMetaData, inputs, settings);
 
-        //
-        // Now copy and compress geometry
-        //
+        // The LBVH emits a leaf per primitive, flag the procedural ones the same way
+        // SerializeBVH does for the SAH builder
+        if (settings.Algorithm == CpuBvh2BuildAlgorithm::Lbvh)
+        {
+            const UINT firstLeaf = (UINT)(bvh.m_nodes.size() - bvh.m_metadata.size());
+            concurrency::parallel_for(0u, (UINT)bvh.m_metadata.size(), [&](UINT i)
+            {
+                const GeometryStream& geometry = geometries[bvh.m_metadata[i].GeometryContributionToHitGroupIndex];
+                if (geometry.type == D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS)
+                {
+                    bvh.m_nodes[firstLeaf + i].nodeAllBits |= PROCEDURAL_LEAF_FLAG;
+                }
+            }, concurrency::static_partitioner());
+        }
+
+        if (pStatistics)
+        {
+            auto endTime = std::chrono::high_resolution_clock::now();
+            pStatistics->PrimitiveCount = totalNumberOfPrimitives;
+            pStatistics->NodeCount = (UINT)bvh.m_nodes.size();
+            pStatistics->LoadTimeInMs = std::chrono::duration<double, std::milli>(loadEndTime - startTime).count();
+            pStatistics->BuildTimeInMs = std::chrono::duration<double, std::milli>(endTime - loadEndTime).count();
+        }
+    }
+
+    static
+        UINT GetCpuBvh2UpdateDataSize(
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags)
+    {
+        return (flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) ? sizeof(CpuBvh2UpdateData) : 0;
+    }
 
-        // Copy verts
-        const UINT numTris = triangleIndex;
-        bvh.m_triangles.resize(numTris * 3 * 3);
-        assert(bvh.m_triangles.size() == triangleVertices.size());
-        assert(sizeof(bvh.m_triangles[0]) == sizeof(triangleVertices[0]));
+    UINT GetCpuBvh2ResultDataMaxSizeInBytes(
+        UINT numPrimitives,
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags)
+    {
+        const UINT numNodes = numPrimitives ? 2 * numPrimitives - 1 : 1;
+        return sizeof(BVHOffsets) +
+            numNodes * sizeof(AABBNode) +
+            numPrimitives * sizeof(Primitive) +
+            numPrimitives * sizeof(PrimitiveMetaData) +
+            GetCpuBvh2UpdateDataSize(flags);
+    }
 
-        for (UINT i = 0; i < numTris; ++i)
+    float ComputeBvh2SahCost(
+        _In_reads_(nodeCount) const AABBNode *pNodes,
+        UINT nodeCount)
+    {
+        if (nodeCount == 0)
         {
-            UINT inputIndex = bvh.m_metadata[i].PrimitiveIndex;
-            float *pInputTriangle = &triangleVertices.data()[inputIndex * 9];
-            float* pOutputTriangle = &bvh.m_triangles[i * 9];
+            return 0.0f;
+        }
 
-            // Construct three planes and write to pPlanes
-            XMVECTOR V0 = XMVectorSet(pInputTriangle[0], pInputTriangle[1], pInputTriangle[2], 0.0f);
-            XMVECTOR V1 = XMVectorSet(pInputTriangle[3], pInputTriangle[4], pInputTriangle[5], 0.0f);
-            XMVECTOR V2 = XMVectorSet(pInputTriangle[6], pInputTriangle[7], pInputTriangle[8], 0.0f);
+        AABB rootBox;
+        DecompressAABB(rootBox, pNodes[0]);
+        const float rootArea = ComputeBoxSurfaceArea(rootBox);
+        if (rootArea <= 0.0f)
+        {
+            return 0.0f;
+        }
 
-            XMStoreFloat3((XMFLOAT3*)pOutputTriangle + 0, V0);
-            XMStoreFloat3((XMFLOAT3*)pOutputTriangle + 1, V1);
-            XMStoreFloat3((XMFLOAT3*)pOutputTriangle + 2, V2);
+        double cost = 0.0;
+        for (UINT i = 0; i < nodeCount; ++i)
+        {
+            AABB box;
+            DecompressAABB(box, pNodes[i]);
+            const float area = ComputeBoxSurfaceArea(box);
+            cost += pNodes[i].leaf ? area * pNodes[i].numTriangles : area;
         }
+        return (float)(cost / rootArea);
     }
-}
 
-void BuildRaytracingAccelerationStructureOnCpu(
-    _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
-    _Out_ void *pData)
-{
-    FallbackLayer::BVH bvh;
-    FallbackLayer::BuildUniformBVH(pDesc->Inputs.NumDescs, pDesc->Inputs.pGeometryDescs, bvh);
+    UINT GetCpuBvh2TopLevelResultDataMaxSizeInBytes(
+        UINT numInstances,
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags)
+    {
+        const UINT numNodes = numInstances ? 2 * numInstances - 1 : 1;
+        return sizeof(BVHOffsets) +
+            numNodes * sizeof(AABBNode) +
+            numInstances * sizeof(BVHMetadata) +
+            GetCpuBvh2UpdateDataSize(flags);
+    }
 
-    BYTE* outputData = (BYTE*)pData;
-    BVHOffsets offsets;
-    offsets.offsetToBoxes = sizeof(BVHOffsets);
-    const UINT sizeofBoxes = (UINT)(bvh.m_nodes.size() * sizeof(*bvh.m_nodes.data()));
-    offsets.offsetToVertices = offsets.offsetToBoxes + sizeofBoxes;
-    
-    UINT numTriangles = (UINT)bvh.m_triangles.size() / 9;
-    const UINT sizeofVertices = numTriangles * sizeof(Primitive);
-    offsets.offsetToPrimitiveMetaData = offsets.offsetToVertices + sizeofVertices;
+    //
+    // Top-level inputs are read from CPU memory, InstanceDescs holds the address of the
+    // instance descs and each instance's AccelerationStructure the address of a bottom level
+    // built by BuildRaytracingAccelerationStructureOnCpu
+    //
+    static
+        const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &GetCpuInstanceDesc(
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+            UINT instanceIndex)
+    {
+        switch (inputs.DescsLayout)
+        {
+        case D3D12_ELEMENTS_LAYOUT_ARRAY:
+            return ((const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC *)inputs.InstanceDescs)[instanceIndex];
+        case D3D12_ELEMENTS_LAYOUT_ARRAY_OF_POINTERS:
+            return *((const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC *const *)inputs.InstanceDescs)[instanceIndex];
+        default:
+            ThrowFailure(E_INVALIDARG, L"Unexpected value for D3D12_ELEMENTS_LAYOUT");
+            return *(const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC *)nullptr;
+        }
+    }
 
-    const UINT sizeofMetadata = (UINT)(bvh.m_metadata.size() * sizeof(*bvh.m_metadata.data()));
-    offsets.totalSize = offsets.offsetToPrimitiveMetaData + sizeofMetadata;
+    static
+        void InvertAffineTransform(
+            const FLOAT transform[3][4],
+            FLOAT inverse[3][4])
+    {
+        using namespace DirectX;
+
+        // Instance transforms multiply column vectors, so the translation is the last column. With a
+        // (0, 0, 0, 1) bottom row they form the full affine matrix, whose inverse keeps that bottom row,
+        // so its top three rows are the world-to-object transform in the same layout.
+        const XMMATRIX matrix(
+            transform[0][0], transform[0][1], transform[0][2], transform[0][3],
+            transform[1][0], transform[1][1], transform[1][2], transform[1][3],
+            transform[2][0], transform[2][1], transform[2][2], transform[2][3],
+            0.0f, 0.0f, 0.0f, 1.0f);
+        const XMMATRIX inverseMatrix = XMMatrixInverse(nullptr, matrix);
+
+        for (UINT row = 0; row < 3; ++row)
+        {
+            XMStoreFloat4((XMFLOAT4 *)inverse[row], inverseMatrix.r[row]);
+        }
+    }
+
+    //
+    // Same as TransformAABB in the top-level loader, the box around the transformed corners
+    //
+    static
+        void TransformBox(
+            const AABB& box,
+            const FLOAT transform[3][4],
+            AABB& transformedBox)
+    {
+        InitBoxToInverseMax(transformedBox);
+        for (UINT corner = 0; corner < 8; ++corner)
+        {
+            const float3 v =
+            {
+                (corner & 1) ? box.max.x : box.min.x,
+                (corner & 2) ? box.max.y : box.min.y,
+                (corner & 4) ? box.max.z : box.min.z
+            };
+
+            AABB cornerBox;
+            cornerBox.min = cornerBox.max = TransformVertex(v, &transform[0][0]);
+            AddExtentToBox(transformedBox, cornerBox);
+        }
+    }
+
+    static
+        void ComputeInstanceBox(
+            const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instanceDesc,
+            AABB& box)
+    {
+        const BYTE *pBottomLevel = (const BYTE *)instanceDesc.AccelerationStructure.GpuVA;
+        if (pBottomLevel == nullptr)
+        {
+            ThrowFailure(E_INVALIDARG, L"Instance desc has a null acceleration structure");
+        }
+
+        const BVHOffsets &bottomLevelOffsets = *(const BVHOffsets *)pBottomLevel;
+        AABB objectBox;
+        DecompressAABB(objectBox, *(const AABBNode *)(pBottomLevel + bottomLevelOffsets.offsetToBoxes));
+        TransformBox(objectBox, instanceDesc.Transform, box);
+    }
+
+    static
+        void WriteInstanceMetaData(
+            const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instanceDesc,
+            UINT instanceIndex,
+            BVHMetadata& metadata)
+    {
+        metadata.instanceDesc = instanceDesc;
+        InvertAffineTransform(instanceDesc.Transform, metadata.instanceDesc.Transform);
+        memcpy(metadata.ObjectToWorld, instanceDesc.Transform, sizeof(metadata.ObjectToWorld));
+        metadata.InstanceIndex = instanceIndex;
+    }
+
+    //
+    // Builds the same layout as the GPU top-level builder: the hierarchy followed by a
+    // BVHMetadata per leaf, whose instance desc holds the world-to-object transform
+    //
+    static
+        void BuildTopLevelOnCpu(
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+            BYTE *pOutputData,
+            const CpuBvh2BuildSettings &settings,
+            CpuBvh2BuildStatistics *pStatistics)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        const UINT numInstances = inputs.NumDescs;
+        std::vector<AABB> boxes(numInstances);
+        std::vector<PrimitiveMetaData> instanceMetaData(numInstances);
+        concurrency::parallel_for(0u, numInstances, [&](UINT i)
+        {
+            ComputeInstanceBox(GetCpuInstanceDesc(inputs, i), boxes[i]);
+
+            PrimitiveMetaData& metadata = instanceMetaData[i];
+            metadata.GeometryContributionToHitGroupIndex = 0;
+            metadata.PrimitiveIndex = i;
+            metadata.GeometryFlags = 0;
+        });
+
+        auto loadEndTime = std::chrono::high_resolution_clock::now();
+
+        // The traversal shader reads a single instance per leaf
+        CpuBvh2BuildSettings topLevelSettings = settings;
+        topLevelSettings.MaxPrimitivesInLeaf = 1;
+
+        BVH bvh;
+        BuildBVH(bvh, boxes, instanceMetaData, inputs, topLevelSettings);
+
+        // Instance leaves are read with GetLeafIndexFromFlag, which only masks off the
+        // leaf flags, so the count can't be packed next to the index
+        for (AABBNode& node : bvh.m_nodes)
+        {
+            if (node.leaf)
+            {
+                node.leafNode.numTriangleIds = 0;
+            }
+        }
+
+        BVHOffsets offsets;
+        offsets.offsetToBoxes = sizeof(BVHOffsets);
+        const UINT sizeofBoxes = (UINT)(bvh.m_nodes.size() * sizeof(*bvh.m_nodes.data()));
+        offsets.offsetToVertices = offsets.offsetToBoxes + sizeofBoxes;     // Offset to the leaf metadata
+        offsets.offsetToPrimitiveMetaData = 0;
+        offsets.totalSize = offsets.offsetToVertices + numInstances * sizeof(BVHMetadata);
+
+        memcpy(pOutputData, &offsets, sizeof(offsets));
+        memcpy(pOutputData + offsets.offsetToBoxes, bvh.m_nodes.data(), sizeofBoxes);
+
+        BVHMetadata *pLeafMetaData = (BVHMetadata *)(pOutputData + offsets.offsetToVertices);
+        concurrency::parallel_for(0u, numInstances, [&](UINT i)
+        {
+            const UINT instanceIndex = bvh.m_metadata[i].PrimitiveIndex;
+            WriteInstanceMetaData(GetCpuInstanceDesc(inputs, instanceIndex), instanceIndex, pLeafMetaData[i]);
+        }, concurrency::static_partitioner());
+
+        if (pStatistics)
+        {
+            auto endTime = std::chrono::high_resolution_clock::now();
+            pStatistics->PrimitiveCount = numInstances;
+            pStatistics->NodeCount = (UINT)bvh.m_nodes.size();
+            pStatistics->LoadTimeInMs = std::chrono::duration<double, std::milli>(loadEndTime - startTime).count();
+            pStatistics->BuildTimeInMs = std::chrono::duration<double, std::milli>(endTime - loadEndTime).count();
+            pStatistics->SahCost = ComputeBvh2SahCost(bvh.m_nodes.data(), (UINT)bvh.m_nodes.size());
+        }
+    }
+
+    //
+    // Same layout as the GPU bottom-level builder: the hierarchy, then the primitives and
+    // their metadata in leaf order
+    //
+    static
+        void BuildBottomLevelOnCpu(
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+            BYTE *pOutputData,
+            const CpuBvh2BuildSettings &settings,
+            CpuBvh2BuildStatistics *pStatistics)
+    {
+        BVH bvh;
+        std::vector<GeometryStream> geometries;
+        BuildUniformBVH(inputs, settings, bvh, geometries, pStatistics);
+
+        BVHOffsets offsets;
+        offsets.offsetToBoxes = sizeof(BVHOffsets);
+        const UINT sizeofBoxes = (UINT)(bvh.m_nodes.size() * sizeof(*bvh.m_nodes.data()));
+        offsets.offsetToVertices = offsets.offsetToBoxes + sizeofBoxes;
+
+        const UINT numPrimitives = (UINT)bvh.m_metadata.size();
+        const UINT sizeofVertices = numPrimitives * sizeof(Primitive);
+        offsets.offsetToPrimitiveMetaData = offsets.offsetToVertices + sizeofVertices;
+
+        const UINT sizeofMetadata = numPrimitives * sizeof(PrimitiveMetaData);
+        offsets.totalSize = offsets.offsetToPrimitiveMetaData + sizeofMetadata;
+
+        memcpy(pOutputData, &offsets, sizeof(offsets));
+        memcpy(pOutputData + offsets.offsetToBoxes, bvh.m_nodes.data(), sizeofBoxes);
+
+        WritePrimitives(geometries,
+            bvh.m_metadata,
+            (Primitive *)(pOutputData + offsets.offsetToVertices),
+            (PrimitiveMetaData *)(pOutputData + offsets.offsetToPrimitiveMetaData));
+
+        if (pStatistics)
+        {
+            pStatistics->SahCost = ComputeBvh2SahCost(bvh.m_nodes.data(), (UINT)bvh.m_nodes.size());
+        }
+    }
+
+    // Subtrees this close to the root are refit as separate tasks
+    static const UINT REFIT_TASK_DEPTH = 8;
+
+    //
+    // Recomputes the boxes of a subtree bottom-up, leaving its topology and flags as they are.
+    // Returns the subtree's SAH cost before it's normalized to the root, weighted the same way
+    // as ComputeBvh2SahCost.
+    //
+    template<typename RefitLeafFunction>
+    static
+        double RefitSubtree(
+            AABBNode *pNodes,
+            UINT nodeIndex,
+            UINT depth,
+            const RefitLeafFunction &refitLeaf,
+            AABB& box)
+    {
+        AABBNode& node = pNodes[nodeIndex];
+        double cost;
+        if (node.leaf)
+        {
+            refitLeaf(node, box);
+            cost = (double)ComputeBoxSurfaceArea(box) * node.numTriangles;
+        }
+        else
+        {
+            const UINT leftNodeIndex = node.internalNode.leftNodeIndex;
+            const UINT rightNodeIndex = node.rightNodeIndex;
+
+            AABB rightBox;
+            double leftCost, rightCost;
+            if (depth < REFIT_TASK_DEPTH)
+            {
+                concurrency::parallel_invoke(
+                    [&] { leftCost = RefitSubtree(pNodes, leftNodeIndex, depth + 1, refitLeaf, box); },
+                    [&] { rightCost = RefitSubtree(pNodes, rightNodeIndex, depth + 1, refitLeaf, rightBox); });
+            }
+            else
+            {
+                leftCost = RefitSubtree(pNodes, leftNodeIndex, depth + 1, refitLeaf, box);
+                rightCost = RefitSubtree(pNodes, rightNodeIndex, depth + 1, refitLeaf, rightBox);
+            }
+
+            AddExtentToBox(box, rightBox);
+            cost = leftCost + rightCost + ComputeBoxSurfaceArea(box);
+        }
 
-    memcpy(outputData,  &offsets, sizeof(offsets));
-    memcpy(outputData + offsets.offsetToBoxes, bvh.m_nodes.data(), sizeofBoxes);
+        // PackAABBNode clears the child indices and leaf bits
+        const UINT nodeAllBits = node.nodeAllBits;
+        const UINT rightNodeIndex = node.rightNodeIndex;
+        PackAABBNode(node, box);
+        node.nodeAllBits = nodeAllBits;
+        node.rightNodeIndex = rightNodeIndex;
+        return cost;
+    }
 
-    Primitive *pPrimitives = (Primitive *)(outputData + offsets.offsetToVertices);
-    for (UINT i = 0; i < numTriangles; i++)
+    //
+    // Bottom-level leaves reload their primitives from the geometry descs, each primitive's
+    // metadata says which geometry and primitive it was written from
+    //
+    static
+        double RefitBottomLevelOnCpu(
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+            BYTE *pOutputData,
+            AABB& rootBox)
     {
-        Triangle *pTriangle = (Triangle *)((BYTE *)bvh.m_triangles.data() + sizeof(Triangle) * i);
-        pPrimitives[i].PrimitiveType = TRIANGLE_TYPE;
-        pPrimitives[i].triangle = *pTriangle;
+        const BVHOffsets &offsets = *(const BVHOffsets *)pOutputData;
+        std::vector<GeometryStream> geometries;
+        const UINT numPrimitives = InitGeometryStreams(inputs, geometries);
+        if (numPrimitives != (offsets.offsetToPrimitiveMetaData - offsets.offsetToVertices) / sizeof(Primitive))
+        {
+            ThrowFailure(E_INVALIDARG, L"An update must have the same number of primitives as the acceleration structure it updates");
+        }
+
+        AABBNode *pNodes = (AABBNode *)(pOutputData + offsets.offsetToBoxes);
+        if (numPrimitives == 0)
+        {
+            DecompressAABB(rootBox, pNodes[0]);
+            return 0.0;
+        }
+
+        Primitive *pPrimitives = (Primitive *)(pOutputData + offsets.offsetToVertices);
+        const PrimitiveMetaData *pPrimitiveMetaData = (const PrimitiveMetaData *)(pOutputData + offsets.offsetToPrimitiveMetaData);
+        auto refitLeaf = [&](const AABBNode& leaf, AABB& box)
+        {
+            InitBoxToInverseMax(box);
+            const UINT firstPrimitive = leaf.leafNode.firstTriangleId;
+            for (UINT i = firstPrimitive; i < firstPrimitive + leaf.numTriangles; ++i)
+            {
+                const PrimitiveMetaData& metadata = pPrimitiveMetaData[i];
+                const GeometryStream& geometry = geometries[metadata.GeometryContributionToHitGroupIndex];
+                Primitive& primitive = pPrimitives[i];
+
+                AABB primitiveBox;
+                if (geometry.type == D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS)
+                {
+                    LoadProceduralAABB(geometry, metadata.PrimitiveIndex, primitive.aabb);
+                    primitiveBox = primitive.aabb;
+                }
+                else
+                {
+                    LoadTriangle(geometry, metadata.PrimitiveIndex, primitive.triangle);
+                    ComputeTriangleBox(primitive.triangle, primitiveBox);
+                }
+                AddExtentToBox(box, primitiveBox);
+            }
+        };
+
+        return RefitSubtree(pNodes, 0, 0, refitLeaf, rootBox);
     }
-    memcpy(outputData + offsets.offsetToPrimitiveMetaData, bvh.m_metadata.data(), sizeofMetadata);
+
+    //
+    // Top-level leaves recompute their instance's box and transforms, the bottom levels
+    // are expected to have been updated first
+    //
+    static
+        double RefitTopLevelOnCpu(
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+            BYTE *pOutputData,
+            AABB& rootBox)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pOutputData;
+        if (inputs.NumDescs != (offsets.totalSize - offsets.offsetToVertices) / sizeof(BVHMetadata))
+        {
+            ThrowFailure(E_INVALIDARG, L"An update must have the same number of instances as the acceleration structure it updates");
+        }
+
+        AABBNode *pNodes = (AABBNode *)(pOutputData + offsets.offsetToBoxes);
+        if (inputs.NumDescs == 0)
+        {
+            DecompressAABB(rootBox, pNodes[0]);
+            return 0.0;
+        }
+
+        BVHMetadata *pLeafMetaData = (BVHMetadata *)(pOutputData + offsets.offsetToVertices);
+        auto refitLeaf = [&](const AABBNode& leaf, AABB& box)
+        {
+            BVHMetadata& metadata = pLeafMetaData[leaf.leafNode.firstTriangleId];
+            const UINT instanceIndex = metadata.InstanceIndex;
+            const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instanceDesc = GetCpuInstanceDesc(inputs, instanceIndex);
+            ComputeInstanceBox(instanceDesc, box);
+            WriteInstanceMetaData(instanceDesc, instanceIndex, metadata);
+        };
+
+        return RefitSubtree(pNodes, 0, 0, refitLeaf, rootBox);
+    }
+
+    //
+    // Copies the source acceleration structure to pOutputData and refits it to the new inputs.
+    // Returns false if the refit left the tree too far past the cost it was built with, in
+    // which case the caller rebuilds over it.
+    //
+    static
+        bool RefitOnCpu(
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+            BYTE *pOutputData,
+            const CpuBvh2BuildSettings &settings,
+            CpuBvh2BuildStatistics *pStatistics)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        const BYTE *pSourceData = (const BYTE *)pDesc->SourceAccelerationStructureData;
+        if (pSourceData == nullptr)
+        {
+            ThrowFailure(E_INVALIDARG, L"PERFORM_UPDATE requires SourceAccelerationStructureData");
+        }
+        if (pSourceData != pOutputData)
+        {
+            const BVHOffsets &sourceOffsets = *(const BVHOffsets *)pSourceData;
+            memmove(pOutputData, pSourceData, sourceOffsets.totalSize + sizeof(CpuBvh2UpdateData));
+        }
+
+        AABB rootBox;
+        const double cost = pDesc->Inputs.Type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL ?
+            RefitTopLevelOnCpu(pDesc->Inputs, pOutputData, rootBox) :
+            RefitBottomLevelOnCpu(pDesc->Inputs, pOutputData, rootBox);
+        const float rootArea = ComputeBoxSurfaceArea(rootBox);
+        const float sahCost = rootArea > 0.0f ? (float)(cost / rootArea) : 0.0f;
+
+        const BVHOffsets &offsets = *(const BVHOffsets *)pOutputData;
+        CpuBvh2UpdateData &updateData = *(CpuBvh2UpdateData *)(pOutputData + offsets.totalSize);
+        const bool keepRefit = settings.MaxRefitSahCostRatio <= 0.0f ||
+            sahCost <= updateData.BuildSahCost * settings.MaxRefitSahCostRatio;
+        if (keepRefit)
+        {
+            updateData.RefitsSinceBuild++;
+        }
+
+        if (pStatistics)
+        {
+            auto endTime = std::chrono::high_resolution_clock::now();
+            pStatistics->Refit = keepRefit;
+            pStatistics->RefitTimeInMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+            if (keepRefit)
+            {
+                pStatistics->PrimitiveCount = pDesc->Inputs.Type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL ?
+                    pDesc->Inputs.NumDescs :
+                    (offsets.offsetToPrimitiveMetaData - offsets.offsetToVertices) / sizeof(Primitive);
+                pStatistics->NodeCount = (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(AABBNode);
+                pStatistics->SahCost = sahCost;
+            }
+        }
+        return keepRefit;
+    }
+
+    void BuildRaytracingAccelerationStructureOnCpu(
+        _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        _Out_ void *pData,
+        _In_ const CpuBvh2BuildSettings &settings,
+        _Out_opt_ CpuBvh2BuildStatistics *pStatistics)
+    {
+        ScopedBuildScheduler scheduler(settings.MaxThreadCount);
+
+        const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs = pDesc->Inputs;
+        const bool allowUpdate = (inputs.Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) != 0;
+        const bool performUpdate = (inputs.Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE) != 0;
+        if (performUpdate && !allowUpdate)
+        {
+            ThrowFailure(E_INVALIDARG, L"PERFORM_UPDATE requires ALLOW_UPDATE, the flags must match the build being updated");
+        }
+
+        if (pStatistics)
+        {
+            *pStatistics = {};
+        }
+
+        BYTE *pOutputData = (BYTE *)pData;
+        if (!performUpdate || !RefitOnCpu(pDesc, pOutputData, settings, pStatistics))
+        {
+            if (inputs.Type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL)
+            {
+                BuildTopLevelOnCpu(inputs, pOutputData, settings, pStatistics);
+            }
+            else
+            {
+                BuildBottomLevelOnCpu(inputs, pOutputData, settings, pStatistics);
+            }
+
+            if (allowUpdate)
+            {
+                const BVHOffsets &offsets = *(const BVHOffsets *)pOutputData;
+                CpuBvh2UpdateData &updateData = *(CpuBvh2UpdateData *)(pOutputData + offsets.totalSize);
+                updateData.BuildSahCost = pStatistics ? pStatistics->SahCost : ComputeBvh2SahCost(
+                    (const AABBNode *)(pOutputData + offsets.offsetToBoxes),
+                    (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(AABBNode));
+                updateData.RefitsSinceBuild = 0;
+            }
+        }
+
+        if (pStatistics)
+        {
+            pStatistics->ThreadCount = scheduler.GetThreadCount();
+            if (allowUpdate)
+            {
+                const BVHOffsets &offsets = *(const BVHOffsets *)pOutputData;
+                const CpuBvh2UpdateData &updateData = *(const CpuBvh2UpdateData *)(pOutputData + offsets.totalSize);
+                pStatistics->BuildSahCost = updateData.BuildSahCost;
+                pStatistics->RefitsSinceBuild = updateData.RefitsSinceBuild;
+            }
+        }
+    }
+}
+
+void BuildRaytracingAccelerationStructureOnCpu(
+    _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+    _Out_ void *pData)
+{
+    FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(pDesc, pData, FallbackLayer::CpuBvh2BuildSettings());
 }
@@ -0,0 +1,1085 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    using namespace DirectX;
+
+    struct TraversalCounters
+    {
+        UINT64 HitCount;
+        UINT64 NodesVisited;
+        UINT64 PrimitivesTested;
+    };
+
+    //
+    // The parts of an acceleration structure a trace reads, bottom levels hold
+    // primitives and their metadata and top levels a BVHMetadata per leaf
+    //
+    struct BvhView
+    {
+        const AABBNode *pNodes;
+        const Primitive *pPrimitives;
+        const PrimitiveMetaData *pPrimitiveMetaData;
+        const BVHMetadata *pInstances;
+    };
+
+    static
+        BvhView GetBvhView(
+            const void *pAccelerationStructure,
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE type)
+    {
+        const BYTE *pData = (const BYTE *)pAccelerationStructure;
+        const BVHOffsets &offsets = *(const BVHOffsets *)pData;
+
+        BvhView view = {};
+        view.pNodes = (const AABBNode *)(pData + offsets.offsetToBoxes);
+        if (type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL)
+        {
+            // Top levels keep the offset to their leaf metadata where bottom levels keep their primitives
+            view.pInstances = (const BVHMetadata *)(pData + offsets.offsetToVertices);
+        }
+        else
+        {
+            view.pPrimitives = (const Primitive *)(pData + offsets.offsetToVertices);
+            view.pPrimitiveMetaData = (const PrimitiveMetaData *)(pData + offsets.offsetToPrimitiveMetaData);
+        }
+        return view;
+    }
+
+    static
+        BvhView GetBottomLevelView(
+            const BVHMetadata &instance)
+    {
+        return GetBvhView(
+            (const void *)instance.instanceDesc.AccelerationStructure.GpuVA,
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL);
+    }
+
+    static
+        void InitializeHit(
+            const CpuRay &ray,
+            CpuRayHit &hit)
+    {
+        hit.T = ray.TMax;
+        hit.Barycentrics = { 0.0f, 0.0f };
+        hit.HitKind = 0;
+        hit.PrimitiveIndex = CPU_RAY_MISS;
+        hit.GeometryContributionToHitGroupIndex = 0;
+        hit.InstanceIndex = CPU_RAY_MISS;
+        hit.InstanceID = CPU_RAY_MISS;
+    }
+
+    static
+        void CommitPrimitiveHit(
+            const PrimitiveMetaData &metadata,
+            float t,
+            float u,
+            float v,
+            UINT hitKind,
+            CpuRayHit &hit)
+    {
+        hit.T = t;
+        hit.Barycentrics = { u, v };
+        hit.HitKind = hitKind;
+        hit.PrimitiveIndex = metadata.PrimitiveIndex;
+        hit.GeometryContributionToHitGroupIndex = metadata.GeometryContributionToHitGroupIndex;
+    }
+
+    //
+    // Which triangles a ray culls once the instance flags are applied, front facing
+    // triangles are clockwise unless the instance says otherwise
+    //
+    struct TriangleFacing
+    {
+        bool FrontCounterClockwise;
+        bool CullFrontFacing;
+        bool CullBackFacing;
+    };
+
+    static
+        TriangleFacing GetTriangleFacing(
+            UINT rayFlags,
+            UINT instanceFlags)
+    {
+        const bool cullDisable = (instanceFlags & D3D12_RAYTRACING_INSTANCE_FLAG_TRIANGLE_CULL_DISABLE) != 0;
+
+        TriangleFacing facing;
+        facing.FrontCounterClockwise = (instanceFlags & D3D12_RAYTRACING_INSTANCE_FLAG_TRIANGLE_FRONT_COUNTERCLOCKWISE) != 0;
+        facing.CullFrontFacing = !cullDisable && (rayFlags & D3D12_RAY_FLAG_CULL_FRONT_FACING_TRIANGLES);
+        facing.CullBackFacing = !cullDisable && (rayFlags & D3D12_RAY_FLAG_CULL_BACK_FACING_TRIANGLES);
+        return facing;
+    }
+
+    //
+    // Transform is the row-major world-to-object matrix of a BVHMetadata. Rays aren't
+    // renormalized, so T is the same in world and object space.
+    //
+    static
+        float3 TransformPoint(
+            const FLOAT transform[3][4],
+            const float3 &p)
+    {
+        return float3
+        {
+            transform[0][0] * p.x + transform[0][1] * p.y + transform[0][2] * p.z + transform[0][3],
+            transform[1][0] * p.x + transform[1][1] * p.y + transform[1][2] * p.z + transform[1][3],
+            transform[2][0] * p.x + transform[2][1] * p.y + transform[2][2] * p.z + transform[2][3]
+        };
+    }
+
+    static
+        float3 TransformDirection(
+            const FLOAT transform[3][4],
+            const float3 &d)
+    {
+        return float3
+        {
+            transform[0][0] * d.x + transform[0][1] * d.y + transform[0][2] * d.z,
+            transform[1][0] * d.x + transform[1][1] * d.y + transform[1][2] * d.z,
+            transform[2][0] * d.x + transform[2][1] * d.y + transform[2][2] * d.z
+        };
+    }
+
+    //
+    // Single ray kernel
+    //
+    // Like the traversal shader, both children of a node are tested before either is
+    // visited, and the nearer one is visited first. The packet kernel does the same
+    // arithmetic in the same order so both find the same hits.
+    //
+
+    struct SingleRayStacks
+    {
+        std::vector<UINT> TopLevel;
+        std::vector<UINT> BottomLevel;
+    };
+
+    static
+        bool RayBoxTest(
+            const float3 &boxMin,
+            const float3 &boxMax,
+            const float3 &origin,
+            const float3 &inverseDirection,
+            float tMin,
+            float tMax,
+            float &tEntry)
+    {
+        const float3 t0 = (boxMin - origin) * inverseDirection;
+        const float3 t1 = (boxMax - origin) * inverseDirection;
+        const float3 tNear = min(t0, t1);
+        const float3 tFar = max(t0, t1);
+
+        tEntry = max(max(max(tMin, tNear.x), tNear.y), tNear.z);
+        const float tExit = min(min(min(tMax, tFar.x), tFar.y), tFar.z);
+        return tEntry <= tExit;
+    }
+
+    static
+        bool RayNodeTest(
+            const AABBNode &node,
+            const float3 &origin,
+            const float3 &inverseDirection,
+            float tMin,
+            float tMax,
+            float &tEntry)
+    {
+        const float3 center = { node.center[0], node.center[1], node.center[2] };
+        const float3 halfDim = { node.halfDim[0], node.halfDim[1], node.halfDim[2] };
+        return RayBoxTest(center - halfDim, center + halfDim, origin, inverseDirection, tMin, tMax, tEntry);
+    }
+
+    //
+    // Moller-Trumbore. The determinant is positive when the triangle is clockwise
+    // as seen along the ray, which is the front face in D3D's default winding.
+    //
+    static
+        bool RayTriangleTest(
+            const Triangle &tri,
+            const float3 &origin,
+            const float3 &direction,
+            float tMin,
+            float tMax,
+            const TriangleFacing &facing,
+            float &t,
+            float &u,
+            float &v,
+            bool &frontFacing)
+    {
+        const float3 e1 = tri.v1 - tri.v0;
+        const float3 e2 = tri.v2 - tri.v0;
+        const float3 p = cross(direction, e2);
+        const float det = dot(e1, p);
+        if (det == 0.0f)
+        {
+            return false;
+        }
+
+        frontFacing = (det > 0.0f) != facing.FrontCounterClockwise;
+        if (frontFacing ? facing.CullFrontFacing : facing.CullBackFacing)
+        {
+            return false;
+        }
+
+        const float inverseDet = 1.0f / det;
+        const float3 s = origin - tri.v0;
+        u = dot(s, p) * inverseDet;
+        if (!(u >= 0.0f && u <= 1.0f))
+        {
+            return false;
+        }
+
+        const float3 q = cross(s, e1);
+        v = dot(direction, q) * inverseDet;
+        if (!(v >= 0.0f && u + v <= 1.0f))
+        {
+            return false;
+        }
+
+        t = dot(e2, q) * inverseDet;
+        return t >= tMin && t < tMax;
+    }
+
+    //
+    // Traverses a bottom level with a ray in its object space. Returns true if
+    // a closer hit was found, endSearch is set if the ray accepted it.
+    //
+    static
+        bool TraceBottomLevel(
+            const BvhView &bvh,
+            const float3 &origin,
+            const float3 &direction,
+            float tMin,
+            UINT rayFlags,
+            const TriangleFacing &facing,
+            std::vector<UINT> &stack,
+            CpuRayHit &hit,
+            bool &endSearch,
+            TraversalCounters &counters)
+    {
+        const float3 inverseDirection = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+        float tEntry;
+        if (!RayNodeTest(bvh.pNodes[0], origin, inverseDirection, tMin, hit.T, tEntry))
+        {
+            return false;
+        }
+
+        bool foundHit = false;
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty())
+        {
+            const AABBNode &node = bvh.pNodes[stack.back()];
+            stack.pop_back();
+            counters.NodesVisited++;
+
+            if (node.leaf)
+            {
+                const UINT firstId = node.leafNode.firstTriangleId;
+                for (UINT i = 0; i < node.numTriangles; ++i)
+                {
+                    const Primitive &primitive = bvh.pPrimitives[firstId + i];
+                    counters.PrimitivesTested++;
+
+                    float t, u, v;
+                    UINT hitKind;
+                    if (primitive.PrimitiveType == TRIANGLE_TYPE)
+                    {
+                        bool frontFacing;
+                        if (!RayTriangleTest(primitive.triangle, origin, direction, tMin, hit.T, facing, t, u, v, frontFacing))
+                        {
+                            continue;
+                        }
+                        hitKind = frontFacing ? CPU_HIT_KIND_TRIANGLE_FRONT_FACE : CPU_HIT_KIND_TRIANGLE_BACK_FACE;
+                    }
+                    else
+                    {
+                        if (!RayBoxTest(primitive.aabb.min, primitive.aabb.max, origin, inverseDirection, tMin, hit.T, t) ||
+                            !(t < hit.T))
+                        {
+                            continue;
+                        }
+                        u = v = 0.0f;
+                        hitKind = CPU_HIT_KIND_PROCEDURAL_AABB;
+                    }
+
+                    CommitPrimitiveHit(bvh.pPrimitiveMetaData[firstId + i], t, u, v, hitKind, hit);
+                    foundHit = true;
+                    if (rayFlags & D3D12_RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH)
+                    {
+                        endSearch = true;
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                const UINT leftIndex = node.internalNode.leftNodeIndex;
+                const UINT rightIndex = node.rightNodeIndex;
+
+                float tLeft, tRight;
+                const bool hitLeft = RayNodeTest(bvh.pNodes[leftIndex], origin, inverseDirection, tMin, hit.T, tLeft);
+                const bool hitRight = RayNodeTest(bvh.pNodes[rightIndex], origin, inverseDirection, tMin, hit.T, tRight);
+                if (hitLeft && hitRight)
+                {
+                    // The farther child goes first so the nearer one is popped next
+                    const bool leftFirst = tLeft <= tRight;
+                    stack.push_back(leftFirst ? rightIndex : leftIndex);
+                    stack.push_back(leftFirst ? leftIndex : rightIndex);
+                }
+                else if (hitLeft)
+                {
+                    stack.push_back(leftIndex);
+                }
+                else if (hitRight)
+                {
+                    stack.push_back(rightIndex);
+                }
+            }
+        }
+        return foundHit;
+    }
+
+    static
+        void TraceRay(
+            const BvhView &bvh,
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE type,
+            const CpuRay &ray,
+            SingleRayStacks &stacks,
+            CpuRayHit &hit,
+            TraversalCounters &counters)
+    {
+        InitializeHit(ray, hit);
+
+        bool endSearch = false;
+        if (type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL)
+        {
+            TraceBottomLevel(bvh, ray.Origin, ray.Direction, ray.TMin, ray.Flags,
+                GetTriangleFacing(ray.Flags, 0), stacks.BottomLevel, hit, endSearch, counters);
+            return;
+        }
+
+        const float3 inverseDirection = { 1.0f / ray.Direction.x, 1.0f / ray.Direction.y, 1.0f / ray.Direction.z };
+
+        float tEntry;
+        if (!RayNodeTest(bvh.pNodes[0], ray.Origin, inverseDirection, ray.TMin, hit.T, tEntry))
+        {
+            return;
+        }
+
+        std::vector<UINT> &stack = stacks.TopLevel;
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty())
+        {
+            const AABBNode &node = bvh.pNodes[stack.back()];
+            stack.pop_back();
+            counters.NodesVisited++;
+
+            if (node.leaf)
+            {
+                const BVHMetadata &instance = bvh.pInstances[node.leafNode.firstTriangleId];
+                const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instanceDesc = instance.instanceDesc;
+                if ((instanceDesc.InstanceMask & ray.InstanceInclusionMask) == 0)
+                {
+                    continue;
+                }
+
+                if (TraceBottomLevel(
+                    GetBottomLevelView(instance),
+                    TransformPoint(instanceDesc.Transform, ray.Origin),
+                    TransformDirection(instanceDesc.Transform, ray.Direction),
+                    ray.TMin,
+                    ray.Flags,
+                    GetTriangleFacing(ray.Flags, instanceDesc.Flags),
+                    stacks.BottomLevel,
+                    hit,
+                    endSearch,
+                    counters))
+                {
+                    hit.InstanceIndex = instance.InstanceIndex;
+                    hit.InstanceID = instanceDesc.InstanceID;
+                    if (endSearch)
+                    {
+                        return;
+                    }
+                }
+            }
+            else
+            {
+                const UINT leftIndex = node.internalNode.leftNodeIndex;
+                const UINT rightIndex = node.rightNodeIndex;
+
+                float tLeft, tRight;
+                const bool hitLeft = RayNodeTest(bvh.pNodes[leftIndex], ray.Origin, inverseDirection, ray.TMin, hit.T, tLeft);
+                const bool hitRight = RayNodeTest(bvh.pNodes[rightIndex], ray.Origin, inverseDirection, ray.TMin, hit.T, tRight);
+                if (hitLeft && hitRight)
+                {
+                    const bool leftFirst = tLeft <= tRight;
+                    stack.push_back(leftFirst ? rightIndex : leftIndex);
+                    stack.push_back(leftFirst ? leftIndex : rightIndex);
+                }
+                else if (hitLeft)
+                {
+                    stack.push_back(leftIndex);
+                }
+                else if (hitRight)
+                {
+                    stack.push_back(rightIndex);
+                }
+            }
+        }
+    }
+
+    static
+        void TraceSingleRays(
+            const BvhView &bvh,
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE type,
+            const CpuRay *pRays,
+            UINT numRays,
+            CpuRayHit *pHits,
+            TraversalCounters &counters)
+    {
+        SingleRayStacks stacks;
+        stacks.TopLevel.reserve(64);
+        stacks.BottomLevel.reserve(64);
+
+        for (UINT i = 0; i < numRays; ++i)
+        {
+            TraceRay(bvh, type, pRays[i], stacks, pHits[i], counters);
+            if (pHits[i].PrimitiveIndex != CPU_RAY_MISS)
+            {
+                counters.HitCount++;
+            }
+        }
+    }
+
+    //
+    // Packet kernel
+    //
+    // Four rays are traced together in SoA form, one ray per lane of an XMVECTOR. Each
+    // stack entry carries the lanes that entered the node, lanes leave the packet when
+    // they miss a node or accept a hit. The packet visits the child that is nearer for
+    // most of its lanes first.
+    //
+
+    static const UINT PACKET_WIDTH = 4;
+    static const UINT ALL_LANES = (1 << PACKET_WIDTH) - 1;
+
+    static const UINT LaneCount[ALL_LANES + 1] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+    static inline
+        UINT XM_CALLCONV GetLaneMask(
+            FXMVECTOR comparison)
+    {
+#if defined(_XM_SSE_INTRINSICS_)
+        return (UINT)_mm_movemask_ps(comparison);
+#else
+        XMUINT4 lanes;
+        XMStoreUInt4(&lanes, comparison);
+        return (lanes.x & 1) | (lanes.y & 2) | (lanes.z & 4) | (lanes.w & 8);
+#endif
+    }
+
+    static inline
+        XMVECTOR XM_CALLCONV GetLaneSelect(
+            UINT laneMask)
+    {
+        return XMVectorSelectControl(laneMask & 1, (laneMask >> 1) & 1, (laneMask >> 2) & 1, (laneMask >> 3) & 1);
+    }
+
+    struct RayPacket
+    {
+        XMVECTOR Origin[3];
+        XMVECTOR Direction[3];
+        XMVECTOR InverseDirection[3];
+        XMVECTOR TMin;
+
+        UINT Flags[PACKET_WIDTH];
+        UINT InstanceInclusionMask[PACKET_WIDTH];
+        UINT AcceptFirstHitLanes;
+    };
+
+    struct PacketStackEntry
+    {
+        UINT NodeIndex;
+        UINT LaneMask;
+    };
+
+    struct PacketStacks
+    {
+        std::vector<PacketStackEntry> TopLevel;
+        std::vector<PacketStackEntry> BottomLevel;
+    };
+
+    struct PacketFacing
+    {
+        bool FrontCounterClockwise;
+        UINT CullFrontFacingLanes;
+        UINT CullBackFacingLanes;
+    };
+
+    static
+        PacketFacing GetPacketFacing(
+            const RayPacket &packet,
+            UINT instanceFlags)
+    {
+        PacketFacing facing = {};
+        for (UINT lane = 0; lane < PACKET_WIDTH; ++lane)
+        {
+            const TriangleFacing laneFacing = GetTriangleFacing(packet.Flags[lane], instanceFlags);
+            facing.FrontCounterClockwise = laneFacing.FrontCounterClockwise;
+            facing.CullFrontFacingLanes |= laneFacing.CullFrontFacing ? (1 << lane) : 0;
+            facing.CullBackFacingLanes |= laneFacing.CullBackFacing ? (1 << lane) : 0;
+        }
+        return facing;
+    }
+
+    //
+    // Fills all four lanes, repeating the last ray if there are fewer
+    //
+    static
+        void LoadRayPacket(
+            const CpuRay *pRays,
+            UINT numRays,
+            RayPacket &packet)
+    {
+        XMFLOAT4A origin[3], direction[3], tMin;
+        packet.AcceptFirstHitLanes = 0;
+        for (UINT lane = 0; lane < PACKET_WIDTH; ++lane)
+        {
+            const CpuRay &ray = pRays[std::min(lane, numRays - 1)];
+            (&origin[0].x)[lane] = ray.Origin.x;
+            (&origin[1].x)[lane] = ray.Origin.y;
+            (&origin[2].x)[lane] = ray.Origin.z;
+            (&direction[0].x)[lane] = ray.Direction.x;
+            (&direction[1].x)[lane] = ray.Direction.y;
+            (&direction[2].x)[lane] = ray.Direction.z;
+            (&tMin.x)[lane] = ray.TMin;
+
+            packet.Flags[lane] = ray.Flags;
+            packet.InstanceInclusionMask[lane] = ray.InstanceInclusionMask;
+            if (ray.Flags & D3D12_RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH)
+            {
+                packet.AcceptFirstHitLanes |= 1 << lane;
+            }
+        }
+
+        for (UINT axis = 0; axis < 3; ++axis)
+        {
+            packet.Origin[axis] = XMLoadFloat4A(&origin[axis]);
+            packet.Direction[axis] = XMLoadFloat4A(&direction[axis]);
+            packet.InverseDirection[axis] = XMVectorReciprocal(packet.Direction[axis]);
+        }
+        packet.TMin = XMLoadFloat4A(&tMin);
+    }
+
+    static
+        void TransformRayPacket(
+            const FLOAT transform[3][4],
+            const RayPacket &packet,
+            RayPacket &transformedPacket)
+    {
+        transformedPacket = packet;
+        for (UINT row = 0; row < 3; ++row)
+        {
+            const XMVECTOR m0 = XMVectorReplicate(transform[row][0]);
+            const XMVECTOR m1 = XMVectorReplicate(transform[row][1]);
+            const XMVECTOR m2 = XMVectorReplicate(transform[row][2]);
+
+            const XMVECTOR direction = XMVectorAdd(XMVectorAdd(
+                XMVectorMultiply(m0, packet.Direction[0]),
+                XMVectorMultiply(m1, packet.Direction[1])),
+                XMVectorMultiply(m2, packet.Direction[2]));
+            transformedPacket.Direction[row] = direction;
+            transformedPacket.InverseDirection[row] = XMVectorReciprocal(direction);
+
+            transformedPacket.Origin[row] = XMVectorAdd(XMVectorAdd(XMVectorAdd(
+                XMVectorMultiply(m0, packet.Origin[0]),
+                XMVectorMultiply(m1, packet.Origin[1])),
+                XMVectorMultiply(m2, packet.Origin[2])),
+                XMVectorReplicate(transform[row][3]));
+        }
+    }
+
+    static inline
+        UINT XM_CALLCONV PacketBoxTest(
+            const float boxMin[3],
+            const float boxMax[3],
+            const RayPacket &packet,
+            FXMVECTOR tMax,
+            UINT laneMask,
+            XMVECTOR &tEntry)
+    {
+        XMVECTOR tNear = packet.TMin;
+        XMVECTOR tFar = tMax;
+        for (UINT axis = 0; axis < 3; ++axis)
+        {
+            const XMVECTOR t0 = XMVectorMultiply(
+                XMVectorSubtract(XMVectorReplicate(boxMin[axis]), packet.Origin[axis]), packet.InverseDirection[axis]);
+            const XMVECTOR t1 = XMVectorMultiply(
+                XMVectorSubtract(XMVectorReplicate(boxMax[axis]), packet.Origin[axis]), packet.InverseDirection[axis]);
+            tNear = XMVectorMax(tNear, XMVectorMin(t0, t1));
+            tFar = XMVectorMin(tFar, XMVectorMax(t0, t1));
+        }
+
+        tEntry = tNear;
+        return GetLaneMask(XMVectorLessOrEqual(tNear, tFar)) & laneMask;
+    }
+
+    static inline
+        UINT XM_CALLCONV PacketNodeTest(
+            const AABBNode &node,
+            const RayPacket &packet,
+            FXMVECTOR tMax,
+            UINT laneMask,
+            XMVECTOR &tEntry)
+    {
+        const float boxMin[3] =
+        {
+            node.center[0] - node.halfDim[0],
+            node.center[1] - node.halfDim[1],
+            node.center[2] - node.halfDim[2]
+        };
+        const float boxMax[3] =
+        {
+            node.center[0] + node.halfDim[0],
+            node.center[1] + node.halfDim[1],
+            node.center[2] + node.halfDim[2]
+        };
+        return PacketBoxTest(boxMin, boxMax, packet, tMax, laneMask, tEntry);
+    }
+
+    static inline
+        XMVECTOR XM_CALLCONV DotSoA(
+            FXMVECTOR ax, FXMVECTOR ay, FXMVECTOR az,
+            GXMVECTOR bx, HXMVECTOR by, HXMVECTOR bz)
+    {
+        return XMVectorAdd(XMVectorAdd(XMVectorMultiply(ax, bx), XMVectorMultiply(ay, by)), XMVectorMultiply(az, bz));
+    }
+
+    //
+    // RayTriangleTest for four rays, returns the lanes that hit
+    //
+    static
+        UINT XM_CALLCONV PacketTriangleTest(
+            const Triangle &tri,
+            const RayPacket &packet,
+            FXMVECTOR tMax,
+            UINT laneMask,
+            const PacketFacing &facing,
+            XMVECTOR &t,
+            XMVECTOR &u,
+            XMVECTOR &v,
+            UINT &frontFacingLanes)
+    {
+        const float3 e1 = tri.v1 - tri.v0;
+        const float3 e2 = tri.v2 - tri.v0;
+        const XMVECTOR e1x = XMVectorReplicate(e1.x), e1y = XMVectorReplicate(e1.y), e1z = XMVectorReplicate(e1.z);
+        const XMVECTOR e2x = XMVectorReplicate(e2.x), e2y = XMVectorReplicate(e2.y), e2z = XMVectorReplicate(e2.z);
+        const XMVECTOR *d = packet.Direction;
+
+        // p = cross(direction, e2)
+        const XMVECTOR px = XMVectorSubtract(XMVectorMultiply(d[1], e2z), XMVectorMultiply(d[2], e2y));
+        const XMVECTOR py = XMVectorSubtract(XMVectorMultiply(d[2], e2x), XMVectorMultiply(d[0], e2z));
+        const XMVECTOR pz = XMVectorSubtract(XMVectorMultiply(d[0], e2y), XMVectorMultiply(d[1], e2x));
+        const XMVECTOR det = DotSoA(e1x, e1y, e1z, px, py, pz);
+
+        const XMVECTOR zero = XMVectorZero();
+        const UINT nonZeroLanes = GetLaneMask(XMVectorNotEqual(det, zero));
+        const UINT positiveLanes = GetLaneMask(XMVectorGreater(det, zero));
+        frontFacingLanes = (facing.FrontCounterClockwise ? ~positiveLanes : positiveLanes) & nonZeroLanes;
+
+        const UINT culledLanes =
+            (frontFacingLanes & facing.CullFrontFacingLanes) |
+            (~frontFacingLanes & facing.CullBackFacingLanes);
+        laneMask &= nonZeroLanes & ~culledLanes;
+        if (laneMask == 0)
+        {
+            return 0;
+        }
+
+        const XMVECTOR inverseDet = XMVectorReciprocal(det);
+
+        // s = origin - v0
+        const XMVECTOR sx = XMVectorSubtract(packet.Origin[0], XMVectorReplicate(tri.v0.x));
+        const XMVECTOR sy = XMVectorSubtract(packet.Origin[1], XMVectorReplicate(tri.v0.y));
+        const XMVECTOR sz = XMVectorSubtract(packet.Origin[2], XMVectorReplicate(tri.v0.z));
+        u = XMVectorMultiply(DotSoA(sx, sy, sz, px, py, pz), inverseDet);
+
+        // q = cross(s, e1)
+        const XMVECTOR qx = XMVectorSubtract(XMVectorMultiply(sy, e1z), XMVectorMultiply(sz, e1y));
+        const XMVECTOR qy = XMVectorSubtract(XMVectorMultiply(sz, e1x), XMVectorMultiply(sx, e1z));
+        const XMVECTOR qz = XMVectorSubtract(XMVectorMultiply(sx, e1y), XMVectorMultiply(sy, e1x));
+        v = XMVectorMultiply(DotSoA(d[0], d[1], d[2], qx, qy, qz), inverseDet);
+        t = XMVectorMultiply(DotSoA(e2x, e2y, e2z, qx, qy, qz), inverseDet);
+
+        const XMVECTOR one = XMVectorSplatOne();
+        XMVECTOR inside = XMVectorAndInt(XMVectorGreaterOrEqual(u, zero), XMVectorLessOrEqual(u, one));
+        inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(v, zero));
+        inside = XMVectorAndInt(inside, XMVectorLessOrEqual(XMVectorAdd(u, v), one));
+        inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(t, packet.TMin));
+        inside = XMVectorAndInt(inside, XMVectorLess(t, tMax));
+        return GetLaneMask(inside) & laneMask;
+    }
+
+    //
+    // TraceBottomLevel for a packet in the bottom level's object space. Returns the
+    // lanes that found a closer hit and adds the lanes that accepted one to endedLanes.
+    //
+    static
+        UINT TracePacketBottomLevel(
+            const BvhView &bvh,
+            const RayPacket &packet,
+            UINT laneMask,
+            const PacketFacing &facing,
+            std::vector<PacketStackEntry> &stack,
+            XMVECTOR &closestT,
+            CpuRayHit *pHits,
+            UINT &endedLanes,
+            TraversalCounters &counters)
+    {
+        XMVECTOR tEntry;
+        const UINT rootLanes = PacketNodeTest(bvh.pNodes[0], packet, closestT, laneMask, tEntry);
+        if (rootLanes == 0)
+        {
+            return 0;
+        }
+
+        UINT hitLanes = 0;
+        stack.clear();
+        stack.push_back({ 0, rootLanes });
+        while (!stack.empty())
+        {
+            const PacketStackEntry entry = stack.back();
+            stack.pop_back();
+
+            UINT lanes = entry.LaneMask & ~endedLanes;
+            if (lanes == 0)
+            {
+                continue;
+            }
+
+            const AABBNode &node = bvh.pNodes[entry.NodeIndex];
+            counters.NodesVisited += LaneCount[lanes];
+
+            if (node.leaf)
+            {
+                const UINT firstId = node.leafNode.firstTriangleId;
+                for (UINT i = 0; i < node.numTriangles && lanes; ++i)
+                {
+                    const Primitive &primitive = bvh.pPrimitives[firstId + i];
+                    counters.PrimitivesTested += LaneCount[lanes];
+
+                    XMVECTOR t, u, v;
+                    UINT frontFacingLanes;
+                    UINT newHitLanes;
+                    if (primitive.PrimitiveType == TRIANGLE_TYPE)
+                    {
+                        newHitLanes = PacketTriangleTest(primitive.triangle, packet, closestT, lanes, facing, t, u, v, frontFacingLanes);
+                    }
+                    else
+                    {
+                        newHitLanes = PacketBoxTest(&primitive.aabb.min.x, &primitive.aabb.max.x, packet, closestT, lanes, t);
+                        newHitLanes &= GetLaneMask(XMVectorLess(t, closestT));
+                        u = v = XMVectorZero();
+                        frontFacingLanes = 0;
+                    }
+
+                    if (newHitLanes == 0)
+                    {
+                        continue;
+                    }
+
+                    closestT = XMVectorSelect(closestT, t, GetLaneSelect(newHitLanes));
+
+                    XMFLOAT4A laneT, laneU, laneV;
+                    XMStoreFloat4A(&laneT, t);
+                    XMStoreFloat4A(&laneU, u);
+                    XMStoreFloat4A(&laneV, v);
+                    const PrimitiveMetaData &metadata = bvh.pPrimitiveMetaData[firstId + i];
+                    for (UINT lane = 0; lane < PACKET_WIDTH; ++lane)
+                    {
+                        if (newHitLanes & (1 << lane))
+                        {
+                            UINT hitKind = CPU_HIT_KIND_PROCEDURAL_AABB;
+                            if (primitive.PrimitiveType == TRIANGLE_TYPE)
+                            {
+                                hitKind = (frontFacingLanes & (1 << lane)) ?
+                                    CPU_HIT_KIND_TRIANGLE_FRONT_FACE : CPU_HIT_KIND_TRIANGLE_BACK_FACE;
+                            }
+                            CommitPrimitiveHit(metadata, (&laneT.x)[lane], (&laneU.x)[lane], (&laneV.x)[lane], hitKind, pHits[lane]);
+                        }
+                    }
+
+                    hitLanes |= newHitLanes;
+                    const UINT acceptedLanes = newHitLanes & packet.AcceptFirstHitLanes;
+                    endedLanes |= acceptedLanes;
+                    lanes &= ~acceptedLanes;
+                }
+            }
+            else
+            {
+                const UINT leftIndex = node.internalNode.leftNodeIndex;
+                const UINT rightIndex = node.rightNodeIndex;
+
+                XMVECTOR tLeft, tRight;
+                const UINT leftLanes = PacketNodeTest(bvh.pNodes[leftIndex], packet, closestT, lanes, tLeft);
+                const UINT rightLanes = PacketNodeTest(bvh.pNodes[rightIndex], packet, closestT, lanes, tRight);
+                if (leftLanes && rightLanes)
+                {
+                    const UINT bothLanes = leftLanes & rightLanes;
+                    const UINT leftNearerLanes = GetLaneMask(XMVectorLessOrEqual(tLeft, tRight)) & bothLanes;
+                    const bool leftFirst = LaneCount[leftNearerLanes] * 2 >= LaneCount[bothLanes];
+                    if (leftFirst)
+                    {
+                        stack.push_back({ rightIndex, rightLanes });
+                        stack.push_back({ leftIndex, leftLanes });
+                    }
+                    else
+                    {
+                        stack.push_back({ leftIndex, leftLanes });
+                        stack.push_back({ rightIndex, rightLanes });
+                    }
+                }
+                else if (leftLanes)
+                {
+                    stack.push_back({ leftIndex, leftLanes });
+                }
+                else if (rightLanes)
+                {
+                    stack.push_back({ rightIndex, rightLanes });
+                }
+            }
+        }
+        return hitLanes;
+    }
+
+    static
+        void TracePacket(
+            const BvhView &bvh,
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE type,
+            const RayPacket &packet,
+            UINT laneMask,
+            PacketStacks &stacks,
+            XMVECTOR &closestT,
+            CpuRayHit *pHits,
+            TraversalCounters &counters)
+    {
+        UINT endedLanes = 0;
+        if (type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL)
+        {
+            TracePacketBottomLevel(bvh, packet, laneMask, GetPacketFacing(packet, 0),
+                stacks.BottomLevel, closestT, pHits, endedLanes, counters);
+            return;
+        }
+
+        XMVECTOR tEntry;
+        const UINT rootLanes = PacketNodeTest(bvh.pNodes[0], packet, closestT, laneMask, tEntry);
+        if (rootLanes == 0)
+        {
+            return;
+        }
+
+        std::vector<PacketStackEntry> &stack = stacks.TopLevel;
+        stack.clear();
+        stack.push_back({ 0, rootLanes });
+        while (!stack.empty())
+        {
+            const PacketStackEntry entry = stack.back();
+            stack.pop_back();
+
+            const UINT lanes = entry.LaneMask & ~endedLanes;
+            if (lanes == 0)
+            {
+                continue;
+            }
+
+            const AABBNode &node = bvh.pNodes[entry.NodeIndex];
+            counters.NodesVisited += LaneCount[lanes];
+
+            if (node.leaf)
+            {
+                const BVHMetadata &instance = bvh.pInstances[node.leafNode.firstTriangleId];
+                const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instanceDesc = instance.instanceDesc;
+
+                UINT instanceLanes = 0;
+                for (UINT lane = 0; lane < PACKET_WIDTH; ++lane)
+                {
+                    if (instanceDesc.InstanceMask & packet.InstanceInclusionMask[lane])
+                    {
+                        instanceLanes |= 1 << lane;
+                    }
+                }
+                instanceLanes &= lanes;
+                if (instanceLanes == 0)
+                {
+                    continue;
+                }
+
+                RayPacket objectPacket;
+                TransformRayPacket(instanceDesc.Transform, packet, objectPacket);
+
+                const UINT hitLanes = TracePacketBottomLevel(
+                    GetBottomLevelView(instance),
+                    objectPacket,
+                    instanceLanes,
+                    GetPacketFacing(packet, instanceDesc.Flags),
+                    stacks.BottomLevel,
+                    closestT,
+                    pHits,
+                    endedLanes,
+                    counters);
+                for (UINT lane = 0; lane < PACKET_WIDTH; ++lane)
+                {
+                    if (hitLanes & (1 << lane))
+                    {
+                        pHits[lane].InstanceIndex = instance.InstanceIndex;
+                        pHits[lane].InstanceID = instanceDesc.InstanceID;
+                    }
+                }
+            }
+            else
+            {
+                const UINT leftIndex = node.internalNode.leftNodeIndex;
+                const UINT rightIndex = node.rightNodeIndex;
+
+                XMVECTOR tLeft, tRight;
+                const UINT leftLanes = PacketNodeTest(bvh.pNodes[leftIndex], packet, closestT, lanes, tLeft);
+                const UINT rightLanes = PacketNodeTest(bvh.pNodes[rightIndex], packet, closestT, lanes, tRight);
+                if (leftLanes && rightLanes)
+                {
+                    const UINT bothLanes = leftLanes & rightLanes;
+                    const UINT leftNearerLanes = GetLaneMask(XMVectorLessOrEqual(tLeft, tRight)) & bothLanes;
+                    const bool leftFirst = LaneCount[leftNearerLanes] * 2 >= LaneCount[bothLanes];
+                    if (leftFirst)
+                    {
+                        stack.push_back({ rightIndex, rightLanes });
+                        stack.push_back({ leftIndex, leftLanes });
+                    }
+                    else
+                    {
+                        stack.push_back({ leftIndex, leftLanes });
+                        stack.push_back({ rightIndex, rightLanes });
+                    }
+                }
+                else if (leftLanes)
+                {
+                    stack.push_back({ leftIndex, leftLanes });
+                }
+                else if (rightLanes)
+                {
+                    stack.push_back({ rightIndex, rightLanes });
+                }
+            }
+        }
+    }
+
+    static
+        void TracePackets(
+            const BvhView &bvh,
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE type,
+            const CpuRay *pRays,
+            UINT numRays,
+            CpuRayHit *pHits,
+            TraversalCounters &counters)
+    {
+        PacketStacks stacks;
+        stacks.TopLevel.reserve(64);
+        stacks.BottomLevel.reserve(64);
+
+        for (UINT firstRay = 0; firstRay < numRays; firstRay += PACKET_WIDTH)
+        {
+            const UINT packetSize = std::min(PACKET_WIDTH, numRays - firstRay);
+            const UINT laneMask = (1 << packetSize) - 1;
+
+            RayPacket packet;
+            LoadRayPacket(pRays + firstRay, packetSize, packet);
+
+            CpuRayHit laneHits[PACKET_WIDTH];
+            XMFLOAT4A tMax;
+            for (UINT lane = 0; lane < PACKET_WIDTH; ++lane)
+            {
+                const CpuRay &ray = pRays[firstRay + std::min(lane, packetSize - 1)];
+                InitializeHit(ray, laneHits[lane]);
+                (&tMax.x)[lane] = ray.TMax;
+            }
+
+            XMVECTOR closestT = XMLoadFloat4A(&tMax);
+            TracePacket(bvh, type, packet, laneMask, stacks, closestT, laneHits, counters);
+
+            for (UINT lane = 0; lane < packetSize; ++lane)
+            {
+                pHits[firstRay + lane] = laneHits[lane];
+                if (laneHits[lane].PrimitiveIndex != CPU_RAY_MISS)
+                {
+                    counters.HitCount++;
+                }
+            }
+        }
+    }
+
+    void TraceRaysOnCpu(
+        _In_ const void *pAccelerationStructure,
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE type,
+        _In_reads_(numRays) const CpuRay *pRays,
+        UINT numRays,
+        _Out_writes_(numRays) CpuRayHit *pHits,
+        _In_ const CpuBvh2TraversalSettings &settings,
+        _Out_opt_ CpuBvh2TraversalStatistics *pStatistics)
+    {
+        ScopedBuildScheduler scheduler(settings.MaxThreadCount);
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        const BvhView bvh = GetBvhView(pAccelerationStructure, type);
+
+        // Tasks are whole packets so only the last one can be partially filled
+        const UINT raysPerTask = (std::max(settings.RaysPerTask, 1u) + PACKET_WIDTH - 1) & ~(PACKET_WIDTH - 1);
+        const UINT numTasks = (numRays + raysPerTask - 1) / raysPerTask;
+
+        concurrency::combinable<TraversalCounters> taskCounters([]() { return TraversalCounters{}; });
+        concurrency::parallel_for(0u, numTasks, [&](UINT task)
+        {
+            const UINT firstRay = task * raysPerTask;
+            const UINT taskRays = std::min(raysPerTask, numRays - firstRay);
+            if (settings.Kernel == CpuBvh2TraversalKernel::Packet)
+            {
+                TracePackets(bvh, type, pRays + firstRay, taskRays, pHits + firstRay, taskCounters.local());
+            }
+            else
+            {
+                TraceSingleRays(bvh, type, pRays + firstRay, taskRays, pHits + firstRay, taskCounters.local());
+            }
+        });
+
+        if (pStatistics)
+        {
+            auto endTime = std::chrono::high_resolution_clock::now();
+
+            TraversalCounters counters = {};
+            taskCounters.combine_each([&](const TraversalCounters &local)
+            {
+                counters.HitCount += local.HitCount;
+                counters.NodesVisited += local.NodesVisited;
+                counters.PrimitivesTested += local.PrimitivesTested;
+            });
+
+            pStatistics->ThreadCount = scheduler.GetThreadCount();
+            pStatistics->RayCount = numRays;
+            pStatistics->HitCount = counters.HitCount;
+            pStatistics->NodesVisited = counters.NodesVisited;
+            pStatistics->PrimitivesTested = counters.PrimitivesTested;
+            pStatistics->TraceTimeInMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+        }
+    }
+}
@@ -0,0 +1,201 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+// Define as 0 to compile out the SIMD SAH binning kernel and always use the scalar one
+#ifndef CPU_BVH2_SIMD_BINNING
+#define CPU_BVH2_SIMD_BINNING 1
+#endif
+
+namespace FallbackLayer
+{
+    enum class CpuBvh2BinningKernel
+    {
+        Scalar,
+        Simd
+    };
+
+    enum class CpuBvh2BuildAlgorithm
+    {
+        // Top-down binned SAH
+        Sah,
+
+        // The stages of the GPU builder: Morton codes, sort, Karras hierarchy, bottom-up AABBs
+        // and treelet reordering. Quicker to build, with one primitive per leaf.
+        Lbvh
+    };
+
+    struct CpuBvh2BuildSettings
+    {
+        CpuBvh2BuildSettings() :
+            Algorithm(CpuBvh2BuildAlgorithm::Sah),
+            MaxThreadCount(0),
+            MaxRefitSahCostRatio(1.5f),
+            MaxPrimitivesInLeaf(MAX_TRIS_IN_LEAF),
+            ParallelBinningThreshold(64 * 1024),
+            SubtreeTaskThreshold(4 * 1024),
+#if CPU_BVH2_SIMD_BINNING
+            BinningKernel(CpuBvh2BinningKernel::Simd) {}
+#else
+            BinningKernel(CpuBvh2BinningKernel::Scalar) {}
+#endif
+
+        // The settings below MaxThreadCount only apply to Sah. Lbvh runs as many treelet
+        // reordering passes as the GPU builder does for the build flags.
+        CpuBvh2BuildAlgorithm Algorithm;
+
+        // Caps the number of worker threads used by the build, 0 uses the default scheduler
+        UINT MaxThreadCount;
+
+        // PERFORM_UPDATE refits the existing tree to the new geometry, unless that leaves its
+        // SAH cost more than this many times the cost it was built with, in which case it's
+        // rebuilt instead. 0 always keeps the refit.
+        float MaxRefitSahCostRatio;
+
+        UINT MaxPrimitivesInLeaf;
+
+        // Nodes with at least this many primitives bin their primitives across multiple threads
+        UINT ParallelBinningThreshold;
+
+        // Subtrees with more primitives than this are built as independent tasks
+        UINT SubtreeTaskThreshold;
+
+        // Both kernels produce identical bins, the scalar one is kept for validation
+        CpuBvh2BinningKernel BinningKernel;
+    };
+
+    //
+    // Attaches a scheduler limited to the requested number of threads
+    // to the calling context for the duration of a build or trace
+    //
+    class ScopedBuildScheduler
+    {
+    public:
+        ScopedBuildScheduler(UINT maxThreadCount) : m_pScheduler(nullptr)
+        {
+            if (maxThreadCount)
+            {
+                m_pScheduler = concurrency::Scheduler::Create(concurrency::SchedulerPolicy(2,
+                    concurrency::MinConcurrency, 1,
+                    concurrency::MaxConcurrency, maxThreadCount));
+                m_pScheduler->Attach();
+            }
+        }
+
+        ~ScopedBuildScheduler()
+        {
+            if (m_pScheduler)
+            {
+                concurrency::CurrentScheduler::Detach();
+                m_pScheduler->Release();
+            }
+        }
+
+        UINT GetThreadCount() const
+        {
+            return m_pScheduler ? (UINT)m_pScheduler->GetPolicy().GetPolicyValue(concurrency::MaxConcurrency) :
+                concurrency::GetProcessorCount();
+        }
+
+    private:
+        concurrency::Scheduler *m_pScheduler;
+    };
+
+    struct CpuBvh2SahSplit
+    {
+        UINT    SplitAxis;
+        UINT    SplitBin;
+        UINT    NumPrimitivesInLeft;
+        AABB    LeftBox;
+        AABB    RightBox;
+    };
+
+    struct CpuBvh2BuildStatistics
+    {
+        UINT ThreadCount;
+        UINT PrimitiveCount;
+        UINT NodeCount;
+
+        // Time spent loading primitives from the geometry descs
+        double LoadTimeInMs;
+
+        // Time spent constructing and serializing the hierarchy
+        double BuildTimeInMs;
+
+        float SahCost;
+
+        // Updates only. Refit is false if the refit was thrown away for a rebuild,
+        // the time spent on it is counted either way.
+        bool Refit;
+        UINT RefitsSinceBuild;
+        double RefitTimeInMs;
+        float BuildSahCost;
+    };
+
+    // Kept after the end of an acceleration structure built with ALLOW_UPDATE
+    struct CpuBvh2UpdateData
+    {
+        // SAH cost of the tree when it was last built, refits are measured against it
+        float BuildSahCost;
+        UINT RefitsSinceBuild;
+    };
+
+    // Upper bound on the output size of BuildRaytracingAccelerationStructureOnCpu,
+    // usable without a device. Updates need no scratch memory.
+    UINT GetCpuBvh2ResultDataMaxSizeInBytes(
+        UINT numPrimitives,
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE);
+    UINT GetCpuBvh2TopLevelResultDataMaxSizeInBytes(
+        UINT numInstances,
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE);
+
+    // SAH cost of a serialized hierarchy normalized to the root's surface area,
+    // using unit cost for both node traversal and primitive intersection
+    float ComputeBvh2SahCost(
+        _In_reads_(nodeCount) const AABBNode *pNodes,
+        UINT nodeCount);
+
+    // Finds the best SAH split of a single node made of the given primitives. Exposed
+    // so the binning kernels can be validated and benchmarked in isolation.
+    // Returns false if no plane separates the primitives.
+    bool ComputeCpuBvh2SahSplit(
+        _In_reads_(numPrimitives) const PrimitiveMetaData *pMetadata,
+        UINT numPrimitives,
+        const std::vector<AABB> &boxes,
+        CpuBvh2BinningKernel kernel,
+        _Out_ CpuBvh2SahSplit &split);
+
+    // Sorts the keys and reorders the values the same way, keys must fit in 30 bits.
+    // The LBVH builder sorts Morton codes with it, exposed so it can be validated on its own.
+    void SortCpuLbvhMortonCodes(
+        std::vector<UINT> &keys,
+        std::vector<UINT> &values);
+
+    // The LBVH build behind CpuBvh2BuildAlgorithm::Lbvh. Boxes are addressed by PrimitiveIndex,
+    // primitiveMetaData is reordered into leaf order and the nodes are laid out like the GPU
+    // builder's: the n - 1 internal nodes followed by a leaf per primitive. The type and build
+    // flags of the inputs decide how many treelet reordering passes are run.
+    void BuildCpuLbvh(
+        const std::vector<AABB> &boxes,
+        std::vector<PrimitiveMetaData> &primitiveMetaData,
+        const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+        std::vector<AABBNode> &nodes);
+
+    // Builds bottom levels from geometry descs, and top levels from instance descs in CPU
+    // memory whose AccelerationStructure is the CPU address of a bottom level built here.
+    // With PERFORM_UPDATE, SourceAccelerationStructureData is the CPU address of a build with
+    // ALLOW_UPDATE and the same primitives or instances, it may be the same as pData.
+    void BuildRaytracingAccelerationStructureOnCpu(
+        _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        _Out_ void *pData,
+        _In_ const CpuBvh2BuildSettings &settings,
+        _Out_opt_ CpuBvh2BuildStatistics *pStatistics = nullptr);
+}
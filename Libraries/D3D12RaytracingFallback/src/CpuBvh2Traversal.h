@@ -0,0 +1,107 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    // Same values as the HLSL HIT_KIND_TRIANGLE_* intrinsics
+    static const UINT CPU_HIT_KIND_TRIANGLE_FRONT_FACE = 0xFE;
+    static const UINT CPU_HIT_KIND_TRIANGLE_BACK_FACE = 0xFF;
+
+    // Procedural primitives have no intersection shader to run, a ray hits
+    // one where it enters its AABB
+    static const UINT CPU_HIT_KIND_PROCEDURAL_AABB = 0;
+
+    static const UINT CPU_RAY_MISS = 0xffffffff;
+
+    enum class CpuBvh2TraversalKernel
+    {
+        // One ray at a time, visiting nodes in the same order as the traversal shader
+        SingleRay,
+
+        // Four rays sharing a stack, each node and triangle is tested against all four at once
+        Packet
+    };
+
+    struct CpuBvh2TraversalSettings
+    {
+        CpuBvh2TraversalSettings() :
+            MaxThreadCount(0),
+            RaysPerTask(4 * 1024),
+            Kernel(CpuBvh2TraversalKernel::Packet) {}
+
+        // Caps the number of worker threads used by the trace, 0 uses the default scheduler
+        UINT MaxThreadCount;
+
+        // Rays are traced in tasks of this many consecutive rays, packets are
+        // made of neighbouring rays so coherent rays should be kept together
+        UINT RaysPerTask;
+
+        // Both kernels find the same hits
+        CpuBvh2TraversalKernel Kernel;
+    };
+
+    struct CpuRay
+    {
+        float3  Origin;
+        float   TMin;
+        float3  Direction;
+        float   TMax;
+
+        // D3D12_RAY_FLAGS. Without any-hit shaders every primitive is opaque, so only
+        // ACCEPT_FIRST_HIT_AND_END_SEARCH and the triangle facing culls have an effect.
+        UINT    Flags;
+
+        // Ignored when tracing a bottom level
+        UINT    InstanceInclusionMask;
+    };
+
+    struct CpuRayHit
+    {
+        // TMax of the ray if nothing was hit
+        float   T;
+        float2  Barycentrics;
+        UINT    HitKind;
+
+        // CPU_RAY_MISS if nothing was hit
+        UINT    PrimitiveIndex;
+        UINT    GeometryContributionToHitGroupIndex;
+
+        // CPU_RAY_MISS if nothing was hit or a bottom level was traced
+        UINT    InstanceIndex;
+        UINT    InstanceID;
+    };
+
+    struct CpuBvh2TraversalStatistics
+    {
+        UINT    ThreadCount;
+        UINT64  RayCount;
+        UINT64  HitCount;
+
+        // Summed over all rays, bottom-level nodes and primitives are counted once per instance visited
+        UINT64  NodesVisited;
+        UINT64  PrimitivesTested;
+
+        double  TraceTimeInMs;
+    };
+
+    // Finds the closest hit of each ray in an acceleration structure in CPU memory, either
+    // the output of BuildRaytracingAccelerationStructureOnCpu or a GPU build read back.
+    // A top level's instances must point at the CPU address of their bottom level.
+    void TraceRaysOnCpu(
+        _In_ const void *pAccelerationStructure,
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE type,
+        _In_reads_(numRays) const CpuRay *pRays,
+        UINT numRays,
+        _Out_writes_(numRays) CpuRayHit *pHits,
+        _In_ const CpuBvh2TraversalSettings &settings,
+        _Out_opt_ CpuBvh2TraversalStatistics *pStatistics = nullptr);
+}
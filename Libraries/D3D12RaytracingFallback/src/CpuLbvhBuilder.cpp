@@ -0,0 +1,689 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+#include "TreeletReorderBindings.h"
+
+//
+// CPU version of the GPU LBVH build. Each stage follows its shader: Morton codes as in
+// CalculateMortonCodes.hlsli, the hierarchy as in BuildBVHSplits.hlsli, bottom-up AABBs
+// as in ComputeAABBs.hlsli and treelet reordering as in FindTreelets.hlsl/TreeletReorder.hlsl.
+// The bitonic sort is replaced with a radix sort, which gives the same order except that
+// equal codes keep their input order.
+//
+
+namespace FallbackLayer
+{
+    // Same constants as TreeletReorder.hlsl
+    static const float CostOfRayBoxIntersection = 1.2f;
+    static const UINT NumInternalTreeletNodes = FullTreeletSize - 1;
+    static const UINT NumTreeletSplitPermutations = 1 << FullTreeletSize;
+    static const UINT FullPartitionMask = NumTreeletSplitPermutations - 1;
+
+    static const UINT MORTON_CODE_BITS_PER_AXIS = 10;
+    static const UINT MORTON_CODE_BITS = 3 * MORTON_CODE_BITS_PER_AXIS;
+
+    // Three passes of 10 bits cover a Morton code
+    static const UINT RADIX_SORT_BITS = 10;
+    static const UINT RADIX_SORT_BUCKETS = 1 << RADIX_SORT_BITS;
+    static const UINT RADIX_SORT_CHUNK_SIZE = 64 * 1024;
+
+    static const UINT SCENE_BOX_CHUNK_SIZE = 16 * 1024;
+
+    // Subtrees with more primitives than this are reordered as independent tasks
+    static const UINT TREELET_TASK_THRESHOLD = 4 * 1024;
+
+    struct LbvhContext
+    {
+        LbvhContext(
+            const std::vector<AABB>& boxes,
+            const std::vector<PrimitiveMetaData>& primitiveMetaData) :
+            boxes(boxes),
+            primitiveMetaData(primitiveMetaData),
+            numElements((UINT)primitiveMetaData.size()),
+            numInternalNodes((UINT)primitiveMetaData.size() - 1) {}
+
+        const std::vector<AABB>& boxes;
+        const std::vector<PrimitiveMetaData>& primitiveMetaData;
+        const UINT numElements;
+        const UINT numInternalNodes;
+
+        std::vector<UINT> mortonCodes;
+
+        // Internal nodes followed by the leaves, same as the GPU's hierarchy and AABB buffers
+        std::vector<HierarchyNode> hierarchy;
+        std::vector<AABB> nodeBoxes;
+        std::vector<UINT> numTriangles;
+        std::unique_ptr<std::atomic<UINT>[]> childNodesProcessedCounters;
+
+        bool IsLeafIndex(UINT nodeIndex) const
+        {
+            return nodeIndex >= numInternalNodes;
+        }
+
+        const AABB& GetLeafBox(UINT leafIndex) const
+        {
+            return boxes[primitiveMetaData[leafIndex].PrimitiveIndex];
+        }
+    };
+
+    static
+        void InitBoxToInverseMax(
+            AABB& box)
+    {
+        box.max.x = box.max.y = box.max.z = -FLT_MAX;
+        box.min.x = box.min.y = box.min.z = FLT_MAX;
+    }
+
+    static
+        AABB CombineAABB(
+            const AABB& a,
+            const AABB& b)
+    {
+        AABB combined;
+        combined.min = float3{ std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z) };
+        combined.max = float3{ std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z) };
+        return combined;
+    }
+
+    static
+        float ComputeBoxSurfaceArea(
+            const AABB& box)
+    {
+        const float3 dim = { box.max.x - box.min.x, box.max.y - box.min.y, box.max.z - box.min.z };
+        return 2 * (dim.x * dim.y + dim.x * dim.z + dim.y * dim.z);
+    }
+
+    static
+        int CountLeadingZeroes(
+            UINT num)
+    {
+        DWORD highestBit;
+        return _BitScanReverse(&highestBit, num) ? 31 - (int)highestBit : 32;
+    }
+
+    //
+    // Spreads the low 10 bits out so there are two zero bits between each of them
+    //
+    static
+        UINT ExpandBits(
+            UINT v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    static
+        void ComputeSceneBox(
+            const LbvhContext& context,
+            AABB& sceneBox)
+    {
+        const UINT numChunks = (context.numElements + SCENE_BOX_CHUNK_SIZE - 1) / SCENE_BOX_CHUNK_SIZE;
+        std::vector<AABB> chunkBoxes(numChunks);
+        concurrency::parallel_for(0u, numChunks, [&](UINT chunk)
+        {
+            AABB& chunkBox = chunkBoxes[chunk];
+            InitBoxToInverseMax(chunkBox);
+
+            const UINT end = std::min(context.numElements, (chunk + 1) * SCENE_BOX_CHUNK_SIZE);
+            for (UINT i = chunk * SCENE_BOX_CHUNK_SIZE; i < end; ++i)
+            {
+                chunkBox = CombineAABB(chunkBox, context.GetLeafBox(i));
+            }
+        });
+
+        InitBoxToInverseMax(sceneBox);
+        for (const AABB& chunkBox : chunkBoxes)
+        {
+            sceneBox = CombineAABB(sceneBox, chunkBox);
+        }
+    }
+
+    //
+    // The GPU takes the centroid of a triangle's vertices, only the bounds are loaded here
+    // so the center of the box is used instead. Axes are interleaved y, x, z from the lowest bit.
+    //
+    static
+        void CalculateMortonCodes(
+            const LbvhContext& context,
+            std::vector<UINT>& mortonCodes)
+    {
+        const float epsilon = 0.00001f;
+
+        AABB sceneBox;
+        ComputeSceneBox(context, sceneBox);
+        float sceneDimension[3];
+        for (UINT axis = 0; axis < 3; ++axis)
+        {
+            sceneDimension[axis] = std::max(sceneBox.maxArr[axis] - sceneBox.minArr[axis], epsilon);
+        }
+
+        const float maxCoord = (float)(1 << MORTON_CODE_BITS_PER_AXIS);
+        mortonCodes.resize(context.numElements);
+        concurrency::parallel_for(0u, context.numElements, [&](UINT i)
+        {
+            const AABB& box = context.GetLeafBox(i);
+            UINT coords[3];
+            for (UINT axis = 0; axis < 3; ++axis)
+            {
+                const float centroid = (box.minArr[axis] + box.maxArr[axis]) * 0.5f;
+                const float unitCoord = (centroid - sceneBox.minArr[axis]) / sceneDimension[axis];
+                coords[axis] = (UINT)std::min(std::max(unitCoord * maxCoord, 0.0f), maxCoord - 1);
+            }
+
+            mortonCodes[i] = ExpandBits(coords[1]) | (ExpandBits(coords[0]) << 1) | (ExpandBits(coords[2]) << 2);
+        }, concurrency::static_partitioner());
+    }
+
+    void SortCpuLbvhMortonCodes(
+        std::vector<UINT> &keys,
+        std::vector<UINT> &values)
+    {
+        assert(keys.size() == values.size());
+        const UINT numElements = (UINT)keys.size();
+        const UINT numChunks = (numElements + RADIX_SORT_CHUNK_SIZE - 1) / RADIX_SORT_CHUNK_SIZE;
+
+        std::vector<UINT> sortedKeys(numElements);
+        std::vector<UINT> sortedValues(numElements);
+        std::vector<UINT> chunkOffsets(numChunks * RADIX_SORT_BUCKETS);
+
+        for (UINT shift = 0; shift < MORTON_CODE_BITS; shift += RADIX_SORT_BITS)
+        {
+            concurrency::parallel_for(0u, numChunks, [&](UINT chunk)
+            {
+                UINT *pCounts = &chunkOffsets[chunk * RADIX_SORT_BUCKETS];
+                std::fill(pCounts, pCounts + RADIX_SORT_BUCKETS, 0);
+
+                const UINT end = std::min(numElements, (chunk + 1) * RADIX_SORT_CHUNK_SIZE);
+                for (UINT i = chunk * RADIX_SORT_CHUNK_SIZE; i < end; ++i)
+                {
+                    assert(keys[i] < (1u << MORTON_CODE_BITS));
+                    pCounts[(keys[i] >> shift) & (RADIX_SORT_BUCKETS - 1)]++;
+                }
+            });
+
+            // Each chunk writes its share of a bucket after the chunks before it,
+            // so keys with the same digit keep their order and the sort is stable
+            UINT offset = 0;
+            for (UINT bucket = 0; bucket < RADIX_SORT_BUCKETS; ++bucket)
+            {
+                for (UINT chunk = 0; chunk < numChunks; ++chunk)
+                {
+                    UINT& chunkOffset = chunkOffsets[chunk * RADIX_SORT_BUCKETS + bucket];
+                    const UINT count = chunkOffset;
+                    chunkOffset = offset;
+                    offset += count;
+                }
+            }
+
+            concurrency::parallel_for(0u, numChunks, [&](UINT chunk)
+            {
+                UINT *pOffsets = &chunkOffsets[chunk * RADIX_SORT_BUCKETS];
+
+                const UINT end = std::min(numElements, (chunk + 1) * RADIX_SORT_CHUNK_SIZE);
+                for (UINT i = chunk * RADIX_SORT_CHUNK_SIZE; i < end; ++i)
+                {
+                    const UINT sortedIndex = pOffsets[(keys[i] >> shift) & (RADIX_SORT_BUCKETS - 1)]++;
+                    sortedKeys[sortedIndex] = keys[i];
+                    sortedValues[sortedIndex] = values[i];
+                }
+            });
+
+            keys.swap(sortedKeys);
+            values.swap(sortedValues);
+        }
+    }
+
+    //
+    // Equal codes are told apart by their sorted index, which sets them apart by more
+    // than any two codes that differ
+    //
+    static
+        int GetLongestCommonPrefix(
+            const LbvhContext& context,
+            int indexA,
+            int indexB)
+    {
+        const int numElements = (int)context.numElements;
+        if (indexA < 0 || indexA >= numElements || indexB < 0 || indexB >= numElements)
+        {
+            return -1;
+        }
+
+        const UINT mortonCodeA = context.mortonCodes[indexA];
+        const UINT mortonCodeB = context.mortonCodes[indexB];
+        if (mortonCodeA != mortonCodeB)
+        {
+            return CountLeadingZeroes(mortonCodeA ^ mortonCodeB);
+        }
+        return CountLeadingZeroes((UINT)(indexA ^ indexB)) + 31;
+    }
+
+    static
+        void DetermineRange(
+            const LbvhContext& context,
+            int idx,
+            int& first,
+            int& last)
+    {
+        int d = GetLongestCommonPrefix(context, idx, idx + 1) - GetLongestCommonPrefix(context, idx, idx - 1);
+        d = std::max(-1, std::min(d, 1));
+        const int minPrefix = GetLongestCommonPrefix(context, idx, idx - d);
+
+        int maxLength = 2;
+        while (GetLongestCommonPrefix(context, idx, idx + maxLength * d) > minPrefix)
+        {
+            maxLength *= 4;
+        }
+
+        int length = 0;
+        for (int t = maxLength / 2; t > 0; t /= 2)
+        {
+            if (GetLongestCommonPrefix(context, idx, idx + (length + t) * d) > minPrefix)
+            {
+                length = length + t;
+            }
+        }
+
+        const int j = idx + length * d;
+        first = std::min(idx, j);
+        last = std::max(idx, j);
+    }
+
+    static
+        int FindSplit(
+            const LbvhContext& context,
+            int first,
+            int last)
+    {
+        const int commonPrefix = GetLongestCommonPrefix(context, first, last);
+        int split = first;
+        int step = last - first;
+
+        do
+        {
+            step = (step + 1) >> 1;
+            const int newSplit = split + step;
+
+            if (newSplit < last)
+            {
+                const int splitPrefix = GetLongestCommonPrefix(context, first, newSplit);
+                if (splitPrefix > commonPrefix)
+                {
+                    split = newSplit;
+                }
+            }
+        } while (step > 1);
+
+        return split;
+    }
+
+    static
+        void ConstructHierarchy(
+            LbvhContext& context)
+    {
+        context.hierarchy.resize(context.numInternalNodes + context.numElements);
+        context.hierarchy[0] = {};
+
+        const UINT leafNodeOffset = context.numInternalNodes;
+        concurrency::parallel_for(0u, context.numInternalNodes, [&](UINT idx)
+        {
+            int first, last;
+            DetermineRange(context, (int)idx, first, last);
+            const int split = FindSplit(context, first, last);
+
+            const UINT childAIndex = (split == first) ? leafNodeOffset + split : split;
+            const UINT childBIndex = (split + 1 == last) ? leafNodeOffset + split + 1 : split + 1;
+
+            HierarchyNode& node = context.hierarchy[idx];
+            node.LeftChildIndex = childAIndex;
+            node.RightChildIndex = childBIndex;
+            context.hierarchy[childAIndex].ParentIndex = idx;
+            context.hierarchy[childAIndex].bCollapseChildren = 0;
+            context.hierarchy[childBIndex].ParentIndex = idx;
+            context.hierarchy[childBIndex].bCollapseChildren = 0;
+        }, concurrency::static_partitioner());
+    }
+
+    //
+    // Every leaf walks up the tree, the second child to reach a parent combines both
+    // child boxes and carries on. Also counts the triangles under each node.
+    //
+    static
+        void ComputeAABBs(
+            LbvhContext& context)
+    {
+        concurrency::parallel_for(0u, context.numInternalNodes, [&](UINT i)
+        {
+            context.childNodesProcessedCounters[i].store(0, std::memory_order_relaxed);
+        }, concurrency::static_partitioner());
+
+        concurrency::parallel_for(0u, context.numElements, [&](UINT leafIndex)
+        {
+            UINT nodeIndex = context.numInternalNodes + leafIndex;
+            context.nodeBoxes[nodeIndex] = context.GetLeafBox(leafIndex);
+            context.numTriangles[nodeIndex] = 1;
+
+            UINT numTriangles = 1;
+            while (nodeIndex != 0)
+            {
+                const UINT parentNodeIndex = context.hierarchy[nodeIndex].ParentIndex;
+                const UINT trianglesFromOtherChild =
+                    context.childNodesProcessedCounters[parentNodeIndex].fetch_add(numTriangles, std::memory_order_acq_rel);
+                if (trianglesFromOtherChild == 0)
+                {
+                    break;
+                }
+
+                nodeIndex = parentNodeIndex;
+                numTriangles += trianglesFromOtherChild;
+
+                const HierarchyNode& node = context.hierarchy[nodeIndex];
+                context.nodeBoxes[nodeIndex] = CombineAABB(context.nodeBoxes[node.LeftChildIndex], context.nodeBoxes[node.RightChildIndex]);
+                context.numTriangles[nodeIndex] = numTriangles;
+            }
+        }, concurrency::static_partitioner());
+    }
+
+    //
+    // Finds the best way to arrange the 7 largest nodes under nodeIndex and rebuilds the
+    // treelet to match, reusing its internal nodes
+    //
+    static
+        void ReorderTreelet(
+            LbvhContext& context,
+            UINT nodeIndex)
+    {
+        std::vector<HierarchyNode>& hierarchy = context.hierarchy;
+        std::vector<AABB>& nodeBoxes = context.nodeBoxes;
+
+        UINT treeletToReorder[FullTreeletSize];
+        UINT internalNodes[NumInternalTreeletNodes];
+        internalNodes[0] = nodeIndex;
+        treeletToReorder[0] = hierarchy[nodeIndex].LeftChildIndex;
+        treeletToReorder[1] = hierarchy[nodeIndex].RightChildIndex;
+
+        for (UINT treeletSize = 2; treeletSize < FullTreeletSize; treeletSize++)
+        {
+            // Starts below zero so flat boxes can still be picked
+            float largestSurfaceArea = -1.0f;
+            UINT indexOfNodeIndexToTraverse = 0;
+            for (UINT i = 0; i < treeletSize; i++)
+            {
+                const UINT treeletNodeIndex = treeletToReorder[i];
+                if (!context.IsLeafIndex(treeletNodeIndex))
+                {
+                    const float surfaceArea = ComputeBoxSurfaceArea(nodeBoxes[treeletNodeIndex]);
+                    if (surfaceArea > largestSurfaceArea)
+                    {
+                        largestSurfaceArea = surfaceArea;
+                        indexOfNodeIndexToTraverse = i;
+                    }
+                }
+            }
+            assert(largestSurfaceArea >= 0.0f);
+
+            // Replace the original node with its left child and add the right child to the end
+            const UINT nodeIndexToTraverse = treeletToReorder[indexOfNodeIndexToTraverse];
+            internalNodes[treeletSize - 1] = nodeIndexToTraverse;
+            treeletToReorder[indexOfNodeIndexToTraverse] = hierarchy[nodeIndexToTraverse].LeftChildIndex;
+            treeletToReorder[treeletSize] = hierarchy[nodeIndexToTraverse].RightChildIndex;
+        }
+
+        // Subsets of the treelet's leaves are numbered by bitmask, so every proper subset
+        // of a subset comes before it
+        float optimalCost[NumTreeletSplitPermutations];
+        UINT optimalPartition[NumTreeletSplitPermutations];
+        for (UINT treeletBitmask = 1; treeletBitmask < NumTreeletSplitPermutations; treeletBitmask++)
+        {
+            AABB aabb;
+            InitBoxToInverseMax(aabb);
+            for (UINT i = 0; i < FullTreeletSize; i++)
+            {
+                if ((1 << i) & treeletBitmask)
+                {
+                    aabb = CombineAABB(aabb, nodeBoxes[treeletToReorder[i]]);
+                }
+            }
+            const float surfaceArea = ComputeBoxSurfaceArea(aabb);
+
+            // Single leaves are never split
+            if ((treeletBitmask & (treeletBitmask - 1)) == 0)
+            {
+                optimalCost[treeletBitmask] = CostOfRayBoxIntersection * surfaceArea;
+                optimalPartition[treeletBitmask] = 0;
+                continue;
+            }
+
+            float lowestCost = FLT_MAX;
+            UINT bestPartition = 0;
+
+            const UINT delta = (treeletBitmask - 1) & treeletBitmask;
+            UINT partitionBitmask = (0u - delta) & treeletBitmask;
+            do
+            {
+                const float cost = optimalCost[partitionBitmask] + optimalCost[treeletBitmask ^ partitionBitmask];
+                if (cost < lowestCost)
+                {
+                    lowestCost = cost;
+                    bestPartition = partitionBitmask;
+                }
+                partitionBitmask = (partitionBitmask - delta) & treeletBitmask;
+            } while (partitionBitmask != 0);
+
+            optimalCost[treeletBitmask] = CostOfRayBoxIntersection * surfaceArea + lowestCost;
+            optimalPartition[treeletBitmask] = bestPartition;
+        }
+
+        struct PartitionEntry
+        {
+            UINT Mask;
+            UINT NodeIndex;
+        };
+        UINT nodesAllocated = 1;
+        UINT partitionStackSize = 1;
+        PartitionEntry partitionStack[FullTreeletSize];
+        partitionStack[0].Mask = FullPartitionMask;
+        partitionStack[0].NodeIndex = internalNodes[0];
+
+        while (partitionStackSize > 0)
+        {
+            const PartitionEntry partition = partitionStack[--partitionStackSize];
+
+            PartitionEntry entries[2];
+            entries[0].Mask = optimalPartition[partition.Mask];
+            entries[1].Mask = partition.Mask ^ entries[0].Mask;
+            for (PartitionEntry& entry : entries)
+            {
+                if (entry.Mask & (entry.Mask - 1))
+                {
+                    entry.NodeIndex = internalNodes[nodesAllocated++];
+                    partitionStack[partitionStackSize++] = entry;
+                }
+                else
+                {
+                    DWORD leafBit;
+                    _BitScanForward(&leafBit, entry.Mask);
+                    entry.NodeIndex = treeletToReorder[leafBit];
+                }
+                hierarchy[entry.NodeIndex].ParentIndex = partition.NodeIndex;
+            }
+
+            hierarchy[partition.NodeIndex].LeftChildIndex = entries[0].NodeIndex;
+            hierarchy[partition.NodeIndex].RightChildIndex = entries[1].NodeIndex;
+        }
+        assert(nodesAllocated == NumInternalTreeletNodes);
+
+        // Internal nodes are allocated after their parent, so going backwards is bottom-up
+        for (int j = NumInternalTreeletNodes - 1; j >= 0; j--)
+        {
+            const HierarchyNode& node = hierarchy[internalNodes[j]];
+            nodeBoxes[internalNodes[j]] = CombineAABB(nodeBoxes[node.LeftChildIndex], nodeBoxes[node.RightChildIndex]);
+        }
+    }
+
+    //
+    // Same nodes as the GPU visits: every node with at least minTrianglesPerTreelet triangles,
+    // after the nodes below it. Triangle counts above a node don't change when it's reordered.
+    //
+    static
+        void ReorderTreelets(
+            LbvhContext& context,
+            UINT nodeIndex,
+            UINT minTrianglesPerTreelet)
+    {
+        if (context.numTriangles[nodeIndex] < minTrianglesPerTreelet)
+        {
+            return;
+        }
+
+        const UINT leftNodeIndex = context.hierarchy[nodeIndex].LeftChildIndex;
+        const UINT rightNodeIndex = context.hierarchy[nodeIndex].RightChildIndex;
+        if (context.numTriangles[nodeIndex] > TREELET_TASK_THRESHOLD)
+        {
+            concurrency::parallel_invoke(
+                [&] { ReorderTreelets(context, leftNodeIndex, minTrianglesPerTreelet); },
+                [&] { ReorderTreelets(context, rightNodeIndex, minTrianglesPerTreelet); });
+        }
+        else
+        {
+            ReorderTreelets(context, leftNodeIndex, minTrianglesPerTreelet);
+            ReorderTreelets(context, rightNodeIndex, minTrianglesPerTreelet);
+        }
+
+        ReorderTreelet(context, nodeIndex);
+    }
+
+    static
+        void PackAABBNode(
+            AABBNode& packedBox,
+            const AABB& box)
+    {
+        for (UINT axis = 0; axis < 3; ++axis)
+        {
+            packedBox.center[axis] = (box.maxArr[axis] + box.minArr[axis]) * 0.5f;
+            packedBox.halfDim[axis] = box.maxArr[axis] - packedBox.center[axis];
+        }
+        packedBox.nodeAllBits = 0;
+        packedBox.rightNodeIndex = 0;
+    }
+
+    //
+    // Nodes keep their hierarchy index, with the child that has fewer triangles on the left
+    //
+    static
+        void WriteNodes(
+            const LbvhContext& context,
+            std::vector<AABBNode>& nodes)
+    {
+        nodes.resize(context.numInternalNodes + context.numElements);
+        concurrency::parallel_for(0u, (UINT)nodes.size(), [&](UINT nodeIndex)
+        {
+            AABBNode& packedBox = nodes[nodeIndex];
+            PackAABBNode(packedBox, context.nodeBoxes[nodeIndex]);
+
+            if (context.IsLeafIndex(nodeIndex))
+            {
+                packedBox.leaf = true;
+                packedBox.leafNode.firstTriangleId = nodeIndex - context.numInternalNodes;
+                packedBox.numTriangles = 1;
+            }
+            else
+            {
+                const HierarchyNode& node = context.hierarchy[nodeIndex];
+                UINT leftNodeIndex = node.LeftChildIndex;
+                UINT rightNodeIndex = node.RightChildIndex;
+                if (context.numTriangles[leftNodeIndex] > context.numTriangles[rightNodeIndex])
+                {
+                    std::swap(leftNodeIndex, rightNodeIndex);
+                }
+
+                packedBox.internalNode.leftNodeIndex = leftNodeIndex;
+                packedBox.rightNodeIndex = rightNodeIndex;
+            }
+        }, concurrency::static_partitioner());
+    }
+
+    void BuildCpuLbvh(
+        const std::vector<AABB> &boxes,
+        std::vector<PrimitiveMetaData> &primitiveMetaData,
+        const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs,
+        std::vector<AABBNode> &nodes)
+    {
+        const UINT numElements = (UINT)primitiveMetaData.size();
+        if (numElements == 0)
+        {
+            nodes.assign(1, AABBNode{});
+            nodes[0].leaf = true;
+            return;
+        }
+        if (2 * numElements - 1 > (1 << 24))
+        {
+            ThrowFailure(E_INVALIDARG, L"Too many primitives for an LBVH, node indices are limited to 24 bits");
+        }
+
+        LbvhContext context(boxes, primitiveMetaData);
+        std::vector<UINT> sortedIndices(numElements);
+        for (UINT i = 0; i < numElements; ++i)
+        {
+            sortedIndices[i] = i;
+        }
+        CalculateMortonCodes(context, context.mortonCodes);
+        SortCpuLbvhMortonCodes(context.mortonCodes, sortedIndices);
+
+        std::vector<PrimitiveMetaData> sortedMetaData(numElements);
+        concurrency::parallel_for(0u, numElements, [&](UINT i)
+        {
+            sortedMetaData[i] = primitiveMetaData[sortedIndices[i]];
+        }, concurrency::static_partitioner());
+        primitiveMetaData.swap(sortedMetaData);
+
+        // The context still points at primitiveMetaData, which is now in sorted order
+        ConstructHierarchy(context);
+
+        context.nodeBoxes.resize(context.hierarchy.size());
+        context.numTriangles.resize(context.hierarchy.size());
+        context.childNodesProcessedCounters.reset(new std::atomic<UINT>[std::max(context.numInternalNodes, 1u)]);
+        ComputeAABBs(context);
+
+        // Same number of passes as TreeletReorder::Optimize, top levels aren't reordered on the GPU either
+        UINT numOptimizationPasses = 0;
+        if (inputs.Type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL)
+        {
+            if (inputs.Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD)
+            {
+                numOptimizationPasses = 0;
+            }
+            else if (inputs.Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE)
+            {
+                numOptimizationPasses = 3;
+            }
+            else
+            {
+                numOptimizationPasses = 1;
+            }
+        }
+
+        UINT minTrianglesPerTreelet = FullTreeletSize;
+        for (UINT i = 0; i < numOptimizationPasses && minTrianglesPerTreelet <= numElements; i++)
+        {
+            ReorderTreelets(context, 0, minTrianglesPerTreelet);
+
+            // Reordering moves triangles between the nodes of each treelet
+            ComputeAABBs(context);
+            minTrianglesPerTreelet *= 2;
+        }
+
+        WriteNodes(context, nodes);
+    }
+}
@@ -628,6 +628,185 @@ namespace FallbackLayerUnitTests
             }
         }
 
+        TEST_METHOD(R32IndexBufferBottomLevelCpuBVHBuilder)
+        {
+            CpuGeometryDescriptor testCases[] =
+            {
+                CpuGeometryDescriptor(ReferenceVerticies0, VERTEX_COUNT(ReferenceVerticies0), ReferenceR32Indices0, ARRAYSIZE(ReferenceR32Indices0)),
+                CpuGeometryDescriptor(ReferenceVerticies1, VERTEX_COUNT(ReferenceVerticies1), ReferenceR32Indices1, ARRAYSIZE(ReferenceR32Indices1))
+            };
+
+            for (UINT testIndex = 0; testIndex < ARRAYSIZE(testCases); testIndex++)
+            {
+                TestCpuBvh2Builder(testCases[testIndex]);
+            }
+        }
+
+        TEST_METHOD(NoIndexBufferBottomLevelCpuBVHBuilder)
+        {
+            CpuGeometryDescriptor testCases[] =
+            {
+                CpuGeometryDescriptor(ReferenceVerticies0, VERTEX_COUNT(ReferenceVerticies0)),
+                CpuGeometryDescriptor(ReferenceVerticies1, VERTEX_COUNT(ReferenceVerticies1))
+            };
+
+            for (UINT testIndex = 0; testIndex < ARRAYSIZE(testCases); testIndex++)
+            {
+                TestCpuBvh2Builder(testCases[testIndex]);
+            }
+        }
+
+        TEST_METHOD(BottomLevelCpuBVHBuilderWithTransforms)
+        {
+            const UINT numGeoms = 10;
+            float pMatrixStorage[numGeoms * 12];
+            std::vector<CpuGeometryDescriptor> testCases;
+            srand(10);
+            for (UINT i = 0; i < numGeoms; i++)
+            {
+                float *pMatrix = pMatrixStorage + FloatsPerMatrix * i;
+                GenerateRandomTranformation(pMatrix);
+                testCases.push_back(
+                    CpuGeometryDescriptor(ReferenceVerticies0, VERTEX_COUNT(ReferenceVerticies0), nullptr, 0, DXGI_FORMAT_UNKNOWN, pMatrix));
+            }
+            TestCpuBvh2Builder(testCases.data(), numGeoms);
+        }
+
+        TEST_METHOD(MultipleGeometrySingleBottomLevelCpuBVHBuilder_ArrayOfPointersLayout)
+        {
+            TestMultipleGeometrySingleBottomLevelCpuBVHBuilder(D3D12_ELEMENTS_LAYOUT_ARRAY_OF_POINTERS);
+        }
+
+        TEST_METHOD(MultipleGeometrySingleBottomLevelCpuBVHBuilder_ArrayLayout)
+        {
+            TestMultipleGeometrySingleBottomLevelCpuBVHBuilder(D3D12_ELEMENTS_LAYOUT_ARRAY);
+        }
+
+        void TestMultipleGeometrySingleBottomLevelCpuBVHBuilder(D3D12_ELEMENTS_LAYOUT layoutToTest)
+        {
+            CpuGeometryDescriptor testCases[] =
+            {
+                CpuGeometryDescriptor(ReferenceVerticies0, VERTEX_COUNT(ReferenceVerticies0), ReferenceIndices0, ARRAYSIZE(ReferenceIndices0)),
+                CpuGeometryDescriptor(ReferenceVerticies1, VERTEX_COUNT(ReferenceVerticies1), ReferenceR32Indices1, ARRAYSIZE(ReferenceR32Indices1)),
+                CpuGeometryDescriptor(ReferenceVerticies1, VERTEX_COUNT(ReferenceVerticies1))
+            };
+
+            TestCpuBvh2Builder(testCases, ARRAYSIZE(testCases), layoutToTest);
+        }
+
+        TEST_METHOD(CompressedVertexFormatsBottomLevelCpuBVHBuilder)
+        {
+            CpuGeometryDescriptor testCases[] =
+            {
+                CpuGeometryDescriptor(ReferenceVerticies0, VERTEX_COUNT(ReferenceVerticies0), ReferenceIndices0, ARRAYSIZE(ReferenceIndices0)),
+                CpuGeometryDescriptor(ReferenceVerticies1, VERTEX_COUNT(ReferenceVerticies1), ReferenceR32Indices1, ARRAYSIZE(ReferenceR32Indices1))
+            };
+            TestCpuBvh2Builder(testCases, ARRAYSIZE(testCases), D3D12_ELEMENTS_LAYOUT_ARRAY, DXGI_FORMAT_R32G32B32A32_FLOAT);
+            TestCpuBvh2Builder(testCases, ARRAYSIZE(testCases), D3D12_ELEMENTS_LAYOUT_ARRAY, DXGI_FORMAT_R16G16B16A16_FLOAT);
+
+            // SNORM can only represent [-1, 1], scale the reference geometry into range
+            std::vector<float> normalizedVertices;
+            for (float f : ReferenceVerticies1)
+            {
+                normalizedVertices.push_back(f * 0.25f);
+            }
+            CpuGeometryDescriptor snormTestCase(normalizedVertices.data(), (UINT)(normalizedVertices.size() / 3), ReferenceIndices1, ARRAYSIZE(ReferenceIndices1));
+            TestCpuBvh2Builder(&snormTestCase, 1, D3D12_ELEMENTS_LAYOUT_ARRAY, DXGI_FORMAT_R16G16B16A16_SNORM);
+        }
+
+        TEST_METHOD(ProceduralPrimitivesBottomLevelCpuBVHBuilder)
+        {
+            const UINT numGeoms = 4;
+            const UINT aabbsPerGeom = 100;
+            std::vector<D3D12_RAYTRACING_AABB> aabbs(numGeoms * aabbsPerGeom);
+            std::vector<AABB> referenceBoxes(aabbs.size());
+            srand(10);
+            for (UINT i = 0; i < aabbs.size(); i++)
+            {
+                float *pMin = &aabbs[i].MinX;
+                float *pMax = &aabbs[i].MaxX;
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    pMin[axis] = (float)(rand() % 1000) / 10.0f;
+                    pMax[axis] = pMin[axis] + 1.0f + (float)(rand() % 100) / 10.0f;
+                    referenceBoxes[i].minArr[axis] = pMin[axis];
+                    referenceBoxes[i].maxArr[axis] = pMax[axis];
+                }
+            }
+
+            std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDescs(numGeoms);
+            for (UINT i = 0; i < numGeoms; i++)
+            {
+                geomDescs[i].Type = D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS;
+                geomDescs[i].AABBs.AABBCount = aabbsPerGeom;
+                geomDescs[i].AABBs.AABBs.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)&aabbs[i * aabbsPerGeom];
+                geomDescs[i].AABBs.AABBs.StrideInBytes = sizeof(D3D12_RAYTRACING_AABB);
+            }
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs = desc.Inputs;
+            inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            inputs.NumDescs = numGeoms;
+            inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+            inputs.pGeometryDescs = geomDescs.data();
+
+            // The traversal shader only runs intersection shaders for leaves flagged as procedural
+            // and only for their first primitive, so every builder has to emit them one per leaf
+            const FallbackLayer::CpuBvh2BuildAlgorithm algorithms[] =
+            {
+                FallbackLayer::CpuBvh2BuildAlgorithm::Sah,
+                FallbackLayer::CpuBvh2BuildAlgorithm::Lbvh
+            };
+            for (FallbackLayer::CpuBvh2BuildAlgorithm algorithm : algorithms)
+            {
+                FallbackLayer::CpuBvh2BuildSettings settings;
+                settings.Algorithm = algorithm;
+
+                std::unique_ptr<BYTE[]> pData = std::unique_ptr<BYTE[]>(new BYTE[GetCpuBvh2ResultDataMaxSizeInBytes((UINT)aabbs.size())]);
+                BuildRaytracingAccelerationStructureOnCpu(&desc, pData.get(), settings);
+
+                std::wstring errorMessage;
+                auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::BVH2);
+                if (!validator.VerifyTopLevelOutput(referenceBoxes.data(), nullptr, (UINT)referenceBoxes.size(), pData.get(), errorMessage))
+                {
+                    Assert::Fail(errorMessage.c_str());
+                }
+
+                // Leaves must reference the primitive by its index within its own geometry
+                BVHOffsets offsets = *(BVHOffsets *)pData.get();
+                AABBNode *pNodes = (AABBNode *)(pData.get() + offsets.offsetToBoxes);
+                Primitive *pPrimitives = (Primitive *)(pData.get() + offsets.offsetToVertices);
+                PrimitiveMetaData *pMetadata = (PrimitiveMetaData *)(pData.get() + offsets.offsetToPrimitiveMetaData);
+                for (UINT i = 0; i < aabbs.size(); i++)
+                {
+                    Assert::AreEqual((UINT)PROCEDURAL_PRIMITIVE_TYPE, (UINT)pPrimitives[i].PrimitiveType);
+                    Assert::IsTrue(pMetadata[i].PrimitiveIndex < aabbsPerGeom);
+
+                    const D3D12_RAYTRACING_AABB &expected = aabbs[pMetadata[i].GeometryContributionToHitGroupIndex * aabbsPerGeom + pMetadata[i].PrimitiveIndex];
+                    Assert::IsTrue(memcmp(&expected, &pPrimitives[i].aabb, sizeof(expected)) == 0);
+                }
+
+                UINT numLeaves = 0;
+                std::vector<UINT> stack(1, 0);
+                while (!stack.empty())
+                {
+                    const AABBNode &node = pNodes[stack.back()];
+                    stack.pop_back();
+                    if (!node.leaf)
+                    {
+                        stack.push_back(node.internalNode.leftNodeIndex);
+                        stack.push_back(node.rightNodeIndex);
+                        continue;
+                    }
+
+                    numLeaves++;
+                    Assert::AreEqual(1u, node.numTriangles, L"Procedural primitives must be alone in their leaf");
+                    Assert::IsTrue((node.nodeAllBits & 0x40000000) != 0, L"Procedural leaf is missing IsProceduralGeometryFlag");
+                }
+                Assert::AreEqual((UINT)aabbs.size(), numLeaves);
+            }
+        }
+
         TEST_METHOD(R16IndexBufferBottomLevelGpuBVHBuilder)
         {
             CpuGeometryDescriptor testCases[] =
@@ -1341,15 +1520,70 @@ namespace FallbackLayerUnitTests
             }
         }
 
-        void TestCpuBvh2Builder(CpuGeometryDescriptor *pGeomDescs, UINT numGeoms, D3D12_ELEMENTS_LAYOUT layoutToTest = D3D12_ELEMENTS_LAYOUT_ARRAY)
+        // Packs float3 vertices into one of the compressed vertex formats, returns the stride
+        static UINT PackVertices(const float *pVertices, UINT numVertices, DXGI_FORMAT vertexFormat, std::vector<BYTE> &packedVertices)
         {
-            ID3D12Device &device = m_d3d12Context.GetDevice();
-            std::unique_ptr<FallbackLayer::IAccelerationStructureBuilder> pBuilder =
-                std::unique_ptr<FallbackLayer::IAccelerationStructureBuilder>(
-                    new FallbackLayer::GpuBvh2Builder(&device, m_d3d12Context.GetTotalLaneCount(), 0));
-            InternalFallbackBuilder builderWrapper(pBuilder.get());
+            switch (vertexFormat)
+            {
+            case DXGI_FORMAT_R16G16B16A16_FLOAT:
+            {
+                packedVertices.resize(numVertices * sizeof(USHORT) * 4);
+                USHORT *pHalfs = (USHORT *)packedVertices.data();
+                for (UINT i = 0; i < numVertices; i++)
+                {
+                    for (UINT j = 0; j < 3; j++)
+                    {
+                        pHalfs[i * 4 + j] = DirectX::PackedVector::XMConvertFloatToHalf(pVertices[i * 3 + j]);
+                    }
+                    pHalfs[i * 4 + 3] = DirectX::PackedVector::XMConvertFloatToHalf(1.0f);
+                }
+                return sizeof(USHORT) * 4;
+            }
+            case DXGI_FORMAT_R16G16B16A16_SNORM:
+            {
+                packedVertices.resize(numVertices * sizeof(SHORT) * 4);
+                SHORT *pSnorms = (SHORT *)packedVertices.data();
+                for (UINT i = 0; i < numVertices; i++)
+                {
+                    for (UINT j = 0; j < 3; j++)
+                    {
+                        const float v = std::min(std::max(pVertices[i * 3 + j], -1.0f), 1.0f);
+                        pSnorms[i * 4 + j] = (SHORT)roundf(v * 32767.0f);
+                    }
+                    pSnorms[i * 4 + 3] = 32767;
+                }
+                return sizeof(SHORT) * 4;
+            }
+            case DXGI_FORMAT_R32G32B32A32_FLOAT:
+            {
+                packedVertices.resize(numVertices * sizeof(float) * 4);
+                float *pFloats = (float *)packedVertices.data();
+                for (UINT i = 0; i < numVertices; i++)
+                {
+                    for (UINT j = 0; j < 3; j++)
+                    {
+                        pFloats[i * 4 + j] = pVertices[i * 3 + j];
+                    }
+                    pFloats[i * 4 + 3] = 1.0f;
+                }
+                return sizeof(float) * 4;
+            }
+            default:
+                Assert::Fail(L"Unexpected vertex format");
+                return 0;
+            }
+        }
 
+        void TestCpuBvh2Builder(
+            CpuGeometryDescriptor *pGeomDescs,
+            UINT numGeoms,
+            D3D12_ELEMENTS_LAYOUT layoutToTest = D3D12_ELEMENTS_LAYOUT_ARRAY,
+            DXGI_FORMAT vertexFormat = DXGI_FORMAT_R32G32B32_FLOAT)
+        {
+            std::vector<std::vector<BYTE>> packedVertices(numGeoms);
             std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDescs(numGeoms);
+            std::vector<D3D12_RAYTRACING_GEOMETRY_DESC *> geomDescPointers(numGeoms);
+            UINT numPrimitives = 0;
             for (UINT i = 0; i < numGeoms; i++)
             {
                 geomDescs[i].Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
@@ -1360,27 +1594,36 @@ namespace FallbackLayerUnitTests
                 triangleDesc.IndexCount = pGeomDescs[i].m_numIndicies;
                 triangleDesc.VertexCount = pGeomDescs[i].m_numVerticies;
                 triangleDesc.VertexBuffer.StrideInBytes = sizeof(float) * 3;
+                triangleDesc.VertexFormat = vertexFormat;
+                triangleDesc.Transform3x4 = (D3D12_GPU_VIRTUAL_ADDRESS)pGeomDescs[i].transform.data();
+                if (vertexFormat != DXGI_FORMAT_R32G32B32_FLOAT)
+                {
+                    triangleDesc.VertexBuffer.StrideInBytes = PackVertices(pGeomDescs[i].m_pVertexData, pGeomDescs[i].m_numVerticies, vertexFormat, packedVertices[i]);
+                    triangleDesc.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)packedVertices[i].data();
+                }
+                geomDescPointers[i] = &geomDescs[i];
+                numPrimitives += GetPrimitiveCountFromGeometryDesc(geomDescs[i]);
             }
 
-            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo;
-            builderWrapper.GetRaytracingAccelerationStructurePrebuildInfo(&device,
-                D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL,
-                D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD,
-                numGeoms,
-                geomDescs.data(),
-                &prebuildInfo);
-            std::unique_ptr<BYTE[]> pData = std::unique_ptr<BYTE[]>(new BYTE[prebuildInfo.ResultDataMaxSizeInBytes]);
+            std::unique_ptr<BYTE[]> pData = std::unique_ptr<BYTE[]>(new BYTE[GetCpuBvh2ResultDataMaxSizeInBytes(numPrimitives)]);
 
             D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
             D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS &inputs = desc.Inputs;
-            inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            inputs.DescsLayout = layoutToTest;
             inputs.NumDescs = numGeoms;
             inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-            inputs.pGeometryDescs = geomDescs.data();
+            if (layoutToTest == D3D12_ELEMENTS_LAYOUT_ARRAY_OF_POINTERS)
+            {
+                inputs.ppGeometryDescs = geomDescPointers.data();
+            }
+            else
+            {
+                inputs.pGeometryDescs = geomDescs.data();
+            }
 
             BuildRaytracingAccelerationStructureOnCpu(&desc, pData.get());
             std::wstring errorMessage;
-            auto &validator = FallbackLayer::GetAccelerationStructureValidator(pBuilder->GetAccelerationStructureType());
+            auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::BVH2);
             if (!validator.VerifyBottomLevelOutput(pGeomDescs, numGeoms, pData.get(), errorMessage))
             {
                 Assert::Fail(errorMessage.c_str());
@@ -1445,6 +1688,1082 @@ namespace FallbackLayerUnitTests
         std::unique_ptr<AccelerationStructureBuilderHelper> m_pBuilderHelper;
     };
 
+    void GenerateGrid(UINT dimension, float offset, std::vector<float> &vertices, std::vector<UINT16> &indices)
+    {
+        const UINT verticesPerRow = dimension + 1;
+        for (UINT y = 0; y < verticesPerRow; y++)
+        {
+            for (UINT x = 0; x < verticesPerRow; x++)
+            {
+                vertices.push_back((float)x);
+                vertices.push_back(sinf(x * 0.3f + offset) * cosf(y * 0.2f) * 4.0f + offset * 2.0f);
+                vertices.push_back((float)y);
+            }
+        }
+
+        for (UINT y = 0; y < dimension; y++)
+        {
+            for (UINT x = 0; x < dimension; x++)
+            {
+                const UINT16 i0 = (UINT16)(y * verticesPerRow + x);
+                const UINT16 i1 = (UINT16)(i0 + 1);
+                const UINT16 i2 = (UINT16)(i0 + verticesPerRow);
+                const UINT16 i3 = (UINT16)(i2 + 1);
+                indices.insert(indices.end(), { i0, i2, i1, i1, i2, i3 });
+            }
+        }
+    }
+
+    // Makes numGeometries grids stacked on top of each other, returns the number of triangles
+    UINT GenerateGridGeometry(
+        UINT dimension,
+        UINT numGeometries,
+        std::vector<std::vector<float>> &vertices,
+        std::vector<std::vector<UINT16>> &indices,
+        std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> &geomDescs)
+    {
+        vertices.resize(numGeometries);
+        indices.resize(numGeometries);
+        geomDescs.resize(numGeometries);
+
+        UINT totalTriangles = 0;
+        for (UINT geometryIndex = 0; geometryIndex < numGeometries; geometryIndex++)
+        {
+            GenerateGrid(dimension, (float)geometryIndex, vertices[geometryIndex], indices[geometryIndex]);
+
+            D3D12_RAYTRACING_GEOMETRY_DESC &geomDesc = geomDescs[geometryIndex];
+            geomDesc = {};
+            geomDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+            geomDesc.Triangles.IndexBuffer = (D3D12_GPU_VIRTUAL_ADDRESS)indices[geometryIndex].data();
+            geomDesc.Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
+            geomDesc.Triangles.IndexCount = (UINT)indices[geometryIndex].size();
+            geomDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)vertices[geometryIndex].data();
+            geomDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(float) * 3;
+            geomDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+            geomDesc.Triangles.VertexCount = (UINT)vertices[geometryIndex].size() / 3;
+            totalTriangles += geomDesc.Triangles.IndexCount / 3;
+        }
+        return totalTriangles;
+    }
+
+    // The benchmarks take far longer than the unit tests, so normal runs skip them.
+    // Set FALLBACK_LAYER_BENCHMARKS in the environment to run them.
+    bool AreBenchmarksEnabled()
+    {
+        if (GetEnvironmentVariableW(L"FALLBACK_LAYER_BENCHMARKS", nullptr, 0) == 0)
+        {
+            Logger::WriteMessage(L"Skipped, set FALLBACK_LAYER_BENCHMARKS to run benchmarks\n");
+            return false;
+        }
+        return true;
+    }
+
+    // Ground truth for the CPU traversal: the same triangle test, applied to one triangle
+    bool BruteForceRayTriangleTest(
+        const float3 &v0,
+        const float3 &v1,
+        const float3 &v2,
+        const FallbackLayer::CpuRay &ray,
+        float &t,
+        bool &frontFacing)
+    {
+        const float3 e1 = v1 - v0;
+        const float3 e2 = v2 - v0;
+        const float3 p = cross(ray.Direction, e2);
+        const float det = dot(e1, p);
+        if (det == 0.0f)
+        {
+            return false;
+        }
+
+        // Clockwise as seen along the ray is the front face
+        frontFacing = det > 0.0f;
+
+        const float inverseDet = 1.0f / det;
+        const float3 s = ray.Origin - v0;
+        const float u = dot(s, p) * inverseDet;
+        if (!(u >= 0.0f && u <= 1.0f))
+        {
+            return false;
+        }
+
+        const float3 q = cross(s, e1);
+        const float v = dot(ray.Direction, q) * inverseDet;
+        if (!(v >= 0.0f && u + v <= 1.0f))
+        {
+            return false;
+        }
+
+        t = dot(e2, q) * inverseDet;
+        return t >= ray.TMin && t < ray.TMax;
+    }
+
+    float3 GetGridVertex(const std::vector<float> &vertices, UINT index)
+    {
+        return float3{ vertices[index * 3], vertices[index * 3 + 1], vertices[index * 3 + 2] };
+    }
+
+    bool BruteForceGridTriangleTest(
+        const std::vector<std::vector<float>> &vertices,
+        const std::vector<std::vector<UINT16>> &indices,
+        UINT geometryIndex,
+        UINT primitiveIndex,
+        const FallbackLayer::CpuRay &ray,
+        float &t,
+        bool &frontFacing)
+    {
+        const std::vector<float> &geometryVertices = vertices[geometryIndex];
+        const UINT16 *pIndices = &indices[geometryIndex][primitiveIndex * 3];
+        if (!BruteForceRayTriangleTest(
+            GetGridVertex(geometryVertices, pIndices[0]),
+            GetGridVertex(geometryVertices, pIndices[1]),
+            GetGridVertex(geometryVertices, pIndices[2]),
+            ray, t, frontFacing))
+        {
+            return false;
+        }
+
+        const bool culled = frontFacing ?
+            (ray.Flags & D3D12_RAY_FLAG_CULL_FRONT_FACING_TRIANGLES) != 0 :
+            (ray.Flags & D3D12_RAY_FLAG_CULL_BACK_FACING_TRIANGLES) != 0;
+        return !culled;
+    }
+
+    // Tests a ray against every triangle of the grids from GenerateGridGeometry, returns the T of
+    // the closest hit or the ray's TMax if it hits none
+    float BruteForceClosestHit(
+        const std::vector<std::vector<float>> &vertices,
+        const std::vector<std::vector<UINT16>> &indices,
+        const FallbackLayer::CpuRay &ray)
+    {
+        float closestT = ray.TMax;
+        for (UINT geometryIndex = 0; geometryIndex < (UINT)indices.size(); geometryIndex++)
+        {
+            const UINT numTriangles = (UINT)indices[geometryIndex].size() / 3;
+            for (UINT primitiveIndex = 0; primitiveIndex < numTriangles; primitiveIndex++)
+            {
+                float t;
+                bool frontFacing;
+                if (BruteForceGridTriangleTest(vertices, indices, geometryIndex, primitiveIndex, ray, t, frontFacing))
+                {
+                    closestT = std::min(closestT, t);
+                }
+            }
+        }
+        return closestT;
+    }
+
+    bool IsNearlyEqual(float a, float b)
+    {
+        return fabsf(a - b) <= 1e-5f * std::max(1.0f, fabsf(b));
+    }
+
+    TEST_CLASS(CpuBVHBuilderTests)
+    {
+    public:
+        // Every thread count and binning kernel must produce exactly the same output. The
+        // thresholds are lowered so a small scene still bins in parallel and spawns subtree tasks.
+        TEST_METHOD(CpuBVHBuilderOutputIndependentOfThreadCount)
+        {
+            const UINT gridDimension = 32;
+            const UINT numGeometries = 8;
+
+            std::vector<std::vector<float>> vertices;
+            std::vector<std::vector<UINT16>> indices;
+            std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDescs;
+            const UINT totalTriangles = GenerateGridGeometry(gridDimension, numGeometries, vertices, indices, geomDescs);
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+            desc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            desc.Inputs.NumDescs = numGeometries;
+            desc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+            desc.Inputs.pGeometryDescs = geomDescs.data();
+
+            const UINT dataSize = FallbackLayer::GetCpuBvh2ResultDataMaxSizeInBytes(totalTriangles);
+            std::unique_ptr<BYTE[]> pReferenceData;
+
+            const UINT threadCounts[] = { 1, 2, 0 };
+            const FallbackLayer::CpuBvh2BinningKernel kernels[] =
+            {
+                FallbackLayer::CpuBvh2BinningKernel::Scalar,
+                FallbackLayer::CpuBvh2BinningKernel::Simd
+            };
+
+            for (UINT threadCount : threadCounts)
+            {
+                for (FallbackLayer::CpuBvh2BinningKernel kernel : kernels)
+                {
+                    std::unique_ptr<BYTE[]> pData(new BYTE[dataSize]);
+                    ZeroMemory(pData.get(), dataSize);
+
+                    FallbackLayer::CpuBvh2BuildSettings settings;
+                    settings.MaxThreadCount = threadCount;
+                    settings.BinningKernel = kernel;
+                    settings.ParallelBinningThreshold = 1024;
+                    settings.SubtreeTaskThreshold = 256;
+                    FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&desc, pData.get(), settings);
+
+                    if (pReferenceData)
+                    {
+                        Assert::IsTrue(memcmp(pReferenceData.get(), pData.get(), dataSize) == 0, L"CPU BVH2 output differs between thread counts or binning kernels");
+                    }
+                    else
+                    {
+                        pReferenceData = std::move(pData);
+                    }
+                }
+            }
+        }
+
+        // The LBVH builder's radix sort must give the same order as a stable sort
+        TEST_METHOD(CpuLbvhMortonCodeSort)
+        {
+            const UINT numElements = 300 * 1000;
+
+            srand(23);
+            std::vector<UINT> keys(numElements);
+            std::vector<UINT> values(numElements);
+            std::vector<std::pair<UINT, UINT>> expected(numElements);
+            for (UINT i = 0; i < numElements; i++)
+            {
+                // Few enough distinct codes that many are repeated
+                keys[i] = ((rand() << 15) ^ rand()) & 0x3fff0fff;
+                values[i] = i;
+                expected[i] = { keys[i], i };
+            }
+
+            std::stable_sort(expected.begin(), expected.end(),
+                [](const std::pair<UINT, UINT> &a, const std::pair<UINT, UINT> &b) { return a.first < b.first; });
+            FallbackLayer::SortCpuLbvhMortonCodes(keys, values);
+
+            for (UINT i = 0; i < numElements; i++)
+            {
+                Assert::IsTrue(keys[i] == expected[i].first && values[i] == expected[i].second, L"Sorted morton codes incorrect");
+            }
+        }
+
+        // Every kernel must find the same closest hit as testing the rays against each triangle in
+        // turn. Rays that accept the first hit must stop on a triangle they really hit.
+        TEST_METHOD(CpuBVHTraversalMatchesBruteForce)
+        {
+            const UINT gridDimension = 16;
+            const UINT numGeometries = 4;
+            const UINT numRays = 2048;
+
+            std::vector<std::vector<float>> vertices;
+            std::vector<std::vector<UINT16>> indices;
+            std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDescs;
+            const UINT totalTriangles = GenerateGridGeometry(gridDimension, numGeometries, vertices, indices, geomDescs);
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+            desc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            desc.Inputs.NumDescs = numGeometries;
+            desc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+            desc.Inputs.pGeometryDescs = geomDescs.data();
+
+            std::unique_ptr<BYTE[]> pData(new BYTE[FallbackLayer::GetCpuBvh2ResultDataMaxSizeInBytes(totalTriangles)]);
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&desc, pData.get(), FallbackLayer::CpuBvh2BuildSettings());
+
+            // Rays start around and between the grids and go in every direction
+            srand(24);
+            std::vector<FallbackLayer::CpuRay> rays(numRays);
+            for (FallbackLayer::CpuRay &ray : rays)
+            {
+                ray.Origin = { rand() / (float)RAND_MAX * 20.0f - 2.0f, rand() / (float)RAND_MAX * 20.0f - 6.0f, rand() / (float)RAND_MAX * 20.0f - 2.0f };
+                ray.Direction = { rand() / (float)RAND_MAX * 2.0f - 1.0f, rand() / (float)RAND_MAX * 2.0f - 1.0f, rand() / (float)RAND_MAX * 2.0f - 1.0f };
+                ray.TMin = 0.0f;
+                ray.TMax = 1e6f;
+                ray.InstanceInclusionMask = 0xff;
+            }
+
+            const UINT rayFlags[] =
+            {
+                D3D12_RAY_FLAG_NONE,
+                D3D12_RAY_FLAG_CULL_BACK_FACING_TRIANGLES,
+                D3D12_RAY_FLAG_CULL_FRONT_FACING_TRIANGLES,
+                D3D12_RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH
+            };
+            const FallbackLayer::CpuBvh2TraversalKernel kernels[] =
+            {
+                FallbackLayer::CpuBvh2TraversalKernel::SingleRay,
+                FallbackLayer::CpuBvh2TraversalKernel::Packet
+            };
+
+            for (UINT flags : rayFlags)
+            {
+                std::vector<float> expectedT(numRays);
+                for (UINT i = 0; i < numRays; i++)
+                {
+                    rays[i].Flags = flags;
+                    expectedT[i] = BruteForceClosestHit(vertices, indices, rays[i]);
+                }
+
+                for (FallbackLayer::CpuBvh2TraversalKernel kernel : kernels)
+                {
+                    FallbackLayer::CpuBvh2TraversalSettings settings;
+                    settings.Kernel = kernel;
+
+                    std::vector<FallbackLayer::CpuRayHit> hits(numRays);
+                    FallbackLayer::TraceRaysOnCpu(pData.get(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL,
+                        rays.data(), numRays, hits.data(), settings);
+
+                    UINT numHits = 0;
+                    for (UINT i = 0; i < numRays; i++)
+                    {
+                        const FallbackLayer::CpuRayHit &hit = hits[i];
+                        const bool expectHit = expectedT[i] < rays[i].TMax;
+                        Assert::IsTrue(expectHit == (hit.PrimitiveIndex != FallbackLayer::CPU_RAY_MISS), L"CPU traversal and brute force disagree on whether a ray hit");
+                        if (!expectHit)
+                        {
+                            Assert::IsTrue(hit.T == rays[i].TMax, L"A ray that missed didn't report its TMax");
+                            continue;
+                        }
+                        numHits++;
+
+                        // Whichever triangle was reported, the ray must hit it where the traversal says
+                        Assert::IsTrue(hit.GeometryContributionToHitGroupIndex < numGeometries, L"Hit has an invalid geometry index");
+                        Assert::IsTrue(hit.PrimitiveIndex < indices[hit.GeometryContributionToHitGroupIndex].size() / 3, L"Hit has an invalid primitive index");
+
+                        float t;
+                        bool frontFacing;
+                        Assert::IsTrue(BruteForceGridTriangleTest(vertices, indices, hit.GeometryContributionToHitGroupIndex, hit.PrimitiveIndex, rays[i], t, frontFacing),
+                            L"CPU traversal reported a triangle the ray doesn't hit");
+                        Assert::IsTrue(IsNearlyEqual(hit.T, t), L"CPU traversal reported the wrong T for a triangle");
+                        Assert::IsTrue(hit.HitKind == (frontFacing ? FallbackLayer::CPU_HIT_KIND_TRIANGLE_FRONT_FACE : FallbackLayer::CPU_HIT_KIND_TRIANGLE_BACK_FACE),
+                            L"CPU traversal reported the wrong facing");
+
+                        if (!(flags & D3D12_RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH))
+                        {
+                            Assert::IsTrue(IsNearlyEqual(hit.T, expectedT[i]), L"CPU traversal didn't find the closest hit");
+                        }
+                    }
+                    Assert::IsTrue(numHits > numRays / 8, L"Too few rays hit the grids to test the traversal");
+                }
+            }
+        }
+
+        // Rays with known hits and misses, through a bottom level directly and through transformed
+        // instances of it
+        TEST_METHOD(CpuBVHTraversalHandPlacedRays)
+        {
+            // Triangle 0 is at z = 5 and faces rays going towards +z, triangle 1 is at z = 10 and
+            // wound the other way
+            const float vertexData[] =
+            {
+                0.0f, 0.0f, 5.0f,   0.0f, 1.0f, 5.0f,   1.0f, 0.0f, 5.0f,
+                0.0f, 0.0f, 10.0f,  1.0f, 0.0f, 10.0f,  0.0f, 1.0f, 10.0f,
+            };
+            const UINT16 indexData[] = { 0, 1, 2, 3, 4, 5 };
+
+            D3D12_RAYTRACING_GEOMETRY_DESC geomDesc = {};
+            geomDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+            geomDesc.Triangles.IndexBuffer = (D3D12_GPU_VIRTUAL_ADDRESS)indexData;
+            geomDesc.Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
+            geomDesc.Triangles.IndexCount = ARRAYSIZE(indexData);
+            geomDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)vertexData;
+            geomDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(float) * 3;
+            geomDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+            geomDesc.Triangles.VertexCount = ARRAYSIZE(vertexData) / 3;
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC bottomLevelDesc = {};
+            bottomLevelDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            bottomLevelDesc.Inputs.NumDescs = 1;
+            bottomLevelDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+            bottomLevelDesc.Inputs.pGeometryDescs = &geomDesc;
+
+            std::unique_ptr<BYTE[]> pBottomLevel(new BYTE[FallbackLayer::GetCpuBvh2ResultDataMaxSizeInBytes(2)]);
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&bottomLevelDesc, pBottomLevel.get(), FallbackLayer::CpuBvh2BuildSettings());
+
+            // Instance 0 is untransformed. Instance 1 is scaled by 2 in x and y and moved to x = 10.
+            // Instance 2 is turned 90 degrees about z, moved to x = 20 and counts counterclockwise
+            // triangles as front facing.
+            D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC instanceDescs[3] = {};
+            const float transforms[3][3][4] =
+            {
+                { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } },
+                { { 2.0f, 0.0f, 0.0f, 10.0f }, { 0.0f, 2.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } },
+                { { 0.0f, -1.0f, 0.0f, 20.0f }, { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } },
+            };
+            for (UINT instanceIndex = 0; instanceIndex < ARRAYSIZE(instanceDescs); instanceIndex++)
+            {
+                D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instanceDesc = instanceDescs[instanceIndex];
+                memcpy(instanceDesc.Transform, transforms[instanceIndex], sizeof(instanceDesc.Transform));
+                instanceDesc.InstanceID = 100 + instanceIndex;
+                instanceDesc.InstanceMask = instanceIndex == 0 ? 0x1 : 0x2;
+                instanceDesc.AccelerationStructure.GpuVA = (D3D12_GPU_VIRTUAL_ADDRESS)pBottomLevel.get();
+            }
+            instanceDescs[2].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_TRIANGLE_FRONT_COUNTERCLOCKWISE;
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topLevelDesc = {};
+            topLevelDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            topLevelDesc.Inputs.NumDescs = ARRAYSIZE(instanceDescs);
+            topLevelDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+            topLevelDesc.Inputs.InstanceDescs = (D3D12_GPU_VIRTUAL_ADDRESS)instanceDescs;
+
+            std::unique_ptr<BYTE[]> pTopLevel(new BYTE[FallbackLayer::GetCpuBvh2TopLevelResultDataMaxSizeInBytes(ARRAYSIZE(instanceDescs))]);
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&topLevelDesc, pTopLevel.get(), FallbackLayer::CpuBvh2BuildSettings());
+
+            struct HandPlacedRay
+            {
+                const wchar_t *pName;
+                float3 Origin;
+                float3 Direction;
+                float TMin;
+                float TMax;
+                UINT Flags;
+                UINT InstanceInclusionMask;
+
+                // CPU_RAY_MISS if the ray should miss, in which case T is its TMax
+                UINT PrimitiveIndex;
+                float T;
+                UINT HitKind;
+                UINT InstanceIndex;
+            };
+
+            const UINT miss = FallbackLayer::CPU_RAY_MISS;
+            const UINT front = FallbackLayer::CPU_HIT_KIND_TRIANGLE_FRONT_FACE;
+            const UINT back = FallbackLayer::CPU_HIT_KIND_TRIANGLE_BACK_FACE;
+            const float3 forward = { 0.0f, 0.0f, 1.0f };
+            const float3 backward = { 0.0f, 0.0f, -1.0f };
+
+            // Every ray passes through (0.2, 0.3) in the object space of the triangles it should hit
+            const HandPlacedRay bottomLevelRays[] =
+            {
+                { L"Closest hit", { 0.2f, 0.3f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, 0, 5.0f, front },
+                { L"TMin past the first triangle", { 0.2f, 0.3f, 0.0f }, forward, 6.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, 1, 10.0f, back },
+                { L"TMax before the first triangle", { 0.2f, 0.3f, 0.0f }, forward, 0.0f, 4.0f, D3D12_RAY_FLAG_NONE, 0xff, miss, 4.0f },
+                { L"Outside both triangles", { 0.8f, 0.8f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, miss, 100.0f },
+                { L"Parallel to the triangles", { 0.2f, 0.3f, 0.0f }, { 1.0f, 0.0f, 0.0f }, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, miss, 100.0f },
+                { L"From behind", { 0.2f, 0.3f, 20.0f }, backward, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, 1, 10.0f, front },
+                { L"Cull front faces", { 0.2f, 0.3f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_CULL_FRONT_FACING_TRIANGLES, 0xff, 1, 10.0f, back },
+                { L"Cull back faces", { 0.2f, 0.3f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_CULL_BACK_FACING_TRIANGLES, 0xff, 0, 5.0f, front },
+                { L"Cull front faces from behind", { 0.2f, 0.3f, 20.0f }, backward, 0.0f, 100.0f, D3D12_RAY_FLAG_CULL_FRONT_FACING_TRIANGLES, 0xff, 0, 15.0f, back },
+                { L"Cull back faces, facing away", { 0.2f, 0.3f, 6.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_CULL_BACK_FACING_TRIANGLES, 0xff, miss, 100.0f },
+                { L"Accept first hit", { 0.2f, 0.3f, 0.0f }, forward, 0.0f, 8.0f, D3D12_RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH, 0xff, 0, 5.0f, front },
+                { L"Accept first hit, culled", { 0.2f, 0.3f, 0.0f }, forward, 0.0f, 100.0f,
+                    D3D12_RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH | D3D12_RAY_FLAG_CULL_FRONT_FACING_TRIANGLES, 0xff, 1, 10.0f, back },
+            };
+
+            const HandPlacedRay topLevelRays[] =
+            {
+                { L"Untransformed instance", { 0.2f, 0.3f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, 0, 5.0f, front, 0 },
+                { L"Scaled instance", { 10.4f, 0.6f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, 0, 5.0f, front, 1 },
+                { L"Rotated counterclockwise instance", { 19.7f, 0.2f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, 0, 5.0f, back, 2 },
+                { L"Rotated counterclockwise instance, cull back faces", { 19.7f, 0.2f, 0.0f }, forward, 0.0f, 100.0f,
+                    D3D12_RAY_FLAG_CULL_BACK_FACING_TRIANGLES, 0xff, 1, 10.0f, front, 2 },
+                { L"Masked out instance", { 0.2f, 0.3f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0x2, miss, 100.0f },
+                { L"Between instances", { 5.0f, 0.3f, 0.0f }, forward, 0.0f, 100.0f, D3D12_RAY_FLAG_NONE, 0xff, miss, 100.0f },
+                { L"Accept first hit, scaled instance", { 10.4f, 0.6f, 0.0f }, forward, 0.0f, 8.0f,
+                    D3D12_RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH, 0xff, 0, 5.0f, front, 1 },
+            };
+
+            const FallbackLayer::CpuBvh2TraversalKernel kernels[] =
+            {
+                FallbackLayer::CpuBvh2TraversalKernel::SingleRay,
+                FallbackLayer::CpuBvh2TraversalKernel::Packet
+            };
+
+            auto traceAndCheck = [&](const void *pAccelerationStructure, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE type,
+                const HandPlacedRay *pExpected, UINT numRays)
+            {
+                std::vector<FallbackLayer::CpuRay> rays(numRays);
+                for (UINT i = 0; i < numRays; i++)
+                {
+                    rays[i].Origin = pExpected[i].Origin;
+                    rays[i].Direction = pExpected[i].Direction;
+                    rays[i].TMin = pExpected[i].TMin;
+                    rays[i].TMax = pExpected[i].TMax;
+                    rays[i].Flags = pExpected[i].Flags;
+                    rays[i].InstanceInclusionMask = pExpected[i].InstanceInclusionMask;
+                }
+
+                for (FallbackLayer::CpuBvh2TraversalKernel kernel : kernels)
+                {
+                    FallbackLayer::CpuBvh2TraversalSettings settings;
+                    settings.Kernel = kernel;
+
+                    std::vector<FallbackLayer::CpuRayHit> hits(numRays);
+                    FallbackLayer::TraceRaysOnCpu(pAccelerationStructure, type, rays.data(), numRays, hits.data(), settings);
+
+                    for (UINT i = 0; i < numRays; i++)
+                    {
+                        const HandPlacedRay &expected = pExpected[i];
+                        const FallbackLayer::CpuRayHit &hit = hits[i];
+
+                        wchar_t message[256];
+                        swprintf_s(message, L"%s: expected primitive %u at T %f, got primitive %u at T %f",
+                            expected.pName, expected.PrimitiveIndex, expected.T, hit.PrimitiveIndex, hit.T);
+                        Assert::IsTrue(hit.PrimitiveIndex == expected.PrimitiveIndex && IsNearlyEqual(hit.T, expected.T), message);
+                        if (expected.PrimitiveIndex == miss)
+                        {
+                            continue;
+                        }
+
+                        swprintf_s(message, L"%s: wrong hit kind, barycentrics or instance", expected.pName);
+                        Assert::IsTrue(hit.HitKind == expected.HitKind, message);
+                        Assert::IsTrue(hit.GeometryContributionToHitGroupIndex == 0, message);
+
+                        // Both triangles have their first vertex at the origin, the second on the y axis
+                        // (0, 1) and the third on the x axis (1, 0) or the other way around
+                        const float2 barycentrics = hit.PrimitiveIndex == 0 ? float2{ 0.3f, 0.2f } : float2{ 0.2f, 0.3f };
+                        Assert::IsTrue(IsNearlyEqual(hit.Barycentrics.x, barycentrics.x) && IsNearlyEqual(hit.Barycentrics.y, barycentrics.y), message);
+
+                        if (type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL)
+                        {
+                            Assert::IsTrue(hit.InstanceIndex == expected.InstanceIndex && hit.InstanceID == 100 + expected.InstanceIndex, message);
+                        }
+                        else
+                        {
+                            Assert::IsTrue(hit.InstanceIndex == miss && hit.InstanceID == miss, message);
+                        }
+                    }
+                }
+            };
+
+            traceAndCheck(pBottomLevel.get(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL, bottomLevelRays, ARRAYSIZE(bottomLevelRays));
+            traceAndCheck(pTopLevel.get(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL, topLevelRays, ARRAYSIZE(topLevelRays));
+        }
+    };
+
+    TEST_CLASS(CpuBVHBuilderBenchmarks)
+    {
+    public:
+        // Builds a set of wavy grids and reports build time and SAH cost for each
+        // thread count. Every thread count must produce exactly the same output.
+        TEST_METHOD(CpuBVHBuilderThreadScaling)
+        {
+            if (!AreBenchmarksEnabled())
+            {
+                return;
+            }
+
+            const UINT gridDimension = 128;
+            const UINT numGeometries = 32;
+
+            std::vector<std::vector<float>> vertices;
+            std::vector<std::vector<UINT16>> indices;
+            std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDescs;
+            const UINT totalTriangles = GenerateGridGeometry(gridDimension, numGeometries, vertices, indices, geomDescs);
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+            desc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            desc.Inputs.NumDescs = numGeometries;
+            desc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+            desc.Inputs.pGeometryDescs = geomDescs.data();
+
+            const UINT dataSize = FallbackLayer::GetCpuBvh2ResultDataMaxSizeInBytes(totalTriangles);
+            std::unique_ptr<BYTE[]> pReferenceData;
+
+            std::vector<UINT> threadCounts;
+            const UINT maxThreadCount = concurrency::GetProcessorCount();
+            for (UINT threadCount = 1; threadCount < maxThreadCount; threadCount *= 2)
+            {
+                threadCounts.push_back(threadCount);
+            }
+            threadCounts.push_back(maxThreadCount);
+
+            for (UINT threadCount : threadCounts)
+            {
+                std::unique_ptr<BYTE[]> pData = std::unique_ptr<BYTE[]>(new BYTE[dataSize]);
+                ZeroMemory(pData.get(), dataSize);
+
+                FallbackLayer::CpuBvh2BuildSettings settings;
+                settings.MaxThreadCount = threadCount;
+
+                FallbackLayer::CpuBvh2BuildStatistics stats = {};
+                FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&desc, pData.get(), settings, &stats);
+
+                wchar_t message[256];
+                swprintf_s(message, L"CPU BVH2 build: %u triangles, %u threads, load %.2f ms, build %.2f ms, SAH cost %.3f\n",
+                    stats.PrimitiveCount, stats.ThreadCount, stats.LoadTimeInMs, stats.BuildTimeInMs, stats.SahCost);
+                Logger::WriteMessage(message);
+
+                if (pReferenceData)
+                {
+                    Assert::IsTrue(memcmp(pReferenceData.get(), pData.get(), dataSize) == 0, L"CPU BVH2 output differs between thread counts");
+                }
+                else
+                {
+                    pReferenceData = std::move(pData);
+                }
+            }
+
+            std::unique_ptr<BYTE[]> pScalarData = std::unique_ptr<BYTE[]>(new BYTE[dataSize]);
+            ZeroMemory(pScalarData.get(), dataSize);
+            FallbackLayer::CpuBvh2BuildSettings scalarSettings;
+            scalarSettings.BinningKernel = FallbackLayer::CpuBvh2BinningKernel::Scalar;
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&desc, pScalarData.get(), scalarSettings);
+            Assert::IsTrue(memcmp(pReferenceData.get(), pScalarData.get(), dataSize) == 0, L"CPU BVH2 output differs between binning kernels");
+        }
+
+        // Compares primitives/second of the scalar and SIMD SAH binning kernels on a single
+        // large node, and checks both pick the same split
+        TEST_METHOD(SahBinningKernelThroughput)
+        {
+            if (!AreBenchmarksEnabled())
+            {
+                return;
+            }
+
+            const UINT numPrimitives = 1024 * 1024;
+            const UINT numIterations = 10;
+
+            srand(10);
+            std::vector<AABB> boxes(numPrimitives);
+            std::vector<PrimitiveMetaData> metadata(numPrimitives);
+            for (UINT i = 0; i < numPrimitives; i++)
+            {
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    const float position = (rand() / (float)RAND_MAX) * 1000.0f;
+                    const float extent = (rand() / (float)RAND_MAX) * 2.0f;
+                    boxes[i].minArr[axis] = position;
+                    boxes[i].maxArr[axis] = position + extent;
+                }
+                metadata[i] = { 0, i, 0 };
+            }
+
+            const FallbackLayer::CpuBvh2BinningKernel kernels[] =
+            {
+                FallbackLayer::CpuBvh2BinningKernel::Scalar,
+                FallbackLayer::CpuBvh2BinningKernel::Simd
+            };
+            const wchar_t *kernelNames[] = { L"Scalar", L"SIMD" };
+
+            FallbackLayer::CpuBvh2SahSplit splits[ARRAYSIZE(kernels)];
+            for (UINT kernelIndex = 0; kernelIndex < ARRAYSIZE(kernels); kernelIndex++)
+            {
+                auto startTime = std::chrono::high_resolution_clock::now();
+                for (UINT iteration = 0; iteration < numIterations; iteration++)
+                {
+                    Assert::IsTrue(FallbackLayer::ComputeCpuBvh2SahSplit(metadata.data(), numPrimitives, boxes, kernels[kernelIndex], splits[kernelIndex]), L"No SAH split found");
+                }
+                const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+                wchar_t message[256];
+                swprintf_s(message, L"%s SAH binning: %.2f Mprimitives/s\n", kernelNames[kernelIndex], (double)numPrimitives * numIterations / seconds / 1e6);
+                Logger::WriteMessage(message);
+            }
+
+            Assert::IsTrue(memcmp(&splits[0], &splits[1], sizeof(splits[0])) == 0, L"Scalar and SIMD binning kernels disagree");
+        }
+
+        // Traces camera, shadow and random rays through a top level of wavy grid instances
+        // and reports rays/second for both traversal kernels at each thread count. Both
+        // kernels must find the same closest hits, though a hit on an edge shared by two
+        // triangles may be reported on either of them.
+        TEST_METHOD(CpuBVHTraversalThroughput)
+        {
+            if (!AreBenchmarksEnabled())
+            {
+                return;
+            }
+
+            const UINT gridDimension = 128;
+            const UINT numGeometries = 8;
+            const UINT instancesPerRow = 4;
+            const UINT raysPerRow = 512;
+            const float instanceSpacing = (float)gridDimension + 8.0f;
+            const float sceneSize = instanceSpacing * instancesPerRow;
+
+            std::vector<std::vector<float>> vertices;
+            std::vector<std::vector<UINT16>> indices;
+            std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDescs;
+            const UINT totalTriangles = GenerateGridGeometry(gridDimension, numGeometries, vertices, indices, geomDescs);
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC bottomLevelDesc = {};
+            bottomLevelDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            bottomLevelDesc.Inputs.NumDescs = numGeometries;
+            bottomLevelDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+            bottomLevelDesc.Inputs.pGeometryDescs = geomDescs.data();
+
+            std::unique_ptr<BYTE[]> pBottomLevel(new BYTE[FallbackLayer::GetCpuBvh2ResultDataMaxSizeInBytes(totalTriangles)]);
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&bottomLevelDesc, pBottomLevel.get(), FallbackLayer::CpuBvh2BuildSettings());
+
+            const UINT numInstances = instancesPerRow * instancesPerRow;
+            std::vector<D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC> instanceDescs(numInstances);
+            for (UINT instanceIndex = 0; instanceIndex < numInstances; instanceIndex++)
+            {
+                D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instanceDesc = instanceDescs[instanceIndex];
+                instanceDesc = {};
+                instanceDesc.Transform[0][0] = instanceDesc.Transform[1][1] = instanceDesc.Transform[2][2] = 1.0f;
+                instanceDesc.Transform[0][3] = (instanceIndex % instancesPerRow) * instanceSpacing;
+                instanceDesc.Transform[2][3] = (instanceIndex / instancesPerRow) * instanceSpacing;
+                instanceDesc.InstanceID = instanceIndex;
+                instanceDesc.InstanceMask = 0xff;
+                instanceDesc.AccelerationStructure.GpuVA = (D3D12_GPU_VIRTUAL_ADDRESS)pBottomLevel.get();
+            }
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topLevelDesc = {};
+            topLevelDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            topLevelDesc.Inputs.NumDescs = numInstances;
+            topLevelDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+            topLevelDesc.Inputs.InstanceDescs = (D3D12_GPU_VIRTUAL_ADDRESS)instanceDescs.data();
+
+            std::unique_ptr<BYTE[]> pTopLevel(new BYTE[FallbackLayer::GetCpuBvh2TopLevelResultDataMaxSizeInBytes(numInstances)]);
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&topLevelDesc, pTopLevel.get(), FallbackLayer::CpuBvh2BuildSettings());
+
+            const UINT numRays = raysPerRow * raysPerRow;
+            const float3 cameraPosition = { sceneSize * 0.5f, 64.0f, -sceneSize * 0.25f };
+            std::vector<FallbackLayer::CpuRay> cameraRays(numRays);
+            std::vector<FallbackLayer::CpuRay> shadowRays(numRays);
+            std::vector<FallbackLayer::CpuRay> randomRays(numRays);
+
+            srand(22);
+            for (UINT i = 0; i < numRays; i++)
+            {
+                // Camera rays are in scanline order so neighbouring rays go in packets together
+                const float u = ((i % raysPerRow) + 0.5f) / raysPerRow * 2.0f - 1.0f;
+                const float v = ((i / raysPerRow) + 0.5f) / raysPerRow * 2.0f - 1.0f;
+                FallbackLayer::CpuRay &cameraRay = cameraRays[i];
+                cameraRay.Origin = cameraPosition;
+                cameraRay.Direction = { u, v * 0.5f - 0.5f, 1.0f };
+                cameraRay.TMin = 0.0f;
+                cameraRay.TMax = 1e6f;
+                cameraRay.Flags = D3D12_RAY_FLAG_NONE;
+                cameraRay.InstanceInclusionMask = 0xff;
+
+                // Shadow rays start above the scene and head towards a point light below it
+                FallbackLayer::CpuRay &shadowRay = shadowRays[i];
+                shadowRay = cameraRay;
+                shadowRay.Origin = { (u + 1.0f) * 0.5f * sceneSize, 48.0f, (v + 1.0f) * 0.5f * sceneSize };
+                shadowRay.Direction = float3{ sceneSize * 0.5f, -16.0f, sceneSize * 0.5f } - shadowRay.Origin;
+                shadowRay.TMax = 1.0f;
+                shadowRay.Flags = D3D12_RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH;
+
+                FallbackLayer::CpuRay &randomRay = randomRays[i];
+                randomRay = cameraRay;
+                randomRay.Origin = { rand() / (float)RAND_MAX * sceneSize, rand() / (float)RAND_MAX * 32.0f - 8.0f, rand() / (float)RAND_MAX * sceneSize };
+                randomRay.Direction = { rand() / (float)RAND_MAX * 2.0f - 1.0f, rand() / (float)RAND_MAX * 2.0f - 1.0f, rand() / (float)RAND_MAX * 2.0f - 1.0f };
+            }
+
+            struct RaySet
+            {
+                const wchar_t *pName;
+                const std::vector<FallbackLayer::CpuRay> *pRays;
+
+                // Rays that accept the first hit can stop on a different primitive in each kernel
+                bool ClosestHit;
+            };
+            const RaySet raySets[] =
+            {
+                { L"Camera", &cameraRays, true },
+                { L"Shadow", &shadowRays, false },
+                { L"Random", &randomRays, true },
+            };
+
+            const FallbackLayer::CpuBvh2TraversalKernel kernels[] =
+            {
+                FallbackLayer::CpuBvh2TraversalKernel::SingleRay,
+                FallbackLayer::CpuBvh2TraversalKernel::Packet
+            };
+            const wchar_t *kernelNames[] = { L"single ray", L"packet" };
+
+            std::vector<UINT> threadCounts;
+            const UINT maxThreadCount = concurrency::GetProcessorCount();
+            for (UINT threadCount = 1; threadCount < maxThreadCount; threadCount *= 2)
+            {
+                threadCounts.push_back(threadCount);
+            }
+            threadCounts.push_back(maxThreadCount);
+
+            for (const RaySet &raySet : raySets)
+            {
+                std::vector<FallbackLayer::CpuRayHit> referenceHits;
+                for (UINT kernelIndex = 0; kernelIndex < ARRAYSIZE(kernels); kernelIndex++)
+                {
+                    std::vector<FallbackLayer::CpuRayHit> kernelHits;
+                    for (UINT threadCount : threadCounts)
+                    {
+                        FallbackLayer::CpuBvh2TraversalSettings settings;
+                        settings.MaxThreadCount = threadCount;
+                        settings.Kernel = kernels[kernelIndex];
+
+                        std::vector<FallbackLayer::CpuRayHit> hits(numRays);
+                        FallbackLayer::CpuBvh2TraversalStatistics stats = {};
+                        FallbackLayer::TraceRaysOnCpu(pTopLevel.get(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL,
+                            raySet.pRays->data(), numRays, hits.data(), settings, &stats);
+
+                        wchar_t message[256];
+                        swprintf_s(message, L"%s rays, %s kernel, %u triangles x %u instances, %u threads: %.2f Mrays/s, %.1f nodes/ray, %.1f primitives/ray, %.1f%% hit\n",
+                            raySet.pName, kernelNames[kernelIndex], totalTriangles, numInstances, stats.ThreadCount,
+                            stats.RayCount / (stats.TraceTimeInMs * 1000.0),
+                            (double)stats.NodesVisited / stats.RayCount,
+                            (double)stats.PrimitivesTested / stats.RayCount,
+                            100.0 * stats.HitCount / stats.RayCount);
+                        Logger::WriteMessage(message);
+
+                        if (kernelHits.empty())
+                        {
+                            kernelHits = std::move(hits);
+                        }
+                        else
+                        {
+                            Assert::IsTrue(memcmp(kernelHits.data(), hits.data(), numRays * sizeof(hits[0])) == 0, L"CPU traversal hits differ between thread counts");
+                        }
+                    }
+
+                    if (referenceHits.empty())
+                    {
+                        Assert::IsTrue(std::any_of(kernelHits.begin(), kernelHits.end(),
+                            [](const FallbackLayer::CpuRayHit &hit) { return hit.PrimitiveIndex != FallbackLayer::CPU_RAY_MISS; }), L"No ray hit the scene");
+                        referenceHits = std::move(kernelHits);
+                        continue;
+                    }
+
+                    for (UINT i = 0; i < numRays; i++)
+                    {
+                        const bool referenceHit = referenceHits[i].PrimitiveIndex != FallbackLayer::CPU_RAY_MISS;
+                        const bool kernelHit = kernelHits[i].PrimitiveIndex != FallbackLayer::CPU_RAY_MISS;
+                        Assert::IsTrue(referenceHit == kernelHit, L"Traversal kernels disagree on whether a ray hit");
+                        if (raySet.ClosestHit)
+                        {
+                            Assert::IsTrue(referenceHits[i].T == kernelHits[i].T, L"Traversal kernels found different closest hits");
+                        }
+                    }
+                }
+            }
+        }
+
+        // Builds the same wavy grids as an SAH tree and as LBVHs with each number of treelet
+        // reordering passes, and reports build time, SAH cost and rays/second for each.
+        // Every tree must find the same closest hits.
+        TEST_METHOD(CpuLbvhVersusSahBuild)
+        {
+            if (!AreBenchmarksEnabled())
+            {
+                return;
+            }
+
+            const UINT gridDimension = 128;
+            const UINT numGeometries = 32;
+            const UINT raysPerRow = 512;
+
+            std::vector<std::vector<float>> vertices;
+            std::vector<std::vector<UINT16>> indices;
+            std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDescs;
+            const UINT totalTriangles = GenerateGridGeometry(gridDimension, numGeometries, vertices, indices, geomDescs);
+
+            const UINT numRays = raysPerRow * raysPerRow;
+            std::vector<FallbackLayer::CpuRay> rays(numRays);
+            for (UINT i = 0; i < numRays; i++)
+            {
+                const float u = ((i % raysPerRow) + 0.5f) / raysPerRow;
+                const float v = ((i / raysPerRow) + 0.5f) / raysPerRow;
+                FallbackLayer::CpuRay &ray = rays[i];
+                ray.Origin = { gridDimension * 0.5f, numGeometries * 2.0f + 32.0f, -32.0f };
+                ray.Direction = float3{ u * gridDimension, 0.0f, v * gridDimension } - ray.Origin;
+                ray.TMin = 0.0f;
+                ray.TMax = 1e6f;
+                ray.Flags = D3D12_RAY_FLAG_NONE;
+                ray.InstanceInclusionMask = 0xff;
+            }
+
+            struct BuildConfiguration
+            {
+                const wchar_t *pName;
+                FallbackLayer::CpuBvh2BuildAlgorithm Algorithm;
+                D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS Flags;
+            };
+            const BuildConfiguration configurations[] =
+            {
+                { L"SAH", FallbackLayer::CpuBvh2BuildAlgorithm::Sah, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE },
+                { L"LBVH fast build", FallbackLayer::CpuBvh2BuildAlgorithm::Lbvh, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD },
+                { L"LBVH", FallbackLayer::CpuBvh2BuildAlgorithm::Lbvh, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE },
+                { L"LBVH fast trace", FallbackLayer::CpuBvh2BuildAlgorithm::Lbvh, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE },
+            };
+
+            const UINT dataSize = FallbackLayer::GetCpuBvh2ResultDataMaxSizeInBytes(totalTriangles);
+            std::vector<FallbackLayer::CpuRayHit> referenceHits;
+            float unreorderedSahCost = 0.0f;
+            for (const BuildConfiguration &configuration : configurations)
+            {
+                D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+                desc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+                desc.Inputs.NumDescs = numGeometries;
+                desc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+                desc.Inputs.Flags = configuration.Flags;
+                desc.Inputs.pGeometryDescs = geomDescs.data();
+
+                FallbackLayer::CpuBvh2BuildSettings settings;
+                settings.Algorithm = configuration.Algorithm;
+
+                // Every stage is split up the same way whatever the thread count
+                std::unique_ptr<BYTE[]> pSingleThreadedData(new BYTE[dataSize]);
+                ZeroMemory(pSingleThreadedData.get(), dataSize);
+                settings.MaxThreadCount = 1;
+                FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&desc, pSingleThreadedData.get(), settings);
+
+                std::unique_ptr<BYTE[]> pData(new BYTE[dataSize]);
+                ZeroMemory(pData.get(), dataSize);
+                settings.MaxThreadCount = 0;
+                FallbackLayer::CpuBvh2BuildStatistics buildStats = {};
+                FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&desc, pData.get(), settings, &buildStats);
+                Assert::IsTrue(memcmp(pSingleThreadedData.get(), pData.get(), dataSize) == 0, L"CPU build output differs between thread counts");
+
+                std::vector<FallbackLayer::CpuRayHit> hits(numRays);
+                FallbackLayer::CpuBvh2TraversalStatistics traceStats = {};
+                FallbackLayer::TraceRaysOnCpu(pData.get(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL,
+                    rays.data(), numRays, hits.data(), FallbackLayer::CpuBvh2TraversalSettings(), &traceStats);
+
+                wchar_t message[256];
+                swprintf_s(message, L"%s: %u triangles, %u threads, build %.2f ms, SAH cost %.3f, %.2f Mrays/s, %.1f nodes/ray, %.1f primitives/ray\n",
+                    configuration.pName, buildStats.PrimitiveCount, buildStats.ThreadCount, buildStats.BuildTimeInMs, buildStats.SahCost,
+                    traceStats.RayCount / (traceStats.TraceTimeInMs * 1000.0),
+                    (double)traceStats.NodesVisited / traceStats.RayCount,
+                    (double)traceStats.PrimitivesTested / traceStats.RayCount);
+                Logger::WriteMessage(message);
+
+                // Reordering a treelet never raises its cost
+                if (configuration.Flags == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD)
+                {
+                    unreorderedSahCost = buildStats.SahCost;
+                }
+                else if (configuration.Algorithm == FallbackLayer::CpuBvh2BuildAlgorithm::Lbvh)
+                {
+                    Assert::IsTrue(buildStats.SahCost <= unreorderedSahCost * 1.0001f, L"Treelet reordering raised the SAH cost");
+                }
+
+                if (referenceHits.empty())
+                {
+                    referenceHits = std::move(hits);
+                    continue;
+                }
+
+                for (UINT i = 0; i < numRays; i++)
+                {
+                    Assert::IsTrue(referenceHits[i].T == hits[i].T, L"LBVH and SAH trees found different closest hits");
+                }
+            }
+        }
+
+        // Animates the wavy grids and updates them every frame, reporting refit time, SAH cost
+        // and rays/second next to a rebuild of the same frame. The refit tree must find the same
+        // closest hits as the rebuild, and scrambling the triangles must make the update rebuild.
+        TEST_METHOD(CpuBvhRefitVersusRebuild)
+        {
+            if (!AreBenchmarksEnabled())
+            {
+                return;
+            }
+
+            const UINT gridDimension = 128;
+            const UINT numGeometries = 32;
+            const UINT raysPerRow = 512;
+            const UINT numFrames = 8;
+
+            std::vector<std::vector<float>> vertices;
+            std::vector<std::vector<UINT16>> indices;
+            std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDescs;
+            const UINT totalTriangles = GenerateGridGeometry(gridDimension, numGeometries, vertices, indices, geomDescs);
+            const std::vector<std::vector<float>> restVertices = vertices;
+
+            const UINT numRays = raysPerRow * raysPerRow;
+            std::vector<FallbackLayer::CpuRay> rays(numRays);
+            for (UINT i = 0; i < numRays; i++)
+            {
+                const float u = ((i % raysPerRow) + 0.5f) / raysPerRow;
+                const float v = ((i / raysPerRow) + 0.5f) / raysPerRow;
+                FallbackLayer::CpuRay &ray = rays[i];
+                ray.Origin = { gridDimension * 0.5f, numGeometries * 2.0f + 32.0f, -32.0f };
+                ray.Direction = float3{ u * gridDimension, 0.0f, v * gridDimension } - ray.Origin;
+                ray.TMin = 0.0f;
+                ray.TMax = 1e6f;
+                ray.Flags = D3D12_RAY_FLAG_NONE;
+                ray.InstanceInclusionMask = 0xff;
+            }
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+            buildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            buildDesc.Inputs.NumDescs = numGeometries;
+            buildDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+            buildDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+            buildDesc.Inputs.pGeometryDescs = geomDescs.data();
+
+            const UINT dataSize = FallbackLayer::GetCpuBvh2ResultDataMaxSizeInBytes(totalTriangles, buildDesc.Inputs.Flags);
+            std::unique_ptr<BYTE[]> pRefitData(new BYTE[dataSize]);
+            std::unique_ptr<BYTE[]> pRebuildData(new BYTE[dataSize]);
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&buildDesc, pRefitData.get(), FallbackLayer::CpuBvh2BuildSettings());
+
+            // Updates in place
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC updateDesc = buildDesc;
+            updateDesc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+            updateDesc.SourceAccelerationStructureData = (D3D12_GPU_VIRTUAL_ADDRESS)pRefitData.get();
+
+            auto traceRays = [&](const BYTE *pData, std::vector<FallbackLayer::CpuRayHit> &hits, FallbackLayer::CpuBvh2TraversalStatistics &stats)
+            {
+                hits.resize(numRays);
+                FallbackLayer::TraceRaysOnCpu(pData, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL,
+                    rays.data(), numRays, hits.data(), FallbackLayer::CpuBvh2TraversalSettings(), &stats);
+            };
+
+            for (UINT frame = 1; frame <= numFrames; frame++)
+            {
+                // Waves roll across each grid, moving its triangles further from where they were built
+                for (UINT geometryIndex = 0; geometryIndex < numGeometries; geometryIndex++)
+                {
+                    std::vector<float> &geometryVertices = vertices[geometryIndex];
+                    const std::vector<float> &restGeometryVertices = restVertices[geometryIndex];
+                    for (size_t i = 0; i < geometryVertices.size(); i += 3)
+                    {
+                        geometryVertices[i + 1] = restGeometryVertices[i + 1] +
+                            sinf(restGeometryVertices[i] * 0.1f + frame * 0.5f) * cosf(restGeometryVertices[i + 2] * 0.05f) * frame * 0.5f;
+                    }
+                }
+
+                // Measure how far the refit degrades without letting the monitor step in
+                FallbackLayer::CpuBvh2BuildSettings refitSettings;
+                refitSettings.MaxRefitSahCostRatio = 0.0f;
+                FallbackLayer::CpuBvh2BuildStatistics refitStats = {};
+                FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&updateDesc, pRefitData.get(), refitSettings, &refitStats);
+                Assert::IsTrue(refitStats.Refit && refitStats.RefitsSinceBuild == frame, L"Update didn't keep the refit");
+
+                FallbackLayer::CpuBvh2BuildStatistics rebuildStats = {};
+                FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&buildDesc, pRebuildData.get(), FallbackLayer::CpuBvh2BuildSettings(), &rebuildStats);
+
+                std::vector<FallbackLayer::CpuRayHit> refitHits, rebuildHits;
+                FallbackLayer::CpuBvh2TraversalStatistics refitTraceStats = {}, rebuildTraceStats = {};
+                traceRays(pRefitData.get(), refitHits, refitTraceStats);
+                traceRays(pRebuildData.get(), rebuildHits, rebuildTraceStats);
+
+                wchar_t message[256];
+                swprintf_s(message, L"Frame %u, %u triangles: refit %.2f ms, SAH cost %.3f, %.2f Mrays/s; rebuild %.2f ms, SAH cost %.3f, %.2f Mrays/s\n",
+                    frame, totalTriangles,
+                    refitStats.RefitTimeInMs, refitStats.SahCost, refitTraceStats.RayCount / (refitTraceStats.TraceTimeInMs * 1000.0),
+                    rebuildStats.LoadTimeInMs + rebuildStats.BuildTimeInMs, rebuildStats.SahCost, rebuildTraceStats.RayCount / (rebuildTraceStats.TraceTimeInMs * 1000.0));
+                Logger::WriteMessage(message);
+
+                for (UINT i = 0; i < numRays; i++)
+                {
+                    Assert::IsTrue(refitHits[i].T == rebuildHits[i].T, L"Refit and rebuilt trees found different closest hits");
+                }
+            }
+
+            // Triangles stretched across the whole grid leave the refit tree far worse than a new one
+            srand(24);
+            for (std::vector<float> &geometryVertices : vertices)
+            {
+                for (size_t i = 0; i < geometryVertices.size(); i += 3)
+                {
+                    geometryVertices[i] = rand() / (float)RAND_MAX * gridDimension;
+                    geometryVertices[i + 2] = rand() / (float)RAND_MAX * gridDimension;
+                }
+            }
+
+            FallbackLayer::CpuBvh2BuildStatistics updateStats = {};
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&updateDesc, pRefitData.get(), FallbackLayer::CpuBvh2BuildSettings(), &updateStats);
+            Assert::IsFalse(updateStats.Refit, L"Update kept a refit past MaxRefitSahCostRatio");
+            Assert::IsTrue(updateStats.RefitsSinceBuild == 0 && updateStats.BuildSahCost == updateStats.SahCost, L"Rebuild didn't reset the update data");
+
+            FallbackLayer::BuildRaytracingAccelerationStructureOnCpu(&buildDesc, pRebuildData.get(), FallbackLayer::CpuBvh2BuildSettings());
+            std::vector<FallbackLayer::CpuRayHit> updateHits, rebuildHits;
+            FallbackLayer::CpuBvh2TraversalStatistics updateTraceStats = {}, rebuildTraceStats = {};
+            traceRays(pRefitData.get(), updateHits, updateTraceStats);
+            traceRays(pRebuildData.get(), rebuildHits, rebuildTraceStats);
+            Assert::IsTrue(memcmp(updateHits.data(), rebuildHits.data(), numRays * sizeof(updateHits[0])) == 0, L"Rebuilding update differs from a build");
+        }
+    };
+
     void AllocateUAVBuffer(ID3D12Device &d3d12device, UINT64 bufferSize, ID3D12Resource **ppResource)
     {
         const auto uploadHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
@@ -395,6 +395,9 @@ namespace FallbackLayer
             totalSize = std::max(sizeNeededForAABBCalculation, totalSize);
         }
 
+        // An update only reloads the elements and refits the AABBs, which uses nothing from here on
+        scratchMemoryPartitions.UpdateSize = totalSize;
+
         const UINT64 hierarchySize = ALIGN_GPU_VA_OFFSET(sizeof(HierarchyNode) * totalNumNodes);
         scratchMemoryPartitions.OffsetToHierarchy = totalSize;
         totalSize += hierarchySize;
@@ -450,8 +453,9 @@ namespace FallbackLayer
             pInfo->ResultDataMaxSizeInBytes += totalNumNodes * sizeof(UINT); // Parent indices for nodes in hierarchy
         }
 
-        pInfo->ScratchDataSizeInBytes = CalculateScratchMemoryUsage(level, numLeaves).TotalSize;
-        pInfo->UpdateScratchDataSizeInBytes = 0;
+        const ScratchMemoryPartitions scratchMemoryPartitions = CalculateScratchMemoryUsage(level, numLeaves);
+        pInfo->ScratchDataSizeInBytes = scratchMemoryPartitions.TotalSize;
+        pInfo->UpdateScratchDataSizeInBytes = updatesAllowed(pDesc->Flags) ? scratchMemoryPartitions.UpdateSize : 0;
     }
 
     void GpuBvh2Builder::EmitRaytracingAccelerationStructurePostbuildInfo(
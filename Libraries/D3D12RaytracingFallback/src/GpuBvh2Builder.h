@@ -62,6 +62,7 @@ namespace FallbackLayer
 
             UINT64 OffsetToCalculateAABBDispatchArgs;
             UINT64 OffsetToPerNodeCounter;
+            UINT64 UpdateSize;
             UINT64 TotalSize;
         };
 
@@ -25,6 +25,9 @@
 #include <unordered_set>
 #include <map>
 #include <deque>
+#include <atomic>
+#include <chrono>
+#include <ppl.h>
 #include <string>
 #include <strsafe.h>
 #include "d3d12_1.h"
@@ -86,6 +89,8 @@
 #include "GpuBvh2Copy.h"
 #include "TreeletReorder.h"
 #include "GpuBvh2Builder.h"
+#include "CpuBvh2Builder.h"
+#include "CpuBvh2Traversal.h"
 
 // Dispatchers
 #include "UberShaderBindings.h"
@@ -0,0 +1,383 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include "pch.h"
+#include "BuddyAllocator.h"
+#include "TLSFAllocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <random>
+#include <unordered_map>
+
+using namespace std;
+
+void PrintHelp()
+{
+    printf("allocator_benchmark\n");
+
+    printf("usage:\n");
+    printf("allocator_benchmark [-trace file] [-record file] [-heap megabytes] [-placed 0|1] [-latency submits]\n");
+    printf("                    [-ops count] [-seed number] [-repeat count]\n");
+    printf("replays an allocation trace through the buddy and TLSF allocators and reports throughput and\n");
+    printf("fragmentation.  Only the allocators' bookkeeping is run, so no device is needed.\n");
+    printf("trace: a file written by TLSFAllocator::StartTrace().  Without one, a trace of streamed vertex and\n");
+    printf("index buffers is generated, and -record saves it.\n");
+    printf("latency: frees are held back until this many command lists have been submitted after them.\n");
+}
+
+// One line of a trace:  "a <id> <bytes>", "f <id>", or "s" when a command list was submitted
+struct TraceEvent
+{
+    char Type;
+    uint32_t Slot;      // Ids are mapped to dense slots before replaying
+    size_t Size;
+};
+
+static bool LoadTrace(const wchar_t* fileName, vector<TraceEvent>& events, uint32_t& slotCount)
+{
+    FILE* file = nullptr;
+    if (_wfopen_s(&file, fileName, L"r") != 0)
+        return false;
+
+    unordered_map<uint64_t, uint32_t> slots;
+    char line[256];
+
+    while (fgets(line, sizeof(line), file))
+    {
+        TraceEvent event = { line[0], 0, 0 };
+        unsigned long long id = 0, size = 0;
+
+        if (event.Type == 'a' && sscanf_s(line + 1, "%llu %llu", &id, &size) == 2)
+        {
+            event.Slot = (uint32_t)slots.size();
+            event.Size = (size_t)max(size, 1ull);
+            slots[id] = event.Slot;
+        }
+        else if (event.Type == 'f' && sscanf_s(line + 1, "%llu", &id) == 1)
+        {
+            auto iter = slots.find(id);
+            if (iter == slots.end())
+                continue;
+            event.Slot = iter->second;
+        }
+        else if (event.Type != 's')
+            continue;
+
+        events.push_back(event);
+    }
+
+    fclose(file);
+    slotCount = (uint32_t)slots.size();
+    return true;
+}
+
+// Keeps the heap about two thirds full of buffers with a long tail of sizes, freeing random ones as new
+// ones stream in, with a submit every few operations
+static void GenerateTrace(vector<TraceEvent>& events, uint32_t& slotCount, size_t heapSize, uint32_t opCount, uint32_t seed)
+{
+    mt19937 random(seed);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+
+    vector<pair<uint32_t, size_t>> live;
+    size_t liveBytes = 0;
+    slotCount = 0;
+
+    for (uint32_t op = 0; op < opCount; ++op)
+    {
+        if (op % 8 == 7)
+            events.push_back({ 's', 0, 0 });
+
+        bool allocate = live.empty() || (liveBytes < heapSize * 2 / 3 && unit(random) < 0.6);
+
+        if (allocate)
+        {
+            // Mostly small meshes from 1KB to 256KB, some large ones up to 8MB
+            double logSize = unit(random) < 0.8 ? 10.0 + unit(random) * 8.0 : 18.0 + unit(random) * 5.0;
+            size_t size = (size_t)pow(2.0, logSize);
+
+            events.push_back({ 'a', slotCount, size });
+            live.push_back(make_pair(slotCount++, size));
+            liveBytes += size;
+        }
+        else
+        {
+            size_t victim = random() % live.size();
+            events.push_back({ 'f', live[victim].first, 0 });
+            liveBytes -= live[victim].second;
+            live[victim] = live.back();
+            live.pop_back();
+        }
+    }
+}
+
+static bool SaveTrace(const wchar_t* fileName, const vector<TraceEvent>& events, size_t heapSize, bool placed)
+{
+    FILE* file = nullptr;
+    if (_wfopen_s(&file, fileName, L"w") != 0)
+        return false;
+
+    fprintf(file, "# Generated trace:  %s, %llu byte heap\n", placed ? "placed" : "manual", (uint64_t)heapSize);
+    for (const TraceEvent& event : events)
+    {
+        if (event.Type == 'a')
+            fprintf(file, "a %u %llu\n", event.Slot + 1, (uint64_t)event.Size);
+        else if (event.Type == 'f')
+            fprintf(file, "f %u\n", event.Slot + 1);
+        else
+            fputs("s\n", file);
+    }
+
+    fclose(file);
+    return true;
+}
+
+struct Slot
+{
+    size_t Offset;
+    size_t Size;
+    uint32_t Node;
+    bool Valid;
+};
+
+class BuddyReplay
+{
+public:
+    BuddyReplay(bool placed, size_t heapSize) : m_Allocator(placed ? kPlacedResourceStrategy : kManualSubAllocationStrategy,
+        D3D12_HEAP_TYPE_DEFAULT, heapSize, placed ? MIN_PLACED_BUFFER_SIZE : 256) {}
+
+    bool Allocate(size_t size, Slot& slot) { return m_Allocator.AllocateRange(size, slot.Offset, slot.Size); }
+    void Free(const Slot& slot) { m_Allocator.DeallocateRange(slot.Offset, slot.Size); }
+    size_t GetLargestFreeRange() const { return m_Allocator.GetLargestFreeBlock(); }
+
+private:
+    BuddyAllocator m_Allocator;
+};
+
+class TLSFReplay
+{
+public:
+    TLSFReplay(bool placed, size_t heapSize) { m_Allocator.Reset(heapSize, placed ? MIN_PLACED_BUFFER_SIZE : 256); }
+
+    bool Allocate(size_t size, Slot& slot)
+    {
+        TLSFRangeAllocator::Range range = m_Allocator.Allocate(size);
+        slot.Offset = range.Offset;
+        slot.Size = range.Size;
+        slot.Node = range.Node;
+        return range.IsValid();
+    }
+
+    void Free(const Slot& slot) { m_Allocator.Free(slot.Node); }
+    size_t GetLargestFreeRange() const { return m_Allocator.GetLargestFreeRange(); }
+
+private:
+    TLSFRangeAllocator m_Allocator;
+};
+
+struct ReplayResult
+{
+    double Seconds;
+    uint32_t Operations;
+    uint32_t Failures;
+    size_t PeakReservedBytes;
+    double InternalFragmentation;   // Averaged over the submits
+    double ExternalFragmentation;
+};
+
+// Measuring fragmentation walks free lists, so it's only done on a separate, untimed pass
+template <typename ReplayType>
+static ReplayResult Replay(const vector<TraceEvent>& events, uint32_t slotCount, bool placed, size_t heapSize,
+    uint32_t latency, bool measure)
+{
+    unique_ptr<ReplayType> allocator(new ReplayType(placed, heapSize));
+    vector<Slot> slots(slotCount);
+    vector<size_t> requested(slotCount);
+    deque<pair<uint32_t, uint32_t>> pendingFrees;     // Submit count, slot
+
+    ReplayResult result = {};
+    uint32_t submits = 0;
+    uint32_t samples = 0;
+    size_t reservedBytes = 0;
+    size_t requestedBytes = 0;
+
+    auto release = [&](uint32_t index)
+    {
+        allocator->Free(slots[index]);
+        slots[index].Valid = false;
+        reservedBytes -= slots[index].Size;
+        ++result.Operations;
+    };
+
+    auto startTime = chrono::high_resolution_clock::now();
+
+    for (const TraceEvent& event : events)
+    {
+        if (event.Type == 'a')
+        {
+            Slot& slot = slots[event.Slot];
+            slot.Valid = allocator->Allocate(event.Size, slot);
+            ++result.Operations;
+
+            if (!slot.Valid)
+            {
+                ++result.Failures;
+                continue;
+            }
+
+            reservedBytes += slot.Size;
+            requested[event.Slot] = event.Size;
+            requestedBytes += event.Size;
+            result.PeakReservedBytes = max(result.PeakReservedBytes, reservedBytes);
+        }
+        else if (event.Type == 'f')
+        {
+            if (!slots[event.Slot].Valid)
+                continue;
+
+            requestedBytes -= requested[event.Slot];
+            if (latency == 0)
+                release(event.Slot);
+            else
+                pendingFrees.push_back(make_pair(submits, event.Slot));
+        }
+        else
+        {
+            ++submits;
+            while (!pendingFrees.empty() && submits - pendingFrees.front().first >= latency)
+            {
+                release(pendingFrees.front().second);
+                pendingFrees.pop_front();
+            }
+
+            if (measure)
+            {
+                size_t pendingBytes = 0;
+                for (auto& pending : pendingFrees)
+                    pendingBytes += slots[pending.second].Size;
+
+                size_t liveBytes = reservedBytes - pendingBytes;
+                size_t freeBytes = heapSize - reservedBytes;
+
+                result.InternalFragmentation += liveBytes == 0 ? 0.0 : 1.0 - (double)requestedBytes / liveBytes;
+                result.ExternalFragmentation += freeBytes == 0 ? 0.0 : 1.0 - (double)allocator->GetLargestFreeRange() / freeBytes;
+                ++samples;
+            }
+        }
+    }
+
+    result.Seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+
+    if (samples > 0)
+    {
+        result.InternalFragmentation /= samples;
+        result.ExternalFragmentation /= samples;
+    }
+
+    return result;
+}
+
+template <typename ReplayType>
+static void Report(const char* name, const vector<TraceEvent>& events, uint32_t slotCount, bool placed, size_t heapSize,
+    uint32_t latency, int repeatCount)
+{
+    ReplayResult best = {};
+    for (int i = 0; i < repeatCount; ++i)
+    {
+        ReplayResult result = Replay<ReplayType>(events, slotCount, placed, heapSize, latency, false);
+        if (i == 0 || result.Seconds < best.Seconds)
+            best = result;
+    }
+
+    ReplayResult measured = Replay<ReplayType>(events, slotCount, placed, heapSize, latency, true);
+
+    printf("%-6s %12.0f ops/s %8u failed %10.1f MB peak %8.1f%% internal %8.1f%% external\n", name,
+        best.Operations / best.Seconds, best.Failures, measured.PeakReservedBytes / (1024.0 * 1024.0),
+        measured.InternalFragmentation * 100.0, measured.ExternalFragmentation * 100.0);
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+    if (argc % 2 != 1)
+    {
+        PrintHelp();
+        return -1;
+    }
+
+    const wchar_t* traceFile = nullptr;
+    const wchar_t* recordFile = nullptr;
+    size_t heapMegabytes = 256;
+    bool placed = true;
+    uint32_t latency = 3;
+    uint32_t opCount = 200000;
+    uint32_t seed = 1;
+    int repeatCount = 3;
+
+    for (int arg = 1; arg < argc; arg += 2)
+    {
+        if (0 == wcscmp(argv[arg], L"-trace"))
+            traceFile = argv[arg + 1];
+        else if (0 == wcscmp(argv[arg], L"-record"))
+            recordFile = argv[arg + 1];
+        else if (0 == wcscmp(argv[arg], L"-heap"))
+            heapMegabytes = max(1, _wtoi(argv[arg + 1]));
+        else if (0 == wcscmp(argv[arg], L"-placed"))
+            placed = _wtoi(argv[arg + 1]) != 0;
+        else if (0 == wcscmp(argv[arg], L"-latency"))
+            latency = max(0, _wtoi(argv[arg + 1]));
+        else if (0 == wcscmp(argv[arg], L"-ops"))
+            opCount = max(1, _wtoi(argv[arg + 1]));
+        else if (0 == wcscmp(argv[arg], L"-seed"))
+            seed = (uint32_t)_wtoi(argv[arg + 1]);
+        else if (0 == wcscmp(argv[arg], L"-repeat"))
+            repeatCount = max(1, _wtoi(argv[arg + 1]));
+        else
+        {
+            PrintHelp();
+            return -1;
+        }
+    }
+
+    // The buddy allocator needs a power of two number of blocks
+    size_t heapSize = Math::AlignPowerOfTwo(heapMegabytes) * 1024 * 1024;
+
+    vector<TraceEvent> events;
+    uint32_t slotCount = 0;
+
+    if (traceFile != nullptr)
+    {
+        if (!LoadTrace(traceFile, events, slotCount))
+        {
+            printf("error: could not read trace %ls\n", traceFile);
+            return -1;
+        }
+    }
+    else
+    {
+        GenerateTrace(events, slotCount, heapSize, opCount, seed);
+        if (recordFile != nullptr && !SaveTrace(recordFile, events, heapSize, placed))
+        {
+            printf("error: could not write trace %ls\n", recordFile);
+            return -1;
+        }
+    }
+
+    printf("%zu events, %u allocations, %zu MB %s heap, frees held for %u submits, best of %d\n\n", events.size(), slotCount,
+        heapSize / (1024 * 1024), placed ? "placed" : "manual", latency, repeatCount);
+
+    Report<BuddyReplay>("buddy", events, slotCount, placed, heapSize, latency, repeatCount);
+    Report<TLSFReplay>("tlsf", events, slotCount, placed, heapSize, latency, repeatCount);
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+
+#include "pch.h"
+#include "BindlessDescriptorHeap.h"
+#include "GraphicsCore.h"
+#include "CommandListManager.h"
+#include <algorithm>
+
+using namespace Graphics;
+
+void BindlessDescriptorHeap::Create( const std::wstring& DebugHeapName )
+{
+    std::lock_guard<std::mutex> LockGuard(m_Mutex);
+    m_Heap.Create(DebugHeapName);
+    m_IsCreated = true;
+}
+
+void BindlessDescriptorHeap::Destroy( void )
+{
+    std::lock_guard<std::mutex> LockGuard(m_Mutex);
+    m_Heap.Destroy();
+    m_IsCreated = false;
+}
+
+uint32_t BindlessDescriptorHeap::Register( const D3D12_CPU_DESCRIPTOR_HANDLE Handles[], uint32_t Count )
+{
+    ASSERT(m_IsCreated, "Bindless descriptor heap has not been created");
+
+    uint32_t Index;
+    {
+        std::lock_guard<std::mutex> LockGuard(m_Mutex);
+        ASSERT(m_Heap.HasAvailableSpace(Count), "Bindless descriptor heap out of space.  Increase heap size.");
+        Index = m_Heap.GetOffsetOfHandle(m_Heap.Alloc(Count));
+    }
+
+    CopyIn(Index, Handles, Count);
+    return Index;
+}
+
+void BindlessDescriptorHeap::Update( uint32_t Index, const D3D12_CPU_DESCRIPTOR_HANDLE Handles[], uint32_t Count )
+{
+    CopyIn(Index, Handles, Count);
+}
+
+void BindlessDescriptorHeap::CopyIn( uint32_t Index, const D3D12_CPU_DESCRIPTOR_HANDLE Handles[], uint32_t Count )
+{
+    // Source descriptors aren't assumed to be contiguous
+    static const uint32_t kMaxDescriptorsPerCopy = 16;
+    static const UINT kSrcSizes[kMaxDescriptorsPerCopy] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+    D3D12_CPU_DESCRIPTOR_HANDLE DestStart = GetHandle(Index).GetCpuHandle();
+    uint32_t DescriptorSize = g_Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+    for (uint32_t First = 0; First < Count; First += kMaxDescriptorsPerCopy)
+    {
+        UINT NumDescriptors = std::min(Count - First, kMaxDescriptorsPerCopy);
+        D3D12_CPU_DESCRIPTOR_HANDLE Dest = DestStart;
+        Dest.ptr += (SIZE_T)First * DescriptorSize;
+
+        g_Device->CopyDescriptors(1, &Dest, &NumDescriptors, NumDescriptors, Handles + First, kSrcSizes,
+            D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+    }
+
+    m_NumDescriptorsCopied += Count;
+}
+
+void BindlessDescriptorHeap::Free( uint32_t Index, uint32_t Count, uint64_t FenceValue )
+{
+    std::lock_guard<std::mutex> LockGuard(m_Mutex);
+    m_Heap.Free(GetHandle(Index), Count, FenceValue);
+}
+
+DescriptorHandle BindlessDescriptorHeap::AllocateDynamicBlock( uint32_t Count )
+{
+    std::unique_lock<std::mutex> Lock(m_Mutex);
+    ASSERT(m_IsCreated, "Bindless descriptor heap has not been created");
+
+    while (!m_Heap.HasAvailableSpace(Count))
+    {
+        uint64_t FenceValue = m_Heap.GetOldestPendingFreeFence();
+        ASSERT(FenceValue != 0, "Bindless descriptor heap out of space for dynamic descriptors.  Increase heap size.");
+
+        Lock.unlock();
+        g_CommandManager.WaitForFence(FenceValue);
+        Lock.lock();
+    }
+
+    return m_Heap.Alloc(Count);
+}
+
+void BindlessDescriptorHeap::FreeDynamicBlock( const DescriptorHandle& Block, uint32_t Count, uint64_t FenceValue )
+{
+    std::lock_guard<std::mutex> LockGuard(m_Mutex);
+    m_Heap.Free(Block, Count, FenceValue);
+}
+
+DescriptorAllocatorStats BindlessDescriptorHeap::GetStats( void )
+{
+    std::lock_guard<std::mutex> LockGuard(m_Mutex);
+    return m_Heap.GetStats();
+}
@@ -0,0 +1,74 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// One large, persistent, shader-visible CBV_SRV_UAV heap.  Descriptors registered with it are
+// copied in once and keep their index until they are freed, so shaders can select them with an
+// index passed in root constants instead of having a table copied for every draw.  The dynamic
+// descriptor heaps carve their per-command list tables out of the same heap, so it never has to
+// be swapped out for another while rendering.
+//
+
+#pragma once
+
+#include "DescriptorHeap.h"
+#include <mutex>
+#include <atomic>
+
+class BindlessDescriptorHeap
+{
+public:
+
+    static const uint32_t kInvalidIndex = 0xFFFFFFFF;
+
+    BindlessDescriptorHeap( uint32_t MaxDescriptors )
+        : m_Heap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, MaxDescriptors), m_IsCreated(false), m_NumDescriptorsCopied(0) {}
+
+    void Create( const std::wstring& DebugHeapName );
+    void Destroy( void );
+
+    bool IsCreated( void ) const { return m_IsCreated; }
+    ID3D12DescriptorHeap* GetHeapPointer( void ) const { return m_Heap.GetHeapPointer(); }
+
+    // Copies the descriptors into consecutive slots and returns the index of the first.  The source
+    // descriptors may be freed or overwritten afterwards.
+    uint32_t Register( const D3D12_CPU_DESCRIPTOR_HANDLE Handles[], uint32_t Count );
+    uint32_t Register( D3D12_CPU_DESCRIPTOR_HANDLE Handle ) { return Register(&Handle, 1); }
+
+    // Replaces registered descriptors in place, e.g. after the resource was recreated.  The GPU must
+    // not be reading the old ones.
+    void Update( uint32_t Index, const D3D12_CPU_DESCRIPTOR_HANDLE Handles[], uint32_t Count );
+
+    // Pass the fence following the last command list that used the descriptors
+    void Free( uint32_t Index, uint32_t Count, uint64_t FenceValue = 0 );
+
+    DescriptorHandle GetHandle( uint32_t Index ) const { return m_Heap.GetHandleAtOffset(Index); }
+    D3D12_GPU_DESCRIPTOR_HANDLE GetGpuHandle( uint32_t Index ) const { return GetHandle(Index).GetGpuHandle(); }
+
+    // Blocks of descriptors for DynamicDescriptorHeap.  When the heap is full this waits for the GPU to
+    // finish with retired blocks, since switching heaps would unbind the bindless tables.
+    DescriptorHandle AllocateDynamicBlock( uint32_t Count );
+    void FreeDynamicBlock( const DescriptorHandle& Block, uint32_t Count, uint64_t FenceValue );
+
+    // Counts every descriptor copied into the heap by Register() and Update()
+    uint64_t GetNumDescriptorsCopied( void ) const { return m_NumDescriptorsCopied; }
+
+    DescriptorAllocatorStats GetStats( void );
+
+private:
+
+    void CopyIn( uint32_t Index, const D3D12_CPU_DESCRIPTOR_HANDLE Handles[], uint32_t Count );
+
+    std::mutex m_Mutex;
+    UserDescriptorHeap m_Heap;
+    bool m_IsCreated;
+    std::atomic<uint64_t> m_NumDescriptorsCopied;
+};
@@ -208,6 +208,38 @@ BuddyBlock* BuddyAllocator::Allocate(uint32_t numElements, uint32_t elementSize,
     }
 }
 
+bool BuddyAllocator::AllocateRange(size_t size, size_t& offset, size_t& paddedSize)
+{
+    UINT order = UnitSizeToOrder(SizeToUnitSize(size));
+
+    try
+    {
+        offset = AllocateBlock(order) * m_minBlockSize;
+        paddedSize = OrderToUnitSize(order) * m_minBlockSize;
+        return true;
+    }
+
+    catch (std::bad_alloc&)
+    {
+        return false;
+    }
+}
+
+void BuddyAllocator::DeallocateRange(size_t offset, size_t paddedSize)
+{
+    DeallocateBlock(offset / m_minBlockSize, UnitSizeToOrder(SizeToUnitSize(paddedSize)));
+}
+
+size_t BuddyAllocator::GetLargestFreeBlock() const
+{
+    for (UINT order = m_maxOrder + 1; order > 0; --order)
+    {
+        if (!m_freeBlocks[order - 1].empty())
+            return OrderToUnitSize(order - 1) * m_minBlockSize;
+    }
+    return 0;
+}
+
 /*
 void BuddyAllocator::Deallocate(BuddyBlock* pBlock)
 {
@@ -106,6 +106,12 @@ public:
 
     void CleanUpAllocations();
 
+    // Bookkeeping only, without creating a resource, for tools such as AllocatorBenchmark.  Offsets and
+    // sizes are in bytes from the base offset.  Returns false when no block is large enough.
+    bool AllocateRange(size_t size, size_t& offset, size_t& paddedSize);
+    void DeallocateRange(size_t offset, size_t paddedSize);
+    size_t GetLargestFreeBlock() const;
+
 private:
     ID3D12Heap* m_pBackingHeap;
     ByteAddressBuffer m_BackingResource;
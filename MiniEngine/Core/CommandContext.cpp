@@ -31,6 +31,7 @@ void ContextManager::DestroyAllContexts(void)
 {
     for (uint32_t i = 0; i < 4; ++i)
         sm_ContextPool[i].clear();
+    sm_OpenContextSerials.clear();
 }
 
 CommandContext* ContextManager::AllocateContext(D3D12_COMMAND_LIST_TYPE Type)
@@ -56,6 +57,9 @@ CommandContext* ContextManager::AllocateContext(D3D12_COMMAND_LIST_TYPE Type)
 
     ASSERT(ret->m_Type == Type);
 
+    ret->m_Serial = sm_NextContextSerial++;
+    sm_OpenContextSerials.insert(ret->m_Serial);
+
     return ret;
 }
 
@@ -63,9 +67,22 @@ void ContextManager::FreeContext(CommandContext* UsedContext)
 {
     ASSERT(UsedContext != nullptr);
     std::lock_guard<std::mutex> LockGuard(sm_ContextAllocationMutex);
+    sm_OpenContextSerials.erase(UsedContext->m_Serial);
     sm_AvailableContexts[UsedContext->m_Type].push(UsedContext);
 }
 
+uint64_t ContextManager::GetNextContextSerial(void)
+{
+    std::lock_guard<std::mutex> LockGuard(sm_ContextAllocationMutex);
+    return sm_NextContextSerial;
+}
+
+uint64_t ContextManager::GetOldestOpenContextSerial(void)
+{
+    std::lock_guard<std::mutex> LockGuard(sm_ContextAllocationMutex);
+    return sm_OpenContextSerials.empty() ? sm_NextContextSerial : *sm_OpenContextSerials.begin();
+}
+
 void CommandContext::DestroyAllContexts(void)
 {
     LinearAllocator::DestroyAll();
@@ -82,6 +99,11 @@ CommandContext& CommandContext::Begin( const std::wstring ID )
     return *NewContext;
 }
 
+CommandContext& CommandContext::BeginCopy( void )
+{
+    return *g_ContextManager.AllocateContext(D3D12_COMMAND_LIST_TYPE_COPY);
+}
+
 ComputeContext& ComputeContext::Begin(const std::wstring& ID, bool Async)
 {
     ComputeContext& NewContext = g_ContextManager.AllocateContext(
@@ -94,15 +116,104 @@ ComputeContext& ComputeContext::Begin(const std::wstring& ID, bool Async)
 
 uint64_t CommandContext::Flush(bool WaitForCompletion)
 {
-    FlushResourceBarriers();
+    return FlushWith(nullptr, 0, WaitForCompletion);
+}
+
+uint64_t CommandContext::FlushWith( CommandContext* const Followers[], uint32_t NumFollowers, bool WaitForCompletion )
+{
+    // Pending texture uploads have to reach the copy queue first so that this queue can wait on them
+    if (m_Type != D3D12_COMMAND_LIST_TYPE_COPY)
+        TextureManager::SubmitUploads();
 
     ASSERT(m_CurrentAllocator != nullptr);
 
-    uint64_t FenceValue = g_CommandManager.GetQueue(m_Type).ExecuteCommandList(m_CommandList);
+    std::vector<CommandContext*> Contexts(NumFollowers + 1);
+    Contexts[0] = this;
+    for (uint32_t i = 0; i < NumFollowers; ++i)
+        Contexts[i + 1] = Followers[i];
+
+    uint64_t FenceValue = ExecuteContexts(Contexts.data(), (uint32_t)Contexts.size());
+
+    for (uint32_t i = 0; i < NumFollowers; ++i)
+    {
+        Followers[i]->RetireResources(FenceValue);
+        g_ContextManager.FreeContext(Followers[i]);
+    }
 
     if (WaitForCompletion)
         g_CommandManager.WaitForFence(FenceValue);
 
+    RestoreState();
+
+    return FenceValue;
+}
+
+uint64_t CommandContext::ExecuteContexts( CommandContext* const Contexts[], uint32_t NumContexts )
+{
+    D3D12_COMMAND_LIST_TYPE Type = Contexts[0]->m_Type;
+
+    for (uint32_t i = 0; i < NumContexts; ++i)
+    {
+        CommandContext& Context = *Contexts[i];
+        ASSERT(Context.m_Type == Type, "Batched command lists must share a queue");
+        Context.m_StateTracker.EndSplitTransitions();
+        Context.FlushResourceBarriers();
+        ASSERT_SUCCEEDED(Context.m_CommandList->Close());
+    }
+
+    std::vector<ID3D12CommandList*> Lists;
+    Lists.reserve(NumContexts * 2);
+    std::vector<D3D12_RESOURCE_BARRIER> Fixups;
+
+    // The states each list assumed are checked against those left by the lists before it, so they have to be
+    // resolved in the order the queue receives them
+    std::lock_guard<std::mutex> LockGuard(ResourceStateTracker::GetStateMutex());
+
+    for (uint32_t i = 0; i < NumContexts; ++i)
+    {
+        CommandContext& Context = *Contexts[i];
+
+        Fixups.clear();
+        Context.m_StateTracker.ResolveInitialStates(Fixups);
+        if (!Fixups.empty())
+            Lists.push_back(Context.RecordFixupBarriers(Fixups));
+
+        Lists.push_back(Context.m_CommandList);
+    }
+
+    return g_CommandManager.GetQueue(Type).ExecuteCommandLists((UINT)Lists.size(), Lists.data());
+}
+
+ID3D12CommandList* CommandContext::RecordFixupBarriers( const std::vector<D3D12_RESOURCE_BARRIER>& Barriers )
+{
+    if (m_Type == D3D12_COMMAND_LIST_TYPE_COMPUTE)
+    {
+        for (const D3D12_RESOURCE_BARRIER& Barrier : Barriers)
+        {
+            ASSERT((Barrier.Transition.StateBefore & VALID_COMPUTE_QUEUE_RESOURCE_STATES) == Barrier.Transition.StateBefore);
+            ASSERT((Barrier.Transition.StateAfter & VALID_COMPUTE_QUEUE_RESOURCE_STATES) == Barrier.Transition.StateAfter);
+        }
+    }
+
+    // The main list is closed by now, so this one can record into the same allocator
+    if (m_FixupCommandList == nullptr)
+    {
+        ASSERT_SUCCEEDED(g_Device->CreateCommandList(1, m_Type, m_CurrentAllocator, nullptr, MY_IID_PPV_ARGS(&m_FixupCommandList)));
+        m_FixupCommandList->SetName(L"Fixup CommandList");
+    }
+    else
+    {
+        m_FixupCommandList->Reset(m_CurrentAllocator, nullptr);
+    }
+
+    m_FixupCommandList->ResourceBarrier((UINT)Barriers.size(), Barriers.data());
+    ASSERT_SUCCEEDED(m_FixupCommandList->Close());
+
+    return m_FixupCommandList;
+}
+
+void CommandContext::RestoreState( void )
+{
     //
     // Reset the command list and restore previous state
     //
@@ -121,13 +232,15 @@ uint64_t CommandContext::Flush(bool WaitForCompletion)
     }
 
     BindDescriptorHeaps();
-
-    return FenceValue;
 }
 
 uint64_t CommandContext::Finish( bool WaitForCompletion )
 {
-    ASSERT(m_Type == D3D12_COMMAND_LIST_TYPE_DIRECT || m_Type == D3D12_COMMAND_LIST_TYPE_COMPUTE);
+    ASSERT(m_Type == D3D12_COMMAND_LIST_TYPE_DIRECT || m_Type == D3D12_COMMAND_LIST_TYPE_COMPUTE ||
+        m_Type == D3D12_COMMAND_LIST_TYPE_COPY);
+
+    if (m_Type != D3D12_COMMAND_LIST_TYPE_COPY)
+        TextureManager::SubmitUploads();
 
     FlushResourceBarriers();
 
@@ -136,16 +249,9 @@ uint64_t CommandContext::Finish( bool WaitForCompletion )
 
     ASSERT(m_CurrentAllocator != nullptr);
 
-    CommandQueue& Queue = g_CommandManager.GetQueue(m_Type);
-
-    uint64_t FenceValue = Queue.ExecuteCommandList(m_CommandList);
-    Queue.DiscardAllocator(FenceValue, m_CurrentAllocator);
-    m_CurrentAllocator = nullptr;
-
-    m_CpuLinearAllocator.CleanupUsedPages(FenceValue);
-    m_GpuLinearAllocator.CleanupUsedPages(FenceValue);
-    m_DynamicViewDescriptorHeap.CleanupUsedHeaps(FenceValue);
-    m_DynamicSamplerDescriptorHeap.CleanupUsedHeaps(FenceValue);
+    CommandContext* Self = this;
+    uint64_t FenceValue = ExecuteContexts(&Self, 1);
+    RetireResources(FenceValue);
 
     if (WaitForCompletion)
         g_CommandManager.WaitForFence(FenceValue);
@@ -155,6 +261,18 @@ uint64_t CommandContext::Finish( bool WaitForCompletion )
     return FenceValue;
 }
 
+void CommandContext::RetireResources( uint64_t FenceValue )
+{
+    g_CommandManager.GetQueue(m_Type).DiscardAllocator(FenceValue, m_CurrentAllocator);
+    m_CurrentAllocator = nullptr;
+
+    m_CpuLinearAllocator.CleanupUsedPages(FenceValue);
+    m_GpuLinearAllocator.CleanupUsedPages(FenceValue);
+    m_CpuLinearAllocator.SetPageSize(0);
+    m_DynamicViewDescriptorHeap.CleanupUsedHeaps(FenceValue);
+    m_DynamicSamplerDescriptorHeap.CleanupUsedHeaps(FenceValue);
+}
+
 CommandContext::CommandContext(D3D12_COMMAND_LIST_TYPE Type) :
     m_Type(Type),
     m_DynamicViewDescriptorHeap(*this, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV),
@@ -163,21 +281,24 @@ CommandContext::CommandContext(D3D12_COMMAND_LIST_TYPE Type) :
     m_GpuLinearAllocator(kGpuExclusive)
 {
     m_OwningManager = nullptr;
+    m_Serial = 0;
     m_CommandList = nullptr;
     m_CurrentAllocator = nullptr;
+    m_FixupCommandList = nullptr;
     ZeroMemory(m_CurrentDescriptorHeaps, sizeof(m_CurrentDescriptorHeaps));
 
     m_CurGraphicsRootSignature = nullptr;
     m_CurGraphicsPipelineState = nullptr;
     m_CurComputeRootSignature = nullptr;
     m_CurComputePipelineState = nullptr;
-    m_NumBarriersToFlush = 0;
 }
 
 CommandContext::~CommandContext( void )
 {
     if (m_CommandList != nullptr)
         m_CommandList->Release();
+    if (m_FixupCommandList != nullptr)
+        m_FixupCommandList->Release();
 }
 
 void CommandContext::Initialize(void)
@@ -197,7 +318,7 @@ void CommandContext::Reset( void )
     m_CurGraphicsPipelineState = nullptr;
     m_CurComputeRootSignature = nullptr;
     m_CurComputePipelineState = nullptr;
-    m_NumBarriersToFlush = 0;
+    ASSERT(!m_StateTracker.HasPendingBarriers());
 
     BindDescriptorHeaps();
 }
@@ -336,79 +457,35 @@ void GraphicsContext::SetScissor( const D3D12_RECT& rect )
 
 void CommandContext::TransitionResource(GpuResource& Resource, D3D12_RESOURCE_STATES NewState, bool FlushImmediate)
 {
-    D3D12_RESOURCE_STATES OldState = Resource.m_UsageState;
+    TransitionSubresource(Resource, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, NewState, FlushImmediate);
+}
 
+void CommandContext::TransitionSubresource(GpuResource& Resource, UINT Subresource, D3D12_RESOURCE_STATES NewState, bool FlushImmediate)
+{
     if (m_Type == D3D12_COMMAND_LIST_TYPE_COMPUTE)
     {
+        D3D12_RESOURCE_STATES OldState = m_StateTracker.GetState(Resource, Subresource);
         ASSERT((OldState & VALID_COMPUTE_QUEUE_RESOURCE_STATES) == OldState);
         ASSERT((NewState & VALID_COMPUTE_QUEUE_RESOURCE_STATES) == NewState);
     }
 
-    if (OldState != NewState)
-    {
-        ASSERT(m_NumBarriersToFlush < 16, "Exceeded arbitrary limit on buffered barriers");
-        D3D12_RESOURCE_BARRIER& BarrierDesc = m_ResourceBarrierBuffer[m_NumBarriersToFlush++];
-
-        BarrierDesc.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-        BarrierDesc.Transition.pResource = Resource.GetResource();
-        BarrierDesc.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-        BarrierDesc.Transition.StateBefore = OldState;
-        BarrierDesc.Transition.StateAfter = NewState;
-
-        // Check to see if we already started the transition
-        if (NewState == Resource.m_TransitioningState)
-        {
-            BarrierDesc.Flags = D3D12_RESOURCE_BARRIER_FLAG_END_ONLY;
-            Resource.m_TransitioningState = (D3D12_RESOURCE_STATES)-1;
-        }
-        else
-            BarrierDesc.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-
-        Resource.m_UsageState = NewState;
-    }
-    else if (NewState == D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
-        InsertUAVBarrier(Resource, FlushImmediate);
+    m_StateTracker.TransitionResource(Resource, NewState, Subresource);
 
-    if (FlushImmediate || m_NumBarriersToFlush == 16)
+    if (FlushImmediate)
         FlushResourceBarriers();
 }
 
 void CommandContext::BeginResourceTransition(GpuResource& Resource, D3D12_RESOURCE_STATES NewState, bool FlushImmediate)
 {
-    // If it's already transitioning, finish that transition
-    if (Resource.m_TransitioningState != (D3D12_RESOURCE_STATES)-1)
-        TransitionResource(Resource, Resource.m_TransitioningState);
-
-    D3D12_RESOURCE_STATES OldState = Resource.m_UsageState;
+    m_StateTracker.BeginResourceTransition(Resource, NewState, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
 
-    if (OldState != NewState)
-    {
-        ASSERT(m_NumBarriersToFlush < 16, "Exceeded arbitrary limit on buffered barriers");
-        D3D12_RESOURCE_BARRIER& BarrierDesc = m_ResourceBarrierBuffer[m_NumBarriersToFlush++];
-
-        BarrierDesc.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-        BarrierDesc.Transition.pResource = Resource.GetResource();
-        BarrierDesc.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-        BarrierDesc.Transition.StateBefore = OldState;
-        BarrierDesc.Transition.StateAfter = NewState;
-
-        BarrierDesc.Flags = D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY;
-
-        Resource.m_TransitioningState = NewState;
-    }
-
-    if (FlushImmediate || m_NumBarriersToFlush == 16)
+    if (FlushImmediate)
         FlushResourceBarriers();
 }
 
 void CommandContext::InsertUAVBarrier(GpuResource& Resource, bool FlushImmediate)
 {
-    ASSERT(m_NumBarriersToFlush < 16, "Exceeded arbitrary limit on buffered barriers");
-    D3D12_RESOURCE_BARRIER& BarrierDesc = m_ResourceBarrierBuffer[m_NumBarriersToFlush++];
-
-    BarrierDesc.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-    BarrierDesc.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    BarrierDesc.UAV.pResource = Resource.GetResource();
+    m_StateTracker.InsertUAVBarrier(Resource);
 
     if (FlushImmediate)
         FlushResourceBarriers();
@@ -416,13 +493,7 @@ void CommandContext::InsertUAVBarrier(GpuResource& Resource, bool FlushImmediate
 
 void CommandContext::InsertAliasBarrier(GpuResource& Before, GpuResource& After, bool FlushImmediate)
 {
-    ASSERT(m_NumBarriersToFlush < 16, "Exceeded arbitrary limit on buffered barriers");
-    D3D12_RESOURCE_BARRIER& BarrierDesc = m_ResourceBarrierBuffer[m_NumBarriersToFlush++];
-
-    BarrierDesc.Type = D3D12_RESOURCE_BARRIER_TYPE_ALIASING;
-    BarrierDesc.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-    BarrierDesc.Aliasing.pResourceBefore = Before.GetResource();
-    BarrierDesc.Aliasing.pResourceAfter = After.GetResource();
+    m_StateTracker.InsertAliasBarrier(Before, After);
 
     if (FlushImmediate)
         FlushResourceBarriers();
@@ -557,6 +628,37 @@ void CommandContext::InitializeBuffer( GpuResource& Dest, const void* BufferData
     InitContext.Finish(true);
 }
 
+void CommandContext::InitializeBufferChunked( GpuResource& Dest, const void* BufferData, size_t NumBytes, size_t Offset, size_t ChunkSize )
+{
+    const uint8_t* Source = (const uint8_t*)BufferData;
+    uint64_t PreviousFence = 0;
+
+    for (size_t ChunkOffset = 0; ChunkOffset < NumBytes; ChunkOffset += ChunkSize)
+    {
+        const size_t CopySize = std::min(ChunkSize, NumBytes - ChunkOffset);
+
+        CommandContext& InitContext = CommandContext::Begin();
+
+        DynAlloc mem = InitContext.ReserveUploadMemory(CopySize);
+        memcpy(mem.DataPtr, Source + ChunkOffset, CopySize);
+
+        InitContext.TransitionResource(Dest, D3D12_RESOURCE_STATE_COPY_DEST, true);
+        InitContext.m_CommandList->CopyBufferRegion(Dest.GetResource(), Offset + ChunkOffset, mem.Buffer.GetResource(), 0, CopySize);
+        if (ChunkOffset + CopySize == NumBytes)
+            InitContext.TransitionResource(Dest, D3D12_RESOURCE_STATE_GENERIC_READ, true);
+
+        // Upload pages are recycled once their fence passes.  Waiting on the chunk before this one
+        // keeps the next memcpy overlapping the GPU copy while bounding the staging memory.
+        uint64_t Fence = InitContext.Finish(false);
+        if (PreviousFence != 0)
+            g_CommandManager.WaitForFence(PreviousFence);
+        PreviousFence = Fence;
+    }
+
+    if (PreviousFence != 0)
+        g_CommandManager.WaitForFence(PreviousFence);
+}
+
 void CommandContext::PIXBeginEvent(const wchar_t* label)
 {
 #ifdef RELEASE
@@ -24,8 +24,10 @@
 #include "DynamicDescriptorHeap.h"
 #include "LinearAllocator.h"
 #include "CommandSignature.h"
+#include "ResourceStateTracker.h"
 #include "GraphicsCore.h"
 #include <vector>
+#include <set>
 
 class ColorBuffer;
 class DepthBuffer;
@@ -60,15 +62,22 @@ struct DWParam
 class ContextManager
 {
 public:
-    ContextManager(void) {}
+    ContextManager(void) : sm_NextContextSerial(1) {}
 
     CommandContext* AllocateContext(D3D12_COMMAND_LIST_TYPE Type);
     void FreeContext(CommandContext*);
     void DestroyAllContexts();
 
+    // Contexts are numbered as they are handed out.  Everything recorded before a call to GetNextContextSerial()
+    // has been submitted once GetOldestOpenContextSerial() returns at least that number.
+    uint64_t GetNextContextSerial(void);
+    uint64_t GetOldestOpenContextSerial(void);
+
 private:
     std::vector<std::unique_ptr<CommandContext> > sm_ContextPool[4];
     std::queue<CommandContext*> sm_AvailableContexts[4];
+    std::set<uint64_t> sm_OpenContextSerials;
+    uint64_t sm_NextContextSerial;
     std::mutex sm_ContextAllocationMutex;
 };
 
@@ -96,12 +105,20 @@ public:
 
     static CommandContext& Begin(const std::wstring ID = L"");
 
+    // Contexts on the copy queue may only record copies.  Resources decay to the common state when the
+    // copy finishes, so they should not be transitioned on this context.
+    static CommandContext& BeginCopy(void);
+
     // Flush existing commands to the GPU but keep the context alive
     uint64_t Flush( bool WaitForCompletion = false );
 
     // Flush existing commands and release the current context
     uint64_t Finish( bool WaitForCompletion = false );
 
+    // Like Flush, but the lists of Followers are submitted right after this one in the same call and with the
+    // same fence.  The followers are released; this context keeps recording.
+    uint64_t FlushWith( CommandContext* const Followers[], uint32_t NumFollowers, bool WaitForCompletion = false );
+
     // Prepare to render by reserving a command list and command allocator
     void Initialize(void);
 
@@ -129,8 +146,20 @@ public:
         return m_CpuLinearAllocator.Allocate(SizeInBytes);
     }
 
+    // Upload pages of another size for the rest of this context, e.g. when streaming large buffers.  The
+    // default is restored when the context is finished.
+    void SetUploadPageSize(size_t PageSize)
+    {
+        m_CpuLinearAllocator.SetPageSize(PageSize);
+    }
+
     static void InitializeTexture( GpuResource& Dest, UINT NumSubresources, D3D12_SUBRESOURCE_DATA SubData[] );
     static void InitializeBuffer( GpuResource& Dest, const void* Data, size_t NumBytes, size_t Offset = 0);
+
+    // Like InitializeBuffer, but stages the data through upload memory ChunkSize bytes at a time with at most
+    // two chunks in flight.  The source needs no alignment or padding, so it can point into a mapped file.
+    static void InitializeBufferChunked( GpuResource& Dest, const void* Data, size_t NumBytes, size_t Offset = 0,
+        size_t ChunkSize = 16 * 1024 * 1024 );
     static void InitializeTextureArraySlice(GpuResource& Dest, UINT SliceIndex, GpuResource& Src);
     static void ReadbackTexture2D(GpuResource& ReadbackBuffer, PixelBuffer& SrcBuffer);
 
@@ -138,11 +167,21 @@ public:
     void FillBuffer( GpuResource& Dest, size_t DestOffset, DWParam Value, size_t NumBytes );
 
     void TransitionResource(GpuResource& Resource, D3D12_RESOURCE_STATES NewState, bool FlushImmediate = false);
+    void TransitionSubresource(GpuResource& Resource, UINT Subresource, D3D12_RESOURCE_STATES NewState, bool FlushImmediate = false);
+
+    // Starts a split transition.  The resource must not be used until TransitionResource() finishes it with the same
+    // state, which can be many commands later.  Transitions still in flight are finished when the list is submitted.
     void BeginResourceTransition(GpuResource& Resource, D3D12_RESOURCE_STATES NewState, bool FlushImmediate = false);
     void InsertUAVBarrier(GpuResource& Resource, bool FlushImmediate = false);
     void InsertAliasBarrier(GpuResource& Before, GpuResource& After, bool FlushImmediate = false);
     inline void FlushResourceBarriers(void);
 
+    // The state this context has left the resource in so far
+    D3D12_RESOURCE_STATES GetResourceState(const GpuResource& Resource) { return m_StateTracker.GetState(Resource); }
+
+    // Every barrier recorded on this context, for counting them per profiled pass
+    uint64_t GetNumBarriersFlushed(void) const { return m_StateTracker.GetNumBarriersFlushed(); }
+
     void InsertTimeStamp( ID3D12QueryHeap* pQueryHeap, uint32_t QueryIdx );
     void ResolveTimeStamps( ID3D12Resource* pReadbackHeap, ID3D12QueryHeap* pQueryHeap, uint32_t NumQueries );
     void PIXBeginEvent(const wchar_t* label);
@@ -158,9 +197,19 @@ protected:
 
     void BindDescriptorHeaps( void );
 
+    // Closes the lists and submits them in order, each preceded by the barriers needed to bring its resources into
+    // the states it assumed
+    static uint64_t ExecuteContexts( CommandContext* const Contexts[], uint32_t NumContexts );
+    ID3D12CommandList* RecordFixupBarriers( const std::vector<D3D12_RESOURCE_BARRIER>& Barriers );
+
+    // Returns the allocator, pages and descriptor heaps used by the submitted commands once FenceValue passes
+    void RetireResources( uint64_t FenceValue );
+    void RestoreState( void );
+
     CommandListManager* m_OwningManager;
     ID3D12GraphicsCommandList* m_CommandList;
     ID3D12CommandAllocator* m_CurrentAllocator;
+    ID3D12GraphicsCommandList* m_FixupCommandList;     // Created when first needed
 
     ID3D12RootSignature* m_CurGraphicsRootSignature;
     ID3D12PipelineState* m_CurGraphicsPipelineState;
@@ -170,8 +219,7 @@ protected:
     DynamicDescriptorHeap m_DynamicViewDescriptorHeap;        // HEAP_TYPE_CBV_SRV_UAV
     DynamicDescriptorHeap m_DynamicSamplerDescriptorHeap;    // HEAP_TYPE_SAMPLER
 
-    D3D12_RESOURCE_BARRIER m_ResourceBarrierBuffer[16];
-    UINT m_NumBarriersToFlush;
+    ResourceStateTracker m_StateTracker;
 
     ID3D12DescriptorHeap* m_CurrentDescriptorHeaps[D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES];
 
@@ -182,6 +230,7 @@ protected:
     void SetID(const std::wstring& ID) { m_ID = ID; }
 
     D3D12_COMMAND_LIST_TYPE m_Type;
+    uint64_t m_Serial;
 };
 
 class GraphicsContext : public CommandContext
@@ -303,11 +352,8 @@ private:
 
 inline void CommandContext::FlushResourceBarriers( void )
 {
-    if (m_NumBarriersToFlush > 0)
-    {
-        m_CommandList->ResourceBarrier(m_NumBarriersToFlush, m_ResourceBarrierBuffer);
-        m_NumBarriersToFlush = 0;
-    }
+    if (m_StateTracker.HasPendingBarriers())
+        m_StateTracker.FlushResourceBarriers(m_CommandList);
 }
 
 inline void GraphicsContext::SetRootSignature( const RootSignature& RootSig )
@@ -530,25 +576,25 @@ inline void ComputeContext::SetDynamicSRV(UINT RootIndex, size_t BufferSize, con
 
 inline void GraphicsContext::SetBufferSRV( UINT RootIndex, const GpuBuffer& SRV, UINT64 Offset)
 {
-    ASSERT((SRV.m_UsageState & (D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)) != 0);
+    ASSERT((m_StateTracker.GetState(SRV) & (D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)) != 0);
     m_CommandList->SetGraphicsRootShaderResourceView(RootIndex, SRV.GetGpuVirtualAddress() + Offset);
 }
 
 inline void ComputeContext::SetBufferSRV( UINT RootIndex, const GpuBuffer& SRV, UINT64 Offset)
 {
-    ASSERT((SRV.m_UsageState & D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE) != 0);
+    ASSERT((m_StateTracker.GetState(SRV) & D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE) != 0);
     m_CommandList->SetComputeRootShaderResourceView(RootIndex, SRV.GetGpuVirtualAddress() + Offset);
 }
 
 inline void GraphicsContext::SetBufferUAV( UINT RootIndex, const GpuBuffer& UAV, UINT64 Offset)
 {
-    ASSERT((UAV.m_UsageState & D3D12_RESOURCE_STATE_UNORDERED_ACCESS) != 0);
+    ASSERT((m_StateTracker.GetState(UAV) & D3D12_RESOURCE_STATE_UNORDERED_ACCESS) != 0);
     m_CommandList->SetGraphicsRootUnorderedAccessView(RootIndex, UAV.GetGpuVirtualAddress() + Offset);
 }
 
 inline void ComputeContext::SetBufferUAV( UINT RootIndex, const GpuBuffer& UAV, UINT64 Offset)
 {
-    ASSERT((UAV.m_UsageState & D3D12_RESOURCE_STATE_UNORDERED_ACCESS) != 0);
+    ASSERT((m_StateTracker.GetState(UAV) & D3D12_RESOURCE_STATE_UNORDERED_ACCESS) != 0);
     m_CommandList->SetComputeRootUnorderedAccessView(RootIndex, UAV.GetGpuVirtualAddress() + Offset);
 }
 
@@ -115,19 +115,14 @@ void CommandListManager::CreateNewCommandList( D3D12_COMMAND_LIST_TYPE Type, ID3
     (*List)->SetName(L"CommandList");
 }
 
-uint64_t CommandQueue::ExecuteCommandList( ID3D12CommandList* List )
+uint64_t CommandQueue::ExecuteCommandLists( UINT NumLists, ID3D12CommandList* const* Lists )
 {
     std::lock_guard<std::mutex> LockGuard(m_FenceMutex);
 
-    ASSERT_SUCCEEDED(((ID3D12GraphicsCommandList*)List)->Close());
+    m_CommandQueue->ExecuteCommandLists(NumLists, Lists);
 
-    // Kickoff the command list
-    m_CommandQueue->ExecuteCommandLists(1, &List);
-
-    // Signal the next fence value (with the GPU)
     m_CommandQueue->Signal(m_pFence, m_NextFenceValue);
 
-    // And increment the fence value.  
     return m_NextFenceValue++;
 }
 
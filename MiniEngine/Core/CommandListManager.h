@@ -49,7 +49,8 @@ public:
 
 private:
 
-    uint64_t ExecuteCommandList(ID3D12CommandList* List);
+    // Submits lists that are already closed, in order, with one call and one fence signal
+    uint64_t ExecuteCommandLists(UINT NumLists, ID3D12CommandList* const* Lists);
     ID3D12CommandAllocator* RequestAllocator(void);
     void DiscardAllocator(uint64_t FenceValueForReset, ID3D12CommandAllocator* Allocator);
 
@@ -0,0 +1,113 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// A hash map for objects that are expensive to create and shared between threads, such as
+// pipeline states.  Keys are spread across independently locked shards, and a shard's lock is
+// only held long enough to find or reserve an entry, never while a value is being created.
+// The first thread to ask for a key creates its value.  Threads that ask while that is still
+// in progress block on a future for the same result instead of spinning or compiling it again.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <unordered_map>
+
+template <typename ValueType, size_t ShardCount = 64>
+class CompileOnceMap
+{
+public:
+
+    // Returns the value for Hash, calling Create() to make it if no other thread has.  Created
+    // is set when this call was the one that made the value.
+    template <typename CreateFunc>
+    ValueType GetOrCreate( size_t Hash, CreateFunc Create, bool* Created = nullptr )
+    {
+        Shard& shard = m_Shards[GetShardIndex(Hash)];
+
+        std::shared_future<ValueType> Future;
+        std::unique_ptr< std::promise<ValueType> > Promise;
+        {
+            std::lock_guard<std::mutex> LockGuard(shard.Mutex);
+            auto Iter = shard.Map.find(Hash);
+
+            // Reserve the entry so the next inquiry will find that someone got here first.
+            if (Iter == shard.Map.end())
+            {
+                Promise.reset(new std::promise<ValueType>);
+                Future = Promise->get_future().share();
+                shard.Map.emplace(Hash, Future);
+            }
+            else
+                Future = Iter->second;
+        }
+
+        if (Created != nullptr)
+            *Created = Promise != nullptr;
+
+        if (Promise != nullptr)
+        {
+            try
+            {
+                Promise->set_value(Create());
+            }
+            catch (...)
+            {
+                Promise->set_exception(std::current_exception());
+            }
+        }
+
+        return Future.get();
+    }
+
+    // Drops every entry.  Values still being created are kept alive by their creators.
+    void Clear( void )
+    {
+        for (size_t i = 0; i < ShardCount; ++i)
+        {
+            std::lock_guard<std::mutex> LockGuard(m_Shards[i].Mutex);
+            m_Shards[i].Map.clear();
+        }
+    }
+
+    size_t Size( void )
+    {
+        size_t Count = 0;
+        for (size_t i = 0; i < ShardCount; ++i)
+        {
+            std::lock_guard<std::mutex> LockGuard(m_Shards[i].Mutex);
+            Count += m_Shards[i].Map.size();
+        }
+        return Count;
+    }
+
+private:
+
+    static size_t GetShardIndex( size_t Hash )
+    {
+        // State hashes are CRCs, so fold the high bits in before picking a shard
+        uint64_t Folded = (uint64_t)Hash;
+        return (size_t)((Folded ^ (Folded >> 16) ^ (Folded >> 32)) % ShardCount);
+    }
+
+    // Each shard gets its own cache line so threads working in different shards don't share one
+    struct alignas(64) Shard
+    {
+        std::mutex Mutex;
+        std::unordered_map< size_t, std::shared_future<ValueType> > Map;
+    };
+
+    Shard m_Shards[ShardCount];
+};
@@ -15,52 +15,404 @@
 #include "DescriptorHeap.h"
 #include "GraphicsCore.h"
 #include "CommandListManager.h"
+#include <algorithm>
 
 using namespace Graphics;
 
+//
+// DescriptorRangeAllocator implementation
+//
+void DescriptorRangeAllocator::Reset( uint32_t Capacity )
+{
+    m_FreeByOffset.clear();
+    m_FreeBySize.clear();
+    m_Capacity = Capacity;
+    m_FreeCount = 0;
+
+    if (Capacity > 0)
+        AddRange(0, Capacity);
+}
+
+uint32_t DescriptorRangeAllocator::Allocate( uint32_t Count )
+{
+    ASSERT(Count > 0);
+
+    auto BestFit = m_FreeBySize.lower_bound(Count);
+    if (BestFit == m_FreeBySize.end())
+        return kInvalidOffset;
+
+    uint32_t Offset = BestFit->second;
+    uint32_t RangeCount = BestFit->first;
+
+    RemoveRange(m_FreeByOffset.find(Offset));
+    if (RangeCount > Count)
+        AddRange(Offset + Count, RangeCount - Count);
+
+    return Offset;
+}
+
+void DescriptorRangeAllocator::Free( uint32_t Offset, uint32_t Count )
+{
+    ASSERT(Count > 0 && Offset + Count <= m_Capacity);
+
+    // Merge with the free ranges on either side
+    auto Next = m_FreeByOffset.lower_bound(Offset);
+    ASSERT(Next == m_FreeByOffset.end() || Next->first >= Offset + Count, "Descriptors freed twice");
+
+    if (Next != m_FreeByOffset.begin())
+    {
+        auto Prev = std::prev(Next);
+        ASSERT(Prev->first + Prev->second <= Offset, "Descriptors freed twice");
+
+        if (Prev->first + Prev->second == Offset)
+        {
+            Offset = Prev->first;
+            Count += Prev->second;
+            RemoveRange(Prev);
+        }
+    }
+
+    if (Next != m_FreeByOffset.end() && Next->first == Offset + Count)
+    {
+        Count += Next->second;
+        RemoveRange(Next);
+    }
+
+    AddRange(Offset, Count);
+}
+
+void DescriptorRangeAllocator::AddRange( uint32_t Offset, uint32_t Count )
+{
+    m_FreeByOffset.emplace(Offset, Count);
+    m_FreeBySize.emplace(Count, Offset);
+    m_FreeCount += Count;
+}
+
+void DescriptorRangeAllocator::RemoveRange( std::map<uint32_t, uint32_t>::iterator Range )
+{
+    auto SizeRange = m_FreeBySize.equal_range(Range->second);
+    for (auto Iter = SizeRange.first; Iter != SizeRange.second; ++Iter)
+    {
+        if (Iter->second == Range->first)
+        {
+            m_FreeBySize.erase(Iter);
+            break;
+        }
+    }
+
+    m_FreeCount -= Range->second;
+    m_FreeByOffset.erase(Range);
+}
+
+//
+// DescriptorHeapBackend implementation
+//
+namespace
+{
+    class DeviceDescriptorHeapBackend : public DescriptorHeapBackend
+    {
+    public:
+        virtual uint32_t GetDescriptorSize( D3D12_DESCRIPTOR_HEAP_TYPE Type ) override
+        {
+            return g_Device->GetDescriptorHandleIncrementSize(Type);
+        }
+
+        virtual Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> CreateHeap( const D3D12_DESCRIPTOR_HEAP_DESC& Desc,
+            D3D12_CPU_DESCRIPTOR_HANDLE& CpuStart, D3D12_GPU_DESCRIPTOR_HANDLE& GpuStart ) override
+        {
+            Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> pHeap;
+            ASSERT_SUCCEEDED(g_Device->CreateDescriptorHeap(&Desc, MY_IID_PPV_ARGS(&pHeap)));
+
+            CpuStart = pHeap->GetCPUDescriptorHandleForHeapStart();
+            if (Desc.Flags & D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE)
+                GpuStart = pHeap->GetGPUDescriptorHandleForHeapStart();
+            else
+                GpuStart.ptr = D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN;
+
+            return pHeap;
+        }
+
+        virtual bool IsFenceComplete( uint64_t FenceValue ) override
+        {
+            return g_CommandManager.IsFenceComplete(FenceValue);
+        }
+    };
+}
+
+DescriptorHeapBackend& DescriptorHeapBackend::GetDefault( void )
+{
+    static DeviceDescriptorHeapBackend s_DeviceBackend;
+    return s_DeviceBackend;
+}
+
 //
 // DescriptorAllocator implementation
 //
-std::mutex DescriptorAllocator::sm_AllocationMutex;
-std::vector<Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>> DescriptorAllocator::sm_DescriptorHeapPool;
+std::atomic<uint64_t> DescriptorAllocator::sm_NextOwnerId(1);
+
+namespace
+{
+    // Constructed by the first allocator, so it outlives the global ones
+    std::mutex& GetRegistryMutex( void )
+    {
+        static std::mutex s_RegistryMutex;
+        return s_RegistryMutex;
+    }
+
+    std::vector<DescriptorAllocator*>& GetRegistry( void )
+    {
+        static std::vector<DescriptorAllocator*> s_Allocators;
+        return s_Allocators;
+    }
+}
+
+DescriptorAllocator::DescriptorAllocator( D3D12_DESCRIPTOR_HEAP_TYPE Type, DescriptorHeapBackend* Backend,
+    uint32_t NumDescriptorsPerHeap, bool UseThreadCache )
+    : m_Backend(Backend != nullptr ? *Backend : DescriptorHeapBackend::GetDefault()), m_Type(Type),
+    m_NumDescriptorsPerHeap(NumDescriptorsPerHeap), m_UseThreadCache(UseThreadCache), m_OwnerId(sm_NextOwnerId++),
+    m_CurrentHeap(0), m_DescriptorSize(0), m_PendingFreeCount(0), m_ThreadCachedCount(0)
+{
+    std::lock_guard<std::mutex> LockGuard(GetRegistryMutex());
+    GetRegistry().push_back(this);
+}
+
+DescriptorAllocator::~DescriptorAllocator()
+{
+    std::lock_guard<std::mutex> LockGuard(GetRegistryMutex());
+    std::vector<DescriptorAllocator*>& Registry = GetRegistry();
+    Registry.erase(std::find(Registry.begin(), Registry.end(), this));
+}
+
+void DescriptorAllocator::Destroy(void)
+{
+    std::lock_guard<std::mutex> LockGuard(m_AllocationMutex);
+
+    m_Heaps.clear();
+    m_HeapsByAddress.clear();
+    m_PendingFrees.clear();
+    m_CurrentHeap = 0;
+    m_PendingFreeCount = 0;
+    m_ThreadCachedCount = 0;
+
+    // Orphan whatever other threads still have cached
+    m_OwnerId = sm_NextOwnerId++;
+}
 
 void DescriptorAllocator::DestroyAll(void)
 {
-    sm_DescriptorHeapPool.clear();
+    std::lock_guard<std::mutex> LockGuard(GetRegistryMutex());
+    for (DescriptorAllocator* Allocator : GetRegistry())
+        Allocator->Destroy();
+}
+
+DescriptorAllocator::ThreadCache::~ThreadCache()
+{
+    // Hand cached descriptors back when the thread exits rather than stranding them.  The allocator may
+    // have been deleted by now, so only return them to one that is still registered and wasn't destroyed
+    // since they were cached.
+    if (Owner == nullptr || Count == 0)
+        return;
+
+    std::lock_guard<std::mutex> RegistryGuard(GetRegistryMutex());
+    std::vector<DescriptorAllocator*>& Registry = GetRegistry();
+    if (std::find(Registry.begin(), Registry.end(), Owner) == Registry.end())
+        return;
+
+    std::lock_guard<std::mutex> LockGuard(Owner->m_AllocationMutex);
+    if (Owner->m_OwnerId != OwnerId)
+        return;
+
+    for (uint32_t i = 0; i < Count; ++i)
+        Owner->FreeLocked(Handles[i], 1);
+    Owner->m_ThreadCachedCount -= Count;
+}
+
+DescriptorAllocator::ThreadCache& DescriptorAllocator::GetThreadCache( D3D12_DESCRIPTOR_HEAP_TYPE Type )
+{
+    static thread_local ThreadCache t_ThreadCaches[D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES];
+    return t_ThreadCaches[Type];
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE DescriptorAllocator::Allocate( uint32_t Count )
+{
+    if (Count == 1 && m_UseThreadCache)
+    {
+        ThreadCache& Cache = GetThreadCache(m_Type);
+
+        // Descriptors cached for an allocator that has since been destroyed are simply dropped
+        if (Cache.OwnerId != m_OwnerId)
+            Cache.Count = 0;
+
+        if (Cache.Count == 0)
+        {
+            // Refill half of the cache so the next few frees don't immediately overflow it
+            std::lock_guard<std::mutex> LockGuard(m_AllocationMutex);
+            Cache.Owner = this;
+            Cache.OwnerId = m_OwnerId;
+            for (uint32_t i = 0; i < sm_ThreadCacheSize / 2; ++i)
+                Cache.Handles[Cache.Count++] = AllocateLocked(1);
+            m_ThreadCachedCount += sm_ThreadCacheSize / 2;
+        }
+
+        --m_ThreadCachedCount;
+        return Cache.Handles[--Cache.Count];
+    }
+
+    std::lock_guard<std::mutex> LockGuard(m_AllocationMutex);
+    return AllocateLocked(Count);
+}
+
+void DescriptorAllocator::Free( D3D12_CPU_DESCRIPTOR_HANDLE Handle, uint32_t Count, uint64_t FenceValue )
+{
+    ASSERT(Handle.ptr != 0 && Handle.ptr != D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN, "Freeing a null descriptor");
+
+    if (FenceValue != 0 && m_Backend.IsFenceComplete(FenceValue))
+        FenceValue = 0;
+
+    if (Count == 1 && FenceValue == 0 && m_UseThreadCache)
+    {
+        ThreadCache& Cache = GetThreadCache(m_Type);
+
+        if (Cache.OwnerId != m_OwnerId)
+        {
+            Cache.Owner = this;
+            Cache.OwnerId = m_OwnerId;
+            Cache.Count = 0;
+        }
+
+        if (Cache.Count < sm_ThreadCacheSize)
+        {
+            Cache.Handles[Cache.Count++] = Handle;
+            ++m_ThreadCachedCount;
+            return;
+        }
+
+        // Full, so give back the older half along with this one
+        std::lock_guard<std::mutex> LockGuard(m_AllocationMutex);
+        uint32_t NumReturned = sm_ThreadCacheSize / 2;
+        for (uint32_t i = 0; i < NumReturned; ++i)
+            FreeLocked(Cache.Handles[i], 1);
+        for (uint32_t i = NumReturned; i < Cache.Count; ++i)
+            Cache.Handles[i - NumReturned] = Cache.Handles[i];
+        Cache.Count -= NumReturned;
+        m_ThreadCachedCount -= NumReturned;
+        FreeLocked(Handle, 1);
+        return;
+    }
+
+    std::lock_guard<std::mutex> LockGuard(m_AllocationMutex);
+
+    if (FenceValue == 0)
+    {
+        FreeLocked(Handle, Count);
+        return;
+    }
+
+    uint32_t HeapIndex = FindHeap(Handle);
+    PendingFree Pending;
+    Pending.FenceValue = FenceValue;
+    Pending.HeapIndex = HeapIndex;
+    Pending.Offset = (uint32_t)((Handle.ptr - m_Heaps[HeapIndex].CpuStart.ptr) / m_DescriptorSize);
+    Pending.Count = Count;
+    m_PendingFrees.push_back(Pending);
+    m_PendingFreeCount += Count;
 }
 
-ID3D12DescriptorHeap* DescriptorAllocator::RequestNewHeap(D3D12_DESCRIPTOR_HEAP_TYPE Type)
+D3D12_CPU_DESCRIPTOR_HANDLE DescriptorAllocator::AllocateLocked( uint32_t Count )
 {
-    std::lock_guard<std::mutex> LockGuard(sm_AllocationMutex);
+    ReclaimPendingFrees();
+
+    if (m_DescriptorSize == 0)
+        m_DescriptorSize = m_Backend.GetDescriptorSize(m_Type);
+
+    // Keep filling the current heap, then look for room in the others before creating a new one
+    uint32_t NumHeaps = (uint32_t)m_Heaps.size();
+    for (uint32_t i = 0; i < NumHeaps; ++i)
+    {
+        uint32_t HeapIndex = (m_CurrentHeap + i) % NumHeaps;
+        uint32_t Offset = m_Heaps[HeapIndex].Ranges.Allocate(Count);
+        if (Offset != DescriptorRangeAllocator::kInvalidOffset)
+        {
+            m_CurrentHeap = HeapIndex;
+            D3D12_CPU_DESCRIPTOR_HANDLE ret = m_Heaps[HeapIndex].CpuStart;
+            ret.ptr += (SIZE_T)Offset * m_DescriptorSize;
+            return ret;
+        }
+    }
 
     D3D12_DESCRIPTOR_HEAP_DESC Desc;
-    Desc.Type = Type;
-    Desc.NumDescriptors = sm_NumDescriptorsPerHeap;
+    Desc.Type = m_Type;
+    Desc.NumDescriptors = std::max(m_NumDescriptorsPerHeap, Count);
     Desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
     Desc.NodeMask = 1;
 
-    Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> pHeap;
-    ASSERT_SUCCEEDED(Graphics::g_Device->CreateDescriptorHeap(&Desc, MY_IID_PPV_ARGS(&pHeap)));
-    sm_DescriptorHeapPool.emplace_back(pHeap);
-    return pHeap.Get();
+    Heap NewHeap;
+    D3D12_GPU_DESCRIPTOR_HANDLE GpuStart;
+    NewHeap.Heap = m_Backend.CreateHeap(Desc, NewHeap.CpuStart, GpuStart);
+    NewHeap.Ranges.Reset(Desc.NumDescriptors);
+
+    m_CurrentHeap = (uint32_t)m_Heaps.size();
+    m_HeapsByAddress[NewHeap.CpuStart.ptr] = m_CurrentHeap;
+    m_Heaps.push_back(std::move(NewHeap));
+
+    uint32_t Offset = m_Heaps[m_CurrentHeap].Ranges.Allocate(Count);
+    ASSERT(Offset == 0);
+    return m_Heaps[m_CurrentHeap].CpuStart;
 }
 
-D3D12_CPU_DESCRIPTOR_HANDLE DescriptorAllocator::Allocate( uint32_t Count )
+void DescriptorAllocator::FreeLocked( D3D12_CPU_DESCRIPTOR_HANDLE Handle, uint32_t Count )
+{
+    uint32_t HeapIndex = FindHeap(Handle);
+    m_Heaps[HeapIndex].Ranges.Free((uint32_t)((Handle.ptr - m_Heaps[HeapIndex].CpuStart.ptr) / m_DescriptorSize), Count);
+}
+
+void DescriptorAllocator::ReclaimPendingFrees( void )
 {
-    if (m_CurrentHeap == nullptr || m_RemainingFreeHandles < Count)
+    // Fences from different queues may complete out of order, but holding a few descriptors a little
+    // longer is cheaper than scanning the whole list every time
+    while (!m_PendingFrees.empty() && m_Backend.IsFenceComplete(m_PendingFrees.front().FenceValue))
     {
-        m_CurrentHeap = RequestNewHeap(m_Type);
-        m_CurrentHandle = m_CurrentHeap->GetCPUDescriptorHandleForHeapStart();
-        m_RemainingFreeHandles = sm_NumDescriptorsPerHeap;
+        const PendingFree& Pending = m_PendingFrees.front();
+        m_Heaps[Pending.HeapIndex].Ranges.Free(Pending.Offset, Pending.Count);
+        m_PendingFreeCount -= Pending.Count;
+        m_PendingFrees.pop_front();
+    }
+}
+
+uint32_t DescriptorAllocator::FindHeap( D3D12_CPU_DESCRIPTOR_HANDLE Handle ) const
+{
+    auto Iter = m_HeapsByAddress.upper_bound(Handle.ptr);
+    ASSERT(Iter != m_HeapsByAddress.begin(), "Descriptor was not allocated here");
+    --Iter;
+
+    uint32_t HeapIndex = Iter->second;
+    ASSERT(Handle.ptr < m_Heaps[HeapIndex].CpuStart.ptr + (SIZE_T)m_Heaps[HeapIndex].Ranges.GetCapacity() * m_DescriptorSize,
+        "Descriptor was not allocated here");
+    return HeapIndex;
+}
+
+DescriptorAllocatorStats DescriptorAllocator::GetStats( void )
+{
+    std::lock_guard<std::mutex> LockGuard(m_AllocationMutex);
+
+    DescriptorAllocatorStats Stats = {};
+    uint32_t FreeCount = 0;
 
-        if (m_DescriptorSize == 0)
-            m_DescriptorSize = Graphics::g_Device->GetDescriptorHandleIncrementSize(m_Type);
+    for (const Heap& CurHeap : m_Heaps)
+    {
+        Stats.TotalDescriptors += CurHeap.Ranges.GetCapacity();
+        Stats.FreeRanges += CurHeap.Ranges.GetFreeRangeCount();
+        Stats.LargestFreeRange = std::max(Stats.LargestFreeRange, CurHeap.Ranges.GetLargestFreeRange());
+        FreeCount += CurHeap.Ranges.GetFreeCount();
     }
 
-    D3D12_CPU_DESCRIPTOR_HANDLE ret = m_CurrentHandle;
-    m_CurrentHandle.ptr += Count * m_DescriptorSize;
-    m_RemainingFreeHandles -= Count;
-    return ret;
+    Stats.NumHeaps = (uint32_t)m_Heaps.size();
+    Stats.AllocatedDescriptors = Stats.TotalDescriptors - FreeCount;
+    Stats.PendingFreeDescriptors = m_PendingFreeCount;
+    Stats.ThreadCachedDescriptors = m_ThreadCachedCount;
+    Stats.Occupancy = Stats.TotalDescriptors > 0 ? (float)Stats.AllocatedDescriptors / Stats.TotalDescriptors : 0.0f;
+    Stats.Fragmentation = FreeCount > 0 ? 1.0f - (float)Stats.LargestFreeRange / FreeCount : 0.0f;
+    return Stats;
 }
 
 //
@@ -69,25 +421,91 @@ D3D12_CPU_DESCRIPTOR_HANDLE DescriptorAllocator::Allocate( uint32_t Count )
 
 void UserDescriptorHeap::Create( const std::wstring& DebugHeapName )
 {
-    ASSERT_SUCCEEDED(Graphics::g_Device->CreateDescriptorHeap(&m_HeapDesc, MY_IID_PPV_ARGS(m_Heap.ReleaseAndGetAddressOf())));
+    D3D12_CPU_DESCRIPTOR_HANDLE CpuStart;
+    D3D12_GPU_DESCRIPTOR_HANDLE GpuStart;
+    m_Heap = m_Backend.CreateHeap(m_HeapDesc, CpuStart, GpuStart);
 #ifdef RELEASE
     (void)DebugHeapName;
 #else
-    m_Heap->SetName(DebugHeapName.c_str());
+    if (m_Heap != nullptr)
+        m_Heap->SetName(DebugHeapName.c_str());
 #endif
 
-    m_DescriptorSize = Graphics::g_Device->GetDescriptorHandleIncrementSize(m_HeapDesc.Type);
-    m_NumFreeDescriptors = m_HeapDesc.NumDescriptors;
-    m_FirstHandle = DescriptorHandle( m_Heap->GetCPUDescriptorHandleForHeapStart(),  m_Heap->GetGPUDescriptorHandleForHeapStart() );
-    m_NextFreeHandle = m_FirstHandle;
+    m_DescriptorSize = m_Backend.GetDescriptorSize(m_HeapDesc.Type);
+    m_FirstHandle = DescriptorHandle(CpuStart, GpuStart);
+    m_FreeRanges.Reset(m_HeapDesc.NumDescriptors);
+    m_PendingFrees.clear();
+    m_PendingFreeCount = 0;
+}
+
+void UserDescriptorHeap::Destroy( void )
+{
+    m_Heap = nullptr;
+    m_FirstHandle = DescriptorHandle();
+    m_FreeRanges.Reset(0);
+    m_PendingFrees.clear();
+    m_PendingFreeCount = 0;
+}
+
+bool UserDescriptorHeap::HasAvailableSpace( uint32_t Count )
+{
+    ReclaimPendingFrees();
+    return Count <= m_FreeRanges.GetLargestFreeRange();
 }
 
 DescriptorHandle UserDescriptorHeap::Alloc( uint32_t Count )
 {
-    ASSERT(HasAvailableSpace(Count), "Descriptor Heap out of space.  Increase heap size.");
-    DescriptorHandle ret = m_NextFreeHandle;
-    m_NextFreeHandle += Count * m_DescriptorSize;
-    return ret;
+    ReclaimPendingFrees();
+
+    uint32_t Offset = m_FreeRanges.Allocate(Count);
+    ASSERT(Offset != DescriptorRangeAllocator::kInvalidOffset, "Descriptor Heap out of space.  Increase heap size.");
+    return GetHandleAtOffset(Offset);
+}
+
+void UserDescriptorHeap::Free( const DescriptorHandle& DHandle, uint32_t Count, uint64_t FenceValue )
+{
+    ASSERT(ValidateHandle(DHandle));
+
+    uint32_t Offset = GetOffsetOfHandle(DHandle);
+
+    if (FenceValue == 0 || m_Backend.IsFenceComplete(FenceValue))
+    {
+        m_FreeRanges.Free(Offset, Count);
+        return;
+    }
+
+    PendingFree Pending;
+    Pending.FenceValue = FenceValue;
+    Pending.Offset = Offset;
+    Pending.Count = Count;
+    m_PendingFrees.push_back(Pending);
+    m_PendingFreeCount += Count;
+}
+
+void UserDescriptorHeap::ReclaimPendingFrees( void )
+{
+    while (!m_PendingFrees.empty() && m_Backend.IsFenceComplete(m_PendingFrees.front().FenceValue))
+    {
+        m_FreeRanges.Free(m_PendingFrees.front().Offset, m_PendingFrees.front().Count);
+        m_PendingFreeCount -= m_PendingFrees.front().Count;
+        m_PendingFrees.pop_front();
+    }
+}
+
+DescriptorAllocatorStats UserDescriptorHeap::GetStats( void ) const
+{
+    DescriptorAllocatorStats Stats = {};
+    uint32_t FreeCount = m_FreeRanges.GetFreeCount();
+
+    Stats.NumHeaps = m_FreeRanges.GetCapacity() > 0 ? 1 : 0;
+    Stats.TotalDescriptors = m_FreeRanges.GetCapacity();
+    Stats.AllocatedDescriptors = Stats.TotalDescriptors - FreeCount;
+    Stats.PendingFreeDescriptors = m_PendingFreeCount;
+    Stats.FreeRanges = m_FreeRanges.GetFreeRangeCount();
+    Stats.LargestFreeRange = m_FreeRanges.GetLargestFreeRange();
+    Stats.Occupancy = Stats.TotalDescriptors > 0 ? (float)Stats.AllocatedDescriptors / Stats.TotalDescriptors : 0.0f;
+    Stats.Fragmentation = FreeCount > 0 ? 1.0f - (float)Stats.LargestFreeRange / FreeCount : 0.0f;
+    return Stats;
 }
 
 bool UserDescriptorHeap::ValidateHandle( const DescriptorHandle& DHandle ) const
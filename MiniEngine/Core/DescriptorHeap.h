@@ -17,32 +17,152 @@
 #include <vector>
 #include <queue>
 #include <string>
+#include <map>
+#include <deque>
+#include <atomic>
 
+// Tracks the free space of one descriptor heap as ranges of offsets.  Free ranges are indexed by offset,
+// so freed neighbors coalesce, and by size, so an allocation takes the smallest range that fits.  It
+// never touches a heap itself.
+class DescriptorRangeAllocator
+{
+public:
+    static const uint32_t kInvalidOffset = 0xFFFFFFFF;
+
+    DescriptorRangeAllocator() : m_Capacity(0), m_FreeCount(0) {}
+
+    void Reset( uint32_t Capacity );
+
+    // Returns kInvalidOffset if no free range is large enough
+    uint32_t Allocate( uint32_t Count );
+    void Free( uint32_t Offset, uint32_t Count );
+
+    uint32_t GetCapacity( void ) const { return m_Capacity; }
+    uint32_t GetFreeCount( void ) const { return m_FreeCount; }
+    uint32_t GetFreeRangeCount( void ) const { return (uint32_t)m_FreeByOffset.size(); }
+    uint32_t GetLargestFreeRange( void ) const { return m_FreeBySize.empty() ? 0 : m_FreeBySize.rbegin()->first; }
+
+private:
+    void AddRange( uint32_t Offset, uint32_t Count );
+    void RemoveRange( std::map<uint32_t, uint32_t>::iterator Range );
+
+    std::map<uint32_t, uint32_t> m_FreeByOffset;        // Offset -> count
+    std::multimap<uint32_t, uint32_t> m_FreeBySize;     // Count -> offset
+    uint32_t m_Capacity;
+    uint32_t m_FreeCount;
+};
+
+// Creates descriptor heaps and reports fence completion for the allocators below.  The default one uses
+// the device and the command queues.  A test can substitute one that hands out made-up address ranges
+// and controls which fences have completed.
+class DescriptorHeapBackend
+{
+public:
+    virtual ~DescriptorHeapBackend() {}
+
+    virtual uint32_t GetDescriptorSize( D3D12_DESCRIPTOR_HEAP_TYPE Type ) = 0;
+    virtual Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> CreateHeap( const D3D12_DESCRIPTOR_HEAP_DESC& Desc,
+        D3D12_CPU_DESCRIPTOR_HANDLE& CpuStart, D3D12_GPU_DESCRIPTOR_HANDLE& GpuStart ) = 0;
+    virtual bool IsFenceComplete( uint64_t FenceValue ) = 0;
+
+    static DescriptorHeapBackend& GetDefault( void );
+};
+
+struct DescriptorAllocatorStats
+{
+    uint32_t NumHeaps;
+    uint32_t TotalDescriptors;
+    uint32_t AllocatedDescriptors;      // Includes pending frees and thread caches
+    uint32_t PendingFreeDescriptors;    // Waiting for a fence before they can be reused
+    uint32_t ThreadCachedDescriptors;
+    uint32_t FreeRanges;
+    uint32_t LargestFreeRange;
+    float Occupancy;                    // Allocated / total
+    float Fragmentation;                // 1 - largest free range / free descriptors
+};
 
 // This is an unbounded resource descriptor allocator.  It is intended to provide space for CPU-visible resource descriptors
 // as resources are created.  For those that need to be made shader-visible, they will need to be copied to a UserDescriptorHeap
 // or a DynamicDescriptorHeap.
+//
+// Descriptors can be freed, optionally after a fence, and are reused by later allocations.  Single descriptors, by far
+// the most common request, are served from small per-thread caches so that loader threads rarely take the lock.  Each
+// thread has one cache per heap type, so only one allocator per type should enable them; a thread that switches between
+// two drops what it had cached for the other.
 class DescriptorAllocator
 {
 public:
-    DescriptorAllocator(D3D12_DESCRIPTOR_HEAP_TYPE Type) : m_Type(Type), m_CurrentHeap(nullptr) {}
+    DescriptorAllocator(D3D12_DESCRIPTOR_HEAP_TYPE Type, DescriptorHeapBackend* Backend = nullptr,
+        uint32_t NumDescriptorsPerHeap = sm_NumDescriptorsPerHeap, bool UseThreadCache = true);
+    ~DescriptorAllocator();
 
     D3D12_CPU_DESCRIPTOR_HANDLE Allocate( uint32_t Count );
 
+    // A fence value of zero makes the descriptors available again right away.  Otherwise they are reused once
+    // the fence completes.
+    void Free( D3D12_CPU_DESCRIPTOR_HANDLE Handle, uint32_t Count = 1, uint64_t FenceValue = 0 );
+
+    DescriptorAllocatorStats GetStats( void );
+
+    // Releases this allocator's heaps.  Every descriptor it handed out becomes invalid.
+    void Destroy( void );
+
     static void DestroyAll(void);
 
 protected:
 
-    static const uint32_t sm_NumDescriptorsPerHeap = 256;
-    static std::mutex sm_AllocationMutex;
-    static std::vector<Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>> sm_DescriptorHeapPool;
-    static ID3D12DescriptorHeap* RequestNewHeap( D3D12_DESCRIPTOR_HEAP_TYPE Type );
+    static const uint32_t sm_NumDescriptorsPerHeap = 1024;
+    static const uint32_t sm_ThreadCacheSize = 32;
+
+    struct Heap
+    {
+        Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> Heap;
+        D3D12_CPU_DESCRIPTOR_HANDLE CpuStart;
+        DescriptorRangeAllocator Ranges;
+    };
+
+    struct PendingFree
+    {
+        uint64_t FenceValue;
+        uint32_t HeapIndex;
+        uint32_t Offset;
+        uint32_t Count;
+    };
+
+    struct ThreadCache
+    {
+        ThreadCache() : Owner(nullptr), OwnerId(0), Count(0) {}
+        ~ThreadCache();
+
+        DescriptorAllocator* Owner;
+        uint64_t OwnerId;
+        uint32_t Count;
+        D3D12_CPU_DESCRIPTOR_HANDLE Handles[sm_ThreadCacheSize];
+    };
+
+    static ThreadCache& GetThreadCache( D3D12_DESCRIPTOR_HEAP_TYPE Type );
+    static std::atomic<uint64_t> sm_NextOwnerId;
 
+    // These require m_AllocationMutex
+    D3D12_CPU_DESCRIPTOR_HANDLE AllocateLocked( uint32_t Count );
+    void FreeLocked( D3D12_CPU_DESCRIPTOR_HANDLE Handle, uint32_t Count );
+    void ReclaimPendingFrees( void );
+    uint32_t FindHeap( D3D12_CPU_DESCRIPTOR_HANDLE Handle ) const;
+
+    DescriptorHeapBackend& m_Backend;
     D3D12_DESCRIPTOR_HEAP_TYPE m_Type;
-    ID3D12DescriptorHeap* m_CurrentHeap;
-    D3D12_CPU_DESCRIPTOR_HANDLE m_CurrentHandle;
+    uint32_t m_NumDescriptorsPerHeap;
+    bool m_UseThreadCache;
+    uint64_t m_OwnerId;     // Identifies this allocator's entries in thread caches, changes when destroyed
+
+    std::mutex m_AllocationMutex;
+    std::vector<Heap> m_Heaps;
+    std::map<SIZE_T, uint32_t> m_HeapsByAddress;
+    std::deque<PendingFree> m_PendingFrees;
+    uint32_t m_CurrentHeap;
     uint32_t m_DescriptorSize;
-    uint32_t m_RemainingFreeHandles;
+    uint32_t m_PendingFreeCount;
+    std::atomic<uint32_t> m_ThreadCachedCount;
 };
 
 
@@ -97,7 +217,8 @@ class UserDescriptorHeap
 {
 public:
 
-    UserDescriptorHeap( D3D12_DESCRIPTOR_HEAP_TYPE Type, uint32_t MaxCount )
+    UserDescriptorHeap( D3D12_DESCRIPTOR_HEAP_TYPE Type, uint32_t MaxCount, DescriptorHeapBackend* Backend = nullptr )
+        : m_Backend(Backend != nullptr ? *Backend : DescriptorHeapBackend::GetDefault()), m_PendingFreeCount(0)
     {
         m_HeapDesc.Type = Type;
         m_HeapDesc.NumDescriptors = MaxCount;
@@ -106,11 +227,26 @@ public:
     }
 
     void Create( const std::wstring& DebugHeapName );
+    void Destroy( void );
+
+    // True if Count consecutive descriptors are free, counting those whose fences have completed
+    bool HasAvailableSpace( uint32_t Count );
 
-    bool HasAvailableSpace( uint32_t Count ) const { return Count <= m_NumFreeDescriptors; }
+    // The fence the oldest pending free is waiting on, or zero if none are pending
+    uint64_t GetOldestPendingFreeFence( void ) const { return m_PendingFrees.empty() ? 0 : m_PendingFrees.front().FenceValue; }
     DescriptorHandle Alloc( uint32_t Count = 1 );
 
+    // Shader-visible descriptors are usually still referenced by command lists in flight, so pass the fence
+    // that follows their last use.  Zero makes them available right away.
+    void Free( const DescriptorHandle& DHandle, uint32_t Count = 1, uint64_t FenceValue = 0 );
+
+    DescriptorAllocatorStats GetStats( void ) const;
+
     DescriptorHandle GetHandleAtOffset( uint32_t Offset ) const { return m_FirstHandle + Offset * m_DescriptorSize; }
+    uint32_t GetOffsetOfHandle( const DescriptorHandle& DHandle ) const
+    {
+        return (uint32_t)((DHandle.GetCpuHandle().ptr - m_FirstHandle.GetCpuHandle().ptr) / m_DescriptorSize);
+    }
 
     bool ValidateHandle( const DescriptorHandle& DHandle ) const;
 
@@ -118,10 +254,21 @@ public:
 
 private:
 
+    struct PendingFree
+    {
+        uint64_t FenceValue;
+        uint32_t Offset;
+        uint32_t Count;
+    };
+
+    void ReclaimPendingFrees( void );
+
+    DescriptorHeapBackend& m_Backend;
     Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> m_Heap;
     D3D12_DESCRIPTOR_HEAP_DESC m_HeapDesc;
     uint32_t m_DescriptorSize;
-    uint32_t m_NumFreeDescriptors;
     DescriptorHandle m_FirstHandle;
-    DescriptorHandle m_NextFreeHandle;
+    DescriptorRangeAllocator m_FreeRanges;
+    std::deque<PendingFree> m_PendingFrees;
+    uint32_t m_PendingFreeCount;
 };
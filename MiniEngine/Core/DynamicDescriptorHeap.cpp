@@ -17,6 +17,7 @@
 #include "GraphicsCore.h"
 #include "CommandListManager.h"
 #include "RootSignature.h"
+#include "BindlessDescriptorHeap.h"
 
 using namespace Graphics;
 
@@ -28,6 +29,7 @@ std::mutex DynamicDescriptorHeap::sm_Mutex;
 std::vector<Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>> DynamicDescriptorHeap::sm_DescriptorHeapPool[2];
 std::queue<std::pair<uint64_t, ID3D12DescriptorHeap*>> DynamicDescriptorHeap::sm_RetiredDescriptorHeaps[2];
 std::queue<ID3D12DescriptorHeap*> DynamicDescriptorHeap::sm_AvailableDescriptorHeaps[2];
+std::atomic<uint64_t> DynamicDescriptorHeap::sm_NumDescriptorsCopied(0);
 
 ID3D12DescriptorHeap* DynamicDescriptorHeap::RequestDescriptorHeap(D3D12_DESCRIPTOR_HEAP_TYPE HeapType)
 {
@@ -79,7 +81,10 @@ void DynamicDescriptorHeap::RetireCurrentHeap( void )
     }
 
     ASSERT(m_CurrentHeapPtr != nullptr);
-    m_RetiredHeaps.push_back(m_CurrentHeapPtr);
+    if (m_CurrentHeapIsBlock)
+        m_RetiredBlocks.push_back(m_FirstDescriptor);
+    else
+        m_RetiredHeaps.push_back(m_CurrentHeapPtr);
     m_CurrentHeapPtr = nullptr;
     m_CurrentOffset = 0;
 }
@@ -88,6 +93,10 @@ void DynamicDescriptorHeap::RetireUsedHeaps( uint64_t fenceValue )
 {
     DiscardDescriptorHeaps(m_DescriptorType, fenceValue, m_RetiredHeaps);
     m_RetiredHeaps.clear();
+
+    for (const DescriptorHandle& Block : m_RetiredBlocks)
+        g_BindlessDescriptorHeap.FreeDynamicBlock(Block, kNumDescriptorsPerHeap, fenceValue);
+    m_RetiredBlocks.clear();
 }
 
 DynamicDescriptorHeap::DynamicDescriptorHeap(CommandContext& OwningContext, D3D12_DESCRIPTOR_HEAP_TYPE HeapType)
@@ -95,6 +104,7 @@ DynamicDescriptorHeap::DynamicDescriptorHeap(CommandContext& OwningContext, D3D1
 {
     m_CurrentHeapPtr = nullptr;
     m_CurrentOffset = 0;
+    m_CurrentHeapIsBlock = false;
     m_DescriptorSize = Graphics::g_Device->GetDescriptorHandleIncrementSize(HeapType);
 }
 
@@ -115,10 +125,22 @@ inline ID3D12DescriptorHeap* DynamicDescriptorHeap::GetHeapPointer()
     if (m_CurrentHeapPtr == nullptr)
     {
         ASSERT(m_CurrentOffset == 0);
-        m_CurrentHeapPtr = RequestDescriptorHeap(m_DescriptorType);
-        m_FirstDescriptor = DescriptorHandle(
-            m_CurrentHeapPtr->GetCPUDescriptorHandleForHeapStart(),
-            m_CurrentHeapPtr->GetGPUDescriptorHandleForHeapStart());
+
+        // Tables bound directly in the bindless heap, like ModelViewer's materials, only stay valid while
+        // it is the bound heap, so CBV_SRV_UAV tables never move to a heap of their own once it exists
+        m_CurrentHeapIsBlock = m_DescriptorType == D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV && g_BindlessDescriptorHeap.IsCreated();
+        if (m_CurrentHeapIsBlock)
+        {
+            m_FirstDescriptor = g_BindlessDescriptorHeap.AllocateDynamicBlock(kNumDescriptorsPerHeap);
+            m_CurrentHeapPtr = g_BindlessDescriptorHeap.GetHeapPointer();
+        }
+        else
+        {
+            m_CurrentHeapPtr = RequestDescriptorHeap(m_DescriptorType);
+            m_FirstDescriptor = DescriptorHandle(
+                m_CurrentHeapPtr->GetCPUDescriptorHandleForHeapStart(),
+                m_CurrentHeapPtr->GetGPUDescriptorHandleForHeapStart());
+        }
     }
 
     return m_CurrentHeapPtr;
@@ -143,7 +165,7 @@ uint32_t DynamicDescriptorHeap::DescriptorHandleCache::ComputeStagedSize()
     return NeededSpace;
 }
 
-void DynamicDescriptorHeap::DescriptorHandleCache::CopyAndBindStaleTables(
+uint32_t DynamicDescriptorHeap::DescriptorHandleCache::CopyAndBindStaleTables(
     D3D12_DESCRIPTOR_HEAP_TYPE Type, uint32_t DescriptorSize,
     DescriptorHandle DestHandleStart, ID3D12GraphicsCommandList* CmdList,
     void (STDMETHODCALLTYPE ID3D12GraphicsCommandList::*SetFunc)(UINT, D3D12_GPU_DESCRIPTOR_HANDLE))
@@ -185,6 +207,8 @@ void DynamicDescriptorHeap::DescriptorHandleCache::CopyAndBindStaleTables(
     D3D12_CPU_DESCRIPTOR_HANDLE pSrcDescriptorRangeStarts[kMaxDescriptorsPerCopy];
     UINT pSrcDescriptorRangeSizes[kMaxDescriptorsPerCopy];
 
+    uint32_t NumCopied = 0;
+
     for (uint32_t i = 0; i < StaleParamCount; ++i)
     {
         RootIndex = RootIndices[i];
@@ -233,6 +257,7 @@ void DynamicDescriptorHeap::DescriptorHandleCache::CopyAndBindStaleTables(
                 pSrcDescriptorRangeSizes[NumSrcDescriptorRanges] = 1;
                 ++NumSrcDescriptorRanges;
             }
+            NumCopied += DescriptorCount;
 
             // Move the destination pointer forward by the number of descriptors we will copy
             SrcHandles += DescriptorCount;
@@ -244,6 +269,8 @@ void DynamicDescriptorHeap::DescriptorHandleCache::CopyAndBindStaleTables(
         NumDestDescriptorRanges, pDestDescriptorRangeStarts, pDestDescriptorRangeSizes,
         NumSrcDescriptorRanges, pSrcDescriptorRangeStarts, pSrcDescriptorRangeSizes,
         Type);
+
+    return NumCopied;
 }
     
 void DynamicDescriptorHeap::CopyAndBindStagedTables( DescriptorHandleCache& HandleCache, ID3D12GraphicsCommandList* CmdList,
@@ -259,7 +286,7 @@ void DynamicDescriptorHeap::CopyAndBindStagedTables( DescriptorHandleCache& Hand
 
     // This can trigger the creation of a new heap
     m_OwningContext.SetDescriptorHeap(m_DescriptorType, GetHeapPointer());
-    HandleCache.CopyAndBindStaleTables(m_DescriptorType, m_DescriptorSize, Allocate(NeededSize), CmdList, SetFunc);
+    sm_NumDescriptorsCopied += HandleCache.CopyAndBindStaleTables(m_DescriptorType, m_DescriptorSize, Allocate(NeededSize), CmdList, SetFunc);
 }
 
 void DynamicDescriptorHeap::UnbindAllValid( void )
@@ -282,6 +309,7 @@ D3D12_GPU_DESCRIPTOR_HANDLE DynamicDescriptorHeap::UploadDirect( D3D12_CPU_DESCR
     m_CurrentOffset += 1;
 
     g_Device->CopyDescriptorsSimple(1, DestHandle.GetCpuHandle(), Handle, m_DescriptorType);
+    ++sm_NumDescriptorsCopied;
 
     return DestHandle.GetGpuHandle();
 }
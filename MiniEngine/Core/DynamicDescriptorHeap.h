@@ -17,6 +17,7 @@
 #include "RootSignature.h"
 #include <vector>
 #include <queue>
+#include <atomic>
 
 namespace Graphics
 {
@@ -25,7 +26,8 @@ namespace Graphics
 
 // This class is a linear allocation system for dynamically generated descriptor tables.  It internally caches
 // CPU descriptor handles so that when not enough space is available in the current heap, necessary descriptors
-// can be re-copied to the new heap.
+// can be re-copied to the new heap.  CBV_SRV_UAV tables are carved out of the bindless heap in blocks when it
+// exists, so that it stays bound alongside them.  Sampler tables use heaps of their own.
 class DynamicDescriptorHeap
 {
 public:
@@ -38,6 +40,9 @@ public:
         sm_DescriptorHeapPool[1].clear();
     }
 
+    // The number of descriptors copied into shader-visible heaps so far, by all contexts
+    static uint64_t GetNumDescriptorsCopied(void) { return sm_NumDescriptorsCopied; }
+
     void CleanupUsedHeaps( uint64_t fenceValue );
 
     // Copy multiple handles into the cache area reserved for the specified root parameter.
@@ -86,6 +91,7 @@ private:
     static std::vector<Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>> sm_DescriptorHeapPool[2];
     static std::queue<std::pair<uint64_t, ID3D12DescriptorHeap*>> sm_RetiredDescriptorHeaps[2];
     static std::queue<ID3D12DescriptorHeap*> sm_AvailableDescriptorHeaps[2];
+    static std::atomic<uint64_t> sm_NumDescriptorsCopied;
 
     // Static methods
     static ID3D12DescriptorHeap* RequestDescriptorHeap(D3D12_DESCRIPTOR_HEAP_TYPE HeapType);
@@ -98,7 +104,9 @@ private:
     uint32_t m_DescriptorSize;
     uint32_t m_CurrentOffset;
     DescriptorHandle m_FirstDescriptor;
+    bool m_CurrentHeapIsBlock;      // The current "heap" is a block of the bindless heap
     std::vector<ID3D12DescriptorHeap*> m_RetiredHeaps;
+    std::vector<DescriptorHandle> m_RetiredBlocks;
 
     // Describes a descriptor table entry:  a region of the handle cache and which handles have been set
     struct DescriptorTableCache
@@ -130,7 +138,8 @@ private:
         static const uint32_t kMaxNumDescriptorTables = 16;
 
         uint32_t ComputeStagedSize();
-        void CopyAndBindStaleTables( D3D12_DESCRIPTOR_HEAP_TYPE Type, uint32_t DescriptorSize, DescriptorHandle DestHandleStart, ID3D12GraphicsCommandList* CmdList,
+        // Returns the number of descriptors copied
+        uint32_t CopyAndBindStaleTables( D3D12_DESCRIPTOR_HEAP_TYPE Type, uint32_t DescriptorSize, DescriptorHandle DestHandleStart, ID3D12GraphicsCommandList* CmdList,
             void (STDMETHODCALLTYPE ID3D12GraphicsCommandList::*SetFunc)(UINT, D3D12_GPU_DESCRIPTOR_HANDLE));
 
         DescriptorTableCache m_RootDescriptorTable[kMaxNumDescriptorTables];
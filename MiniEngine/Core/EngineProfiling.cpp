@@ -18,6 +18,7 @@
 #include "GraphRenderer.h"
 #include "GameInput.h"
 #include "GpuTimeManager.h"
+#include "TraceProfiler.h"
 #include "CommandContext.h"
 #include <vector>
 #include <unordered_map>
@@ -195,17 +196,29 @@ class NestedTimingTree
 {
 public:
     NestedTimingTree( const wstring& name, NestedTimingTree* parent = nullptr )
-        : m_Name(name), m_Parent(parent), m_IsExpanded(false), m_IsGraphed(false), m_GraphHandle(PERF_GRAPH_ERROR) {}
+        : m_Name(name), m_Parent(parent), m_IsExpanded(false), m_HasGpuTime(true), m_IsGraphed(false),
+        m_StartBarriers(0), m_NumBarriers(0), m_ChildIndex(0), m_NextChild(0),
+        m_TraceId(parent == nullptr ? 0 : TraceProfiler::RegisterScope(name)),
+        m_GraphHandle(PERF_GRAPH_ERROR) {}
 
     NestedTimingTree* GetChild( const wstring& name )
     {
+        // Blocks usually begin in the same order every frame, so try the one after the last first
+        if (m_NextChild < m_Children.size() && m_Children[m_NextChild]->m_Name == name)
+            return m_Children[m_NextChild++];
+
         auto iter = m_LUT.find(name);
         if (iter != m_LUT.end())
+        {
+            m_NextChild = iter->second->m_ChildIndex + 1;
             return iter->second;
+        }
 
         NestedTimingTree* node = new NestedTimingTree(name, this);
+        node->m_ChildIndex = (uint32_t)m_Children.size();
         m_Children.push_back(node);
         m_LUT[name] = node;
+        m_NextChild = (uint32_t)m_Children.size();
         return node;
     }
 
@@ -283,11 +296,14 @@ public:
 
     void StartTiming( CommandContext* Context )
     {
+        m_NextChild = 0;
+        TraceProfiler::BeginScope(m_TraceId);
         m_StartTick = SystemTime::GetCurrentTick();
         if (Context == nullptr)
             return;
 
         m_GpuTimer.Start(*Context);
+        m_StartBarriers = Context->GetNumBarriersFlushed();
 
         Context->PIXBeginEvent(m_Name.c_str());
     }
@@ -295,14 +311,23 @@ public:
     void StopTiming( CommandContext* Context )
     {
         m_EndTick = SystemTime::GetCurrentTick();
+        TraceProfiler::EndScope(m_TraceId);
         if (Context == nullptr)
             return;
 
         m_GpuTimer.Stop(*Context);
+        m_NumBarriers = (uint32_t)(Context->GetNumBarriersFlushed() - m_StartBarriers);
 
         Context->PIXEndEvent();
     }
 
+    void SetCpuTiming( int64_t StartTick, int64_t EndTick )
+    {
+        m_StartTick = StartTick;
+        m_EndTick = EndTick;
+        m_HasGpuTime = false;
+    }
+
     void GatherTimes(uint32_t FrameIndex)
     {
         if (sm_SelectedScope == this)
@@ -316,13 +341,19 @@ public:
             return;
         }
         m_CpuTime.RecordStat(FrameIndex, 1000.0f * (float)SystemTime::TimeBetweenTicks(m_StartTick, m_EndTick));
-        m_GpuTime.RecordStat(FrameIndex, 1000.0f * m_GpuTimer.GetTime());
+        m_GpuTime.RecordStat(FrameIndex, m_HasGpuTime ? 1000.0f * m_GpuTimer.GetTime() : 0.0f);
+        m_Barriers.RecordStat(FrameIndex, (float)m_NumBarriers);
+
+        int64_t GpuStartTick, GpuEndTick;
+        if (m_HasGpuTime && this != &sm_RootScope && GpuTimeManager::GetCpuTicks(m_GpuTimer.GetTimerIndex(), GpuStartTick, GpuEndTick))
+            TraceProfiler::AddGpuScope(m_TraceId, GpuStartTick, GpuEndTick);
 
         for (auto node : m_Children)
             node->GatherTimes(FrameIndex);
 
         m_StartTick = 0;
         m_EndTick = 0;
+        m_NumBarriers = 0;
     }
 
     void SumInclusiveTimes(float& cpuTime, float& gpuTime)
@@ -338,11 +369,14 @@ public:
 
     static void PushProfilingMarker( const wstring& name, CommandContext* Context );
     static void PopProfilingMarker( CommandContext* Context );
+    static void AddCpuTiming( const wstring& name, int64_t StartTick, int64_t EndTick );
     static void Update( void );
     static void UpdateTimes( void )
     {
         uint32_t FrameIndex = (uint32_t)Graphics::GetFrameCount();
 
+        sm_RootScope.m_NextChild = 0;
+
         GpuTimeManager::BeginReadBack();
         sm_RootScope.GatherTimes(FrameIndex);
         s_FrameDelta.RecordStat(FrameIndex, GpuTimeManager::GetTime(0));
@@ -397,7 +431,14 @@ private:
     int64_t m_EndTick;
     StatHistory m_CpuTime;
     StatHistory m_GpuTime;
+    StatHistory m_Barriers;             // Resource barriers recorded on the block's context
+    uint64_t m_StartBarriers;
+    uint32_t m_NumBarriers;
+    uint32_t m_ChildIndex;              // Position in the parent's m_Children
+    uint32_t m_NextChild;               // The child expected to begin next
+    uint32_t m_TraceId;
     bool m_IsExpanded;
+    bool m_HasGpuTime;
     GpuTimer m_GpuTimer;
     bool m_IsGraphed;
     GraphHandle m_GraphHandle;
@@ -425,6 +466,10 @@ namespace EngineProfiling
     BoolVar DrawProfiler("Display Profiler", false);
     //BoolVar DrawPerfGraph("Display Performance Graph", false);
     const bool DrawPerfGraph = false;
+
+    // Blocks on other threads are only traced, so each keeps its own stack of open scopes
+    static const DWORD s_MainThreadId = GetCurrentThreadId();
+    static thread_local vector<uint32_t> t_TraceScopes;
     
     void Update( void )
     {
@@ -438,12 +483,32 @@ namespace EngineProfiling
 
     void BeginBlock(const wstring& name, CommandContext* Context)
     {
-        NestedTimingTree::PushProfilingMarker(name, Context);
+        if (GetCurrentThreadId() == s_MainThreadId)
+        {
+            NestedTimingTree::PushProfilingMarker(name, Context);
+            return;
+        }
+
+        t_TraceScopes.push_back(TraceProfiler::RegisterScope(name));
+        TraceProfiler::BeginScope(t_TraceScopes.back());
     }
 
     void EndBlock(CommandContext* Context)
     {
-        NestedTimingTree::PopProfilingMarker(Context);
+        if (GetCurrentThreadId() == s_MainThreadId)
+        {
+            NestedTimingTree::PopProfilingMarker(Context);
+            return;
+        }
+
+        ASSERT(!t_TraceScopes.empty(), "Profiling block ended without beginning");
+        TraceProfiler::EndScope(t_TraceScopes.back());
+        t_TraceScopes.pop_back();
+    }
+
+    void AddCpuBlock(const wstring& name, int64_t StartTick, int64_t EndTick)
+    {
+        NestedTimingTree::AddCpuTiming(name, StartTick, EndTick);
     }
 
     bool IsPaused()
@@ -484,7 +549,7 @@ namespace EngineProfiling
             Text.DrawString("Engine Profiling");
             Text.SetColor(Color(0.8f, 0.8f, 0.8f));
             Text.SetTextSize(20.0f);
-            Text.DrawString("           CPU    GPU");
+            Text.DrawString("           CPU    GPU   Barriers");
             Text.SetTextSize(24.0f);
             Text.NewLine();
             Text.SetTextSize(20.0f);
@@ -510,6 +575,11 @@ void NestedTimingTree::PopProfilingMarker( CommandContext* Context )
     sm_CurrentNode = sm_CurrentNode->m_Parent;
 }
 
+void NestedTimingTree::AddCpuTiming( const wstring& name, int64_t StartTick, int64_t EndTick )
+{
+    sm_CurrentNode->GetChild(name)->SetCpuTiming(StartTick, EndTick);
+}
+
 void NestedTimingTree::Update( void )
 {
     ASSERT(sm_SelectedScope != nullptr, "Corrupted profiling data structure");
@@ -585,7 +655,7 @@ void NestedTimingTree::DisplayNode( TextContext& Text, float leftMargin, float i
 
         Text.DrawString(m_Name.c_str());
         Text.SetCursorX(leftMargin + 300.0f);
-        Text.DrawFormattedString("%6.3f %6.3f   ", m_CpuTime.GetAvg(), m_GpuTime.GetAvg());
+        Text.DrawFormattedString("%6.3f %6.3f %5.0f   ", m_CpuTime.GetAvg(), m_GpuTime.GetAvg(), m_Barriers.GetAvg());
 
         if (IsGraphed())
         {
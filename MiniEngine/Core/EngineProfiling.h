@@ -22,9 +22,15 @@ namespace EngineProfiling
 {
     void Update();
 
+    // Blocks begun on the main thread are shown on screen and traced.  Those begun on other threads are only
+    // traced (see TraceProfiler.h), and their Context is ignored.
     void BeginBlock(const std::wstring& name, CommandContext* Context = nullptr);
     void EndBlock(CommandContext* Context = nullptr);
 
+    // Adds a CPU-only block under the current one, timed elsewhere such as on a worker thread.  Call it from
+    // the thread that begins and ends blocks.
+    void AddCpuBlock(const std::wstring& name, int64_t StartTick, int64_t EndTick);
+
     void DisplayFrameRate(TextContext& Text);
     void DisplayPerfGraph(GraphicsContext& Text);
     void Display(TextContext& Text, float x, float y, float w, float h);
@@ -15,6 +15,8 @@
 #include "FileUtility.h"
 #include <fstream>
 #include <mutex>
+#include <climits>
+#include <atomic>
 #include <zlib.h> // From NuGet package 
 
 using namespace std;
@@ -57,69 +59,267 @@ ByteArray ReadFileHelperEx( shared_ptr<wstring> fileName)
     return ReadFileHelper(*fileName);
 }
 
-ByteArray Inflate(ByteArray CompressedSource, int& err, uint32_t ChunkSize = 0x100000 ) 
+namespace
 {
-    // Create a dynamic buffer to hold compressed blocks
-    vector<unique_ptr<byte> > blocks;
+    const byte kGzipId1 = 0x1f;
+    const byte kGzipId2 = 0x8b;
+    const byte kGzipFlagExtra = 0x04;
+    const size_t kGzipHeaderSize = 10;
+    const size_t kGzipTrailerSize = 8;
 
-    z_stream strm  = {};
-    strm.data_type = Z_BINARY;
-    strm.total_in  = strm.avail_in  = (uInt)CompressedSource->size();
-    strm.next_in   = CompressedSource->data();
+    // BGZF blocks are gzip members with an extra field 'B' 'C' holding the total block size minus one
+    const size_t kBgzfHeaderSize = kGzipHeaderSize + 8;
+    const size_t kBgzfMaxBlockSize = 0x10000;
+    const size_t kBgzfMaxInputSize = 0xff00;
 
-    err = inflateInit2(&strm, (15 + 32)); //15 window bits, and the +32 tells zlib to to detect if using gzip or zlib
+    // Deflate can't compress better than about 1032:1, so a larger size in a gzip trailer is corrupt
+    const size_t kDeflateMaxRatio = 1032;
 
-    while (err == Z_OK || err == Z_BUF_ERROR)
+    inline uint16_t ReadLE16(const byte* p) { return (uint16_t)(p[0] | p[1] << 8); }
+    inline uint32_t ReadLE32(const byte* p) { return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24; }
+    inline void WriteLE16(byte* p, uint32_t v) { p[0] = (byte)v; p[1] = (byte)(v >> 8); }
+    inline void WriteLE32(byte* p, uint32_t v) { WriteLE16(p, v); WriteLE16(p + 2, v >> 16); }
+
+    struct GzipBlock
+    {
+        size_t CompressedOffset;    // Start of the raw deflate stream
+        size_t CompressedSize;
+        size_t UncompressedOffset;
+        uint32_t UncompressedSize;
+        uint32_t Crc;
+    };
+
+    // Returns the total block size if a BGZF block starts at data, otherwise 0
+    size_t GetBgzfBlockSize(const byte* data, size_t size)
     {
-        strm.avail_out = ChunkSize;
-        strm.next_out = (byte*)malloc(ChunkSize);
-        blocks.emplace_back(strm.next_out);
-        err = inflate(&strm, Z_NO_FLUSH);
+        if (size < kBgzfHeaderSize + kGzipTrailerSize || data[0] != kGzipId1 || data[1] != kGzipId2 ||
+            data[2] != Z_DEFLATED || data[3] != kGzipFlagExtra)
+            return 0;
+
+        if (ReadLE16(data + 10) != 6 || data[12] != 'B' || data[13] != 'C' || ReadLE16(data + 14) != 2)
+            return 0;
+
+        size_t blockSize = (size_t)ReadLE16(data + 16) + 1;
+        return blockSize >= kBgzfHeaderSize + kGzipTrailerSize && blockSize <= size ? blockSize : 0;
     }
 
-    if (err != Z_STREAM_END) 
+    // Splits the data into BGZF blocks.  Fails unless the whole input is made of them.
+    bool FindBgzfBlocks(const byte* data, size_t size, vector<GzipBlock>& blocks, size_t& totalSize)
     {
-        inflateEnd(&strm);
-        return NullFile;
+        totalSize = 0;
+        for (size_t offset = 0; offset < size; )
+        {
+            size_t blockSize = GetBgzfBlockSize(data + offset, size - offset);
+            if (blockSize == 0)
+                return false;
+
+            GzipBlock block;
+            block.CompressedOffset = offset + kBgzfHeaderSize;
+            block.CompressedSize = blockSize - kBgzfHeaderSize - kGzipTrailerSize;
+            block.UncompressedOffset = totalSize;
+            block.Crc = ReadLE32(data + offset + blockSize - 8);
+            block.UncompressedSize = ReadLE32(data + offset + blockSize - 4);
+
+            // A BGZF block never holds more than 64KB, so don't trust the trailer with anything larger
+            if (block.UncompressedSize > kBgzfMaxBlockSize)
+                return false;
+            blocks.push_back(block);
+
+            totalSize += block.UncompressedSize;
+            offset += blockSize;
+        }
+        return !blocks.empty();
     }
 
-    ASSERT(strm.total_out > 0, "Nothing to decompress");
+    ByteArray InflateBgzfBlocks(const byte* data, const vector<GzipBlock>& blocks, size_t totalSize)
+    {
+        ByteArray byteArray = make_shared<vector<byte> >(totalSize);
+        byte* output = byteArray->data();
+        atomic<bool> failed(false);
+
+        parallel_for((size_t)0, blocks.size(), [&](size_t i)
+        {
+            const GzipBlock& block = blocks[i];
+
+            z_stream strm = {};
+            strm.next_in = const_cast<byte*>(data + block.CompressedOffset);
+            strm.avail_in = (uInt)block.CompressedSize;
+            strm.next_out = output + block.UncompressedOffset;
+            strm.avail_out = block.UncompressedSize;
+
+            // Negative window bits for a raw deflate stream, the gzip header and trailer were parsed already
+            if (inflateInit2(&strm, -15) != Z_OK)
+            {
+                failed = true;
+                return;
+            }
 
-    Utility::ByteArray byteArray = make_shared<vector<byte> >( strm.total_out );
+            int err = inflate(&strm, Z_FINISH);
+            inflateEnd(&strm);
 
-    // Allocate actual memory for this.
-    // copy the bits into that RAM.
-    // Free everything else up!!
-    void* curDest = byteArray->data();
-    size_t remaining = byteArray->size();
+            if (err != Z_STREAM_END || strm.total_out != block.UncompressedSize ||
+                crc32(0, output + block.UncompressedOffset, block.UncompressedSize) != block.Crc)
+            {
+                failed = true;
+            }
+        });
 
-    for (size_t i = 0; i < blocks.size(); ++i)
+        return failed ? NullFile : byteArray;
+    }
+
+    ByteArray InflateStream(const byte* data, size_t size, int& err)
     {
-        ASSERT(remaining > 0);
+        // The last four bytes of a gzip file hold the uncompressed size modulo 4GB.  It's only a hint
+        // because a file can hold several members or be larger than that, so the buffer still grows if needed.
+        size_t outputSize = 0;
+        if (size >= kGzipHeaderSize + kGzipTrailerSize && data[0] == kGzipId1 && data[1] == kGzipId2)
+            outputSize = ReadLE32(data + size - 4);
+        if (outputSize == 0 || outputSize / kDeflateMaxRatio > size)
+            outputSize = size * 4;
+
+        ByteArray byteArray = make_shared<vector<byte> >(outputSize);
+
+        z_stream strm = {};
+        strm.data_type = Z_BINARY;
+        strm.next_in = const_cast<byte*>(data);
 
-        size_t CopySize = min(remaining, (size_t)ChunkSize);
+        err = inflateInit2(&strm, (15 + 32)); //15 window bits, and the +32 tells zlib to to detect if using gzip or zlib
 
-        memcpy(curDest, blocks[i].get(), CopySize);
-        curDest = (byte*)curDest + CopySize;
-        remaining -= CopySize;
+        size_t inputRemaining = size;
+        size_t outputUsed = 0;
+
+        while (err == Z_OK)
+        {
+            // zlib counts in 32 bits, so very large buffers are handed over in pieces
+            if (strm.avail_in == 0)
+            {
+                strm.avail_in = (uInt)min(inputRemaining, (size_t)UINT_MAX);
+                inputRemaining -= strm.avail_in;
+            }
+
+            if (outputUsed == byteArray->size())
+                byteArray->resize(byteArray->size() * 2);
+
+            strm.next_out = byteArray->data() + outputUsed;
+            strm.avail_out = (uInt)min(byteArray->size() - outputUsed, (size_t)UINT_MAX);
+            uInt availOut = strm.avail_out;
+
+            err = inflate(&strm, Z_NO_FLUSH);
+            outputUsed += availOut - strm.avail_out;
+
+            if (err == Z_BUF_ERROR && (strm.avail_out == 0 || (strm.avail_in == 0 && inputRemaining > 0)))
+                err = Z_OK;
+
+            // Concatenated gzip members decompress one after the other
+            if (err == Z_STREAM_END && (strm.avail_in > 0 || inputRemaining > 0))
+                err = inflateReset(&strm);
+        }
+
+        inflateEnd(&strm);
+
+        if (err != Z_STREAM_END)
+            return NullFile;
+
+        ASSERT(outputUsed > 0, "Nothing to decompress");
+
+        byteArray->resize(outputUsed);
+        return byteArray;
     }
+}
 
-    inflateEnd(&strm);
+ByteArray Utility::InflateGzip(const byte* data, size_t size)
+{
+    vector<GzipBlock> blocks;
+    size_t totalSize;
+    if (FindBgzfBlocks(data, size, blocks, totalSize))
+        return InflateBgzfBlocks(data, blocks, totalSize);
 
-    return byteArray;
+    int err;
+    return InflateStream(data, size, err);
+}
+
+bool Utility::WriteChunkedGzip(const wstring& fileName, const byte* data, size_t size, int level)
+{
+    ofstream file(fileName, ios::out | ios::binary);
+    if (!file)
+        return false;
+
+    size_t blockCount = (size + kBgzfMaxInputSize - 1) / kBgzfMaxInputSize;
+
+    // Blocks are compressed in parallel, then written in order.  An empty block marks the end of file.
+    vector<vector<byte> > blocks(blockCount + 1);
+    atomic<bool> failed(false);
+
+    parallel_for((size_t)0, blockCount + 1, [&](size_t i)
+    {
+        size_t inputOffset = i * kBgzfMaxInputSize;
+        size_t inputSize = i < blockCount ? min(kBgzfMaxInputSize, size - inputOffset) : 0;
+        const byte* input = data + inputOffset;
+
+        vector<byte>& block = blocks[i];
+        block.resize(kBgzfMaxBlockSize);
+
+        // Incompressible input is stored, which always fits
+        int blockLevel = level;
+        for (;;)
+        {
+            z_stream strm = {};
+            if (deflateInit2(&strm, blockLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                failed = true;
+                return;
+            }
+
+            strm.next_in = const_cast<byte*>(input);
+            strm.avail_in = (uInt)inputSize;
+            strm.next_out = block.data() + kBgzfHeaderSize;
+            strm.avail_out = (uInt)(kBgzfMaxBlockSize - kBgzfHeaderSize - kGzipTrailerSize);
+
+            int err = deflate(&strm, Z_FINISH);
+            size_t compressedSize = strm.total_out;
+            deflateEnd(&strm);
+
+            if (err == Z_STREAM_END)
+            {
+                block.resize(kBgzfHeaderSize + compressedSize + kGzipTrailerSize);
+                break;
+            }
+            if (blockLevel == 0)
+            {
+                failed = true;
+                return;
+            }
+            blockLevel = 0;
+        }
+
+        static const byte header[kBgzfHeaderSize] = { kGzipId1, kGzipId2, Z_DEFLATED, kGzipFlagExtra,
+            0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+        memcpy(block.data(), header, kBgzfHeaderSize);
+        WriteLE16(block.data() + 16, (uint32_t)block.size() - 1);
+        WriteLE32(block.data() + block.size() - 8, crc32(0, input, (uInt)inputSize));
+        WriteLE32(block.data() + block.size() - 4, (uint32_t)inputSize);
+    });
+
+    if (failed)
+        return false;
+
+    for (auto& block : blocks)
+        file.write((const char*)block.data(), block.size());
+
+    return (bool)file;
 }
 
 ByteArray DecompressZippedFile( wstring& fileName )
 {
-    ByteArray CompressedFile = ReadFileHelper(fileName);
-    if (CompressedFile == NullFile)
+    // Inflate straight out of the mapped file instead of reading it into memory first
+    unique_ptr<FileSource> CompressedFile = MapFile(fileName);
+    if (CompressedFile == nullptr || CompressedFile->GetSize() == 0)
         return NullFile;
 
-    int error;
-    ByteArray DecompressedFile = Inflate(CompressedFile, error);
+    ByteArray DecompressedFile = InflateGzip(CompressedFile->GetData(), CompressedFile->GetSize());
     if (DecompressedFile->size() == 0)
     {
-        Utility::Printf(L"Couldn't unzip file %s:  Error = %d\n", fileName.c_str(), error);
+        Utility::Printf(L"Couldn't unzip file %s\n", fileName.c_str());
         return NullFile;
     }
 
@@ -136,3 +336,81 @@ task<ByteArray> Utility::ReadFileAsync(const wstring& fileName)
     shared_ptr<wstring> SharedPtr = make_shared<wstring>(fileName);
     return create_task( [=] { return ReadFileHelperEx(SharedPtr); } );
 }
+
+namespace
+{
+    class MappedFileSource : public FileSource
+    {
+    public:
+        MappedFileSource() : m_File(INVALID_HANDLE_VALUE), m_Mapping(nullptr), m_pData(nullptr), m_Size(0) {}
+
+        ~MappedFileSource()
+        {
+            if (m_pData != nullptr)
+                UnmapViewOfFile(m_pData);
+            if (m_Mapping != nullptr)
+                CloseHandle(m_Mapping);
+            if (m_File != INVALID_HANDLE_VALUE)
+                CloseHandle(m_File);
+        }
+
+        bool Open(const wstring& fileName)
+        {
+            m_File = CreateFileW(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (m_File == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(m_File, &fileSize))
+                return false;
+
+            m_Size = (size_t)fileSize.QuadPart;
+
+            // Empty files can't be mapped
+            if (m_Size == 0)
+                return true;
+
+            m_Mapping = CreateFileMappingW(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_Mapping == nullptr)
+                return false;
+
+            m_pData = (const byte*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+            return m_pData != nullptr;
+        }
+
+        virtual const byte* GetData(void) const override { return m_pData; }
+        virtual size_t GetSize(void) const override { return m_Size; }
+
+    private:
+        HANDLE m_File;
+        HANDLE m_Mapping;
+        const byte* m_pData;
+        size_t m_Size;
+    };
+
+    class MemoryFileSource : public FileSource
+    {
+    public:
+        MemoryFileSource(ByteArray data) : m_Data(data) {}
+
+        virtual const byte* GetData(void) const override { return m_Data->data(); }
+        virtual size_t GetSize(void) const override { return m_Data->size(); }
+
+    private:
+        ByteArray m_Data;
+    };
+}
+
+unique_ptr<FileSource> Utility::MapFile(const wstring& fileName)
+{
+    unique_ptr<MappedFileSource> source(new MappedFileSource);
+    if (!source->Open(fileName))
+        return nullptr;
+    return move(source);
+}
+
+unique_ptr<FileSource> Utility::MakeFileSource(ByteArray data)
+{
+    return unique_ptr<FileSource>(new MemoryFileSource(data));
+}
@@ -34,4 +34,31 @@ namespace Utility
     // Same as previous except that it does not block but instead returns a task.
     task<ByteArray> ReadFileAsync(const wstring& fileName);
 
+    // Decompresses gzip (or zlib) data straight into one buffer, presized from the gzip trailer.  Data made
+    // of BGZF blocks (independently compressed gzip members that record their own size, as written by
+    // WriteChunkedGzip or bgzip) is decompressed on all cores.  Returns NullFile on error.
+    ByteArray InflateGzip(const byte* data, size_t size);
+
+    // Compresses data as BGZF blocks.  The result is an ordinary multi-member gzip file that any gzip tool
+    // can read, but InflateGzip can decompress its blocks in parallel.
+    bool WriteChunkedGzip(const wstring& fileName, const byte* data, size_t size, int level = 6);
+
+    // Read-only access to the whole contents of a file.  The bytes stay valid for the lifetime
+    // of the source, so loaders can parse them in place instead of copying them out first.
+    class FileSource
+    {
+    public:
+        virtual ~FileSource() {}
+        virtual const byte* GetData(void) const = 0;
+        virtual size_t GetSize(void) const = 0;
+    };
+
+    // Maps the file into the address space.  Pages are read from disk on first access and can be
+    // dropped again by the OS, so large files don't count against the working set like a full read.
+    // Returns nullptr if the file can't be opened or mapped.
+    unique_ptr<FileSource> MapFile(const wstring& fileName);
+
+    // Exposes bytes that are already in memory, e.g. from ReadFileSync, through the same interface.
+    unique_ptr<FileSource> MakeFileSource(ByteArray data);
+
 } // namespace Utility
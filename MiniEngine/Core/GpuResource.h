@@ -18,21 +18,20 @@ class GpuResource
     friend class CommandContext;
     friend class GraphicsContext;
     friend class ComputeContext;
+    friend class ResourceStateTracker;
 
 public:
     GpuResource() : 
         m_GpuVirtualAddress(D3D12_GPU_VIRTUAL_ADDRESS_NULL),
         m_UserAllocatedMemory(nullptr),
-        m_UsageState(D3D12_RESOURCE_STATE_COMMON),
-        m_TransitioningState((D3D12_RESOURCE_STATES)-1)
+        m_UsageState(D3D12_RESOURCE_STATE_COMMON)
     {}
 
     GpuResource(ID3D12Resource* pResource, D3D12_RESOURCE_STATES CurrentState) :
         m_GpuVirtualAddress(D3D12_GPU_VIRTUAL_ADDRESS_NULL),
         m_UserAllocatedMemory(nullptr),
         m_pResource(pResource),
-        m_UsageState(CurrentState),
-        m_TransitioningState((D3D12_RESOURCE_STATES)-1)
+        m_UsageState(CurrentState)
     {
     }
 
@@ -40,6 +39,7 @@ public:
     {
         m_pResource = nullptr;
         m_GpuVirtualAddress = D3D12_GPU_VIRTUAL_ADDRESS_NULL;
+        m_SubresourceStates.clear();
         if (m_UserAllocatedMemory != nullptr)
         {
             VirtualFree(m_UserAllocatedMemory, 0, MEM_RELEASE);
@@ -59,7 +59,11 @@ protected:
 
     Microsoft::WRL::ComPtr<ID3D12Resource> m_pResource;
     D3D12_RESOURCE_STATES m_UsageState;
-    D3D12_RESOURCE_STATES m_TransitioningState;
+
+    // The state of each subresource when they differ, otherwise empty and m_UsageState applies to all of them.
+    // Both describe the resource after the last command list submitted.
+    std::vector<D3D12_RESOURCE_STATES> m_SubresourceStates;
+
     D3D12_GPU_VIRTUAL_ADDRESS m_GpuVirtualAddress;
 
     // When using VirtualAlloc() to allocate memory directly, record the allocation here so that it can be freed.  The
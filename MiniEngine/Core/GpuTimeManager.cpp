@@ -28,6 +28,16 @@ namespace
     uint64_t sm_ValidTimeStart = 0;
     uint64_t sm_ValidTimeEnd = 0;
     double sm_GpuTickDelta = 0.0;
+
+    // A GPU timestamp and a QPC tick taken at the same moment, for putting GPU times on the CPU timeline
+    uint64_t sm_CalibrationGpuTick = 0;
+    uint64_t sm_CalibrationCpuTick = 0;
+    double sm_CpuTicksPerGpuTick = 0.0;
+
+    void Calibrate(void)
+    {
+        Graphics::g_CommandManager.GetCommandQueue()->GetClockCalibration(&sm_CalibrationGpuTick, &sm_CalibrationCpuTick);
+    }
 }
 
 void GpuTimeManager::Initialize(uint32_t MaxNumTimers)
@@ -36,6 +46,12 @@ void GpuTimeManager::Initialize(uint32_t MaxNumTimers)
     Graphics::g_CommandManager.GetCommandQueue()->GetTimestampFrequency(&GpuFrequency);
     sm_GpuTickDelta = 1.0 / static_cast<double>(GpuFrequency);
 
+    // SystemTime is initialized after the graphics core, so ask for the tick rate it will use
+    LARGE_INTEGER CpuFrequency;
+    QueryPerformanceFrequency(&CpuFrequency);
+    sm_CpuTicksPerGpuTick = static_cast<double>(CpuFrequency.QuadPart) / static_cast<double>(GpuFrequency);
+    Calibrate();
+
     D3D12_HEAP_PROPERTIES HeapProps;
     HeapProps.Type = D3D12_HEAP_TYPE_READBACK;
     HeapProps.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
@@ -98,6 +114,9 @@ void GpuTimeManager::BeginReadBack(void)
 {
     Graphics::g_CommandManager.WaitForFence(sm_Fence);
 
+    // The clocks drift apart slowly, so calibrating once a frame is plenty
+    Calibrate();
+
     D3D12_RANGE Range;
     Range.Begin = 0;
     Range.End = (sm_NumTimers * 2) * sizeof(uint64_t);
@@ -141,3 +160,20 @@ float GpuTimeManager::GetTime(uint32_t TimerIdx)
 
     return static_cast<float>(sm_GpuTickDelta * (TimeStamp2 - TimeStamp1));
 }
+
+bool GpuTimeManager::GetCpuTicks(uint32_t TimerIdx, int64_t& StartTick, int64_t& EndTick)
+{
+    ASSERT(sm_TimeStampBuffer != nullptr, "Time stamp readback buffer is not mapped");
+    ASSERT(TimerIdx < sm_NumTimers, "Invalid GPU timer index");
+
+    uint64_t TimeStamp1 = sm_TimeStampBuffer[TimerIdx * 2];
+    uint64_t TimeStamp2 = sm_TimeStampBuffer[TimerIdx * 2 + 1];
+
+    if (TimeStamp1 < sm_ValidTimeStart || TimeStamp2 > sm_ValidTimeEnd || TimeStamp2 <= TimeStamp1 )
+        return false;
+
+    // The timestamps are from an earlier frame than the calibration, so the offsets are negative
+    StartTick = (int64_t)sm_CalibrationCpuTick + (int64_t)(sm_CpuTicksPerGpuTick * (double)((int64_t)TimeStamp1 - (int64_t)sm_CalibrationGpuTick));
+    EndTick = (int64_t)sm_CalibrationCpuTick + (int64_t)(sm_CpuTicksPerGpuTick * (double)((int64_t)TimeStamp2 - (int64_t)sm_CalibrationGpuTick));
+    return true;
+}
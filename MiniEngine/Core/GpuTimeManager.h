@@ -36,4 +36,7 @@ namespace GpuTimeManager
 
     // Returns the time in milliseconds between start and stop queries
     float GetTime(uint32_t TimerIdx);
+
+    // Returns the start and stop queries as SystemTime ticks, or false if they are not valid this frame
+    bool GetCpuTicks(uint32_t TimerIdx, int64_t& StartTick, int64_t& EndTick);
 }
@@ -16,6 +16,7 @@
 #include "GameCore.h"
 #include "BufferManager.h"
 #include "GpuTimeManager.h"
+#include "TraceProfiler.h"
 #include "PostEffects.h"
 #include "SSAO.h"
 #include "TextRenderer.h"
@@ -26,6 +27,9 @@
 #include "CommandContext.h"
 #include "CommandListManager.h"
 #include "RootSignature.h"
+#include "PipelineStateCache.h"
+#include "PSOCompiler.h"
+#include "ParallelCommandRecorder.h"
 #include "CommandSignature.h"
 #include "ParticleEffectManager.h"
 #include "GraphRenderer.h"
@@ -117,6 +121,7 @@ namespace Graphics
 
     bool g_bTypedUAVLoadSupport_R11G11B10_FLOAT = false;
     bool g_bTypedUAVLoadSupport_R16G16B16A16_FLOAT = false;
+    D3D12_RESOURCE_BINDING_TIER g_ResourceBindingTier = D3D12_RESOURCE_BINDING_TIER_1;
     bool g_bEnableHDROutput = false;
     NumVar g_HDRPaperWhite("Graphics/Display/Paper White (nits)", 200.0f, 100.0f, 500.0f, 50.0f);
     NumVar g_MaxDisplayLuminance("Graphics/Display/Peak Brightness (nits)", 1000.0f, 500.0f, 10000.0f, 100.0f);
@@ -189,12 +194,14 @@ namespace Graphics
 
     DescriptorAllocator g_DescriptorAllocator[D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES] =
     {
-        D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV,
-        D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER,
-        D3D12_DESCRIPTOR_HEAP_TYPE_RTV,
-        D3D12_DESCRIPTOR_HEAP_TYPE_DSV,
+        { D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV },
+        { D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER },
+        { D3D12_DESCRIPTOR_HEAP_TYPE_RTV },
+        { D3D12_DESCRIPTOR_HEAP_TYPE_DSV },
     };
 
+    BindlessDescriptorHeap g_BindlessDescriptorHeap(1 << 18);
+
     RootSignature s_PresentRS;
     GraphicsPSO s_BlendUIPSO;
     GraphicsPSO PresentSDRPS;
@@ -436,6 +443,9 @@ void Graphics::Initialize(void)
     D3D12_FEATURE_DATA_D3D12_OPTIONS FeatureData = {};
     if (SUCCEEDED(g_Device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &FeatureData, sizeof(FeatureData))))
     {
+        // Unbounded descriptor tables, as used for bindless resources, require tier 2
+        g_ResourceBindingTier = FeatureData.ResourceBindingTier;
+
         if (FeatureData.TypedUAVLoadAdditionalFormats)
         {
             D3D12_FEATURE_DATA_FORMAT_SUPPORT Support =
@@ -461,6 +471,18 @@ void Graphics::Initialize(void)
 
     g_CommandManager.Create(g_Device);
 
+    // Pipelines compiled by earlier runs on this adapter and driver are loaded instead of recompiled
+    {
+        Microsoft::WRL::ComPtr<IDXGIAdapter1> pDeviceAdapter;
+        if (SUCCEEDED(dxgiFactory->EnumAdapterByLuid(g_Device->GetAdapterLuid(), MY_IID_PPV_ARGS(&pDeviceAdapter))))
+            PipelineStateCache::Initialize(pDeviceAdapter.Get(), L"PipelineStateCache.bin");
+    }
+
+    PSOCompiler::Initialize();
+    ParallelCommandRecorder::Initialize();
+
+    g_BindlessDescriptorHeap.Create(L"Bindless Descriptor Heap");
+
     DXGI_SWAP_CHAIN_DESC1 swapChainDesc = {};
     swapChainDesc.Width = g_DisplayWidth;
     swapChainDesc.Height = g_DisplayHeight;
@@ -584,6 +606,7 @@ void Graphics::Initialize(void)
     g_PreDisplayBuffer.Create(L"PreDisplay Buffer", g_DisplayWidth, g_DisplayHeight, 1, SwapChainFormat);
 
     GpuTimeManager::Initialize(4096);
+    TraceProfiler::Initialize();
     SetNativeResolution();
     TemporalEffects::Initialize();
     PostEffects::Initialize();
@@ -606,10 +629,15 @@ void Graphics::Shutdown( void )
     CommandContext::DestroyAllContexts();
     g_CommandManager.Shutdown();
     GpuTimeManager::Shutdown();
+    TraceProfiler::Shutdown();
     s_SwapChain1->Release();
+    PSOCompiler::Shutdown();
+    ParallelCommandRecorder::Shutdown();
+    PipelineStateCache::Shutdown();
     PSO::DestroyAll();
     RootSignature::DestroyAll();
     DescriptorAllocator::DestroyAll();
+    g_BindlessDescriptorHeap.Destroy();
 
     DestroyCommonState();
     DestroyRenderingBuffers();
@@ -823,6 +851,10 @@ void Graphics::Present(void)
 
     ++s_FrameIndex;
     TemporalEffects::Update((uint32_t)s_FrameIndex);
+    LinearAllocator::EndFrame();
+    TextureManager::EndFrame();
+    ResourceStateTracker::EndFrame();
+    TraceProfiler::EndFrame();
 
     SetNativeResolution();
 }
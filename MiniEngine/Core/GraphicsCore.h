@@ -15,6 +15,7 @@
 
 #include "PipelineState.h"
 #include "DescriptorHeap.h"
+#include "BindlessDescriptorHeap.h"
 #include "RootSignature.h"
 #include "SamplerManager.h"
 #include "GraphicsCommon.h"
@@ -61,6 +62,7 @@ namespace Graphics
 
     extern D3D_FEATURE_LEVEL g_D3DFeatureLevel;
     extern bool g_bTypedUAVLoadSupport_R11G11B10_FLOAT;
+    extern D3D12_RESOURCE_BINDING_TIER g_ResourceBindingTier;
     extern bool g_bEnableHDROutput;
 
     extern DescriptorAllocator g_DescriptorAllocator[];
@@ -68,6 +70,14 @@ namespace Graphics
     {
         return g_DescriptorAllocator[Type].Allocate(Count);
     }
+    inline void FreeDescriptor( D3D12_DESCRIPTOR_HEAP_TYPE Type, D3D12_CPU_DESCRIPTOR_HANDLE Handle, UINT Count = 1, uint64_t FenceValue = 0 )
+    {
+        g_DescriptorAllocator[Type].Free(Handle, Count, FenceValue);
+    }
+
+    // Persistent shader-visible heap for descriptors indexed from shaders.  Dynamic descriptor tables are
+    // allocated from it too.
+    extern BindlessDescriptorHeap g_BindlessDescriptorHeap;
 
     extern RootSignature g_GenerateMipsRS;
     extern ComputePSO g_GenerateMipsLinearPSO[4];
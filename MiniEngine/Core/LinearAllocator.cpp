@@ -22,26 +22,59 @@ using namespace Graphics;
 using namespace std;
 
 LinearAllocatorType LinearAllocatorPageManager::sm_AutoType = kGpuExclusive;
+atomic<uint64_t> LinearAllocatorPageManager::sm_NextOwnerId(1);
 
 LinearAllocatorPageManager::LinearAllocatorPageManager()
+    : m_OwnerId(sm_NextOwnerId++), m_ThreadCachedCount(0), m_NumLargePages(0), m_NumIdleLargePages(0),
+    m_LargePageBytes(0), m_IdleLargePageBytes(0), m_MaxIdleLargePageBytes(64 * 1024 * 1024)
 {
     m_AllocationType = sm_AutoType;
     sm_AutoType = (LinearAllocatorType)(sm_AutoType + 1);
     ASSERT(sm_AutoType <= kNumAllocatorTypes);
+
+    m_DefaultPageSize = LinearAllocator::GetDefaultPageSize(m_AllocationType);
+    ZeroMemory(&m_ThisFrame, sizeof(m_ThisFrame));
+    ZeroMemory(&m_LastFrame, sizeof(m_LastFrame));
 }
 
 LinearAllocatorPageManager LinearAllocator::sm_PageManager[2];
 
+LinearAllocatorPageManager::ThreadCache::~ThreadCache()
+{
+    // Hand cached pages back when the thread exits rather than stranding them until shutdown
+    if (Owner == nullptr || Count == 0 || Owner->m_OwnerId != OwnerId)
+        return;
+
+    lock_guard<mutex> LockGuard(Owner->m_Mutex);
+    for (uint32_t i = 0; i < Count; ++i)
+        Owner->m_AvailablePages.push(Pages[i]);
+    Owner->m_ThreadCachedCount -= Count;
+}
+
+LinearAllocatorPageManager::ThreadCache& LinearAllocatorPageManager::GetThreadCache( LinearAllocatorType Type )
+{
+    static thread_local ThreadCache t_ThreadCaches[kNumAllocatorTypes];
+    return t_ThreadCaches[Type];
+}
+
 LinearAllocationPage* LinearAllocatorPageManager::RequestPage()
 {
-    lock_guard<mutex> LockGuard(m_Mutex);
+    ThreadCache& Cache = GetThreadCache(m_AllocationType);
 
-    while (!m_RetiredPages.empty() && g_CommandManager.IsFenceComplete(m_RetiredPages.front().first))
+    // Pages cached for a pool that has since been destroyed are simply dropped
+    if (Cache.OwnerId != m_OwnerId)
+        Cache.Count = 0;
+
+    if (Cache.Count > 0)
     {
-        m_AvailablePages.push(m_RetiredPages.front().second);
-        m_RetiredPages.pop();
+        --m_ThreadCachedCount;
+        return Cache.Pages[--Cache.Count];
     }
 
+    lock_guard<mutex> LockGuard(m_Mutex);
+
+    ReclaimRetiredPages();
+
     LinearAllocationPage* PagePtr = nullptr;
 
     if (!m_AvailablePages.empty())
@@ -53,33 +86,198 @@ LinearAllocationPage* LinearAllocatorPageManager::RequestPage()
     {
         PagePtr = CreateNewPage();
         m_PagePool.emplace_back(PagePtr);
+        ++m_ThisFrame.PagesCreated;
+    }
+
+    // Keep any spare pages, up to the cache size, for this thread's next requests
+    Cache.Owner = this;
+    Cache.OwnerId = m_OwnerId;
+    while (Cache.Count < sm_ThreadCacheSize && !m_AvailablePages.empty())
+    {
+        Cache.Pages[Cache.Count++] = m_AvailablePages.front();
+        m_AvailablePages.pop();
+        ++m_ThreadCachedCount;
+    }
+
+    return PagePtr;
+}
+
+size_t LinearAllocatorPageManager::GetLargePageSize( size_t SizeInBytes )
+{
+    ASSERT(SizeInBytes > 0);
+
+    // Buffers take up 64K of a heap at a time anyway
+    size_t PageSize = Math::AlignUp(SizeInBytes, 0x10000);
+
+    unsigned long HighBit;
+    _BitScanReverse64(&HighBit, PageSize);
+    return Math::AlignUp(PageSize, (size_t)1 << (HighBit - 2));
+}
+
+LinearAllocationPage* LinearAllocatorPageManager::RequestLargePage( size_t SizeInBytes )
+{
+    size_t PageSize = GetLargePageSize(SizeInBytes);
+
+    lock_guard<mutex> LockGuard(m_Mutex);
+
+    ReclaimRetiredPages();
+
+    auto SizeClass = m_AvailableLargePages.find(PageSize);
+    if (SizeClass != m_AvailableLargePages.end())
+    {
+        LinearAllocationPage* PagePtr = SizeClass->second.back();
+        SizeClass->second.pop_back();
+        if (SizeClass->second.empty())
+            m_AvailableLargePages.erase(SizeClass);
+
+        --m_NumIdleLargePages;
+        m_IdleLargePageBytes -= PageSize;
+        ++m_ThisFrame.LargePagesReused;
+        return PagePtr;
     }
 
+    LinearAllocationPage* PagePtr = CreateNewPage(PageSize);
+    ++m_NumLargePages;
+    m_LargePageBytes += PageSize;
+    ++m_ThisFrame.LargePagesCreated;
     return PagePtr;
 }
 
-void LinearAllocatorPageManager::DiscardPages( uint64_t FenceValue, const vector<LinearAllocationPage*>& UsedPages )
+void LinearAllocatorPageManager::DiscardPages( uint64_t FenceValue, const vector<LinearAllocationPage*>& UsedPages,
+    const UsageCounters& Usage )
 {
     lock_guard<mutex> LockGuard(m_Mutex);
+
     for (auto iter = UsedPages.begin(); iter != UsedPages.end(); ++iter)
-        m_RetiredPages.push(make_pair(FenceValue, *iter));
+    {
+        // A large page can round to the default size, so go by how the page was created
+        if (!(*iter)->m_IsLargePage)
+            m_RetiredPages.push(make_pair(FenceValue, *iter));
+        else
+            m_RetiredLargePages.push(make_pair(FenceValue, *iter));
+    }
+
+    m_ThisFrame.Usage.PagesUsed += Usage.PagesUsed;
+    m_ThisFrame.Usage.BytesAllocated += Usage.BytesAllocated;
+    m_ThisFrame.Usage.BytesWastedToAlignment += Usage.BytesWastedToAlignment;
+    m_ThisFrame.Usage.BytesWastedAtPageEnd += Usage.BytesWastedAtPageEnd;
+    m_ThisFrame.Usage.BytesWastedToSizeClasses += Usage.BytesWastedToSizeClasses;
+}
+
+void LinearAllocatorPageManager::ReclaimRetiredPages( void )
+{
+    while (!m_RetiredPages.empty() && g_CommandManager.IsFenceComplete(m_RetiredPages.front().first))
+    {
+        m_AvailablePages.push(m_RetiredPages.front().second);
+        m_RetiredPages.pop();
+    }
+
+    while (!m_RetiredLargePages.empty() && g_CommandManager.IsFenceComplete(m_RetiredLargePages.front().first))
+    {
+        LinearAllocationPage* PagePtr = m_RetiredLargePages.front().second;
+        m_RetiredLargePages.pop();
+
+        if (m_IdleLargePageBytes + PagePtr->m_PageSize > m_MaxIdleLargePageBytes)
+        {
+            DeleteLargePage(PagePtr);
+            continue;
+        }
+
+        m_AvailableLargePages[PagePtr->m_PageSize].push_back(PagePtr);
+        ++m_NumIdleLargePages;
+        m_IdleLargePageBytes += PagePtr->m_PageSize;
+    }
+}
+
+void LinearAllocatorPageManager::DeleteLargePage( LinearAllocationPage* PagePtr )
+{
+    --m_NumLargePages;
+    m_LargePageBytes -= PagePtr->m_PageSize;
+    ++m_ThisFrame.LargePagesDestroyed;
+    delete PagePtr;
+}
+
+void LinearAllocatorPageManager::SetMaxIdleLargePageBytes( size_t MaxBytes )
+{
+    lock_guard<mutex> LockGuard(m_Mutex);
+
+    m_MaxIdleLargePageBytes = MaxBytes;
+
+    // Trim from the biggest size class down
+    while (m_IdleLargePageBytes > m_MaxIdleLargePageBytes)
+    {
+        auto SizeClass = std::prev(m_AvailableLargePages.end());
+        LinearAllocationPage* PagePtr = SizeClass->second.back();
+        SizeClass->second.pop_back();
+        if (SizeClass->second.empty())
+            m_AvailableLargePages.erase(SizeClass);
+
+        --m_NumIdleLargePages;
+        m_IdleLargePageBytes -= PagePtr->m_PageSize;
+        DeleteLargePage(PagePtr);
+    }
+}
+
+LinearAllocatorStats LinearAllocatorPageManager::GetStats( void )
+{
+    lock_guard<mutex> LockGuard(m_Mutex);
+
+    LinearAllocatorStats Stats;
+    Stats.ThreadCachedPages = m_ThreadCachedCount;
+    Stats.PagesLive = (uint32_t)m_PagePool.size() + m_NumLargePages;
+    Stats.PagesRetired = (uint32_t)(m_RetiredPages.size() + m_RetiredLargePages.size());
+    Stats.PagesAvailable = (uint32_t)m_AvailablePages.size() + Stats.ThreadCachedPages + m_NumIdleLargePages;
+    Stats.BytesLive = m_PagePool.size() * m_DefaultPageSize + m_LargePageBytes;
+    Stats.IdleLargePageBytes = m_IdleLargePageBytes;
+
+    Stats.PagesCreated = m_LastFrame.PagesCreated;
+    Stats.PagesUsed = m_LastFrame.Usage.PagesUsed;
+    Stats.LargePagesCreated = m_LastFrame.LargePagesCreated;
+    Stats.LargePagesReused = m_LastFrame.LargePagesReused;
+    Stats.LargePagesDestroyed = m_LastFrame.LargePagesDestroyed;
+    Stats.BytesAllocated = m_LastFrame.Usage.BytesAllocated;
+    Stats.BytesWastedToAlignment = m_LastFrame.Usage.BytesWastedToAlignment;
+    Stats.BytesWastedAtPageEnd = m_LastFrame.Usage.BytesWastedAtPageEnd;
+    Stats.BytesWastedToSizeClasses = m_LastFrame.Usage.BytesWastedToSizeClasses;
+    return Stats;
+}
+
+void LinearAllocatorPageManager::EndFrame( void )
+{
+    lock_guard<mutex> LockGuard(m_Mutex);
+    m_LastFrame = m_ThisFrame;
+    ZeroMemory(&m_ThisFrame, sizeof(m_ThisFrame));
 }
 
-void LinearAllocatorPageManager::FreeLargePages( uint64_t FenceValue, const vector<LinearAllocationPage*>& LargePages )
+void LinearAllocatorPageManager::Destroy( void )
 {
     lock_guard<mutex> LockGuard(m_Mutex);
 
-    while (!m_DeletionQueue.empty() && g_CommandManager.IsFenceComplete(m_DeletionQueue.front().first))
+    // Orphan whatever other threads still have cached
+    m_OwnerId = sm_NextOwnerId++;
+    m_ThreadCachedCount = 0;
+
+    m_RetiredPages = queue<pair<uint64_t, LinearAllocationPage*> >();
+    m_AvailablePages = queue<LinearAllocationPage*>();
+    m_PagePool.clear();
+
+    while (!m_RetiredLargePages.empty())
     {
-        delete m_DeletionQueue.front().second;
-        m_DeletionQueue.pop();
+        delete m_RetiredLargePages.front().second;
+        m_RetiredLargePages.pop();
     }
 
-    for (auto iter = LargePages.begin(); iter != LargePages.end(); ++iter)
+    for (auto& SizeClass : m_AvailableLargePages)
     {
-        (*iter)->Unmap();
-        m_DeletionQueue.push(make_pair(FenceValue, *iter));
+        for (LinearAllocationPage* PagePtr : SizeClass.second)
+            delete PagePtr;
     }
+    m_AvailableLargePages.clear();
+
+    m_NumLargePages = 0;
+    m_NumIdleLargePages = 0;
+    m_LargePageBytes = 0;
+    m_IdleLargePageBytes = 0;
 }
 
 LinearAllocationPage* LinearAllocatorPageManager::CreateNewPage( size_t PageSize  )
@@ -124,29 +322,36 @@ LinearAllocationPage* LinearAllocatorPageManager::CreateNewPage( size_t PageSize
 
     pBuffer->SetName(L"LinearAllocator Page");
 
-    return new LinearAllocationPage(pBuffer, DefaultUsage);
+    return new LinearAllocationPage(pBuffer, DefaultUsage, PageSize != 0);
 }
 
 void LinearAllocator::CleanupUsedPages( uint64_t FenceID )
 {
-    if (m_CurPage == nullptr)
-        return;
+    if (m_CurPage != nullptr)
+    {
+        m_RetiredPages.push_back(m_CurPage);
+        m_CurPage = nullptr;
+        m_CurOffset = 0;
+    }
 
-    m_RetiredPages.push_back(m_CurPage);
-    m_CurPage = nullptr;
-    m_CurOffset = 0;
+    if (m_RetiredPages.empty())
+        return;
 
-    sm_PageManager[m_AllocationType].DiscardPages(FenceID, m_RetiredPages);
+    sm_PageManager[m_AllocationType].DiscardPages(FenceID, m_RetiredPages, m_Usage);
     m_RetiredPages.clear();
+    ZeroMemory(&m_Usage, sizeof(m_Usage));
+}
 
-    sm_PageManager[m_AllocationType].FreeLargePages(FenceID, m_LargePageList);
-    m_LargePageList.clear();
+void LinearAllocator::SetPageSize( size_t PageSize )
+{
+    m_PageSize = PageSize == 0 ? GetDefaultPageSize(m_AllocationType) : LinearAllocatorPageManager::GetLargePageSize(PageSize);
 }
 
 DynAlloc LinearAllocator::AllocateLargePage(size_t SizeInBytes)
 {
-    LinearAllocationPage* OneOff = sm_PageManager[m_AllocationType].CreateNewPage(SizeInBytes);
-    m_LargePageList.push_back(OneOff);
+    LinearAllocationPage* OneOff = sm_PageManager[m_AllocationType].RequestLargePage(SizeInBytes);
+    m_RetiredPages.push_back(OneOff);
+    m_Usage.BytesWastedToSizeClasses += OneOff->m_PageSize - SizeInBytes;
 
     DynAlloc ret(*OneOff, 0, SizeInBytes);
     ret.DataPtr = OneOff->m_CpuVirtualAddress;
@@ -165,29 +370,41 @@ DynAlloc LinearAllocator::Allocate(size_t SizeInBytes, size_t Alignment)
     // Align the allocation
     const size_t AlignedSize = Math::AlignUpWithMask(SizeInBytes, AlignmentMask);
 
+    m_Usage.BytesAllocated += SizeInBytes;
+    m_Usage.BytesWastedToAlignment += AlignedSize - SizeInBytes;
+
     if (AlignedSize > m_PageSize)
         return AllocateLargePage(AlignedSize);
 
-    m_CurOffset = Math::AlignUp(m_CurOffset, Alignment);
+    // The current page may predate a change of page size
+    size_t AlignedOffset = Math::AlignUp(m_CurOffset, Alignment);
 
-    if (m_CurOffset + AlignedSize > m_PageSize)
+    if (m_CurPage != nullptr && AlignedOffset + AlignedSize > m_CurPage->m_PageSize)
     {
-        ASSERT(m_CurPage != nullptr);
+        m_Usage.BytesWastedAtPageEnd += m_CurPage->m_PageSize - m_CurOffset;
         m_RetiredPages.push_back(m_CurPage);
         m_CurPage = nullptr;
     }
 
     if (m_CurPage == nullptr)
     {
-        m_CurPage = sm_PageManager[m_AllocationType].RequestPage();
+        if (m_PageSize == GetDefaultPageSize(m_AllocationType))
+            m_CurPage = sm_PageManager[m_AllocationType].RequestPage();
+        else
+            m_CurPage = sm_PageManager[m_AllocationType].RequestLargePage(m_PageSize);
+
+        ++m_Usage.PagesUsed;
         m_CurOffset = 0;
+        AlignedOffset = 0;
     }
 
-    DynAlloc ret(*m_CurPage, m_CurOffset, AlignedSize);
-    ret.DataPtr = (uint8_t*)m_CurPage->m_CpuVirtualAddress + m_CurOffset;
-    ret.GpuAddress = m_CurPage->m_GpuVirtualAddress + m_CurOffset;
+    m_Usage.BytesWastedToAlignment += AlignedOffset - m_CurOffset;
+
+    DynAlloc ret(*m_CurPage, AlignedOffset, AlignedSize);
+    ret.DataPtr = (uint8_t*)m_CurPage->m_CpuVirtualAddress + AlignedOffset;
+    ret.GpuAddress = m_CurPage->m_GpuVirtualAddress + AlignedOffset;
 
-    m_CurOffset += AlignedSize;
+    m_CurOffset = AlignedOffset + AlignedSize;
 
     return ret;
 }
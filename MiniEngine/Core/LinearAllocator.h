@@ -14,7 +14,12 @@
 // with the CommandContext class and to do so in a thread-safe manner.  There may be many command contexts,
 // each with its own linear allocators.  They act as windows into a global memory pool by reserving a
 // context-local memory page.  Requesting a new page is done in a thread-safe manner by guarding accesses
-// with a mutex lock.
+// with a mutex lock.  Each thread keeps a few ready pages of its own so that most requests don't take it.
+//
+// Allocations too big for a page get a "large" page of their own.  These are rounded up to a size class
+// and pooled once their fence passes, so streaming the same sizes every frame doesn't create and destroy
+// committed resources.  An allocator can also be given its own page size, which is served from the same
+// pool, when a workload's allocations don't suit the default.
 //
 // When a command context is finished, it will receive a fence ID that indicates when it's safe to reclaim
 // used resources.  The CleanupUsedPages() method must be invoked at this time so that the used pages can be
@@ -26,6 +31,8 @@
 #include <vector>
 #include <queue>
 #include <mutex>
+#include <map>
+#include <atomic>
 
 // Constant blocks must be multiples of 16 constants @ 16 bytes each
 #define DEFAULT_ALIGN 256
@@ -46,11 +53,14 @@ struct DynAlloc
 class LinearAllocationPage : public GpuResource
 {
 public:
-    LinearAllocationPage(ID3D12Resource* pResource, D3D12_RESOURCE_STATES Usage) : GpuResource()
+    LinearAllocationPage(ID3D12Resource* pResource, D3D12_RESOURCE_STATES Usage, bool IsLargePage = false) : GpuResource()
     {
         m_pResource.Attach(pResource);
         m_UsageState = Usage;
         m_GpuVirtualAddress = m_pResource->GetGPUVirtualAddress();
+        m_PageSize = (size_t)m_pResource->GetDesc().Width;
+        m_IsLargePage = IsLargePage;
+        m_CpuVirtualAddress = nullptr;
         m_pResource->Map(0, nullptr, &m_CpuVirtualAddress);
     }
 
@@ -78,6 +88,8 @@ public:
 
     void* m_CpuVirtualAddress;
     D3D12_GPU_VIRTUAL_ADDRESS m_GpuVirtualAddress;
+    size_t m_PageSize;
+    bool m_IsLargePage;     // Pooled by size class rather than with the default-sized pages
 };
 
 enum LinearAllocatorType
@@ -96,32 +108,115 @@ enum
     kCpuAllocatorPageSize = 0x200000    // 2MB
 };
 
+struct LinearAllocatorStats
+{
+    uint32_t PagesLive;                 // Standard and large pages, whether in use or not
+    uint32_t PagesRetired;              // Waiting for their fence before they can be reused
+    uint32_t PagesAvailable;            // Ready to be reused, including those cached by threads
+    uint32_t ThreadCachedPages;
+    uint64_t BytesLive;
+    uint64_t IdleLargePageBytes;        // Pooled large pages waiting for an allocation of their size
+
+    // Counted over the last frame
+    uint32_t PagesCreated;
+    uint32_t PagesUsed;                 // Standard pages handed to allocators, new or recycled
+    uint32_t LargePagesCreated;
+    uint32_t LargePagesReused;
+    uint32_t LargePagesDestroyed;       // Not pooled because the idle limit was reached
+    uint64_t BytesAllocated;            // As requested, before alignment
+    uint64_t BytesWastedToAlignment;
+    uint64_t BytesWastedAtPageEnd;      // Left over when an allocation didn't fit in the rest of a page
+    uint64_t BytesWastedToSizeClasses;  // Large pages rounded up to their size class
+};
+
 class LinearAllocatorPageManager
 {
 public:
 
+    // What a LinearAllocator did with its pages, handed over when they are discarded
+    struct UsageCounters
+    {
+        uint32_t PagesUsed;
+        uint64_t BytesAllocated;
+        uint64_t BytesWastedToAlignment;
+        uint64_t BytesWastedAtPageEnd;
+        uint64_t BytesWastedToSizeClasses;
+    };
+
     LinearAllocatorPageManager();
     LinearAllocationPage* RequestPage( void );
     LinearAllocationPage* CreateNewPage( size_t PageSize = 0 );
 
-    // Discarded pages will get recycled.  This is for fixed size pages.
-    void DiscardPages( uint64_t FenceID, const std::vector<LinearAllocationPage*>& Pages );
+    // Returns a pooled page of at least SizeInBytes (rounded up by GetLargePageSize) or creates one
+    LinearAllocationPage* RequestLargePage( size_t SizeInBytes );
 
-    // Freed pages will be destroyed once their fence has passed.  This is for single-use,
-    // "large" pages.
-    void FreeLargePages( uint64_t FenceID, const std::vector<LinearAllocationPage*>& Pages );
+    // Discarded pages will get recycled once their fence has passed.  Standard pages go back to the page
+    // pool and any other size to the pool for its size class.
+    void DiscardPages( uint64_t FenceID, const std::vector<LinearAllocationPage*>& Pages, const UsageCounters& Usage );
 
-    void Destroy( void ) { m_PagePool.clear(); }
+    // Large pages beyond this many idle bytes are destroyed after their fence rather than pooled
+    void SetMaxIdleLargePageBytes( size_t MaxBytes );
+
+    LinearAllocatorStats GetStats( void );
+    void EndFrame( void );
+
+    void Destroy( void );
+
+    // Rounds up to one of four sizes per power of two, so a large page is at most 25% bigger than needed
+    static size_t GetLargePageSize( size_t SizeInBytes );
 
 private:
 
+    static const uint32_t sm_ThreadCacheSize = 2;
+
+    struct ThreadCache
+    {
+        ThreadCache() : Owner(nullptr), OwnerId(0), Count(0) {}
+        ~ThreadCache();
+
+        LinearAllocatorPageManager* Owner;
+        uint64_t OwnerId;
+        uint32_t Count;
+        LinearAllocationPage* Pages[sm_ThreadCacheSize];
+    };
+
+    struct FrameCounters
+    {
+        uint32_t PagesCreated;
+        uint32_t LargePagesCreated;
+        uint32_t LargePagesReused;
+        uint32_t LargePagesDestroyed;
+        UsageCounters Usage;
+    };
+
+    static ThreadCache& GetThreadCache( LinearAllocatorType Type );
+    static std::atomic<uint64_t> sm_NextOwnerId;
+
+    // These require m_Mutex
+    void ReclaimRetiredPages( void );
+    void DeleteLargePage( LinearAllocationPage* Page );
+
     static LinearAllocatorType sm_AutoType;
 
     LinearAllocatorType m_AllocationType;
+    size_t m_DefaultPageSize;
+    std::atomic<uint64_t> m_OwnerId;
     std::vector<std::unique_ptr<LinearAllocationPage> > m_PagePool;
     std::queue<std::pair<uint64_t, LinearAllocationPage*> > m_RetiredPages;
-    std::queue<std::pair<uint64_t, LinearAllocationPage*> > m_DeletionQueue;
     std::queue<LinearAllocationPage*> m_AvailablePages;
+    std::atomic<uint32_t> m_ThreadCachedCount;
+
+    std::queue<std::pair<uint64_t, LinearAllocationPage*> > m_RetiredLargePages;
+    std::map<size_t, std::vector<LinearAllocationPage*> > m_AvailableLargePages;
+    uint32_t m_NumLargePages;
+    uint32_t m_NumIdleLargePages;
+    uint64_t m_LargePageBytes;
+    uint64_t m_IdleLargePageBytes;
+    uint64_t m_MaxIdleLargePageBytes;
+
+    FrameCounters m_ThisFrame;
+    FrameCounters m_LastFrame;
+
     std::mutex m_Mutex;
 };
 
@@ -129,16 +224,38 @@ class LinearAllocator
 {
 public:
 
-    LinearAllocator(LinearAllocatorType Type) : m_AllocationType(Type), m_PageSize(0), m_CurOffset(~(size_t)0), m_CurPage(nullptr)
+    // A page size of zero uses the default for the type.  Other sizes are rounded up to a large page size
+    // class, e.g. for a context that streams a lot of data through upload memory.
+    LinearAllocator(LinearAllocatorType Type, size_t PageSize = 0) : m_AllocationType(Type), m_PageSize(0),
+        m_CurOffset(~(size_t)0), m_CurPage(nullptr)
     {
         ASSERT(Type > kInvalidAllocator && Type < kNumAllocatorTypes);
-        m_PageSize = (Type == kGpuExclusive ? kGpuAllocatorPageSize : kCpuAllocatorPageSize);
+        ZeroMemory(&m_Usage, sizeof(m_Usage));
+        SetPageSize(PageSize);
     }
 
     DynAlloc Allocate( size_t SizeInBytes, size_t Alignment = DEFAULT_ALIGN );
 
     void CleanupUsedPages( uint64_t FenceID );
 
+    // Takes effect with the next page.  Zero restores the default for the type.
+    void SetPageSize( size_t PageSize );
+    size_t GetPageSize( void ) const { return m_PageSize; }
+
+    static LinearAllocatorStats GetStats( LinearAllocatorType Type ) { return sm_PageManager[Type].GetStats(); }
+
+    static size_t GetDefaultPageSize( LinearAllocatorType Type )
+    {
+        return Type == kGpuExclusive ? kGpuAllocatorPageSize : kCpuAllocatorPageSize;
+    }
+
+    // Call once per frame to start counting the next one
+    static void EndFrame( void )
+    {
+        sm_PageManager[0].EndFrame();
+        sm_PageManager[1].EndFrame();
+    }
+
     static void DestroyAll( void )
     {
         sm_PageManager[0].Destroy();
@@ -155,6 +272,6 @@ private:
     size_t m_PageSize;
     size_t m_CurOffset;
     LinearAllocationPage* m_CurPage;
-    std::vector<LinearAllocationPage*> m_RetiredPages;
-    std::vector<LinearAllocationPage*> m_LargePageList;
+    std::vector<LinearAllocationPage*> m_RetiredPages;     // Standard, custom sized and large pages
+    LinearAllocatorPageManager::UsageCounters m_Usage;
 };
@@ -0,0 +1,299 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+
+#include "pch.h"
+#include "PSOCompiler.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+using namespace std;
+
+namespace PSOCompiler
+{
+    class WorkerPool
+    {
+    public:
+
+        WorkerPool() : m_IsRunning(false), m_IsStopping(false), m_FallbacksUsed(0) { ResetStats(); }
+
+        void Start( uint32_t NumWorkers )
+        {
+            ASSERT(!m_IsRunning, "PSO compiler has already been initialized");
+
+            ResetStats();
+            m_FallbacksUsed = 0;
+            m_IsStopping = false;
+            m_Stats.NumWorkers = NumWorkers;
+
+            for (uint32_t i = 0; i < NumWorkers; ++i)
+                m_Workers.emplace_back(&WorkerPool::WorkerMain, this);
+
+            m_IsRunning = true;
+        }
+
+        void Stop( void )
+        {
+            if (!m_IsRunning)
+                return;
+
+            {
+                lock_guard<mutex> LockGuard(m_QueueMutex);
+                m_IsStopping = true;
+            }
+            m_QueueCondition.notify_all();
+
+            for (thread& Worker : m_Workers)
+                Worker.join();
+
+            m_Workers.clear();
+            m_IsRunning = false;
+
+            CompilerStats Stats = GetStats();
+            Utility::Printf("PSO compiler:  %llu needed this frame (%.2f ms average, %.2f ms max latency), "
+                "%llu prefetched (%.2f ms average, %.2f ms max latency), peak queue depth %u, %llu promoted, %llu fallbacks\n",
+                Stats.Completed[kNeededThisFrame], Stats.AverageLatencyMs[kNeededThisFrame], Stats.MaxLatencyMs[kNeededThisFrame],
+                Stats.Completed[kPrefetch], Stats.AverageLatencyMs[kPrefetch], Stats.MaxLatencyMs[kPrefetch],
+                Stats.PeakQueueDepth, Stats.Promotions, Stats.FallbacksUsed);
+        }
+
+        void Submit( const shared_ptr<CompileJob>& Job )
+        {
+            if (!m_IsRunning)
+            {
+                // Without workers (e.g. in tools) compile right away
+                lock_guard<mutex> LockGuard(m_QueueMutex);
+                Claim(*Job, true);
+                ++m_Stats.InlineCompiles;
+            }
+            else
+            {
+                {
+                    lock_guard<mutex> LockGuard(m_QueueMutex);
+                    m_Queues[Job->m_Priority].push_back(Job);
+                    ++m_Stats.QueueDepth[Job->m_Priority];
+
+                    uint32_t TotalDepth = 0;
+                    for (uint32_t i = 0; i < kNumPriorities; ++i)
+                        TotalDepth += m_Stats.QueueDepth[i];
+                    m_Stats.PeakQueueDepth = max(m_Stats.PeakQueueDepth, TotalDepth);
+                }
+                m_QueueCondition.notify_one();
+                return;
+            }
+
+            Execute(*Job);
+        }
+
+        void Wait( CompileJob& Job )
+        {
+            if (Job.IsReady())
+                return;
+
+            bool CompileHere;
+            {
+                lock_guard<mutex> LockGuard(m_QueueMutex);
+                CompileHere = Claim(Job, false);
+                if (CompileHere)
+                    ++m_Stats.InlineCompiles;
+            }
+
+            if (CompileHere)
+            {
+                Execute(Job);
+                return;
+            }
+
+            unique_lock<mutex> Lock(m_ReadyMutex);
+            m_ReadyCondition.wait(Lock, [&Job] { return Job.IsReady(); });
+        }
+
+        void UseFallback( CompileJob& Job )
+        {
+            ++m_FallbacksUsed;
+
+            // Draws keep asking for the PSO every frame until it's ready, but only the first can promote it
+            if (Job.m_FallbackUsed.exchange(true))
+                return;
+
+            bool Promoted = false;
+            {
+                lock_guard<mutex> LockGuard(m_QueueMutex);
+
+                // The entry left in the prefetch queue is skipped once the job has been claimed
+                if (m_IsRunning && Job.m_Priority != kNeededThisFrame && Job.m_State.load() == CompileJob::kQueued)
+                {
+                    --m_Stats.QueueDepth[Job.m_Priority];
+                    ++m_Stats.QueueDepth[kNeededThisFrame];
+                    ++m_Stats.Promotions;
+                    Job.m_Priority = kNeededThisFrame;
+                    m_Queues[kNeededThisFrame].push_back(Job.shared_from_this());
+                    Promoted = true;
+                }
+            }
+
+            if (Promoted)
+                m_QueueCondition.notify_one();
+        }
+
+        CompilerStats GetStats( void )
+        {
+            lock_guard<mutex> LockGuard(m_QueueMutex);
+
+            CompilerStats Stats = m_Stats;
+            Stats.FallbacksUsed = m_FallbacksUsed;
+            for (uint32_t i = 0; i < kNumPriorities; ++i)
+                Stats.AverageLatencyMs[i] = Stats.Completed[i] > 0 ? m_TotalLatencyMs[i] / Stats.Completed[i] : 0.0;
+            return Stats;
+        }
+
+    private:
+
+        void ResetStats( void )
+        {
+            ZeroMemory(&m_Stats, sizeof(m_Stats));
+            for (uint32_t i = 0; i < kNumPriorities; ++i)
+                m_TotalLatencyMs[i] = 0.0;
+        }
+
+        // Must hold m_QueueMutex.  Only one thread can claim a job, and only while it's queued.
+        bool Claim( CompileJob& Job, bool IsNew )
+        {
+            uint32_t Expected = CompileJob::kQueued;
+            if (!Job.m_State.compare_exchange_strong(Expected, CompileJob::kCompiling))
+                return false;
+
+            if (!IsNew)
+                --m_Stats.QueueDepth[Job.m_Priority];
+            return true;
+        }
+
+        void Execute( CompileJob& Job )
+        {
+            Job.Compile();
+
+            double LatencyMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - Job.m_SubmitTime).count();
+
+            {
+                lock_guard<mutex> LockGuard(m_QueueMutex);
+                ++m_Stats.Completed[Job.m_Priority];
+                m_TotalLatencyMs[Job.m_Priority] += LatencyMs;
+                m_Stats.MaxLatencyMs[Job.m_Priority] = max(m_Stats.MaxLatencyMs[Job.m_Priority], LatencyMs);
+            }
+
+            {
+                lock_guard<mutex> LockGuard(m_ReadyMutex);
+                Job.m_State.store(CompileJob::kReady, memory_order_release);
+            }
+            m_ReadyCondition.notify_all();
+        }
+
+        void WorkerMain( void )
+        {
+            for (;;)
+            {
+                shared_ptr<CompileJob> Job;
+                {
+                    unique_lock<mutex> Lock(m_QueueMutex);
+
+                    for (;;)
+                    {
+                        uint32_t Level = 0;
+                        while (Level < kNumPriorities && m_Queues[Level].empty())
+                            ++Level;
+
+                        if (Level == kNumPriorities)
+                        {
+                            if (m_IsStopping)
+                                return;
+                            m_QueueCondition.wait(Lock);
+                            continue;
+                        }
+
+                        Job = move(m_Queues[Level].front());
+                        m_Queues[Level].pop_front();
+
+                        // Skip jobs that were promoted or compiled by a waiting thread
+                        if (Claim(*Job, false))
+                            break;
+                    }
+                }
+
+                Execute(*Job);
+            }
+        }
+
+        vector<thread> m_Workers;
+        bool m_IsRunning;
+        bool m_IsStopping;
+
+        mutex m_QueueMutex;
+        condition_variable m_QueueCondition;
+        deque< shared_ptr<CompileJob> > m_Queues[kNumPriorities];
+        CompilerStats m_Stats;
+        double m_TotalLatencyMs[kNumPriorities];
+        atomic<uint64_t> m_FallbacksUsed;
+
+        mutex m_ReadyMutex;
+        condition_variable m_ReadyCondition;
+    };
+
+    static WorkerPool s_WorkerPool;
+}
+
+void PSOCompiler::Initialize( uint32_t NumWorkers )
+{
+    // Leave a couple of cores for the game and render threads
+    if (NumWorkers == 0)
+    {
+        uint32_t NumCores = thread::hardware_concurrency();
+        NumWorkers = NumCores > 3 ? NumCores - 2 : 1;
+    }
+
+    s_WorkerPool.Start(NumWorkers);
+}
+
+void PSOCompiler::Shutdown( void )
+{
+    s_WorkerPool.Stop();
+}
+
+void PSOCompiler::CompileJob::Wait( void )
+{
+    s_WorkerPool.Wait(*this);
+}
+
+void PSOCompiler::CompileJob::UseFallback( void )
+{
+    s_WorkerPool.UseFallback(*this);
+}
+
+PSOCompiler::Handle<GraphicsPSO> PSOCompiler::Compile( const GraphicsPSO& PSO, Priority JobPriority )
+{
+    shared_ptr< TypedCompileJob<GraphicsPSO> > Job = make_shared< TypedCompileJob<GraphicsPSO> >(PSO, JobPriority);
+    s_WorkerPool.Submit(Job);
+    return Handle<GraphicsPSO>(Job);
+}
+
+PSOCompiler::Handle<ComputePSO> PSOCompiler::Compile( const ComputePSO& PSO, Priority JobPriority )
+{
+    shared_ptr< TypedCompileJob<ComputePSO> > Job = make_shared< TypedCompileJob<ComputePSO> >(PSO, JobPriority);
+    s_WorkerPool.Submit(Job);
+    return Handle<ComputePSO>(Job);
+}
+
+PSOCompiler::CompilerStats PSOCompiler::GetStats( void )
+{
+    return s_WorkerPool.GetStats();
+}
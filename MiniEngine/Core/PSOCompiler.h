@@ -0,0 +1,159 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// Finalizes pipeline state objects on a pool of worker threads.  Compile() takes a copy of a
+// fully described PSO and returns a handle right away.  The renderer can poll the handle, wait
+// on it, or draw with a fallback PSO (e.g. a simpler or uber shader variant) until the real
+// one is ready.  Requests marked kNeededThisFrame are always started before prefetches.
+//
+
+#pragma once
+
+#include "pch.h"
+#include "PipelineState.h"
+#include <atomic>
+#include <chrono>
+
+namespace PSOCompiler
+{
+    enum Priority
+    {
+        kNeededThisFrame,
+        kPrefetch,
+
+        kNumPriorities
+    };
+
+    // Starts the worker threads.  Zero picks a count based on the number of cores.
+    void Initialize( uint32_t NumWorkers = 0 );
+
+    // Finishes every queued compile, then stops the workers
+    void Shutdown( void );
+
+    class CompileJob : public std::enable_shared_from_this<CompileJob>
+    {
+    public:
+
+        CompileJob( Priority JobPriority ) : m_State(kQueued), m_Priority(JobPriority), m_FallbackUsed(false),
+            m_SubmitTime(std::chrono::high_resolution_clock::now()) {}
+        virtual ~CompileJob() {}
+
+        bool IsReady( void ) const { return m_State.load(std::memory_order_acquire) == kReady; }
+
+        // Blocks until the PSO is compiled.  If no worker has started it yet, it is compiled on
+        // the calling thread rather than waiting for one to.
+        void Wait( void );
+
+        // Called when a fallback was used in place of this PSO.  The first call moves a prefetch to
+        // the front of the queue, since something is now waiting on it.  Later calls only count.
+        void UseFallback( void );
+
+    protected:
+
+        friend class WorkerPool;
+
+        enum State { kQueued, kCompiling, kReady };
+
+        virtual void Compile( void ) = 0;
+
+        std::atomic<uint32_t> m_State;
+        Priority m_Priority;
+        std::atomic<bool> m_FallbackUsed;
+        std::chrono::high_resolution_clock::time_point m_SubmitTime;
+    };
+
+    template <typename PSOType>
+    class TypedCompileJob : public CompileJob
+    {
+    public:
+        TypedCompileJob( const PSOType& PSO, Priority JobPriority ) : CompileJob(JobPriority), m_PSO(PSO), m_CompiledPSO(nullptr) {}
+
+        const PSOType& GetPSO( void ) const { return m_PSO; }
+
+        // Null until the PSO is finalized.  Published once, so it can be polled without a lock.
+        const PSOType* GetCompiledPSO( void ) const { return m_CompiledPSO.load(std::memory_order_acquire); }
+
+    protected:
+        virtual void Compile( void ) override
+        {
+            m_PSO.Finalize();
+            m_CompiledPSO.store(&m_PSO, std::memory_order_release);
+        }
+
+        PSOType m_PSO;
+        std::atomic<const PSOType*> m_CompiledPSO;
+    };
+
+    template <typename PSOType>
+    class Handle
+    {
+    public:
+
+        Handle() {}
+        Handle( const std::shared_ptr< TypedCompileJob<PSOType> >& Job ) : m_Job(Job) {}
+
+        bool IsValid( void ) const { return m_Job != nullptr; }
+        bool IsReady( void ) const { return m_Job != nullptr && m_Job->IsReady(); }
+
+        const PSOType& Wait( void ) const
+        {
+            ASSERT(IsValid());
+            m_Job->Wait();
+            return m_Job->GetPSO();
+        }
+
+        // The compiled PSO, or null if it isn't ready yet, in which case the caller is expected to
+        // draw without it.  Doesn't lock once the PSO is ready.
+        const PSOType* TryGet( void ) const
+        {
+            if (m_Job == nullptr)
+                return nullptr;
+
+            const PSOType* PSO = m_Job->GetCompiledPSO();
+            if (PSO == nullptr)
+                m_Job->UseFallback();
+            return PSO;
+        }
+
+        // The compiled PSO if it's ready, otherwise Fallback, which must already be finalized
+        const PSOType& Get( const PSOType& Fallback ) const
+        {
+            const PSOType* PSO = TryGet();
+            return PSO != nullptr ? *PSO : Fallback;
+        }
+
+    private:
+
+        std::shared_ptr< TypedCompileJob<PSOType> > m_Job;
+    };
+
+    // The PSO's root signature must already be finalized and outlive the compile, as must its
+    // shader bytecode.  The PSO itself is copied, so it may be modified or destroyed afterwards.
+    Handle<GraphicsPSO> Compile( const GraphicsPSO& PSO, Priority JobPriority = kPrefetch );
+    Handle<ComputePSO> Compile( const ComputePSO& PSO, Priority JobPriority = kPrefetch );
+
+    struct CompilerStats
+    {
+        uint32_t NumWorkers;
+        uint32_t QueueDepth[kNumPriorities];        // Waiting to be started
+        uint32_t PeakQueueDepth;
+        uint64_t Completed[kNumPriorities];
+        double AverageLatencyMs[kNumPriorities];    // From Compile() until the PSO was ready
+        double MaxLatencyMs[kNumPriorities];
+        uint64_t Promotions;                        // Prefetches moved up because a fallback was used
+        uint64_t InlineCompiles;                    // Compiled by a waiting thread instead of a worker
+        uint64_t FallbacksUsed;
+    };
+
+    CompilerStats GetStats( void );
+
+} // namespace PSOCompiler
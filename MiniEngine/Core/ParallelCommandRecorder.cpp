@@ -0,0 +1,216 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+
+#include "pch.h"
+#include "ParallelCommandRecorder.h"
+#include "CommandContext.h"
+#include "EngineProfiling.h"
+#include "TraceProfiler.h"
+#include "SystemTime.h"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+using namespace std;
+
+namespace ParallelCommandRecorder
+{
+    // Runs one task per slice.  Workers sleep between passes rather than being created for each one.
+    class WorkerPool
+    {
+    public:
+
+        WorkerPool() : m_Task(nullptr), m_NumTasks(0), m_NumPending(0), m_Generation(0), m_IsStopping(false) {}
+
+        void Start( uint32_t NumWorkers )
+        {
+            ASSERT(m_Workers.empty(), "Parallel command recorder has already been initialized");
+
+            m_IsStopping = false;
+            for (uint32_t i = 0; i < NumWorkers; ++i)
+                m_Workers.emplace_back(&WorkerPool::WorkerMain, this, i);
+        }
+
+        void Stop( void )
+        {
+            {
+                lock_guard<mutex> LockGuard(m_Mutex);
+                m_IsStopping = true;
+            }
+            m_StartCondition.notify_all();
+
+            for (thread& Worker : m_Workers)
+                Worker.join();
+
+            m_Workers.clear();
+        }
+
+        uint32_t GetNumWorkers( void ) const { return (uint32_t)m_Workers.size(); }
+
+        // Runs Task(0) on the calling thread and the rest on workers, and returns when all have finished
+        void Run( uint32_t NumTasks, const function<void(uint32_t)>& Task )
+        {
+            // Passes recorded from different threads take turns with the pool
+            lock_guard<mutex> RunGuard(m_RunMutex);
+
+            ASSERT(NumTasks <= GetNumWorkers() + 1);
+
+            {
+                lock_guard<mutex> LockGuard(m_Mutex);
+                m_Task = &Task;
+                m_NumTasks = NumTasks;
+                m_NumPending = NumTasks - 1;
+                ++m_Generation;
+            }
+            m_StartCondition.notify_all();
+
+            Task(0);
+
+            unique_lock<mutex> Lock(m_Mutex);
+            m_DoneCondition.wait(Lock, [this] { return m_NumPending == 0; });
+            m_Task = nullptr;
+        }
+
+    private:
+
+        void WorkerMain( uint32_t WorkerIndex )
+        {
+            TraceProfiler::SetThreadName(L"Recording Worker " + to_wstring(WorkerIndex + 1));
+
+            uint64_t LastGeneration = 0;
+            uint32_t TaskIndex = WorkerIndex + 1;
+
+            for (;;)
+            {
+                const function<void(uint32_t)>* Task;
+                {
+                    unique_lock<mutex> Lock(m_Mutex);
+                    m_StartCondition.wait(Lock, [&] { return m_IsStopping || m_Generation != LastGeneration; });
+
+                    if (m_IsStopping)
+                        return;
+
+                    LastGeneration = m_Generation;
+
+                    // Passes split across fewer contexts leave the last workers idle
+                    if (TaskIndex >= m_NumTasks)
+                        continue;
+
+                    Task = m_Task;
+                }
+
+                (*Task)(TaskIndex);
+
+                bool IsLast;
+                {
+                    lock_guard<mutex> LockGuard(m_Mutex);
+                    IsLast = --m_NumPending == 0;
+                }
+                if (IsLast)
+                    m_DoneCondition.notify_one();
+            }
+        }
+
+        vector<thread> m_Workers;
+
+        mutex m_RunMutex;
+        mutex m_Mutex;
+        condition_variable m_StartCondition;
+        condition_variable m_DoneCondition;
+        const function<void(uint32_t)>* m_Task;
+        uint32_t m_NumTasks;
+        uint32_t m_NumPending;
+        uint64_t m_Generation;
+        bool m_IsStopping;
+    };
+
+    static WorkerPool s_WorkerPool;
+
+    static const wchar_t* s_SliceNames[kMaxContexts] =
+    {
+        L"Slice 0", L"Slice 1", L"Slice 2", L"Slice 3", L"Slice 4", L"Slice 5", L"Slice 6", L"Slice 7"
+    };
+
+    static uint32_t s_SliceTraceIds[kMaxContexts];
+}
+
+void ParallelCommandRecorder::Initialize( uint32_t NumWorkers )
+{
+    // The render thread records a slice too, and PSO compiles have their own threads
+    if (NumWorkers == 0)
+    {
+        uint32_t NumCores = thread::hardware_concurrency();
+        NumWorkers = NumCores > 2 ? NumCores / 2 : 1;
+    }
+
+    for (uint32_t i = 0; i < kMaxContexts; ++i)
+        s_SliceTraceIds[i] = TraceProfiler::RegisterScope(s_SliceNames[i]);
+
+    s_WorkerPool.Start(min(NumWorkers, kMaxContexts - 1));
+}
+
+void ParallelCommandRecorder::Shutdown( void )
+{
+    s_WorkerPool.Stop();
+}
+
+uint32_t ParallelCommandRecorder::GetMaxContexts( void )
+{
+    return s_WorkerPool.GetNumWorkers() + 1;
+}
+
+uint32_t ParallelCommandRecorder::Record( GraphicsContext& Parent, uint32_t NumItems, const SetupFunction& Setup,
+    const RecordFunction& Record, uint32_t MaxContexts, uint32_t MinItemsPerContext )
+{
+    uint32_t NumContexts = MaxContexts == 0 ? GetMaxContexts() : min(MaxContexts, GetMaxContexts());
+    NumContexts = min(NumContexts, NumItems / max(MinItemsPerContext, 1u));
+
+    if (NumContexts <= 1)
+    {
+        Setup(Parent);
+        Record(Parent, 0, NumItems);
+        return 1;
+    }
+
+    // Contexts come from the shared pool, so take them before the workers start
+    CommandContext* Contexts[kMaxContexts];
+    for (uint32_t i = 0; i < NumContexts; ++i)
+        Contexts[i] = &CommandContext::Begin();
+
+    int64_t StartTicks[kMaxContexts];
+    int64_t EndTicks[kMaxContexts];
+
+    function<void(uint32_t)> RecordSlice = [&]( uint32_t Slice )
+    {
+        TraceScope SliceScope(s_SliceTraceIds[Slice]);
+        StartTicks[Slice] = SystemTime::GetCurrentTick();
+
+        GraphicsContext& Context = Contexts[Slice]->GetGraphicsContext();
+        uint32_t First = (uint32_t)((uint64_t)NumItems * Slice / NumContexts);
+        uint32_t Last = (uint32_t)((uint64_t)NumItems * (Slice + 1) / NumContexts);
+
+        Setup(Context);
+        Record(Context, First, Last - First);
+
+        EndTicks[Slice] = SystemTime::GetCurrentTick();
+    };
+
+    s_WorkerPool.Run(NumContexts, RecordSlice);
+
+    for (uint32_t i = 0; i < NumContexts; ++i)
+        EngineProfiling::AddCpuBlock(s_SliceNames[i], StartTicks[i], EndTicks[i]);
+
+    Parent.FlushWith(Contexts, NumContexts);
+
+    return NumContexts;
+}
@@ -0,0 +1,59 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// Splits the draws of a pass across several graphics contexts and records them on a pool of worker
+// threads.  The calling thread records the first slice itself.  When every slice is recorded, the
+// parent context's list and the workers' lists are submitted, in that order, with one
+// ExecuteCommandLists call and one fence.  Work recorded on the parent before the pass runs first,
+// and anything recorded on it afterwards runs last, so a pass can be forked and joined in place.
+//
+
+#pragma once
+
+#include "pch.h"
+#include <functional>
+
+class GraphicsContext;
+
+namespace ParallelCommandRecorder
+{
+    static const uint32_t kMaxContexts = 8;
+
+    // Starts the worker threads.  Zero picks a count based on the number of cores.
+    void Initialize( uint32_t NumWorkers = 0 );
+    void Shutdown( void );
+
+    // The worker threads plus the calling thread
+    uint32_t GetMaxContexts( void );
+
+    // Sets the state a slice needs before drawing on a fresh context: root signature, pipeline state, render
+    // targets, viewport, vertex and index buffers, descriptors and constants.
+    typedef std::function<void(GraphicsContext&)> SetupFunction;
+
+    // Records draws [First, First + Count).  It runs on several threads at once, so it must only touch the
+    // context it is given and data that nothing else writes during the pass.
+    typedef std::function<void(GraphicsContext&, uint32_t First, uint32_t Count)> RecordFunction;
+
+    // Records NumItems draws on up to MaxContexts contexts (zero for GetMaxContexts()), giving each at least
+    // MinItemsPerContext.  When one context is enough, the draws are recorded on Parent directly.  Otherwise
+    // Parent is flushed together with the slices, and like Flush(), only its root signature, pipeline state
+    // and descriptor heaps are restored afterwards.
+    //
+    // Slices may transition resources.  Each list's states are resolved in submission order, so a slice sees
+    // the states Parent and the slices before it leave behind.
+    // Each slice's CPU time is added to the profiler under the current block as "Slice N".
+    //
+    // Returns the number of contexts the draws were split across.
+    uint32_t Record( GraphicsContext& Parent, uint32_t NumItems, const SetupFunction& Setup,
+        const RecordFunction& Record, uint32_t MaxContexts = 0, uint32_t MinItemsPerContext = 64 );
+
+} // namespace ParallelCommandRecorder
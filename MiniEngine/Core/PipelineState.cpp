@@ -15,22 +15,21 @@
 #include "PipelineState.h"
 #include "RootSignature.h"
 #include "Hash.h"
-#include <map>
-#include <thread>
-#include <mutex>
+#include "PipelineStateCache.h"
+#include "CompileOnceMap.h"
 
 using Math::IsAligned;
 using namespace Graphics;
 using Microsoft::WRL::ComPtr;
 using namespace std;
 
-static map< size_t, ComPtr<ID3D12PipelineState> > s_GraphicsPSOHashMap;
-static map< size_t, ComPtr<ID3D12PipelineState> > s_ComputePSOHashMap;
+static CompileOnceMap< ComPtr<ID3D12PipelineState> > s_GraphicsPSOHashMap;
+static CompileOnceMap< ComPtr<ID3D12PipelineState> > s_ComputePSOHashMap;
 
 void PSO::DestroyAll(void)
 {
-    s_GraphicsPSOHashMap.clear();
-    s_ComputePSOHashMap.clear();
+    s_GraphicsPSOHashMap.Clear();
+    s_ComputePSOHashMap.Clear();
 }
 
 
@@ -117,34 +116,13 @@ void GraphicsPSO::Finalize()
     HashCode = Utility::HashState(m_InputLayouts.get(), m_PSODesc.InputLayout.NumElements, HashCode);
     m_PSODesc.InputLayout.pInputElementDescs = m_InputLayouts.get();
 
-    ID3D12PipelineState** PSORef = nullptr;
-    bool firstCompile = false;
+    // Only the first thread to finalize this state compiles it, the rest wait for its result
+    m_PSO = s_GraphicsPSOHashMap.GetOrCreate(HashCode, [&]()
     {
-        static mutex s_HashMapMutex;
-        lock_guard<mutex> CS(s_HashMapMutex);
-        auto iter = s_GraphicsPSOHashMap.find(HashCode);
-
-        // Reserve space so the next inquiry will find that someone got here first.
-        if (iter == s_GraphicsPSOHashMap.end())
-        {
-            firstCompile = true;
-            PSORef = s_GraphicsPSOHashMap[HashCode].GetAddressOf();
-        }
-        else
-            PSORef = iter->second.GetAddressOf();
-    }
-
-    if (firstCompile)
-    {
-        ASSERT_SUCCEEDED( g_Device->CreateGraphicsPipelineState(&m_PSODesc, MY_IID_PPV_ARGS(&m_PSO)) );
-        s_GraphicsPSOHashMap[HashCode].Attach(m_PSO);
-    }
-    else
-    {
-        while (*PSORef == nullptr)
-            this_thread::yield();
-        m_PSO = *PSORef;
-    }
+        ComPtr<ID3D12PipelineState> PSO;
+        PSO.Attach(PipelineStateCache::CreateGraphicsPipelineState(m_PSODesc, m_RootSignature->GetSignatureHash()));
+        return PSO;
+    }).Get();
 }
 
 void ComputePSO::Finalize()
@@ -155,34 +133,13 @@ void ComputePSO::Finalize()
 
     size_t HashCode = Utility::HashState(&m_PSODesc);
 
-    ID3D12PipelineState** PSORef = nullptr;
-    bool firstCompile = false;
+    // Only the first thread to finalize this state compiles it, the rest wait for its result
+    m_PSO = s_ComputePSOHashMap.GetOrCreate(HashCode, [&]()
     {
-        static mutex s_HashMapMutex;
-        lock_guard<mutex> CS(s_HashMapMutex);
-        auto iter = s_ComputePSOHashMap.find(HashCode);
-
-        // Reserve space so the next inquiry will find that someone got here first.
-        if (iter == s_ComputePSOHashMap.end())
-        {
-            firstCompile = true;
-            PSORef = s_ComputePSOHashMap[HashCode].GetAddressOf();
-        }
-        else
-            PSORef = iter->second.GetAddressOf();
-    }
-
-    if (firstCompile)
-    {
-        ASSERT_SUCCEEDED( g_Device->CreateComputePipelineState(&m_PSODesc, MY_IID_PPV_ARGS(&m_PSO)) );
-        s_ComputePSOHashMap[HashCode].Attach(m_PSO);
-    }
-    else
-    {
-        while (*PSORef == nullptr)
-            this_thread::yield();
-        m_PSO = *PSORef;
-    }
+        ComPtr<ID3D12PipelineState> PSO;
+        PSO.Attach(PipelineStateCache::CreateComputePipelineState(m_PSODesc, m_RootSignature->GetSignatureHash()));
+        return PSO;
+    }).Get();
 }
 
 ComputePSO::ComputePSO()
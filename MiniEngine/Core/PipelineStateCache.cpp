@@ -0,0 +1,545 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+
+#include "pch.h"
+#include "PipelineStateCache.h"
+#include "GraphicsCore.h"
+#include "FileUtility.h"
+#include <dxgi1_4.h>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+
+using namespace std;
+using namespace Graphics;
+using Microsoft::WRL::ComPtr;
+
+namespace PipelineStateCache
+{
+    static const uint32_t kFileMagic = 0x4350454D;      // 'MEPC'
+    static const size_t kBlobAlignment = 16;
+
+    struct FileHeader
+    {
+        uint32_t Magic;
+        uint32_t FormatVersion;
+        AdapterIdentity Adapter;
+        uint32_t EntryCount;
+        uint32_t EntrySize;
+        uint64_t LibraryOffset;
+        uint64_t LibrarySize;
+        uint64_t Checksum;          // Of everything following the header
+    };
+
+    struct FileEntry
+    {
+        CacheKey Key;
+        float CompileTimeMs;
+        uint32_t Reserved;
+        uint64_t BlobOffset;
+        uint64_t BlobSize;
+    };
+
+    struct CacheKeyHasher
+    {
+        size_t operator()(const CacheKey& Key) const { return (size_t)(Key.DescHash ^ (Key.ShaderHash * 31)); }
+    };
+
+    static uint64_t HashString(const char* String, uint64_t Hash)
+    {
+        // Include the terminator so adjacent strings can't run together
+        return String == nullptr ? HashBytes("", 1, Hash) : HashBytes(String, strlen(String) + 1, Hash);
+    }
+
+    static uint64_t HashShader(const D3D12_SHADER_BYTECODE& Shader, uint64_t Hash)
+    {
+        Hash = HashBytes(&Shader.BytecodeLength, sizeof(Shader.BytecodeLength), Hash);
+        return HashBytes(Shader.pShaderBytecode, Shader.BytecodeLength, Hash);
+    }
+
+    static bool IsInFile(uint64_t Offset, uint64_t Size, size_t FileSize)
+    {
+        return Offset <= FileSize && Size <= FileSize - Offset;
+    }
+}
+
+uint64_t PipelineStateCache::HashBytes(const void* Data, size_t Size, uint64_t Hash)
+{
+    // 64-bit FNV-1a.  Unlike Utility::HashRange this doesn't depend on the CPU, which matters
+    // for keys that are written to disk.
+    const byte* Bytes = (const byte*)Data;
+    for (size_t i = 0; i < Size; ++i)
+        Hash = (Hash ^ Bytes[i]) * 1099511628211ULL;
+    return Hash;
+}
+
+PipelineStateCache::CacheKey PipelineStateCache::ComputeKey(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& Desc, size_t RootSignatureHash)
+{
+    // Hash the plain state with every pointer cleared, then hash what the pointers refer to
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC State = Desc;
+    State.pRootSignature = nullptr;
+    State.VS.pShaderBytecode = nullptr;
+    State.PS.pShaderBytecode = nullptr;
+    State.DS.pShaderBytecode = nullptr;
+    State.HS.pShaderBytecode = nullptr;
+    State.GS.pShaderBytecode = nullptr;
+    State.StreamOutput.pSODeclaration = nullptr;
+    State.StreamOutput.pBufferStrides = nullptr;
+    State.InputLayout.pInputElementDescs = nullptr;
+    State.CachedPSO.pCachedBlob = nullptr;
+    State.CachedPSO.CachedBlobSizeInBytes = 0;
+
+    CacheKey Key;
+    Key.DescHash = HashBytes(&State, sizeof(State));
+    Key.DescHash = HashBytes(&RootSignatureHash, sizeof(RootSignatureHash), Key.DescHash);
+
+    for (UINT i = 0; i < Desc.InputLayout.NumElements; ++i)
+    {
+        D3D12_INPUT_ELEMENT_DESC Element = Desc.InputLayout.pInputElementDescs[i];
+        Key.DescHash = HashString(Element.SemanticName, Key.DescHash);
+        Element.SemanticName = nullptr;
+        Key.DescHash = HashBytes(&Element, sizeof(Element), Key.DescHash);
+    }
+
+    for (UINT i = 0; i < Desc.StreamOutput.NumEntries; ++i)
+    {
+        D3D12_SO_DECLARATION_ENTRY Entry = Desc.StreamOutput.pSODeclaration[i];
+        Key.DescHash = HashString(Entry.SemanticName, Key.DescHash);
+        Entry.SemanticName = nullptr;
+        Key.DescHash = HashBytes(&Entry, sizeof(Entry), Key.DescHash);
+    }
+
+    if (Desc.StreamOutput.NumStrides > 0)
+        Key.DescHash = HashBytes(Desc.StreamOutput.pBufferStrides, Desc.StreamOutput.NumStrides * sizeof(UINT), Key.DescHash);
+
+    Key.ShaderHash = HashShader(Desc.VS, 14695981039346656037ULL);
+    Key.ShaderHash = HashShader(Desc.PS, Key.ShaderHash);
+    Key.ShaderHash = HashShader(Desc.DS, Key.ShaderHash);
+    Key.ShaderHash = HashShader(Desc.HS, Key.ShaderHash);
+    Key.ShaderHash = HashShader(Desc.GS, Key.ShaderHash);
+
+    return Key;
+}
+
+PipelineStateCache::CacheKey PipelineStateCache::ComputeKey(const D3D12_COMPUTE_PIPELINE_STATE_DESC& Desc, size_t RootSignatureHash)
+{
+    D3D12_COMPUTE_PIPELINE_STATE_DESC State = Desc;
+    State.pRootSignature = nullptr;
+    State.CS.pShaderBytecode = nullptr;
+    State.CachedPSO.pCachedBlob = nullptr;
+    State.CachedPSO.CachedBlobSizeInBytes = 0;
+
+    CacheKey Key;
+    Key.DescHash = HashBytes(&State, sizeof(State));
+    Key.DescHash = HashBytes(&RootSignatureHash, sizeof(RootSignatureHash), Key.DescHash);
+    Key.ShaderHash = HashShader(Desc.CS, 14695981039346656037ULL);
+
+    return Key;
+}
+
+wstring PipelineStateCache::GetPipelineName(const CacheKey& Key)
+{
+    wchar_t Name[33];
+    swprintf_s(Name, L"%016llx%016llx", Key.DescHash, Key.ShaderHash);
+    return Name;
+}
+
+vector<byte> PipelineStateCache::WriteCacheFile(const AdapterIdentity& Adapter, const CacheFileContents& Contents)
+{
+    size_t TableEnd = sizeof(FileHeader) + Contents.Entries.size() * sizeof(FileEntry);
+    size_t FileSize = TableEnd;
+
+    for (const CacheEntry& Entry : Contents.Entries)
+    {
+        if (Entry.BlobSize > 0)
+            FileSize = Math::AlignUp(FileSize, kBlobAlignment) + Entry.BlobSize;
+    }
+
+    size_t LibraryOffset = 0;
+    if (Contents.LibrarySize > 0)
+    {
+        LibraryOffset = Math::AlignUp(FileSize, kBlobAlignment);
+        FileSize = LibraryOffset + Contents.LibrarySize;
+    }
+
+    vector<byte> File(FileSize, 0);
+
+    FileHeader* Header = (FileHeader*)File.data();
+    Header->Magic = kFileMagic;
+    Header->FormatVersion = kFormatVersion;
+    Header->Adapter = Adapter;
+    Header->EntryCount = (uint32_t)Contents.Entries.size();
+    Header->EntrySize = sizeof(FileEntry);
+    Header->LibraryOffset = LibraryOffset;
+    Header->LibrarySize = Contents.LibrarySize;
+
+    FileEntry* Table = (FileEntry*)(File.data() + sizeof(FileHeader));
+    size_t BlobOffset = TableEnd;
+
+    for (size_t i = 0; i < Contents.Entries.size(); ++i)
+    {
+        const CacheEntry& Entry = Contents.Entries[i];
+        Table[i].Key = Entry.Key;
+        Table[i].CompileTimeMs = Entry.CompileTimeMs;
+
+        if (Entry.BlobSize > 0)
+        {
+            BlobOffset = Math::AlignUp(BlobOffset, kBlobAlignment);
+            memcpy(File.data() + BlobOffset, Entry.Blob, Entry.BlobSize);
+            Table[i].BlobOffset = BlobOffset;
+            Table[i].BlobSize = Entry.BlobSize;
+            BlobOffset += Entry.BlobSize;
+        }
+    }
+
+    if (Contents.LibrarySize > 0)
+        memcpy(File.data() + LibraryOffset, Contents.Library, Contents.LibrarySize);
+
+    Header->Checksum = HashBytes(File.data() + sizeof(FileHeader), FileSize - sizeof(FileHeader));
+
+    return File;
+}
+
+bool PipelineStateCache::ReadCacheFile(const void* Data, size_t Size, const AdapterIdentity& Adapter, CacheFileContents& Contents)
+{
+    Contents.Entries.clear();
+    Contents.Library = nullptr;
+    Contents.LibrarySize = 0;
+
+    if (Data == nullptr || Size < sizeof(FileHeader))
+        return false;
+
+    const byte* File = (const byte*)Data;
+    const FileHeader& Header = *(const FileHeader*)File;
+
+    if (Header.Magic != kFileMagic || Header.FormatVersion != kFormatVersion || Header.EntrySize != sizeof(FileEntry))
+        return false;
+
+    if (memcmp(&Header.Adapter, &Adapter, sizeof(AdapterIdentity)) != 0)
+        return false;
+
+    if (!IsInFile(sizeof(FileHeader), (uint64_t)Header.EntryCount * sizeof(FileEntry), Size))
+        return false;
+
+    if (Header.LibrarySize > 0 && !IsInFile(Header.LibraryOffset, Header.LibrarySize, Size))
+        return false;
+
+    if (HashBytes(File + sizeof(FileHeader), Size - sizeof(FileHeader)) != Header.Checksum)
+        return false;
+
+    const FileEntry* Table = (const FileEntry*)(File + sizeof(FileHeader));
+    Contents.Entries.resize(Header.EntryCount);
+
+    for (uint32_t i = 0; i < Header.EntryCount; ++i)
+    {
+        if (Table[i].BlobSize > 0 && !IsInFile(Table[i].BlobOffset, Table[i].BlobSize, Size))
+        {
+            Contents.Entries.clear();
+            return false;
+        }
+
+        CacheEntry& Entry = Contents.Entries[i];
+        Entry.Key = Table[i].Key;
+        Entry.CompileTimeMs = Table[i].CompileTimeMs;
+        Entry.Blob = Table[i].BlobSize > 0 ? File + Table[i].BlobOffset : nullptr;
+        Entry.BlobSize = (size_t)Table[i].BlobSize;
+    }
+
+    if (Header.LibrarySize > 0)
+    {
+        Contents.Library = File + Header.LibraryOffset;
+        Contents.LibrarySize = (size_t)Header.LibrarySize;
+    }
+
+    return true;
+}
+
+PipelineStateCache::AdapterIdentity PipelineStateCache::GetAdapterIdentity(IDXGIAdapter1* Adapter)
+{
+    AdapterIdentity Identity = {};
+
+    DXGI_ADAPTER_DESC1 Desc;
+    if (Adapter == nullptr || FAILED(Adapter->GetDesc1(&Desc)))
+        return Identity;
+
+    Identity.VendorId = Desc.VendorId;
+    Identity.DeviceId = Desc.DeviceId;
+    Identity.SubSysId = Desc.SubSysId;
+    Identity.Revision = Desc.Revision;
+
+    // DXGI reports the user mode driver version through this legacy query
+    LARGE_INTEGER DriverVersion;
+    if (SUCCEEDED(Adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &DriverVersion)))
+        Identity.DriverVersion = (uint64_t)DriverVersion.QuadPart;
+
+    return Identity;
+}
+
+namespace PipelineStateCache
+{
+    static mutex s_CacheMutex;
+
+    // The library is free threaded except for concurrent loads of the same pipeline, so loads are
+    // serialized per key rather than behind the cache lock
+    static const size_t kNumLoadMutexes = 16;
+    static mutex s_LoadMutexes[kNumLoadMutexes];
+
+    static bool s_Initialized = false;
+    static bool s_Dirty = false;
+    static wstring s_FileName;
+    static AdapterIdentity s_Adapter;
+
+    // Entries loaded from disk point into the mapped file, so it stays open until shutdown.
+    static unique_ptr<Utility::FileSource> s_MappedFile;
+    static ComPtr<ID3D12PipelineLibrary> s_Library;
+    static unordered_map<CacheKey, CacheEntry, CacheKeyHasher> s_Entries;
+    static vector< ComPtr<ID3DBlob> > s_CompiledBlobs;
+    static CacheStats s_Stats;
+
+    static HRESULT CompilePipeline(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& Desc, ID3D12PipelineState** PSO)
+    {
+        return g_Device->CreateGraphicsPipelineState(&Desc, MY_IID_PPV_ARGS(PSO));
+    }
+
+    static HRESULT CompilePipeline(const D3D12_COMPUTE_PIPELINE_STATE_DESC& Desc, ID3D12PipelineState** PSO)
+    {
+        return g_Device->CreateComputePipelineState(&Desc, MY_IID_PPV_ARGS(PSO));
+    }
+
+    static HRESULT LoadPipeline(LPCWSTR Name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& Desc, ID3D12PipelineState** PSO)
+    {
+        return s_Library->LoadGraphicsPipeline(Name, &Desc, MY_IID_PPV_ARGS(PSO));
+    }
+
+    static HRESULT LoadPipeline(LPCWSTR Name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& Desc, ID3D12PipelineState** PSO)
+    {
+        return s_Library->LoadComputePipeline(Name, &Desc, MY_IID_PPV_ARGS(PSO));
+    }
+
+    static double MillisecondsSince(chrono::high_resolution_clock::time_point Start)
+    {
+        return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - Start).count();
+    }
+
+    template <typename DescType>
+    ID3D12PipelineState* CreatePipelineState(const DescType& Desc, size_t RootSignatureHash)
+    {
+        ID3D12PipelineState* PSO = nullptr;
+
+        if (!s_Initialized)
+        {
+            ASSERT_SUCCEEDED(CompilePipeline(Desc, &PSO));
+            return PSO;
+        }
+
+        CacheKey Key = ComputeKey(Desc, RootSignatureHash);
+        wstring Name = GetPipelineName(Key);
+
+        CacheEntry Entry;
+        bool Found = false;
+        {
+            lock_guard<mutex> LockGuard(s_CacheMutex);
+            auto Iter = s_Entries.find(Key);
+            if (Iter != s_Entries.end())
+            {
+                Entry = Iter->second;
+                Found = true;
+            }
+        }
+
+        if (Found)
+        {
+            auto Start = chrono::high_resolution_clock::now();
+            HRESULT hr = E_FAIL;
+
+            if (s_Library != nullptr)
+            {
+                lock_guard<mutex> LoadGuard(s_LoadMutexes[CacheKeyHasher()(Key) % kNumLoadMutexes]);
+                hr = LoadPipeline(Name.c_str(), Desc, &PSO);
+            }
+            else if (Entry.Blob != nullptr)
+            {
+                DescType CachedDesc = Desc;
+                CachedDesc.CachedPSO.pCachedBlob = Entry.Blob;
+                CachedDesc.CachedPSO.CachedBlobSizeInBytes = Entry.BlobSize;
+                hr = CompilePipeline(CachedDesc, &PSO);
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                double LoadTime = MillisecondsSince(Start);
+
+                lock_guard<mutex> LockGuard(s_CacheMutex);
+                ++s_Stats.Hits;
+                s_Stats.LoadTimeMs += LoadTime;
+                s_Stats.SavedTimeMs += max(0.0, Entry.CompileTimeMs - LoadTime);
+                return PSO;
+            }
+
+            // The driver rejected what we stored, so compile from scratch below
+            PSO = nullptr;
+        }
+
+        auto Start = chrono::high_resolution_clock::now();
+        ASSERT_SUCCEEDED(CompilePipeline(Desc, &PSO));
+        double CompileTime = MillisecondsSince(Start);
+
+        ComPtr<ID3DBlob> Blob;
+        if (s_Library == nullptr && FAILED(PSO->GetCachedBlob(&Blob)))
+            Blob = nullptr;
+
+        lock_guard<mutex> LockGuard(s_CacheMutex);
+        ++s_Stats.Misses;
+        s_Stats.CompileTimeMs += CompileTime;
+
+        Entry.Key = Key;
+        Entry.CompileTimeMs = (float)CompileTime;
+        Entry.Blob = nullptr;
+        Entry.BlobSize = 0;
+
+        if (s_Library != nullptr)
+        {
+            // Fails if a stale pipeline already has this name, in which case it stays uncached
+            if (FAILED(s_Library->StorePipeline(Name.c_str(), PSO)))
+                return PSO;
+        }
+        else if (Blob != nullptr)
+        {
+            Entry.Blob = Blob->GetBufferPointer();
+            Entry.BlobSize = Blob->GetBufferSize();
+            s_CompiledBlobs.push_back(Blob);
+        }
+        else
+            return PSO;
+
+        s_Entries[Key] = Entry;
+        s_Dirty = true;
+
+        return PSO;
+    }
+}
+
+void PipelineStateCache::Initialize(IDXGIAdapter1* Adapter, const wstring& FileName)
+{
+    ASSERT(!s_Initialized, "Pipeline state cache has already been initialized");
+
+    s_FileName = FileName;
+    s_Adapter = GetAdapterIdentity(Adapter);
+    s_Stats = CacheStats();
+    s_Dirty = false;
+
+    CacheFileContents Contents;
+    s_MappedFile = Utility::MapFile(FileName);
+
+    if (s_MappedFile != nullptr && !ReadCacheFile(s_MappedFile->GetData(), s_MappedFile->GetSize(), s_Adapter, Contents))
+    {
+        Utility::Printf(L"Discarding pipeline state cache %s from another format, adapter, or driver\n", FileName.c_str());
+        s_MappedFile = nullptr;
+        s_Dirty = true;
+    }
+
+    ComPtr<ID3D12Device1> Device1;
+    if (SUCCEEDED(g_Device->QueryInterface(MY_IID_PPV_ARGS(&Device1))))
+    {
+        // The library blob must stay valid for the lifetime of the library, which the mapping guarantees
+        HRESULT hr = E_FAIL;
+        if (Contents.LibrarySize > 0)
+            hr = Device1->CreatePipelineLibrary(Contents.Library, Contents.LibrarySize, MY_IID_PPV_ARGS(&s_Library));
+
+        if (FAILED(hr))
+        {
+            // Whatever the entries referred to is gone, so start over with an empty library
+            Contents.Entries.clear();
+            if (FAILED(Device1->CreatePipelineLibrary(nullptr, 0, MY_IID_PPV_ARGS(&s_Library))))
+                s_Library = nullptr;
+        }
+    }
+
+    for (const CacheEntry& Entry : Contents.Entries)
+    {
+        if (s_Library != nullptr || Entry.Blob != nullptr)
+            s_Entries[Entry.Key] = Entry;
+    }
+
+    s_Stats.UsingPipelineLibrary = s_Library != nullptr;
+    s_Initialized = true;
+}
+
+void PipelineStateCache::Shutdown(void)
+{
+    if (!s_Initialized)
+        return;
+
+    lock_guard<mutex> LockGuard(s_CacheMutex);
+
+    Utility::Printf("Pipeline state cache:  %u hits, %u misses, %.1f ms compiling, %.1f ms loading, %.1f ms saved\n",
+        s_Stats.Hits, s_Stats.Misses, s_Stats.CompileTimeMs, s_Stats.LoadTimeMs, s_Stats.SavedTimeMs);
+
+    vector<byte> File;
+
+    if (s_Dirty)
+    {
+        CacheFileContents Contents;
+        Contents.Entries.reserve(s_Entries.size());
+        for (auto& Iter : s_Entries)
+            Contents.Entries.push_back(Iter.second);
+
+        vector<byte> Library;
+        if (s_Library != nullptr)
+        {
+            Library.resize(s_Library->GetSerializedSize());
+            if (FAILED(s_Library->Serialize(Library.data(), Library.size())))
+            {
+                Library.clear();
+                Contents.Entries.clear();
+            }
+        }
+
+        Contents.Library = Library.data();
+        Contents.LibrarySize = Library.size();
+        File = WriteCacheFile(s_Adapter, Contents);
+    }
+
+    // The old file can't be replaced while it's still mapped
+    s_Library = nullptr;
+    s_Entries.clear();
+    s_CompiledBlobs.clear();
+    s_MappedFile = nullptr;
+    s_Initialized = false;
+
+    if (!File.empty())
+    {
+        ofstream OutFile(s_FileName, ios::out | ios::binary);
+        if (OutFile)
+            OutFile.write((const char*)File.data(), File.size());
+        if (!OutFile)
+            Utility::Printf(L"Unable to write pipeline state cache %s\n", s_FileName.c_str());
+    }
+}
+
+ID3D12PipelineState* PipelineStateCache::CreateGraphicsPipelineState(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& Desc, size_t RootSignatureHash)
+{
+    return CreatePipelineState(Desc, RootSignatureHash);
+}
+
+ID3D12PipelineState* PipelineStateCache::CreateComputePipelineState(const D3D12_COMPUTE_PIPELINE_STATE_DESC& Desc, size_t RootSignatureHash)
+{
+    return CreatePipelineState(Desc, RootSignatureHash);
+}
+
+PipelineStateCache::CacheStats PipelineStateCache::GetStats(void)
+{
+    lock_guard<mutex> LockGuard(s_CacheMutex);
+    return s_Stats;
+}
@@ -0,0 +1,119 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// Persists compiled pipeline state objects between runs.  Pipelines are stored in an
+// ID3D12PipelineLibrary when the driver supports one, or as individual cached blobs when
+// it doesn't, inside a small container file that is memory mapped on the next launch.
+//
+
+#pragma once
+
+#include "pch.h"
+#include <vector>
+
+struct IDXGIAdapter1;
+
+namespace PipelineStateCache
+{
+    // Bump whenever the key derivation or the container layout changes
+    static const uint32_t kFormatVersion = 1;
+
+    // Identifies the GPU and driver that compiled the cached pipelines.  Anything compiled by a
+    // different adapter or driver version is thrown away rather than handed to the runtime.
+    struct AdapterIdentity
+    {
+        uint32_t VendorId;
+        uint32_t DeviceId;
+        uint32_t SubSysId;
+        uint32_t Revision;
+        uint64_t DriverVersion;
+    };
+
+    struct CacheKey
+    {
+        uint64_t DescHash;      // Fixed function state, input layout and root signature
+        uint64_t ShaderHash;    // Contents of every shader stage's bytecode
+
+        bool operator==(const CacheKey& rhs) const { return DescHash == rhs.DescHash && ShaderHash == rhs.ShaderHash; }
+        bool operator!=(const CacheKey& rhs) const { return !(*this == rhs); }
+    };
+
+    //
+    // Key derivation.  These only look at the desc contents, never at pointer values, so the
+    // same pipeline produces the same key on every run.  No device is required.
+    //
+
+    uint64_t HashBytes(const void* Data, size_t Size, uint64_t Hash = 14695981039346656037ULL);
+
+    CacheKey ComputeKey(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& Desc, size_t RootSignatureHash);
+    CacheKey ComputeKey(const D3D12_COMPUTE_PIPELINE_STATE_DESC& Desc, size_t RootSignatureHash);
+
+    // The name a pipeline is stored under in the pipeline library
+    std::wstring GetPipelineName(const CacheKey& Key);
+
+    //
+    // File container.  A header identifying the format and adapter, a table of entries, each
+    // entry's optional cached blob, then the optional serialized pipeline library.  No device
+    // is required to write or parse one.
+    //
+
+    struct CacheEntry
+    {
+        CacheKey Key;
+        float CompileTimeMs;        // How long the pipeline took to compile without the cache
+        const void* Blob;           // ID3D12PipelineState::GetCachedBlob(), or null if the library holds it
+        size_t BlobSize;
+    };
+
+    struct CacheFileContents
+    {
+        CacheFileContents() : Library(nullptr), LibrarySize(0) {}
+
+        std::vector<CacheEntry> Entries;
+        const void* Library;        // ID3D12PipelineLibrary::Serialize(), or null
+        size_t LibrarySize;
+    };
+
+    std::vector<byte> WriteCacheFile(const AdapterIdentity& Adapter, const CacheFileContents& Contents);
+
+    // Returns false if the data is truncated, corrupt, from another format version, or from
+    // another adapter or driver.  On success, the pointers in Contents reference Data.
+    bool ReadCacheFile(const void* Data, size_t Size, const AdapterIdentity& Adapter, CacheFileContents& Contents);
+
+    //
+    // Runtime cache
+    //
+
+    AdapterIdentity GetAdapterIdentity(IDXGIAdapter1* Adapter);
+
+    void Initialize(IDXGIAdapter1* Adapter, const std::wstring& FileName);
+
+    // Writes the cache back to disk if anything new was compiled this run
+    void Shutdown(void);
+
+    // Return a new reference.  Pipelines missing from the cache are compiled and added to it.
+    ID3D12PipelineState* CreateGraphicsPipelineState(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& Desc, size_t RootSignatureHash);
+    ID3D12PipelineState* CreateComputePipelineState(const D3D12_COMPUTE_PIPELINE_STATE_DESC& Desc, size_t RootSignatureHash);
+
+    struct CacheStats
+    {
+        uint32_t Hits;
+        uint32_t Misses;
+        double CompileTimeMs;       // Spent compiling misses
+        double LoadTimeMs;          // Spent creating pipelines from the cache
+        double SavedTimeMs;         // Recorded compile time of the hits, less the time spent loading them
+        bool UsingPipelineLibrary;
+    };
+
+    CacheStats GetStats(void);
+
+} // namespace PipelineStateCache
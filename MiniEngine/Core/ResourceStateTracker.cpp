@@ -0,0 +1,475 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+
+#include "pch.h"
+#include "ResourceStateTracker.h"
+#include "GpuResource.h"
+#include "GraphicsCore.h"
+
+using namespace std;
+
+std::mutex ResourceStateTracker::sm_StateMutex;
+ResourceBarrierStats ResourceStateTracker::sm_FrameStats = {};
+ResourceBarrierStats ResourceStateTracker::sm_LastFrameStats = {};
+
+namespace
+{
+    const D3D12_RESOURCE_STATES kReadOnlyStates = D3D12_RESOURCE_STATE_GENERIC_READ |
+        D3D12_RESOURCE_STATE_DEPTH_READ | D3D12_RESOURCE_STATE_RESOLVE_SOURCE;
+
+    // PRESENT and COMMON are zero, which no other read state covers
+    inline bool IsReadOnly( D3D12_RESOURCE_STATES State )
+    {
+        return State != 0 && (State & ~kReadOnlyStates) == 0;
+    }
+
+    inline bool TouchesResource( const D3D12_RESOURCE_BARRIER& Barrier, ID3D12Resource* Resource )
+    {
+        switch (Barrier.Type)
+        {
+        case D3D12_RESOURCE_BARRIER_TYPE_TRANSITION:
+            return Barrier.Transition.pResource == Resource;
+        case D3D12_RESOURCE_BARRIER_TYPE_UAV:
+            return Barrier.UAV.pResource == Resource || Barrier.UAV.pResource == nullptr;
+        default:
+            return Barrier.Aliasing.pResourceBefore == Resource || Barrier.Aliasing.pResourceAfter == Resource ||
+                Barrier.Aliasing.pResourceBefore == nullptr || Barrier.Aliasing.pResourceAfter == nullptr;
+        }
+    }
+
+    inline void AddCounters( ResourceBarrierStats& Dest, const ResourceBarrierStats& Src )
+    {
+        Dest.Transitions += Src.Transitions;
+        Dest.SplitBegins += Src.SplitBegins;
+        Dest.SplitEnds += Src.SplitEnds;
+        Dest.UAVBarriers += Src.UAVBarriers;
+        Dest.AliasingBarriers += Src.AliasingBarriers;
+        Dest.SubmitFixups += Src.SubmitFixups;
+        Dest.Merged += Src.Merged;
+        Dest.Skipped += Src.Skipped;
+        Dest.BarrierCalls += Src.BarrierCalls;
+        Dest.ListsSubmitted += Src.ListsSubmitted;
+    }
+}
+
+UINT ResourceStateTracker::GetNumSubresources( ID3D12Resource* Resource )
+{
+    D3D12_RESOURCE_DESC Desc = Resource->GetDesc();
+    if (Desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+        return 1;
+
+    UINT ArraySize = Desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D ? 1 : Desc.DepthOrArraySize;
+    return Desc.MipLevels * ArraySize * D3D12GetFormatPlaneCount(Graphics::g_Device, Desc.Format);
+}
+
+ResourceStateTracker::TrackedResource& ResourceStateTracker::Track( GpuResource& Resource )
+{
+    auto Iter = m_Lookup.find(&Resource);
+    if (Iter != m_Lookup.end())
+        return m_Resources[Iter->second];
+
+    m_Lookup[&Resource] = (uint32_t)m_Resources.size();
+    m_Resources.emplace_back();
+
+    TrackedResource& Tracked = m_Resources.back();
+    Tracked.Resource = &Resource;
+    Tracked.NumSubresources = 0;
+
+    {
+        lock_guard<mutex> LockGuard(sm_StateMutex);
+        if (Resource.m_SubresourceStates.empty())
+            Tracked.Assumed.assign(1, Resource.m_UsageState);
+        else
+            Tracked.Assumed = Resource.m_SubresourceStates;
+    }
+
+    if (Tracked.Assumed.size() > 1)
+        Tracked.NumSubresources = (UINT)Tracked.Assumed.size();
+
+    Tracked.States.resize(Tracked.Assumed.size());
+    for (size_t i = 0; i < Tracked.Assumed.size(); ++i)
+    {
+        Tracked.States[i].Current = Tracked.Assumed[i];
+        Tracked.States[i].Pending = kNoTransition;
+    }
+
+    return Tracked;
+}
+
+void ResourceStateTracker::SplitSubresources( TrackedResource& Tracked )
+{
+    if (Tracked.States.size() > 1)
+        return;
+
+    // A split transition of the whole resource has to end as one
+    if (Tracked.States[0].Pending != kNoTransition)
+        EndSubresourceTransition(Tracked, 0);
+
+    if (Tracked.NumSubresources == 0)
+        Tracked.NumSubresources = GetNumSubresources(Tracked.Resource->GetResource());
+
+    Tracked.States.assign(Tracked.NumSubresources, Tracked.States[0]);
+}
+
+void ResourceStateTracker::TransitionResource( GpuResource& Resource, D3D12_RESOURCE_STATES NewState, UINT Subresource )
+{
+    TrackedResource& Tracked = Track(Resource);
+
+    if (Subresource != D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+    {
+        SplitSubresources(Tracked);
+        ASSERT(Subresource < Tracked.States.size());
+        TransitionSubresource(Tracked, Subresource, NewState);
+        return;
+    }
+
+    if (Tracked.States.size() > 1)
+    {
+        bool IsUniform = true;
+        for (const SubresourceState& State : Tracked.States)
+        {
+            IsUniform = IsUniform && State.Pending == kNoTransition && State.Current == Tracked.States[0].Current;
+        }
+
+        if (!IsUniform)
+        {
+            for (UINT i = 0; i < (UINT)Tracked.States.size(); ++i)
+                TransitionSubresource(Tracked, i, NewState);
+        }
+
+        // Every subresource is in the same state now, so one barrier will do for the next transition
+        Tracked.States.resize(1);
+        if (!IsUniform)
+            return;
+    }
+
+    TransitionSubresource(Tracked, 0, NewState);
+}
+
+void ResourceStateTracker::BeginResourceTransition( GpuResource& Resource, D3D12_RESOURCE_STATES NewState, UINT Subresource )
+{
+    TrackedResource& Tracked = Track(Resource);
+
+    if (Subresource != D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+    {
+        SplitSubresources(Tracked);
+        ASSERT(Subresource < Tracked.States.size());
+        BeginSubresourceTransition(Tracked, Subresource, NewState);
+        return;
+    }
+
+    if (Tracked.States.size() > 1)
+    {
+        bool IsUniform = true;
+        for (const SubresourceState& State : Tracked.States)
+        {
+            IsUniform = IsUniform && State.Pending == kNoTransition && State.Current == Tracked.States[0].Current;
+        }
+
+        if (!IsUniform)
+        {
+            for (UINT i = 0; i < (UINT)Tracked.States.size(); ++i)
+                BeginSubresourceTransition(Tracked, i, NewState);
+            return;
+        }
+
+        Tracked.States.resize(1);
+    }
+
+    BeginSubresourceTransition(Tracked, 0, NewState);
+}
+
+void ResourceStateTracker::TransitionSubresource( TrackedResource& Tracked, UINT Index, D3D12_RESOURCE_STATES NewState )
+{
+    SubresourceState& State = Tracked.States[Index];
+    UINT Subresource = Tracked.States.size() == 1 ? D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES : Index;
+
+    if (State.Pending != kNoTransition)
+    {
+        // Finish the transition we already started
+        if (State.Pending == NewState)
+        {
+            AddTransition(Tracked.Resource->GetResource(), Subresource, State.Current, NewState, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY);
+            State.Current = NewState;
+            State.Pending = kNoTransition;
+            return;
+        }
+
+        EndSubresourceTransition(Tracked, Index);
+    }
+
+    if (State.Current == NewState)
+    {
+        if (NewState == D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+            InsertUAVBarrier(*Tracked.Resource);
+        return;
+    }
+
+    if (IsReadOnly(State.Current) && IsReadOnly(NewState) && (State.Current & NewState) == NewState)
+    {
+        ++m_Counters.Skipped;
+        return;
+    }
+
+    AddTransition(Tracked.Resource->GetResource(), Subresource, State.Current, NewState, D3D12_RESOURCE_BARRIER_FLAG_NONE);
+    State.Current = NewState;
+}
+
+void ResourceStateTracker::BeginSubresourceTransition( TrackedResource& Tracked, UINT Index, D3D12_RESOURCE_STATES NewState )
+{
+    SubresourceState& State = Tracked.States[Index];
+
+    if (State.Pending != kNoTransition)
+    {
+        if (State.Pending == NewState)
+            return;
+
+        EndSubresourceTransition(Tracked, Index);
+    }
+
+    if (State.Current == NewState)
+        return;
+
+    UINT Subresource = Tracked.States.size() == 1 ? D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES : Index;
+    AddTransition(Tracked.Resource->GetResource(), Subresource, State.Current, NewState, D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY);
+    State.Pending = NewState;
+}
+
+void ResourceStateTracker::EndSubresourceTransition( TrackedResource& Tracked, UINT Index )
+{
+    SubresourceState& State = Tracked.States[Index];
+    UINT Subresource = Tracked.States.size() == 1 ? D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES : Index;
+
+    AddTransition(Tracked.Resource->GetResource(), Subresource, State.Current, State.Pending, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY);
+    State.Current = State.Pending;
+    State.Pending = kNoTransition;
+}
+
+void ResourceStateTracker::AddTransition( ID3D12Resource* Resource, UINT Subresource, D3D12_RESOURCE_STATES Before,
+    D3D12_RESOURCE_STATES After, D3D12_RESOURCE_BARRIER_FLAGS Flags )
+{
+    // No command has run since the batched barriers, so a whole transition can be folded into the last
+    // batched barrier for the resource when that one ends where this one starts
+    if (Flags == D3D12_RESOURCE_BARRIER_FLAG_NONE)
+    {
+        for (size_t i = m_PendingBarriers.size(); i > 0; --i)
+        {
+            D3D12_RESOURCE_BARRIER& Previous = m_PendingBarriers[i - 1];
+            if (!TouchesResource(Previous, Resource))
+                continue;
+
+            if (Previous.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION &&
+                Previous.Flags == D3D12_RESOURCE_BARRIER_FLAG_NONE &&
+                Previous.Transition.Subresource == Subresource &&
+                Previous.Transition.StateAfter == Before)
+            {
+                ++m_Counters.Merged;
+                if (Previous.Transition.StateBefore == After)
+                    m_PendingBarriers.erase(m_PendingBarriers.begin() + (i - 1));
+                else
+                    Previous.Transition.StateAfter = After;
+                return;
+            }
+
+            break;
+        }
+    }
+
+    D3D12_RESOURCE_BARRIER BarrierDesc;
+    BarrierDesc.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+    BarrierDesc.Flags = Flags;
+    BarrierDesc.Transition.pResource = Resource;
+    BarrierDesc.Transition.Subresource = Subresource;
+    BarrierDesc.Transition.StateBefore = Before;
+    BarrierDesc.Transition.StateAfter = After;
+    m_PendingBarriers.push_back(BarrierDesc);
+}
+
+void ResourceStateTracker::InsertUAVBarrier( GpuResource& Resource )
+{
+    // Back to back UAV barriers on the same resource are redundant
+    for (size_t i = m_PendingBarriers.size(); i > 0; --i)
+    {
+        const D3D12_RESOURCE_BARRIER& Previous = m_PendingBarriers[i - 1];
+        if (!TouchesResource(Previous, Resource.GetResource()))
+            continue;
+
+        if (Previous.Type == D3D12_RESOURCE_BARRIER_TYPE_UAV && Previous.UAV.pResource == Resource.GetResource())
+        {
+            ++m_Counters.Merged;
+            return;
+        }
+        break;
+    }
+
+    D3D12_RESOURCE_BARRIER BarrierDesc;
+    BarrierDesc.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+    BarrierDesc.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    BarrierDesc.UAV.pResource = Resource.GetResource();
+    m_PendingBarriers.push_back(BarrierDesc);
+}
+
+void ResourceStateTracker::InsertAliasBarrier( GpuResource& Before, GpuResource& After )
+{
+    D3D12_RESOURCE_BARRIER BarrierDesc;
+    BarrierDesc.Type = D3D12_RESOURCE_BARRIER_TYPE_ALIASING;
+    BarrierDesc.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+    BarrierDesc.Aliasing.pResourceBefore = Before.GetResource();
+    BarrierDesc.Aliasing.pResourceAfter = After.GetResource();
+    m_PendingBarriers.push_back(BarrierDesc);
+}
+
+void ResourceStateTracker::FlushResourceBarriers( ID3D12GraphicsCommandList* CommandList )
+{
+    if (m_PendingBarriers.empty())
+        return;
+
+    for (const D3D12_RESOURCE_BARRIER& Barrier : m_PendingBarriers)
+    {
+        switch (Barrier.Type)
+        {
+        case D3D12_RESOURCE_BARRIER_TYPE_TRANSITION:
+            if (Barrier.Flags & D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY)
+                ++m_Counters.SplitBegins;
+            else if (Barrier.Flags & D3D12_RESOURCE_BARRIER_FLAG_END_ONLY)
+                ++m_Counters.SplitEnds;
+            else
+                ++m_Counters.Transitions;
+            break;
+        case D3D12_RESOURCE_BARRIER_TYPE_UAV:
+            ++m_Counters.UAVBarriers;
+            break;
+        default:
+            ++m_Counters.AliasingBarriers;
+            break;
+        }
+    }
+
+    CommandList->ResourceBarrier((UINT)m_PendingBarriers.size(), m_PendingBarriers.data());
+
+    ++m_Counters.BarrierCalls;
+    m_NumBarriersFlushed += m_PendingBarriers.size();
+    m_PendingBarriers.clear();
+}
+
+D3D12_RESOURCE_STATES ResourceStateTracker::GetState( const GpuResource& Resource, UINT Subresource )
+{
+    UINT Index = Subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES ? 0 : Subresource;
+
+    auto Iter = m_Lookup.find(&Resource);
+    if (Iter != m_Lookup.end())
+    {
+        const TrackedResource& Tracked = m_Resources[Iter->second];
+        return Tracked.States.size() == 1 ? Tracked.States[0].Current : Tracked.States[Index].Current;
+    }
+
+    lock_guard<mutex> LockGuard(sm_StateMutex);
+    return Resource.m_SubresourceStates.empty() ? Resource.m_UsageState : Resource.m_SubresourceStates[Index];
+}
+
+void ResourceStateTracker::EndSplitTransitions( void )
+{
+    for (TrackedResource& Tracked : m_Resources)
+    {
+        for (UINT i = 0; i < (UINT)Tracked.States.size(); ++i)
+        {
+            if (Tracked.States[i].Pending != kNoTransition)
+                EndSubresourceTransition(Tracked, i);
+        }
+    }
+}
+
+void ResourceStateTracker::ResolveInitialStates( std::vector<D3D12_RESOURCE_BARRIER>& Fixups )
+{
+    ASSERT(m_PendingBarriers.empty(), "Barriers must be flushed before the list is submitted");
+
+    size_t FirstFixup = Fixups.size();
+
+    for (TrackedResource& Tracked : m_Resources)
+    {
+        GpuResource& Resource = *Tracked.Resource;
+        std::vector<D3D12_RESOURCE_STATES>& Published = Resource.m_SubresourceStates;
+
+        D3D12_RESOURCE_BARRIER Fixup;
+        Fixup.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+        Fixup.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+        Fixup.Transition.pResource = Resource.GetResource();
+
+        if (Tracked.Assumed.size() == 1 && Published.empty())
+        {
+            if (Resource.m_UsageState != Tracked.Assumed[0])
+            {
+                Fixup.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+                Fixup.Transition.StateBefore = Resource.m_UsageState;
+                Fixup.Transition.StateAfter = Tracked.Assumed[0];
+                Fixups.push_back(Fixup);
+            }
+        }
+        else
+        {
+            size_t NumSubresources = Published.empty() ? Tracked.Assumed.size() : Published.size();
+            for (size_t i = 0; i < NumSubresources; ++i)
+            {
+                D3D12_RESOURCE_STATES Before = Published.empty() ? Resource.m_UsageState : Published[i];
+                D3D12_RESOURCE_STATES After = Tracked.Assumed.size() == 1 ? Tracked.Assumed[0] : Tracked.Assumed[i];
+                if (Before == After)
+                    continue;
+
+                Fixup.Transition.Subresource = (UINT)i;
+                Fixup.Transition.StateBefore = Before;
+                Fixup.Transition.StateAfter = After;
+                Fixups.push_back(Fixup);
+            }
+        }
+
+        bool IsUniform = true;
+        for (const SubresourceState& State : Tracked.States)
+            IsUniform = IsUniform && State.Current == Tracked.States[0].Current;
+
+        Resource.m_UsageState = Tracked.States[0].Current;
+        if (IsUniform)
+        {
+            Published.clear();
+        }
+        else
+        {
+            Published.resize(Tracked.States.size());
+            for (size_t i = 0; i < Tracked.States.size(); ++i)
+                Published[i] = Tracked.States[i].Current;
+        }
+    }
+
+    m_Counters.SubmitFixups += (uint32_t)(Fixups.size() - FirstFixup);
+    if (Fixups.size() > FirstFixup)
+        ++m_Counters.BarrierCalls;
+    ++m_Counters.ListsSubmitted;
+
+    AddCounters(sm_FrameStats, m_Counters);
+    ZeroMemory(&m_Counters, sizeof(m_Counters));
+
+    m_Resources.clear();
+    m_Lookup.clear();
+}
+
+ResourceBarrierStats ResourceStateTracker::GetStats( void )
+{
+    lock_guard<mutex> LockGuard(sm_StateMutex);
+    return sm_LastFrameStats;
+}
+
+void ResourceStateTracker::EndFrame( void )
+{
+    lock_guard<mutex> LockGuard(sm_StateMutex);
+    sm_LastFrameStats = sm_FrameStats;
+    ZeroMemory(&sm_FrameStats, sizeof(sm_FrameStats));
+}
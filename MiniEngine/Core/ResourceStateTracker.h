@@ -0,0 +1,121 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// Tracks the states of the resources a command list transitions, per subresource when needed.
+// The state a resource is in outside of any command list is the one left by the last list
+// submitted, not the last one recorded.  When a list first touches a resource, its barriers are
+// recorded against that submitted state.  When the list is submitted, the states it assumed are
+// checked again, and any that other lists have changed in the meantime (because they were recorded
+// in parallel or submitted in a different order) are fixed by barriers in a short list that runs
+// just ahead of it.
+//
+// Barriers wait in a batch until a command needs them.  A transition that continues or undoes one
+// still in the batch is merged into it, and a transition to a read state that the current combined
+// read state already includes is skipped.
+//
+
+#pragma once
+
+#include "pch.h"
+#include <mutex>
+#include <unordered_map>
+
+class GpuResource;
+
+struct ResourceBarrierStats
+{
+    // Counted over the last frame
+    uint32_t Transitions;               // Whole transitions, excluding split ones
+    uint32_t SplitBegins;
+    uint32_t SplitEnds;
+    uint32_t UAVBarriers;
+    uint32_t AliasingBarriers;
+    uint32_t SubmitFixups;              // Added at submit because a list assumed an outdated state
+    uint32_t Merged;                    // Transitions folded into one that was still batched
+    uint32_t Skipped;                   // Read transitions the current state already covered
+    uint32_t BarrierCalls;              // ResourceBarrier() calls, including those of fixup lists
+    uint32_t ListsSubmitted;
+};
+
+class ResourceStateTracker
+{
+public:
+
+    ResourceStateTracker() : m_NumBarriersFlushed(0) { ZeroMemory(&m_Counters, sizeof(m_Counters)); }
+
+    // Subresource may be D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES
+    void TransitionResource( GpuResource& Resource, D3D12_RESOURCE_STATES NewState, UINT Subresource );
+    void BeginResourceTransition( GpuResource& Resource, D3D12_RESOURCE_STATES NewState, UINT Subresource );
+    void InsertUAVBarrier( GpuResource& Resource );
+    void InsertAliasBarrier( GpuResource& Before, GpuResource& After );
+
+    bool HasPendingBarriers( void ) const { return !m_PendingBarriers.empty(); }
+    void FlushResourceBarriers( ID3D12GraphicsCommandList* CommandList );
+
+    // The state the list has left the resource in so far.  Split subresources report the first one.
+    D3D12_RESOURCE_STATES GetState( const GpuResource& Resource, UINT Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES );
+
+    // Finishes split transitions that are still in flight.  Call before the list is closed.
+    void EndSplitTransitions( void );
+
+    // Appends the barriers needed before the list to bring its resources into the states it assumed, then
+    // publishes the states it leaves them in and forgets them.  Lists must be resolved in the order they are
+    // submitted while holding GetStateMutex().
+    void ResolveInitialStates( std::vector<D3D12_RESOURCE_BARRIER>& Fixups );
+
+    // Barriers recorded on this context since it was created, for profiling
+    uint64_t GetNumBarriersFlushed( void ) const { return m_NumBarriersFlushed; }
+
+    // Guards the published states of every resource
+    static std::mutex& GetStateMutex( void ) { return sm_StateMutex; }
+
+    static ResourceBarrierStats GetStats( void );
+    static void EndFrame( void );
+
+private:
+
+    static const D3D12_RESOURCE_STATES kNoTransition = (D3D12_RESOURCE_STATES)-1;
+
+    struct SubresourceState
+    {
+        D3D12_RESOURCE_STATES Current;
+        D3D12_RESOURCE_STATES Pending;      // The target of a split transition in flight, or kNoTransition
+    };
+
+    struct TrackedResource
+    {
+        GpuResource* Resource;
+        UINT NumSubresources;                           // Zero until the subresources are tracked separately
+        std::vector<D3D12_RESOURCE_STATES> Assumed;     // As published when the list first touched it
+        std::vector<SubresourceState> States;           // A single entry while they all share a state
+    };
+
+    TrackedResource& Track( GpuResource& Resource );
+    void SplitSubresources( TrackedResource& Tracked );
+    void TransitionSubresource( TrackedResource& Tracked, UINT Index, D3D12_RESOURCE_STATES NewState );
+    void BeginSubresourceTransition( TrackedResource& Tracked, UINT Index, D3D12_RESOURCE_STATES NewState );
+    void EndSubresourceTransition( TrackedResource& Tracked, UINT Index );
+    void AddTransition( ID3D12Resource* Resource, UINT Subresource, D3D12_RESOURCE_STATES Before,
+        D3D12_RESOURCE_STATES After, D3D12_RESOURCE_BARRIER_FLAGS Flags );
+
+    static UINT GetNumSubresources( ID3D12Resource* Resource );
+
+    std::vector<TrackedResource> m_Resources;
+    std::unordered_map<const GpuResource*, uint32_t> m_Lookup;
+    std::vector<D3D12_RESOURCE_BARRIER> m_PendingBarriers;
+    uint64_t m_NumBarriersFlushed;
+    ResourceBarrierStats m_Counters;                    // Since the list was last resolved
+
+    static std::mutex sm_StateMutex;
+    static ResourceBarrierStats sm_FrameStats;
+    static ResourceBarrierStats sm_LastFrameStats;
+};
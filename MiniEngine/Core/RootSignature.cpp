@@ -118,14 +118,25 @@ void RootSignature::Finalize(const std::wstring& name, D3D12_ROOT_SIGNATURE_FLAG
             HashCode = Utility::HashState( RootParam.DescriptorTable.pDescriptorRanges,
                 RootParam.DescriptorTable.NumDescriptorRanges, HashCode );
 
+            // Tables with an unbounded range index into the bindless heap.  They are bound directly with
+            // SetDescriptorTable(), so the dynamic descriptor heap doesn't stage anything for them.
+            bool IsUnbounded = false;
+            for (UINT TableRange = 0; TableRange < RootParam.DescriptorTable.NumDescriptorRanges; ++TableRange)
+            {
+                UINT NumDescriptors = RootParam.DescriptorTable.pDescriptorRanges[TableRange].NumDescriptors;
+                if (NumDescriptors == UINT_MAX)
+                    IsUnbounded = true;
+                else
+                    m_DescriptorTableSize[Param] += NumDescriptors;
+            }
+
             // We keep track of sampler descriptor tables separately from CBV_SRV_UAV descriptor tables
-            if (RootParam.DescriptorTable.pDescriptorRanges->RangeType == D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER)
+            if (IsUnbounded)
+                m_DescriptorTableSize[Param] = 0;
+            else if (RootParam.DescriptorTable.pDescriptorRanges->RangeType == D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER)
                 m_SamplerTableBitMap |= (1 << Param);
             else
                 m_DescriptorTableBitMap |= (1 << Param);
-
-            for (UINT TableRange = 0; TableRange < RootParam.DescriptorTable.NumDescriptorRanges; ++TableRange)
-                m_DescriptorTableSize[Param] += RootParam.DescriptorTable.pDescriptorRanges[TableRange].NumDescriptors;
         }
         else
             HashCode = Utility::HashState( &RootParam, 1, HashCode );
@@ -170,5 +181,6 @@ void RootSignature::Finalize(const std::wstring& name, D3D12_ROOT_SIGNATURE_FLAG
         m_Signature = *RSRef;
     }
 
+    m_SignatureHash = HashCode;
     m_Finalized = TRUE;
 }
@@ -24,6 +24,9 @@ public:
 
     RootParameter() 
     {
+        // Parameters are hashed bytewise into the pipeline cache key, so padding and unused union
+        // members must not carry garbage.
+        ZeroMemory(&m_RootParam, sizeof(m_RootParam));
         m_RootParam.ParameterType = (D3D12_ROOT_PARAMETER_TYPE)0xFFFFFFFF;
     }
 
@@ -37,11 +40,13 @@ public:
         if (m_RootParam.ParameterType == D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE)
             delete [] m_RootParam.DescriptorTable.pDescriptorRanges;
 
+        ZeroMemory(&m_RootParam, sizeof(m_RootParam));
         m_RootParam.ParameterType = (D3D12_ROOT_PARAMETER_TYPE)0xFFFFFFFF;
     }
 
     void InitAsConstants( UINT Register, UINT NumDwords, D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL )
     {
+        Clear();
         m_RootParam.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
         m_RootParam.ShaderVisibility = Visibility;
         m_RootParam.Constants.Num32BitValues = NumDwords;
@@ -51,6 +56,7 @@ public:
 
     void InitAsConstantBuffer( UINT Register, D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL )
     {
+        Clear();
         m_RootParam.ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
         m_RootParam.ShaderVisibility = Visibility;
         m_RootParam.Descriptor.ShaderRegister = Register;
@@ -59,6 +65,7 @@ public:
 
     void InitAsBufferSRV( UINT Register, D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL )
     {
+        Clear();
         m_RootParam.ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
         m_RootParam.ShaderVisibility = Visibility;
         m_RootParam.Descriptor.ShaderRegister = Register;
@@ -67,6 +74,7 @@ public:
 
     void InitAsBufferUAV( UINT Register, D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL )
     {
+        Clear();
         m_RootParam.ParameterType = D3D12_ROOT_PARAMETER_TYPE_UAV;
         m_RootParam.ShaderVisibility = Visibility;
         m_RootParam.Descriptor.ShaderRegister = Register;
@@ -81,6 +89,7 @@ public:
 
     void InitAsDescriptorTable( UINT RangeCount, D3D12_SHADER_VISIBILITY Visibility = D3D12_SHADER_VISIBILITY_ALL )
     {
+        Clear();
         m_RootParam.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
         m_RootParam.ShaderVisibility = Visibility;
         m_RootParam.DescriptorTable.NumDescriptorRanges = RangeCount;
@@ -116,7 +125,7 @@ class RootSignature
 
 public:
 
-    RootSignature( UINT NumRootParams = 0, UINT NumStaticSamplers = 0 ) : m_Finalized(FALSE), m_NumParameters(NumRootParams)
+    RootSignature( UINT NumRootParams = 0, UINT NumStaticSamplers = 0 ) : m_Finalized(FALSE), m_NumParameters(NumRootParams), m_SignatureHash(0)
     {
         Reset(NumRootParams, NumStaticSamplers);
     }
@@ -162,6 +171,10 @@ public:
 
     ID3D12RootSignature* GetSignature() const { return m_Signature; }
 
+    // Hash of the finalized root signature's contents.  Unlike the interface pointer it is the
+    // same from one run to the next, so it can be part of a persistent pipeline cache key.
+    size_t GetSignatureHash() const { return m_SignatureHash; }
+
 protected:
 
     BOOL m_Finalized;
@@ -174,4 +187,5 @@ protected:
     std::unique_ptr<RootParameter[]> m_ParamArray;
     std::unique_ptr<D3D12_STATIC_SAMPLER_DESC[]> m_SamplerArray;
     ID3D12RootSignature* m_Signature;
+    size_t m_SignatureHash;
 };
@@ -0,0 +1,650 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+
+#include "pch.h"
+#include "TLSFAllocator.h"
+#include "GraphicsCore.h"
+#include "CommandListManager.h"
+#include "CommandContext.h"
+
+using namespace Graphics;
+using namespace std;
+
+namespace
+{
+    inline uint32_t HighestBit( uint64_t Value )
+    {
+        unsigned long Index;
+        _BitScanReverse64(&Index, Value);
+        return Index;
+    }
+
+    inline uint32_t LowestBit( uint64_t Value )
+    {
+        unsigned long Index;
+        _BitScanForward64(&Index, Value);
+        return Index;
+    }
+}
+
+TLSFRangeAllocator::TLSFRangeAllocator() : m_Capacity(0), m_Granularity(1)
+{
+    Reset(0, 1);
+}
+
+void TLSFRangeAllocator::Reset( size_t Capacity, size_t Granularity )
+{
+    ASSERT(Math::IsPowerOfTwo(Granularity));
+
+    m_Nodes.clear();
+    m_UnusedNodes.clear();
+    m_FirstLevelBitmap = 0;
+    ZeroMemory(m_SecondLevelBitmaps, sizeof(m_SecondLevelBitmaps));
+    memset(m_FreeLists, 0xFF, sizeof(m_FreeLists));
+
+    m_Capacity = Math::AlignDown(Capacity, Granularity);
+    m_Granularity = Granularity;
+    m_FreeUnits = 0;
+    m_NumFreeRanges = 0;
+    m_NumAllocations = 0;
+
+    if (m_Capacity == 0)
+        return;
+
+    uint32_t Index = NewNode();
+    Node& Whole = m_Nodes[Index];
+    Whole.Offset = 0;
+    Whole.Size = m_Capacity / m_Granularity;
+    Whole.PrevPhysical = kInvalidNode;
+    Whole.NextPhysical = kInvalidNode;
+    Whole.IsFree = true;
+    m_FreeUnits = Whole.Size;
+    InsertFree(Index);
+}
+
+void TLSFRangeAllocator::MapSize( uint64_t Units, uint32_t& FirstLevel, uint32_t& SecondLevel )
+{
+    // Sizes below the second level count get exact lists.  Above that, each power of two is split into
+    // kSecondLevelCount equal steps.
+    if (Units < kSecondLevelCount)
+    {
+        FirstLevel = 0;
+        SecondLevel = (uint32_t)Units;
+    }
+    else
+    {
+        uint32_t Bit = HighestBit(Units);
+        FirstLevel = Bit - kSecondLevelLog2 + 1;
+        SecondLevel = (uint32_t)(Units >> (Bit - kSecondLevelLog2)) - kSecondLevelCount;
+    }
+}
+
+uint32_t TLSFRangeAllocator::NewNode( void )
+{
+    if (!m_UnusedNodes.empty())
+    {
+        uint32_t Index = m_UnusedNodes.back();
+        m_UnusedNodes.pop_back();
+        return Index;
+    }
+
+    m_Nodes.emplace_back();
+    return (uint32_t)m_Nodes.size() - 1;
+}
+
+void TLSFRangeAllocator::ReleaseNode( uint32_t Index )
+{
+    m_UnusedNodes.push_back(Index);
+}
+
+uint32_t TLSFRangeAllocator::SplitNode( uint32_t Index, uint64_t KeepUnits )
+{
+    // May reallocate m_Nodes
+    uint32_t NewIndex = NewNode();
+
+    Node& Original = m_Nodes[Index];
+    Node& Remainder = m_Nodes[NewIndex];
+
+    Remainder.Offset = Original.Offset + KeepUnits;
+    Remainder.Size = Original.Size - KeepUnits;
+    Remainder.PrevPhysical = Index;
+    Remainder.NextPhysical = Original.NextPhysical;
+    Remainder.IsFree = true;
+
+    if (Original.NextPhysical != kInvalidNode)
+        m_Nodes[Original.NextPhysical].PrevPhysical = NewIndex;
+
+    Original.NextPhysical = NewIndex;
+    Original.Size = KeepUnits;
+
+    return NewIndex;
+}
+
+void TLSFRangeAllocator::InsertFree( uint32_t Index )
+{
+    Node& Free = m_Nodes[Index];
+
+    uint32_t FirstLevel, SecondLevel;
+    MapSize(Free.Size, FirstLevel, SecondLevel);
+
+    uint32_t& Head = m_FreeLists[FirstLevel][SecondLevel];
+    Free.PrevFree = kInvalidNode;
+    Free.NextFree = Head;
+    if (Head != kInvalidNode)
+        m_Nodes[Head].PrevFree = Index;
+    Head = Index;
+
+    m_FirstLevelBitmap |= (uint64_t)1 << FirstLevel;
+    m_SecondLevelBitmaps[FirstLevel] |= 1u << SecondLevel;
+    ++m_NumFreeRanges;
+}
+
+void TLSFRangeAllocator::RemoveFree( uint32_t Index )
+{
+    Node& Free = m_Nodes[Index];
+
+    uint32_t FirstLevel, SecondLevel;
+    MapSize(Free.Size, FirstLevel, SecondLevel);
+
+    if (Free.PrevFree != kInvalidNode)
+        m_Nodes[Free.PrevFree].NextFree = Free.NextFree;
+    if (Free.NextFree != kInvalidNode)
+        m_Nodes[Free.NextFree].PrevFree = Free.PrevFree;
+
+    uint32_t& Head = m_FreeLists[FirstLevel][SecondLevel];
+    if (Head == Index)
+    {
+        Head = Free.NextFree;
+        if (Head == kInvalidNode)
+        {
+            m_SecondLevelBitmaps[FirstLevel] &= ~(1u << SecondLevel);
+            if (m_SecondLevelBitmaps[FirstLevel] == 0)
+                m_FirstLevelBitmap &= ~((uint64_t)1 << FirstLevel);
+        }
+    }
+
+    --m_NumFreeRanges;
+}
+
+uint32_t TLSFRangeAllocator::FindFree( uint64_t Units ) const
+{
+    // Round up to the next list boundary so that any range in the list found is large enough
+    uint64_t SearchUnits = Units;
+    if (SearchUnits >= kSecondLevelCount)
+        SearchUnits += ((uint64_t)1 << (HighestBit(SearchUnits) - kSecondLevelLog2)) - 1;
+
+    uint32_t FirstLevel, SecondLevel;
+    MapSize(SearchUnits, FirstLevel, SecondLevel);
+
+    if (FirstLevel < kFirstLevelCount)
+    {
+        uint32_t SecondLevelMap = m_SecondLevelBitmaps[FirstLevel] & (~0u << SecondLevel);
+        if (SecondLevelMap == 0)
+        {
+            uint64_t FirstLevelMap = FirstLevel + 1 < 64 ? m_FirstLevelBitmap & (~(uint64_t)0 << (FirstLevel + 1)) : 0;
+            if (FirstLevelMap != 0)
+            {
+                FirstLevel = LowestBit(FirstLevelMap);
+                SecondLevelMap = m_SecondLevelBitmaps[FirstLevel];
+            }
+        }
+
+        if (SecondLevelMap != 0)
+            return m_FreeLists[FirstLevel][LowestBit(SecondLevelMap)];
+    }
+
+    // Nearly full.  Ranges in the request's own list may still be large enough.
+    MapSize(Units, FirstLevel, SecondLevel);
+    for (uint32_t Index = m_FreeLists[FirstLevel][SecondLevel]; Index != kInvalidNode; Index = m_Nodes[Index].NextFree)
+    {
+        if (m_Nodes[Index].Size >= Units)
+            return Index;
+    }
+
+    return kInvalidNode;
+}
+
+TLSFRangeAllocator::Range TLSFRangeAllocator::Allocate( size_t SizeInBytes, size_t Alignment )
+{
+    ASSERT(SizeInBytes > 0);
+    ASSERT(Alignment == 0 || Math::IsPowerOfTwo(Alignment));
+
+    Range Result = { 0, 0, kInvalidNode };
+
+    uint64_t Units = Math::DivideByMultiple(SizeInBytes, m_Granularity);
+    uint64_t AlignmentUnits = Alignment > m_Granularity ? Alignment / m_Granularity : 1;
+
+    uint32_t Index = FindFree(Units + AlignmentUnits - 1);
+    if (Index == kInvalidNode)
+        return Result;
+
+    RemoveFree(Index);
+
+    // Give the space skipped for alignment back as a range of its own
+    uint64_t Padding = Math::AlignUp(m_Nodes[Index].Offset, (size_t)AlignmentUnits) - m_Nodes[Index].Offset;
+    if (Padding > 0)
+    {
+        uint32_t Aligned = SplitNode(Index, Padding);
+        InsertFree(Index);
+        Index = Aligned;
+    }
+
+    if (m_Nodes[Index].Size > Units)
+        InsertFree(SplitNode(Index, Units));
+
+    Node& Allocated = m_Nodes[Index];
+    Allocated.IsFree = false;
+    m_FreeUnits -= Units;
+    ++m_NumAllocations;
+
+    Result.Offset = (size_t)Allocated.Offset * m_Granularity;
+    Result.Size = (size_t)Units * m_Granularity;
+    Result.Node = Index;
+    return Result;
+}
+
+void TLSFRangeAllocator::Free( uint32_t Index )
+{
+    ASSERT(Index < m_Nodes.size() && !m_Nodes[Index].IsFree, "Freeing a range that isn't allocated");
+
+    m_FreeUnits += m_Nodes[Index].Size;
+    --m_NumAllocations;
+    m_Nodes[Index].IsFree = true;
+
+    // Merge with the free neighbors on either side
+    uint32_t Prev = m_Nodes[Index].PrevPhysical;
+    if (Prev != kInvalidNode && m_Nodes[Prev].IsFree)
+    {
+        RemoveFree(Prev);
+        m_Nodes[Prev].Size += m_Nodes[Index].Size;
+        m_Nodes[Prev].NextPhysical = m_Nodes[Index].NextPhysical;
+        if (m_Nodes[Index].NextPhysical != kInvalidNode)
+            m_Nodes[m_Nodes[Index].NextPhysical].PrevPhysical = Prev;
+        ReleaseNode(Index);
+        Index = Prev;
+    }
+
+    uint32_t Next = m_Nodes[Index].NextPhysical;
+    if (Next != kInvalidNode && m_Nodes[Next].IsFree)
+    {
+        RemoveFree(Next);
+        m_Nodes[Index].Size += m_Nodes[Next].Size;
+        m_Nodes[Index].NextPhysical = m_Nodes[Next].NextPhysical;
+        if (m_Nodes[Next].NextPhysical != kInvalidNode)
+            m_Nodes[m_Nodes[Next].NextPhysical].PrevPhysical = Index;
+        ReleaseNode(Next);
+    }
+
+    InsertFree(Index);
+}
+
+size_t TLSFRangeAllocator::GetLargestFreeRange( void ) const
+{
+    if (m_FirstLevelBitmap == 0)
+        return 0;
+
+    uint32_t FirstLevel = HighestBit(m_FirstLevelBitmap);
+    uint32_t SecondLevel = HighestBit(m_SecondLevelBitmaps[FirstLevel]);
+
+    uint64_t Largest = 0;
+    for (uint32_t Index = m_FreeLists[FirstLevel][SecondLevel]; Index != kInvalidNode; Index = m_Nodes[Index].NextFree)
+        Largest = max(Largest, m_Nodes[Index].Size);
+
+    return (size_t)Largest * m_Granularity;
+}
+
+TLSFAllocator::TLSFAllocator(kBuddyAllocationStrategy allocationStrategy, D3D12_HEAP_TYPE heapType, size_t heapSize, size_t granularity)
+    : m_pBackingHeap(nullptr)
+    , m_heapType(heapType)
+    , m_allocationStrategy(allocationStrategy)
+    , m_heapSize(heapSize)
+    , m_requestedBytes(0)
+    , m_pendingFreeBytes(0)
+    , m_traceFile(nullptr)
+    , m_nextTraceId(1)
+    , m_lastTracedFence(0)
+{
+    if (granularity == 0)
+        granularity = allocationStrategy == kPlacedResourceStrategy ? MIN_PLACED_BUFFER_SIZE : DEFAULT_ALIGN;
+
+    // Placed buffers must start on a 64K boundary
+    ASSERT(allocationStrategy != kPlacedResourceStrategy || Math::IsDivisible(granularity, (size_t)MIN_PLACED_BUFFER_SIZE));
+
+    m_ranges.Reset(heapSize, granularity);
+}
+
+TLSFAllocator::~TLSFAllocator()
+{
+    StopTrace();
+}
+
+void TLSFAllocator::Initialize()
+{
+    if (m_allocationStrategy == kPlacedResourceStrategy)
+    {
+        D3D12_HEAP_PROPERTIES heapProps = CD3DX12_HEAP_PROPERTIES(m_heapType);
+
+        D3D12_HEAP_DESC desc = {};
+        desc.SizeInBytes = m_heapSize;
+        desc.Properties = heapProps;
+        desc.Alignment = MIN_PLACED_BUFFER_SIZE;
+        desc.Flags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+
+        ASSERT_SUCCEEDED(g_Device->CreateHeap(&desc, MY_IID_PPV_ARGS(&m_pBackingHeap)));
+    }
+    else
+    {
+        m_BackingResource.Create(L"TLSF Allocator Backing Resource", uint32_t(m_heapSize), 1, nullptr);
+    }
+}
+
+void TLSFAllocator::Destroy()
+{
+    lock_guard<mutex> lockGuard(m_mutex);
+
+    // Anything still waiting for a fence is released along with the heap
+    while (!m_deferredFrees.empty())
+    {
+        delete m_deferredFrees.front().pBuffer;
+        m_deferredFrees.pop();
+    }
+
+    m_relocatableBlocks.clear();
+    m_ranges.Reset(m_heapSize, m_ranges.GetGranularity());
+    m_requestedBytes = 0;
+    m_pendingFreeBytes = 0;
+
+    if (m_allocationStrategy == kPlacedResourceStrategy)
+    {
+        if (m_pBackingHeap != nullptr)
+            m_pBackingHeap->Release();
+        m_pBackingHeap = nullptr;
+    }
+    else
+    {
+        m_BackingResource.Destroy();
+    }
+}
+
+TLSFBlock* TLSFAllocator::Allocate(uint32_t numElements, uint32_t elementSize, const void* initialData,
+    std::function<void(TLSFBlock&)> onRelocate)
+{
+    size_t size = (size_t)numElements * elementSize;
+
+    TLSFBlock* pBlock = nullptr;
+    {
+        lock_guard<mutex> lockGuard(m_mutex);
+
+        TLSFRangeAllocator::Range range = m_ranges.Allocate(size);
+        if (!range.IsValid() && !m_deferredFrees.empty())
+        {
+            CleanUpLocked();
+            range = m_ranges.Allocate(size);
+        }
+
+        if (!range.IsValid())
+            return nullptr;
+
+        pBlock = new TLSFBlock();
+        pBlock->m_offset = range.Offset;
+        pBlock->m_size = range.Size;
+        pBlock->m_unpaddedSize = size;
+        pBlock->m_node = range.Node;
+        pBlock->m_onRelocate = onRelocate;
+        m_requestedBytes += size;
+
+        if (onRelocate)
+            m_relocatableBlocks[pBlock->m_offset] = pBlock;
+
+        if (m_traceFile != nullptr)
+        {
+            TraceSubmitsLocked();
+            pBlock->m_traceId = m_nextTraceId++;
+            fprintf(m_traceFile, "a %llu %llu\n", pBlock->m_traceId, (uint64_t)size);
+        }
+    }
+
+    if (m_allocationStrategy == kPlacedResourceStrategy)
+    {
+        pBlock->m_pBuffer = new ByteAddressBuffer();
+        pBlock->m_pBackingHeap = m_pBackingHeap;
+        pBlock->m_pBuffer->CreatePlaced(L"TLSF Block", m_pBackingHeap, uint32_t(pBlock->m_offset), numElements, elementSize, initialData);
+    }
+    else
+    {
+        pBlock->m_pBuffer = &m_BackingResource;
+        if (initialData)
+            CommandContext::InitializeBuffer(m_BackingResource, initialData, size, pBlock->m_offset);
+    }
+
+    return pBlock;
+}
+
+void TLSFAllocator::Deallocate(TLSFBlock* pBlock, uint64_t fenceValue)
+{
+    if (pBlock == nullptr)
+        return;
+
+    if (fenceValue == 0)
+        fenceValue = g_CommandManager.GetGraphicsQueue().GetNextFenceValue();
+
+    lock_guard<mutex> lockGuard(m_mutex);
+
+    if (pBlock->m_onRelocate)
+        m_relocatableBlocks.erase(pBlock->m_offset);
+
+    if (m_traceFile != nullptr)
+    {
+        TraceSubmitsLocked();
+        fprintf(m_traceFile, "f %llu\n", pBlock->m_traceId);
+    }
+
+    DeferredFree deferred;
+    deferred.FenceValue = fenceValue;
+    deferred.Node = pBlock->m_node;
+    deferred.Size = pBlock->m_size;
+    deferred.pBuffer = m_allocationStrategy == kPlacedResourceStrategy ? pBlock->m_pBuffer : nullptr;
+    m_deferredFrees.push(deferred);
+
+    m_requestedBytes -= pBlock->m_unpaddedSize;
+    m_pendingFreeBytes += pBlock->m_size;
+
+    delete pBlock;
+}
+
+void TLSFAllocator::CleanUpAllocations()
+{
+    lock_guard<mutex> lockGuard(m_mutex);
+    CleanUpLocked();
+}
+
+void TLSFAllocator::CleanUpLocked()
+{
+    while (!m_deferredFrees.empty() && g_CommandManager.IsFenceComplete(m_deferredFrees.front().FenceValue))
+    {
+        DeferredFree& deferred = m_deferredFrees.front();
+
+        // Staging buffers of manual moves have no range of their own
+        if (deferred.Node != TLSFRangeAllocator::kInvalidNode)
+        {
+            m_ranges.Free(deferred.Node);
+            m_pendingFreeBytes -= deferred.Size;
+        }
+
+        delete deferred.pBuffer;
+        m_deferredFrees.pop();
+    }
+}
+
+uint32_t TLSFAllocator::Defragment(uint32_t maxMoves)
+{
+    {
+        lock_guard<mutex> lockGuard(m_mutex);
+        if (m_relocatableBlocks.empty() || maxMoves == 0)
+            return 0;
+    }
+
+    vector<TLSFBlock*> movedBlocks;
+    vector<DeferredFree> oldLocations;
+
+    CommandContext& context = CommandContext::Begin(L"Defragment Heap");
+
+    {
+        lock_guard<mutex> lockGuard(m_mutex);
+
+        CleanUpLocked();
+
+        // Work down from the top of the heap.  A block is only moved if a free range below it fits.
+        vector<TLSFBlock*> candidates;
+        candidates.reserve(m_relocatableBlocks.size());
+        for (auto it = m_relocatableBlocks.rbegin(); it != m_relocatableBlocks.rend(); ++it)
+            candidates.push_back(it->second);
+
+        for (TLSFBlock* pBlock : candidates)
+        {
+            if (movedBlocks.size() == maxMoves)
+                break;
+
+            TLSFRangeAllocator::Range range = m_ranges.Allocate(pBlock->m_unpaddedSize);
+            if (!range.IsValid())
+                break;
+
+            if (range.Offset >= pBlock->m_offset)
+            {
+                m_ranges.Free(range.Node);
+                continue;
+            }
+
+            DeferredFree old;
+            old.Node = pBlock->m_node;
+            old.Size = pBlock->m_size;
+            old.pBuffer = nullptr;
+
+            if (m_allocationStrategy == kPlacedResourceStrategy)
+            {
+                ByteAddressBuffer* pOldBuffer = pBlock->m_pBuffer;
+                pBlock->m_pBuffer = new ByteAddressBuffer();
+                pBlock->m_pBuffer->CreatePlaced(L"TLSF Block", m_pBackingHeap, uint32_t(range.Offset),
+                    pOldBuffer->GetElementCount(), pOldBuffer->GetElementSize());
+
+                context.TransitionResource(*pOldBuffer, D3D12_RESOURCE_STATE_COPY_SOURCE);
+                context.CopyBufferRegion(*pBlock->m_pBuffer, 0, *pOldBuffer, 0, pBlock->m_unpaddedSize);
+                context.TransitionResource(*pBlock->m_pBuffer, D3D12_RESOURCE_STATE_GENERIC_READ);
+                old.pBuffer = pOldBuffer;
+            }
+            else
+            {
+                // A buffer can't be a copy source and destination at once, so stage through a buffer of its own
+                ByteAddressBuffer* pStaging = new ByteAddressBuffer();
+                pStaging->Create(L"TLSF Defragment Staging", uint32_t(pBlock->m_unpaddedSize), 1);
+
+                context.TransitionResource(m_BackingResource, D3D12_RESOURCE_STATE_COPY_SOURCE);
+                context.CopyBufferRegion(*pStaging, 0, m_BackingResource, pBlock->m_offset, pBlock->m_unpaddedSize);
+                context.TransitionResource(*pStaging, D3D12_RESOURCE_STATE_COPY_SOURCE);
+                context.CopyBufferRegion(m_BackingResource, range.Offset, *pStaging, 0, pBlock->m_unpaddedSize);
+
+                DeferredFree staging;
+                staging.Node = TLSFRangeAllocator::kInvalidNode;
+                staging.Size = 0;
+                staging.pBuffer = pStaging;
+                oldLocations.push_back(staging);
+            }
+
+            oldLocations.push_back(old);
+            m_relocatableBlocks.erase(pBlock->m_offset);
+
+            pBlock->m_offset = range.Offset;
+            pBlock->m_size = range.Size;
+            pBlock->m_node = range.Node;
+            m_relocatableBlocks[pBlock->m_offset] = pBlock;
+            m_pendingFreeBytes += old.Size;
+
+            movedBlocks.push_back(pBlock);
+        }
+
+        if (m_allocationStrategy == kManualSubAllocationStrategy && !movedBlocks.empty())
+            context.TransitionResource(m_BackingResource, D3D12_RESOURCE_STATE_GENERIC_READ);
+    }
+
+    uint64_t fenceValue = context.Finish();
+
+    {
+        lock_guard<mutex> lockGuard(m_mutex);
+        for (DeferredFree& old : oldLocations)
+        {
+            old.FenceValue = fenceValue;
+            m_deferredFrees.push(old);
+        }
+    }
+
+    // Outside of the lock, since owners may allocate or free while rebuilding their views
+    for (TLSFBlock* pBlock : movedBlocks)
+        pBlock->m_onRelocate(*pBlock);
+
+    return (uint32_t)movedBlocks.size();
+}
+
+TLSFAllocatorStats TLSFAllocator::GetStats()
+{
+    lock_guard<mutex> lockGuard(m_mutex);
+
+    TLSFAllocatorStats stats;
+    stats.Capacity = m_ranges.GetCapacity();
+    stats.AllocatedBytes = stats.Capacity - m_ranges.GetFreeSize();
+    stats.RequestedBytes = m_requestedBytes;
+    stats.PendingFreeBytes = m_pendingFreeBytes;
+    stats.LargestFreeRange = m_ranges.GetLargestFreeRange();
+    stats.FreeRanges = m_ranges.GetFreeRangeCount();
+    stats.Allocations = m_ranges.GetAllocationCount();
+
+    size_t liveBytes = stats.AllocatedBytes - stats.PendingFreeBytes;
+    size_t freeBytes = m_ranges.GetFreeSize();
+    stats.InternalFragmentation = liveBytes == 0 ? 0.0f : 1.0f - (float)stats.RequestedBytes / liveBytes;
+    stats.ExternalFragmentation = freeBytes == 0 ? 0.0f : 1.0f - (float)stats.LargestFreeRange / freeBytes;
+    return stats;
+}
+
+bool TLSFAllocator::StartTrace(const std::wstring& fileName)
+{
+    lock_guard<mutex> lockGuard(m_mutex);
+
+    if (m_traceFile != nullptr)
+        fclose(m_traceFile);
+
+    m_traceFile = nullptr;
+    if (_wfopen_s(&m_traceFile, fileName.c_str(), L"w") != 0)
+        return false;
+
+    fprintf(m_traceFile, "# TLSFAllocator trace:  %s, %llu byte heap\n",
+        m_allocationStrategy == kPlacedResourceStrategy ? "placed" : "manual", (uint64_t)m_heapSize);
+    m_lastTracedFence = g_CommandManager.GetGraphicsQueue().GetNextFenceValue();
+    return true;
+}
+
+void TLSFAllocator::StopTrace()
+{
+    lock_guard<mutex> lockGuard(m_mutex);
+
+    if (m_traceFile != nullptr)
+        fclose(m_traceFile);
+    m_traceFile = nullptr;
+}
+
+void TLSFAllocator::TraceSubmitsLocked()
+{
+    // One line per graphics command list submitted since the last entry, so a replay can hold frees
+    // back the way fences do
+    uint64_t nextFence = g_CommandManager.GetGraphicsQueue().GetNextFenceValue();
+    for (; m_lastTracedFence < nextFence; ++m_lastTracedFence)
+        fputs("s\n", m_traceFile);
+}
@@ -0,0 +1,207 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// Allocates blocks from a fixed range with a two-level segregated fit (TLSF) allocator.  Free ranges
+// are binned first by power of two and then into 16 linear steps within it, with a bitmap at each
+// level, so finding a free range that fits takes a couple of bit scans and splitting and merging
+// neighbors is constant time.  Unlike BuddyAllocator, sizes are only rounded up to the granularity
+// (and to 1/16th of their power of two while searching), so a 600KB vertex buffer takes 640KB of the
+// heap rather than 1MB.
+//
+// The allocator offers the same placed resource and manual sub-allocation strategies.  Freed blocks are
+// returned to the heap once a fence has passed, and blocks given a relocation callback can be moved
+// lower in the heap by Defragment() to reopen large free ranges.
+//
+
+#pragma once
+
+#include "BuddyAllocator.h"
+#include <functional>
+#include <map>
+
+class CommandContext;
+
+// Tracks the free space of a range of bytes.  It never touches a heap itself, so tools can run it
+// without a device.
+class TLSFRangeAllocator
+{
+public:
+
+    static const uint32_t kInvalidNode = 0xFFFFFFFF;
+
+    struct Range
+    {
+        size_t Offset;      // In bytes from the start of the range
+        size_t Size;        // Reserved bytes, a multiple of the granularity
+        uint32_t Node;      // Pass to Free()
+
+        bool IsValid( void ) const { return Node != kInvalidNode; }
+    };
+
+    TLSFRangeAllocator();
+
+    // Every offset and size is a multiple of Granularity, which must be a power of two
+    void Reset( size_t Capacity, size_t Granularity );
+
+    // Returns an invalid range if no free range is large enough.  Alignment must be zero or a power of two.
+    Range Allocate( size_t SizeInBytes, size_t Alignment = 0 );
+    void Free( uint32_t Node );
+
+    size_t GetCapacity( void ) const { return m_Capacity; }
+    size_t GetGranularity( void ) const { return m_Granularity; }
+    size_t GetFreeSize( void ) const { return (size_t)m_FreeUnits * m_Granularity; }
+    size_t GetLargestFreeRange( void ) const;
+    uint32_t GetFreeRangeCount( void ) const { return m_NumFreeRanges; }
+    uint32_t GetAllocationCount( void ) const { return m_NumAllocations; }
+
+private:
+
+    static const uint32_t kSecondLevelLog2 = 4;
+    static const uint32_t kSecondLevelCount = 1 << kSecondLevelLog2;
+    static const uint32_t kFirstLevelCount = 48;
+
+    struct Node
+    {
+        uint64_t Offset;        // In units of the granularity
+        uint64_t Size;
+        uint32_t PrevPhysical;
+        uint32_t NextPhysical;
+        uint32_t PrevFree;
+        uint32_t NextFree;
+        bool IsFree;
+    };
+
+    static void MapSize( uint64_t Units, uint32_t& FirstLevel, uint32_t& SecondLevel );
+
+    uint32_t NewNode( void );
+    void ReleaseNode( uint32_t Index );
+    uint32_t SplitNode( uint32_t Index, uint64_t KeepUnits );
+    void InsertFree( uint32_t Index );
+    void RemoveFree( uint32_t Index );
+    uint32_t FindFree( uint64_t Units ) const;
+
+    std::vector<Node> m_Nodes;
+    std::vector<uint32_t> m_UnusedNodes;
+
+    uint64_t m_FirstLevelBitmap;
+    uint32_t m_SecondLevelBitmaps[kFirstLevelCount];
+    uint32_t m_FreeLists[kFirstLevelCount][kSecondLevelCount];
+
+    size_t m_Capacity;
+    size_t m_Granularity;
+    uint64_t m_FreeUnits;
+    uint32_t m_NumFreeRanges;
+    uint32_t m_NumAllocations;
+};
+
+struct TLSFBlock
+{
+    ByteAddressBuffer* m_pBuffer;
+    ID3D12Heap* m_pBackingHeap;
+
+    size_t m_offset;
+    size_t m_size;
+    size_t m_unpaddedSize;
+    uint32_t m_node;
+    uint64_t m_traceId;
+
+    // Called after Defragment() has moved the block, to recreate anything that refers to its old location
+    std::function<void(TLSFBlock&)> m_onRelocate;
+
+    inline size_t GetOffset() const { return m_offset; }
+    inline size_t GetSize() const { return m_size; }
+
+    TLSFBlock() : m_pBuffer(nullptr), m_pBackingHeap(nullptr), m_offset(0), m_size(0), m_unpaddedSize(0),
+        m_node(TLSFRangeAllocator::kInvalidNode), m_traceId(0) {}
+};
+
+struct TLSFAllocatorStats
+{
+    size_t Capacity;
+    size_t AllocatedBytes;              // Reserved, including padding and pending frees
+    size_t RequestedBytes;              // As requested by live blocks
+    size_t PendingFreeBytes;            // Waiting for a fence before they can be reused
+    size_t LargestFreeRange;
+    uint32_t FreeRanges;
+    uint32_t Allocations;
+    float InternalFragmentation;        // 1 - requested / allocated
+    float ExternalFragmentation;        // 1 - largest free range / free bytes
+};
+
+class TLSFAllocator
+{
+public:
+
+    // A granularity of zero picks 64K for placed resources and 256 bytes for manual sub-allocation
+    TLSFAllocator(kBuddyAllocationStrategy allocationStrategy, D3D12_HEAP_TYPE heapType, size_t heapSize, size_t granularity = 0);
+    ~TLSFAllocator();
+
+    void Initialize();
+
+    // Every block must have been released
+    void Destroy();
+
+    // Returns nullptr when there is no free range large enough.  A block with a relocation callback may be
+    // moved by Defragment().
+    TLSFBlock* Allocate(uint32_t numElements, uint32_t elementSize, const void* initialData = nullptr,
+        std::function<void(TLSFBlock&)> onRelocate = nullptr);
+
+    // The block is returned to the heap once the fence passes.  Zero uses the next graphics queue fence,
+    // which covers every command list recorded so far.
+    void Deallocate(TLSFBlock* pBlock, uint64_t fenceValue = 0);
+
+    // Returns blocks whose fence has passed to the heap.  Allocate() also does this before giving up.
+    void CleanUpAllocations();
+
+    // Moves up to maxMoves relocatable blocks from the top of the heap into free ranges below them, copying
+    // their contents on a graphics context of its own.  Returns the number moved.
+    uint32_t Defragment(uint32_t maxMoves);
+
+    TLSFAllocatorStats GetStats();
+
+    // Writes allocations and frees to a text file for AllocatorBenchmark to replay
+    bool StartTrace(const std::wstring& fileName);
+    void StopTrace();
+
+    ByteAddressBuffer& GetBackingResource() { return m_BackingResource; }
+
+private:
+
+    struct DeferredFree
+    {
+        uint64_t FenceValue;
+        uint32_t Node;
+        size_t Size;
+        ByteAddressBuffer* pBuffer;     // The placed buffer, or the staging buffer of a manual move
+    };
+
+    void CleanUpLocked();
+    void TraceSubmitsLocked();
+
+    ID3D12Heap* m_pBackingHeap;
+    ByteAddressBuffer m_BackingResource;
+
+    const D3D12_HEAP_TYPE m_heapType;
+    const kBuddyAllocationStrategy m_allocationStrategy;
+    const size_t m_heapSize;
+
+    std::mutex m_mutex;
+    TLSFRangeAllocator m_ranges;
+    std::queue<DeferredFree> m_deferredFrees;
+    std::map<size_t, TLSFBlock*> m_relocatableBlocks;     // By offset
+    size_t m_requestedBytes;
+    size_t m_pendingFreeBytes;
+
+    FILE* m_traceFile;
+    uint64_t m_nextTraceId;
+    uint64_t m_lastTracedFence;
+};
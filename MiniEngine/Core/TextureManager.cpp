@@ -18,8 +18,10 @@
 #include "DDSTextureLoader.h"
 #include "GraphicsCore.h"
 #include "CommandContext.h"
-#include <map>
-#include <thread>
+#include <unordered_map>
+#include <deque>
+#include <atomic>
+#include <condition_variable>
 
 using namespace std;
 using namespace Graphics;
@@ -62,10 +64,16 @@ void Texture::Create( size_t Pitch, size_t Width, size_t Height, DXGI_FORMAT For
     texResource.RowPitch = Pitch * BytesPerPixel(Format);
     texResource.SlicePitch = texResource.RowPitch * Height;
 
-    CommandContext::InitializeTexture(*this, 1, &texResource);
+    m_UploadBatch = TextureManager::QueueTextureUpload(*this, 1, &texResource);
+
+    // Textures accessed on the copy queue decay to the common state once the copy completes
+    m_UsageState = D3D12_RESOURCE_STATE_COMMON;
 
     if (m_hCpuDescriptorHandle.ptr == D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN)
+    {
         m_hCpuDescriptorHandle = AllocateDescriptor(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+        m_OwnsDescriptor = true;
+    }
     g_Device->CreateShaderResourceView(m_pResource.Get(), nullptr, m_hCpuDescriptorHandle);
 }
 
@@ -124,11 +132,16 @@ void Texture::CreateTGAFromMemory( const void* _filePtr, size_t, bool sRGB )
 bool Texture::CreateDDSFromMemory( const void* filePtr, size_t fileSize, bool sRGB )
 {
     if (m_hCpuDescriptorHandle.ptr == D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN)
+    {
         m_hCpuDescriptorHandle = AllocateDescriptor(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+        m_OwnsDescriptor = true;
+    }
 
     HRESULT hr = CreateDDSTextureFromMemory( Graphics::g_Device,
         (const uint8_t*)filePtr, fileSize, 0, sRGB, &m_pResource, m_hCpuDescriptorHandle );
 
+    m_UploadBatch = TextureManager::GetCurrentUploadBatch();
+
     return SUCCEEDED(hr);
 }
 
@@ -149,39 +162,611 @@ void Texture::CreatePIXImageFromMemory( const void* memBuffer, size_t fileSize )
     Create(header.Pitch, header.Width, header.Height, header.Format, (uint8_t*)memBuffer + sizeof(Header));
 }
 
+void Texture::Destroy()
+{
+    GpuResource::Destroy();
+
+    if (m_OwnsDescriptor)
+        FreeDescriptor(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, m_hCpuDescriptorHandle);
+    m_OwnsDescriptor = false;
+    m_hCpuDescriptorHandle.ptr = 0;
+}
+
+bool Texture::IsUploadComplete() const
+{
+    return TextureManager::IsUploadBatchComplete(m_UploadBatch);
+}
+
 namespace TextureManager
 {
     wstring s_RootPath = L"";
-    map< wstring, unique_ptr<ManagedTexture> > s_TextureCache;
 
-    void Initialize( const std::wstring& TextureLibRoot )
+    mutex s_LoadMutex;
+    condition_variable s_LoadCondition;
+
+    class UploadQueue
     {
-        s_RootPath = TextureLibRoot;
+    public:
+        UploadQueue() : m_HasPendingUploads(false), m_Context(nullptr), m_RingHead(0), m_RingTail(0),
+            m_RingBytesInFlight(0), m_BatchRingBytes(0) {}
+
+        uint64_t QueueUpload( GpuResource& Dest, UINT NumSubresources, const D3D12_SUBRESOURCE_DATA SubData[] );
+        void Submit( void );
+        uint64_t GetCurrentBatch( void );
+        bool IsBatchComplete( uint64_t Batch );
+        void Destroy( void );
+
+    private:
+
+        static const size_t kRingSize = 64 * 1024 * 1024;
+
+        struct RetiredBatch
+        {
+            uint64_t FenceValue;
+            size_t RingBytes;
+            vector< Microsoft::WRL::ComPtr<ID3D12Resource> > Resources;
+            vector< unique_ptr<LinearAllocationPage> > LargePages;
+        };
+
+        LinearAllocationPage* CreateUploadPage( size_t PageSize );
+        bool AllocateFromRing( size_t SizeInBytes, size_t& Offset );
+        void RetireCompletedBatches( void );
+        void SubmitLocked( void );
+
+        mutex m_Mutex;
+        atomic<bool> m_HasPendingUploads;
+
+        CommandContext* m_Context;
+        vector< Microsoft::WRL::ComPtr<ID3D12Resource> > m_BatchResources;
+        vector< unique_ptr<LinearAllocationPage> > m_BatchLargePages;
+
+        // A persistently mapped upload buffer used as a ring.  Batches free their part of it, in order,
+        // once their fence has passed.
+        unique_ptr<LinearAllocationPage> m_Ring;
+        size_t m_RingHead;
+        size_t m_RingTail;
+        size_t m_RingBytesInFlight;
+        size_t m_BatchRingBytes;
+
+        deque<RetiredBatch> m_RetiredBatches;
+
+        // Fence value of every submitted batch, indexed by batch number - 1
+        vector<uint64_t> m_BatchFences;
+    };
+
+    UploadQueue s_UploadQueue;
+
+    LinearAllocationPage* UploadQueue::CreateUploadPage( size_t PageSize )
+    {
+        D3D12_HEAP_PROPERTIES HeapProps;
+        HeapProps.Type = D3D12_HEAP_TYPE_UPLOAD;
+        HeapProps.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+        HeapProps.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+        HeapProps.CreationNodeMask = 1;
+        HeapProps.VisibleNodeMask = 1;
+
+        D3D12_RESOURCE_DESC ResourceDesc = CD3DX12_RESOURCE_DESC::Buffer(PageSize);
+
+        ID3D12Resource* pBuffer;
+        ASSERT_SUCCEEDED(g_Device->CreateCommittedResource(&HeapProps, D3D12_HEAP_FLAG_NONE, &ResourceDesc,
+            D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, MY_IID_PPV_ARGS(&pBuffer)));
+
+        pBuffer->SetName(L"Texture Upload Page");
+
+        return new LinearAllocationPage(pBuffer, D3D12_RESOURCE_STATE_GENERIC_READ);
     }
 
-    void Shutdown( void )
+    bool UploadQueue::AllocateFromRing( size_t SizeInBytes, size_t& Offset )
     {
-        s_TextureCache.clear();
+        const size_t Alignment = D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+
+        if (m_RingBytesInFlight == 0)
+        {
+            m_RingHead = 0;
+            m_RingTail = 0;
+        }
+        else if (m_RingHead == m_RingTail)
+        {
+            return false;
+        }
+
+        size_t AlignedHead = Math::AlignUp(m_RingHead, Alignment);
+
+        if (m_RingHead >= m_RingTail)
+        {
+            // Free space is [head, end) followed by [0, tail)
+            if (AlignedHead + SizeInBytes <= kRingSize)
+                Offset = AlignedHead;
+            else if (SizeInBytes <= m_RingTail)
+            {
+                // Skip the end of the ring.  The skipped bytes are freed along with this batch.
+                m_BatchRingBytes += kRingSize - m_RingHead;
+                m_RingBytesInFlight += kRingSize - m_RingHead;
+                m_RingHead = 0;
+                AlignedHead = 0;
+                Offset = 0;
+            }
+            else
+                return false;
+        }
+        else if (AlignedHead + SizeInBytes <= m_RingTail)
+        {
+            Offset = AlignedHead;
+        }
+        else
+            return false;
+
+        size_t AllocatedBytes = Offset + SizeInBytes - m_RingHead;
+        m_BatchRingBytes += AllocatedBytes;
+        m_RingBytesInFlight += AllocatedBytes;
+        m_RingHead = (Offset + SizeInBytes) % kRingSize;
+        return true;
     }
 
-    pair<ManagedTexture*, bool> FindOrLoadTexture( const wstring& fileName )
+    void UploadQueue::RetireCompletedBatches( void )
+    {
+        while (!m_RetiredBatches.empty() && g_CommandManager.IsFenceComplete(m_RetiredBatches.front().FenceValue))
+        {
+            m_RingTail = (m_RingTail + m_RetiredBatches.front().RingBytes) % kRingSize;
+            m_RingBytesInFlight -= m_RetiredBatches.front().RingBytes;
+            m_RetiredBatches.pop_front();
+        }
+    }
+
+    void UploadQueue::SubmitLocked( void )
+    {
+        if (m_Context == nullptr)
+            return;
+
+        uint64_t FenceValue = m_Context->Finish();
+        m_Context = nullptr;
+
+        RetiredBatch Batch;
+        Batch.FenceValue = FenceValue;
+        Batch.RingBytes = m_BatchRingBytes;
+        Batch.Resources.swap(m_BatchResources);
+        Batch.LargePages.swap(m_BatchLargePages);
+        m_RetiredBatches.push_back(std::move(Batch));
+        m_BatchRingBytes = 0;
+        m_BatchFences.push_back(FenceValue);
+
+        // Anything submitted to these queues from now on may sample the new textures
+        g_CommandManager.GetGraphicsQueue().StallForFence(FenceValue);
+        g_CommandManager.GetComputeQueue().StallForFence(FenceValue);
+
+        m_HasPendingUploads = false;
+    }
+
+    uint64_t UploadQueue::QueueUpload( GpuResource& Dest, UINT NumSubresources, const D3D12_SUBRESOURCE_DATA SubData[] )
+    {
+        ASSERT(NumSubresources > 0);
+
+        ID3D12Resource* pDest = Dest.GetResource();
+        D3D12_RESOURCE_DESC DestDesc = pDest->GetDesc();
+
+        vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> Layouts(NumSubresources);
+        vector<UINT> NumRows(NumSubresources);
+        vector<UINT64> RowSizesInBytes(NumSubresources);
+        UINT64 RequiredSize = 0;
+        g_Device->GetCopyableFootprints(&DestDesc, 0, NumSubresources, 0, Layouts.data(), NumRows.data(),
+            RowSizesInBytes.data(), &RequiredSize);
+
+        lock_guard<mutex> LockGuard(m_Mutex);
+
+        if (m_Ring == nullptr)
+            m_Ring.reset(CreateUploadPage(kRingSize));
+
+        RetireCompletedBatches();
+
+        ID3D12Resource* pUpload = nullptr;
+        uint8_t* pUploadData = nullptr;
+        size_t UploadOffset = 0;
+
+        if (RequiredSize > kRingSize / 4)
+        {
+            // Big textures get a page of their own rather than draining the ring
+            LinearAllocationPage* LargePage = CreateUploadPage((size_t)RequiredSize);
+            m_BatchLargePages.emplace_back(LargePage);
+            pUpload = LargePage->GetResource();
+            pUploadData = (uint8_t*)LargePage->m_CpuVirtualAddress;
+        }
+        else
+        {
+            while (!AllocateFromRing((size_t)RequiredSize, UploadOffset))
+            {
+                // The ring is full.  Submit what we have and wait for the oldest batch to finish.
+                SubmitLocked();
+                ASSERT(!m_RetiredBatches.empty());
+                g_CommandManager.WaitForFence(m_RetiredBatches.front().FenceValue);
+                RetireCompletedBatches();
+            }
+            pUpload = m_Ring->GetResource();
+            pUploadData = (uint8_t*)m_Ring->m_CpuVirtualAddress;
+        }
+
+        if (m_Context == nullptr)
+            m_Context = &CommandContext::BeginCopy();
+
+        for (UINT i = 0; i < NumSubresources; ++i)
+        {
+            Layouts[i].Offset += UploadOffset;
+
+            D3D12_MEMCPY_DEST DestData = { pUploadData + Layouts[i].Offset, Layouts[i].Footprint.RowPitch,
+                Layouts[i].Footprint.RowPitch * NumRows[i] };
+            MemcpySubresource(&DestData, &SubData[i], (SIZE_T)RowSizesInBytes[i], NumRows[i], Layouts[i].Footprint.Depth);
+
+            CD3DX12_TEXTURE_COPY_LOCATION Dst(pDest, i);
+            CD3DX12_TEXTURE_COPY_LOCATION Src(pUpload, Layouts[i]);
+            m_Context->GetCommandList()->CopyTextureRegion(&Dst, 0, 0, 0, &Src, nullptr);
+        }
+
+        // Keep the destination alive until the copy has executed
+        m_BatchResources.emplace_back(pDest);
+        m_HasPendingUploads = true;
+
+        return m_BatchFences.size() + 1;
+    }
+
+    void UploadQueue::Submit( void )
+    {
+        // Checked without the lock because every context flush comes through here
+        if (!m_HasPendingUploads)
+            return;
+
+        lock_guard<mutex> LockGuard(m_Mutex);
+        SubmitLocked();
+    }
+
+    uint64_t UploadQueue::GetCurrentBatch( void )
+    {
+        lock_guard<mutex> LockGuard(m_Mutex);
+        return m_Context != nullptr ? m_BatchFences.size() + 1 : m_BatchFences.size();
+    }
+
+    bool UploadQueue::IsBatchComplete( uint64_t Batch )
+    {
+        if (Batch == 0)
+            return true;
+
+        lock_guard<mutex> LockGuard(m_Mutex);
+        if (Batch > m_BatchFences.size())
+            return false;
+
+        return g_CommandManager.IsFenceComplete(m_BatchFences[Batch - 1]);
+    }
+
+    void UploadQueue::Destroy( void )
+    {
+        // The GPU is idle and the copy context was already destroyed with the other contexts
+        lock_guard<mutex> LockGuard(m_Mutex);
+        m_Context = nullptr;
+        m_HasPendingUploads = false;
+        m_BatchResources.clear();
+        m_BatchLargePages.clear();
+        m_RetiredBatches.clear();
+        m_Ring = nullptr;
+        m_RingHead = m_RingTail = m_RingBytesInFlight = m_BatchRingBytes = 0;
+    }
+
+    uint64_t QueueTextureUpload( GpuResource& Dest, UINT NumSubresources, const D3D12_SUBRESOURCE_DATA SubData[] )
+    {
+        return s_UploadQueue.QueueUpload(Dest, NumSubresources, SubData);
+    }
+
+    void SubmitUploads( void )
+    {
+        s_UploadQueue.Submit();
+    }
+
+    uint64_t GetCurrentUploadBatch( void )
+    {
+        return s_UploadQueue.GetCurrentBatch();
+    }
+
+    bool IsUploadBatchComplete( uint64_t Batch )
+    {
+        return s_UploadQueue.IsBatchComplete(Batch);
+    }
+
+    // Textures are cached in shards with separate locks so that loader threads rarely contend.  Reference
+    // counts, the list of unreferenced textures and residency totals are guarded by one residency lock,
+    // which is only ever taken after a shard lock.
+    class TextureCache
+    {
+    public:
+        TextureCache() : m_IsDestroyed(false), m_MemoryBudget(0), m_BytesResident(0), m_TexturesResident(0),
+            m_Hits(0), m_Misses(0), m_Evictions(0) {}
+
+        pair<ManagedTexture*, bool> FindOrLoad( const wstring& fileName );
+        void FinishLoad( ManagedTexture* Texture );
+        void Release( ManagedTexture* Texture );
+        void SetMemoryBudget( size_t SizeInBytes );
+        void EndFrame( void );
+        CacheStats GetStats( void );
+        void Reset( void ) { m_IsDestroyed = false; }
+        void Destroy( void );
+
+    private:
+
+        static const uint32_t kNumShards = 16;
+
+        struct Shard
+        {
+            mutex Mutex;
+            unordered_map< wstring, unique_ptr<ManagedTexture> > Textures;
+        };
+
+        // Evicted textures may still be referenced by contexts that were recorded before the eviction, whether or
+        // not they have been executed yet.  Once all of them are submitted, the last fence on each queue covers them.
+        struct EvictedTexture
+        {
+            uint64_t ContextSerial;         // Contexts handed out before this one may reference the texture
+            bool FencesKnown;
+            uint64_t FenceValues[3];        // Graphics, compute and copy
+            unique_ptr<ManagedTexture> Texture;
+        };
+
+        Shard& GetShard( const wstring& fileName ) { return m_Shards[hash<wstring>()(fileName) % kNumShards]; }
+        void EvictToBudget( void );
+        void DestroyEvictedTextures( void );
+
+        Shard m_Shards[kNumShards];
+        bool m_IsDestroyed;
+
+        mutex m_ResidencyMutex;
+        list<ManagedTexture*> m_UnreferencedTextures;    // Most recently released first
+        deque<EvictedTexture> m_EvictedTextures;
+        size_t m_MemoryBudget;
+        uint64_t m_BytesResident;
+        uint32_t m_TexturesResident;
+
+        atomic<uint64_t> m_Hits;
+        atomic<uint64_t> m_Misses;
+        uint64_t m_Evictions;
+    };
+
+    TextureCache s_TextureCache;
+
+    pair<ManagedTexture*, bool> TextureCache::FindOrLoad( const wstring& fileName )
     {
-        static mutex s_Mutex;
-        lock_guard<mutex> Guard(s_Mutex);
+        Shard& CacheShard = GetShard(fileName);
+        lock_guard<mutex> Guard(CacheShard.Mutex);
 
-        auto iter = s_TextureCache.find(fileName);
+        auto iter = CacheShard.Textures.find(fileName);
 
         // If it's found, it has already been loaded or the load process has begun
-        if (iter != s_TextureCache.end())
-            return make_pair(iter->second.get(), false);
+        if (iter != CacheShard.Textures.end())
+        {
+            ++m_Hits;
+
+            ManagedTexture* Texture = iter->second.get();
+
+            lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+            if (Texture->m_RefCount++ == 0)
+            {
+                m_UnreferencedTextures.erase(Texture->m_UnreferencedPosition);
+                Texture->m_IsUnreferenced = false;
+            }
+            return make_pair(Texture, false);
+        }
 
-        ManagedTexture* NewTexture = new ManagedTexture(fileName);
-        s_TextureCache[fileName].reset( NewTexture );
+        ++m_Misses;
+
+        D3D12_CPU_DESCRIPTOR_HANDLE Handle;
+        {
+            lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+            DestroyEvictedTextures();
+            Handle = AllocateDescriptor(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+            ++m_TexturesResident;
+        }
+
+        ManagedTexture* NewTexture = new ManagedTexture(fileName, Handle);
+        CacheShard.Textures[fileName].reset( NewTexture );
 
         // This was the first time it was requested, so indicate that the caller must read the file
         return make_pair(NewTexture, true);
     }
 
+    void TextureCache::FinishLoad( ManagedTexture* Texture )
+    {
+        if (!Texture->IsValid() || Texture->GetResource() == nullptr)
+            return;
+
+        D3D12_RESOURCE_DESC Desc = Texture->GetResource()->GetDesc();
+        size_t SizeInBytes = (size_t)g_Device->GetResourceAllocationInfo(0, 1, &Desc).SizeInBytes;
+
+        {
+            lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+            Texture->m_SizeInBytes = SizeInBytes;
+            m_BytesResident += SizeInBytes;
+        }
+
+        EvictToBudget();
+    }
+
+    void TextureCache::Release( ManagedTexture* Texture )
+    {
+        // Models may outlive the texture manager
+        if (m_IsDestroyed)
+            return;
+
+        {
+            lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+            ASSERT(Texture->m_RefCount > 0, "Texture released more often than it was loaded");
+            if (--Texture->m_RefCount > 0)
+                return;
+
+            m_UnreferencedTextures.push_front(Texture);
+            Texture->m_UnreferencedPosition = m_UnreferencedTextures.begin();
+            Texture->m_IsUnreferenced = true;
+        }
+
+        EvictToBudget();
+    }
+
+    void TextureCache::SetMemoryBudget( size_t SizeInBytes )
+    {
+        {
+            lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+            m_MemoryBudget = SizeInBytes;
+        }
+
+        EvictToBudget();
+    }
+
+    void TextureCache::EndFrame( void )
+    {
+        lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+        DestroyEvictedTextures();
+    }
+
+    void TextureCache::EvictToBudget( void )
+    {
+        for (;;)
+        {
+            ManagedTexture* Victim;
+            wstring Key;
+            {
+                lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+                if (m_MemoryBudget == 0 || m_BytesResident <= m_MemoryBudget || m_UnreferencedTextures.empty())
+                    return;
+
+                Victim = m_UnreferencedTextures.back();
+                Key = Victim->m_MapKey;
+            }
+
+            // The shard has to be locked first, so check that nobody took a reference or evicted the
+            // texture in the meantime
+            Shard& CacheShard = GetShard(Key);
+            lock_guard<mutex> Guard(CacheShard.Mutex);
+
+            auto iter = CacheShard.Textures.find(Key);
+            if (iter == CacheShard.Textures.end() || iter->second.get() != Victim)
+                continue;
+
+            lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+            if (!Victim->m_IsUnreferenced)
+                continue;
+
+            m_UnreferencedTextures.erase(Victim->m_UnreferencedPosition);
+            Victim->m_IsUnreferenced = false;
+            m_BytesResident -= Victim->m_SizeInBytes;
+            --m_TexturesResident;
+            ++m_Evictions;
+
+            EvictedTexture Evicted;
+            Evicted.ContextSerial = g_ContextManager.GetNextContextSerial();
+            Evicted.FencesKnown = false;
+            Evicted.Texture = std::move(iter->second);
+            m_EvictedTextures.push_back(std::move(Evicted));
+
+            CacheShard.Textures.erase(iter);
+        }
+    }
+
+    void TextureCache::DestroyEvictedTextures( void )
+    {
+        // Evictions are queued in context order, so stop at the first one that may still be referenced by an
+        // open context.  Every context submitted so far signals a fence no later than the last one issued.
+        uint64_t OldestOpenContext = g_ContextManager.GetOldestOpenContextSerial();
+        for (EvictedTexture& Evicted : m_EvictedTextures)
+        {
+            if (Evicted.FencesKnown)
+                continue;
+            if (Evicted.ContextSerial > OldestOpenContext)
+                break;
+
+            Evicted.FenceValues[0] = g_CommandManager.GetGraphicsQueue().GetNextFenceValue() - 1;
+            Evicted.FenceValues[1] = g_CommandManager.GetComputeQueue().GetNextFenceValue() - 1;
+            Evicted.FenceValues[2] = g_CommandManager.GetCopyQueue().GetNextFenceValue() - 1;
+            Evicted.FencesKnown = true;
+        }
+
+        while (!m_EvictedTextures.empty() && m_EvictedTextures.front().FencesKnown &&
+            g_CommandManager.IsFenceComplete(m_EvictedTextures.front().FenceValues[0]) &&
+            g_CommandManager.IsFenceComplete(m_EvictedTextures.front().FenceValues[1]) &&
+            g_CommandManager.IsFenceComplete(m_EvictedTextures.front().FenceValues[2]))
+        {
+            ManagedTexture* Texture = m_EvictedTextures.front().Texture.get();
+
+            // Invalid textures already freed their own descriptor and point at the magenta texture's.
+            // The fences have passed, so the descriptor can be reused right away.
+            if (Texture->IsValid())
+                FreeDescriptor(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, Texture->GetSRV());
+
+            Texture->Destroy();
+            m_EvictedTextures.pop_front();
+        }
+    }
+
+    CacheStats TextureCache::GetStats( void )
+    {
+        lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+
+        CacheStats Stats;
+        Stats.Hits = m_Hits;
+        Stats.Misses = m_Misses;
+        Stats.Evictions = m_Evictions;
+        Stats.BytesResident = m_BytesResident;
+        Stats.TexturesResident = m_TexturesResident;
+        Stats.TexturesUnreferenced = (uint32_t)m_UnreferencedTextures.size();
+        return Stats;
+    }
+
+    void TextureCache::Destroy( void )
+    {
+        // The GPU is idle by now
+        for (uint32_t i = 0; i < kNumShards; ++i)
+        {
+            lock_guard<mutex> Guard(m_Shards[i].Mutex);
+            m_Shards[i].Textures.clear();
+        }
+
+        lock_guard<mutex> ResidencyGuard(m_ResidencyMutex);
+        m_UnreferencedTextures.clear();
+        m_EvictedTextures.clear();
+        m_BytesResident = 0;
+        m_TexturesResident = 0;
+        m_IsDestroyed = true;
+    }
+
+    void Initialize( const std::wstring& TextureLibRoot )
+    {
+        s_RootPath = TextureLibRoot;
+        s_TextureCache.Reset();
+    }
+
+    void Shutdown( void )
+    {
+        s_TextureCache.Destroy();
+        s_UploadQueue.Destroy();
+    }
+
+    void ReleaseTexture( const ManagedTexture* Texture )
+    {
+        s_TextureCache.Release(const_cast<ManagedTexture*>(Texture));
+    }
+
+    void SetMemoryBudget( size_t SizeInBytes )
+    {
+        s_TextureCache.SetMemoryBudget(SizeInBytes);
+    }
+
+    void EndFrame( void )
+    {
+        s_TextureCache.EndFrame();
+    }
+
+    CacheStats GetCacheStats( void )
+    {
+        return s_TextureCache.GetStats();
+    }
+
+    pair<ManagedTexture*, bool> FindOrLoadTexture( const wstring& fileName )
+    {
+        return s_TextureCache.FindOrLoad(fileName);
+    }
+
     const Texture& GetBlackTex2D(void)
     {
         auto ManagedTex = FindOrLoadTexture(L"DefaultBlackTexture");
@@ -197,6 +782,7 @@ namespace TextureManager
 
         uint32_t BlackPixel = 0;
         ManTex->Create(1, 1, DXGI_FORMAT_R8G8B8A8_UNORM, &BlackPixel);
+        ManTex->FinishLoad();
         return *ManTex;
     }
 
@@ -215,6 +801,7 @@ namespace TextureManager
 
         uint32_t WhitePixel = 0xFFFFFFFFul;
         ManTex->Create(1, 1, DXGI_FORMAT_R8G8B8A8_UNORM, &WhitePixel);
+        ManTex->FinishLoad();
         return *ManTex;
     }
 
@@ -233,6 +820,7 @@ namespace TextureManager
 
         uint32_t MagentaPixel = 0x00FF00FF;
         ManTex->Create(1, 1, DXGI_FORMAT_R8G8B8A8_UNORM, &MagentaPixel);
+        ManTex->FinishLoad();
         return *ManTex;
     }
 
@@ -240,14 +828,25 @@ namespace TextureManager
 
 void ManagedTexture::WaitForLoad( void ) const
 {
-    volatile D3D12_CPU_DESCRIPTOR_HANDLE& VolHandle = (volatile D3D12_CPU_DESCRIPTOR_HANDLE&)m_hCpuDescriptorHandle;
-    volatile bool& VolValid = (volatile bool&)m_IsValid;
-    while (VolHandle.ptr == D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN && VolValid)
-        this_thread::yield();
+    unique_lock<mutex> Lock(TextureManager::s_LoadMutex);
+    TextureManager::s_LoadCondition.wait(Lock, [this] { return !m_IsLoading; });
+}
+
+void ManagedTexture::FinishLoad( void )
+{
+    {
+        lock_guard<mutex> Guard(TextureManager::s_LoadMutex);
+        m_IsLoading = false;
+    }
+    TextureManager::s_LoadCondition.notify_all();
+
+    TextureManager::s_TextureCache.FinishLoad(this);
 }
 
 void ManagedTexture::SetToInvalidTexture( void )
 {
+    // Nothing was created with our descriptor, so it can be reused right away
+    Graphics::FreeDescriptor(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, m_hCpuDescriptorHandle);
     m_hCpuDescriptorHandle = TextureManager::GetMagentaTex2D().GetSRV();
     m_IsValid = false;
 }
@@ -258,7 +857,10 @@ const ManagedTexture* TextureManager::LoadFromFile( const std::wstring& fileName
 
     const ManagedTexture* Tex = LoadDDSFromFile( CatPath + L".dds", sRGB );
     if (!Tex->IsValid())
+    {
+        ReleaseTexture(Tex);
         Tex = LoadTGAFromFile( CatPath + L".tga", sRGB );
+    }
 
     return Tex;
 }
@@ -282,6 +884,8 @@ const ManagedTexture* TextureManager::LoadDDSFromFile( const std::wstring& fileN
     else
         ManTex->GetResource()->SetName(fileName.c_str());
 
+    ManTex->FinishLoad();
+
     return ManTex;
 }
 
@@ -307,6 +911,8 @@ const ManagedTexture* TextureManager::LoadTGAFromFile( const std::wstring& fileN
     else
         ManTex->SetToInvalidTexture();
 
+    ManTex->FinishLoad();
+
     return ManTex;
 }
 
@@ -333,5 +939,7 @@ const ManagedTexture* TextureManager::LoadPIXImageFromFile( const std::wstring&
     else
         ManTex->SetToInvalidTexture();
 
+    ManTex->FinishLoad();
+
     return ManTex;
 }
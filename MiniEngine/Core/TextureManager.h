@@ -17,6 +17,7 @@
 #include "pch.h"
 #include "GpuResource.h"
 #include "Utility.h"
+#include <list>
 
 class Texture : public GpuResource
 {
@@ -24,8 +25,8 @@ class Texture : public GpuResource
 
 public:
 
-    Texture() { m_hCpuDescriptorHandle.ptr = D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN; }
-    Texture(D3D12_CPU_DESCRIPTOR_HANDLE Handle) : m_hCpuDescriptorHandle(Handle) {}
+    Texture() : m_UploadBatch(0), m_OwnsDescriptor(false) { m_hCpuDescriptorHandle.ptr = D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN; }
+    Texture(D3D12_CPU_DESCRIPTOR_HANDLE Handle) : m_hCpuDescriptorHandle(Handle), m_UploadBatch(0), m_OwnsDescriptor(false) {}
 
     // Create a 1-level 2D texture
     void Create(size_t Pitch, size_t Width, size_t Height, DXGI_FORMAT Format, const void* InitData );
@@ -38,30 +39,45 @@ public:
     bool CreateDDSFromMemory( const void* memBuffer, size_t fileSize, bool sRGB );
     void CreatePIXImageFromMemory( const void* memBuffer, size_t fileSize );
 
-    virtual void Destroy() override
-    {
-        GpuResource::Destroy();
-        // This leaks descriptor handles.  We should really give it back to be reused.
-        m_hCpuDescriptorHandle.ptr = 0;
-    }
+    // Frees the descriptor if the texture allocated it.  Managed textures are handed theirs by the
+    // texture cache, which frees it when they are evicted.
+    virtual void Destroy() override;
 
     const D3D12_CPU_DESCRIPTOR_HANDLE& GetSRV() const { return m_hCpuDescriptorHandle; }
 
+    // True once the GPU has finished copying the initial data.  Textures can be used before then
+    // because the graphics and compute queues wait on the upload, but streaming code can use this
+    // to avoid stalling them.
+    bool IsUploadComplete() const;
+
     bool operator!() { return m_hCpuDescriptorHandle.ptr == 0; }
 
 protected:
 
     D3D12_CPU_DESCRIPTOR_HANDLE m_hCpuDescriptorHandle;
+    uint64_t m_UploadBatch;
+    bool m_OwnsDescriptor;
 };
 
+namespace TextureManager
+{
+    class TextureCache;
+}
+
 class ManagedTexture : public Texture
 {
+    friend class TextureManager::TextureCache;
+
 public:
-    ManagedTexture( const std::wstring& FileName ) : m_MapKey(FileName), m_IsValid(true) {}
+    ManagedTexture( const std::wstring& FileName, D3D12_CPU_DESCRIPTOR_HANDLE Handle ) :
+        Texture(Handle), m_MapKey(FileName), m_IsValid(true), m_IsLoading(true), m_RefCount(1), m_SizeInBytes(0),
+        m_IsUnreferenced(false) {}
 
     void operator= ( const Texture& Texture );
 
+    // Blocks until the thread that requested the load has created the texture (or given up on it)
     void WaitForLoad(void) const;
+    void FinishLoad(void);
     void Unload(void);
 
     void SetToInvalidTexture(void);
@@ -70,6 +86,13 @@ public:
 private:
     std::wstring m_MapKey;        // For deleting from the map later
     bool m_IsValid;
+    bool m_IsLoading;
+
+    // Owned by the texture cache
+    uint32_t m_RefCount;
+    size_t m_SizeInBytes;
+    bool m_IsUnreferenced;
+    std::list<ManagedTexture*>::iterator m_UnreferencedPosition;
 };
 
 namespace TextureManager
@@ -77,6 +100,28 @@ namespace TextureManager
     void Initialize( const std::wstring& TextureLibRoot );
     void Shutdown(void);
 
+    // Every Load*() call returns a reference to the texture that should be given back with ReleaseTexture()
+    // when it is no longer used.  Unreferenced textures stay cached until they have to be evicted to stay
+    // within the memory budget, least recently released first.
+    void ReleaseTexture( const ManagedTexture* Texture );
+
+    // Zero, the default, never evicts
+    void SetMemoryBudget( size_t SizeInBytes );
+
+    // Frees evicted textures that the GPU is done with.  Called once per frame by Present().
+    void EndFrame(void);
+
+    struct CacheStats
+    {
+        uint64_t Hits;
+        uint64_t Misses;
+        uint64_t Evictions;
+        uint64_t BytesResident;
+        uint32_t TexturesResident;
+        uint32_t TexturesUnreferenced;
+    };
+    CacheStats GetCacheStats(void);
+
     const ManagedTexture* LoadFromFile( const std::wstring& fileName, bool sRGB = false );
     const ManagedTexture* LoadDDSFromFile( const std::wstring& fileName, bool sRGB = false );
     const ManagedTexture* LoadTGAFromFile( const std::wstring& fileName, bool sRGB = false );
@@ -104,4 +149,18 @@ namespace TextureManager
 
     const Texture& GetBlackTex2D(void);
     const Texture& GetWhiteTex2D(void);
+
+    // Texture uploads are batched:  the data is copied into a shared ring of upload memory and recorded
+    // on the copy queue, then the batch is submitted the next time any other command context is flushed.
+    // The graphics and compute queues wait on the copy fence, so the CPU never stalls on an upload.
+    // Returns the batch number the upload was recorded in.
+    uint64_t QueueTextureUpload( GpuResource& Dest, UINT NumSubresources, const D3D12_SUBRESOURCE_DATA SubData[] );
+
+    // Submits the pending upload batch, if any.  Called automatically before other contexts execute.
+    void SubmitUploads(void);
+
+    // The batch that contains every upload queued so far
+    uint64_t GetCurrentUploadBatch(void);
+
+    bool IsUploadBatchComplete( uint64_t Batch );
 }
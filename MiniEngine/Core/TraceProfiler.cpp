@@ -0,0 +1,430 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+
+#include "pch.h"
+#include "TraceProfiler.h"
+#include "SystemTime.h"
+#include "EngineTuning.h"
+#include "Utility.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+
+namespace TraceProfiler
+{
+    BoolVar Record("Profiling/Trace/Record", true);
+    NumVar HitchThreshold("Profiling/Trace/Hitch Threshold (ms)", 0.0f, 0.0f, 1000.0f, 10.0f);
+
+    // 16 bytes an event, so 1 MB a thread.  At a few thousand events a frame that is several seconds.
+    static const uint64_t kRingSize = 1 << 16;
+    static const uint64_t kRingMask = kRingSize - 1;
+    static const uint32_t kMaxThreads = 64;
+    static const uint32_t kGpuThreadId = 0;
+
+    // Hitches are exported a few frames late so that the GPU times of the slow frame are read back
+    static const uint32_t kHitchExportDelay = 4;
+
+    // Written only by its thread.  Readers copy the events and then check how far the writer got meanwhile,
+    // discarding any it may have overwritten.
+    struct ThreadBuffer
+    {
+        ThreadBuffer( uint32_t Id ) : ThreadId(Id), WriteIndex(0) { Events = new TraceEvent[kRingSize]; }
+
+        TraceEvent* Events;
+        uint32_t ThreadId;
+        std::atomic<uint64_t> WriteIndex;
+        std::wstring Name;          // Guarded by s_ScopeMutex
+    };
+
+    std::atomic<ThreadBuffer*> s_Threads[kMaxThreads];
+    std::atomic<uint32_t> s_NumThreads(0);
+    ThreadBuffer* s_GpuBuffer = nullptr;
+
+    std::mutex s_ScopeMutex;
+    std::vector<std::wstring> s_ScopeNames;
+    std::unordered_map<std::wstring, uint32_t> s_ScopeLookup;
+
+    int64_t s_LastFrameTick = 0;
+    uint64_t s_FrameIndex = 0;
+    uint32_t s_FramesUntilHitchExport = 0;
+    uint64_t s_HitchFrame = 0;
+
+    thread_local ThreadBuffer* t_Buffer = nullptr;
+
+    ThreadBuffer* CreateThreadBuffer( uint32_t ThreadId )
+    {
+        uint32_t Slot = s_NumThreads.fetch_add(1);
+        if (Slot >= kMaxThreads)
+            return nullptr;
+
+        ThreadBuffer* Buffer = new ThreadBuffer(ThreadId);
+        Buffer->Name = L"Thread " + std::to_wstring(ThreadId);
+        s_Threads[Slot].store(Buffer, memory_order_release);
+        return Buffer;
+    }
+
+    inline ThreadBuffer* GetThreadBuffer( void )
+    {
+        if (t_Buffer == nullptr)
+            t_Buffer = CreateThreadBuffer(GetCurrentThreadId());
+        return t_Buffer;
+    }
+
+    inline void RecordEvent( ThreadBuffer* Buffer, TraceEventType Type, uint32_t ScopeId, int64_t Tick )
+    {
+        uint64_t Index = Buffer->WriteIndex.load(memory_order_relaxed);
+        TraceEvent& Event = Buffer->Events[Index & kRingMask];
+        Event.Tick = Tick;
+        Event.ScopeId = ScopeId;
+        Event.Type = Type;
+        Buffer->WriteIndex.store(Index + 1, memory_order_release);
+    }
+
+    struct ThreadCapture
+    {
+        uint32_t ThreadId;
+        std::wstring Name;
+        std::vector<TraceEvent> Events;
+    };
+
+    void CaptureThread( ThreadBuffer& Buffer, ThreadCapture& Capture )
+    {
+        uint64_t End = Buffer.WriteIndex.load(memory_order_acquire);
+        uint64_t Begin = End > kRingSize ? End - kRingSize : 0;
+
+        Capture.ThreadId = Buffer.ThreadId;
+        Capture.Events.resize((size_t)(End - Begin));
+        for (uint64_t i = Begin; i < End; ++i)
+            Capture.Events[(size_t)(i - Begin)] = Buffer.Events[i & kRingMask];
+
+        // Events the writer reached while they were copied may be torn, including the one it may be writing now
+        uint64_t NewEnd = Buffer.WriteIndex.load(memory_order_acquire) + 1;
+        uint64_t FirstIntact = NewEnd > kRingSize ? NewEnd - kRingSize : 0;
+        if (FirstIntact > Begin)
+        {
+            size_t NumTorn = (size_t)std::min(FirstIntact - Begin, End - Begin);
+            Capture.Events.erase(Capture.Events.begin(), Capture.Events.begin() + NumTorn);
+        }
+    }
+
+    void WriteJsonString( FILE* File, const std::wstring& String )
+    {
+        fputc('"', File);
+        for (wchar_t c : String)
+        {
+            if (c == L'"' || c == L'\\')
+                fprintf(File, "\\%c", (char)c);
+            else if (c < 0x20 || c > 0x7E)
+                fprintf(File, "\\u%04x", (unsigned)c);
+            else
+                fputc((char)c, File);
+        }
+        fputc('"', File);
+    }
+
+    void WriteChromeTrace( FILE* File, const std::vector<std::wstring>& ScopeNames, const std::vector<ThreadCapture>& Threads,
+        int64_t FirstTick, double MicrosecondsPerTick )
+    {
+        fprintf(File, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool IsFirst = true;
+
+        auto NextEvent = [&]()
+        {
+            fprintf(File, IsFirst ? "" : ",\n");
+            IsFirst = false;
+        };
+
+        for (const ThreadCapture& Thread : Threads)
+        {
+            NextEvent();
+            fprintf(File, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", Thread.ThreadId);
+            WriteJsonString(File, Thread.Name);
+            fprintf(File, "}}");
+
+            // Begin and end events are paired into complete events.  Scopes cut off by the start or end of the
+            // ring buffer are dropped.
+            std::vector<const TraceEvent*> Open;
+            for (const TraceEvent& Event : Thread.Events)
+            {
+                if (Event.Type == kScopeBegin)
+                {
+                    Open.push_back(&Event);
+                }
+                else if (Event.Type == kScopeEnd)
+                {
+                    auto Match = std::find_if(Open.rbegin(), Open.rend(),
+                        [&](const TraceEvent* Begin) { return Begin->ScopeId == Event.ScopeId; });
+                    if (Match == Open.rend())
+                        continue;
+
+                    const TraceEvent& Begin = **Match;
+                    Open.erase(Match.base() - 1, Open.end());
+
+                    NextEvent();
+                    fprintf(File, "{\"name\":");
+                    WriteJsonString(File, Begin.ScopeId < ScopeNames.size() ? ScopeNames[Begin.ScopeId] : L"?");
+                    fprintf(File, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        Thread.ThreadId == kGpuThreadId ? "gpu" : "cpu", Thread.ThreadId,
+                        (Begin.Tick - FirstTick) * MicrosecondsPerTick, (Event.Tick - Begin.Tick) * MicrosecondsPerTick);
+                }
+                else if (Event.Type == kFrameEnd)
+                {
+                    NextEvent();
+                    fprintf(File, "{\"name\":\"Frame %u\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+                        Event.ScopeId, Thread.ThreadId, (Event.Tick - FirstTick) * MicrosecondsPerTick);
+                }
+            }
+        }
+
+        fprintf(File, "\n]}\n");
+    }
+
+    void WriteBinaryCapture( FILE* File, const std::vector<std::wstring>& ScopeNames, const std::vector<ThreadCapture>& Threads,
+        int64_t TicksPerSecond )
+    {
+        const uint32_t Version = 1;
+        uint32_t NumScopes = (uint32_t)ScopeNames.size();
+        uint32_t NumThreads = (uint32_t)Threads.size();
+
+        fwrite("MTRC", 1, 4, File);
+        fwrite(&Version, sizeof(Version), 1, File);
+        fwrite(&TicksPerSecond, sizeof(TicksPerSecond), 1, File);
+        fwrite(&NumScopes, sizeof(NumScopes), 1, File);
+        fwrite(&NumThreads, sizeof(NumThreads), 1, File);
+
+        for (const std::wstring& Name : ScopeNames)
+        {
+            uint32_t Length = (uint32_t)Name.size();
+            fwrite(&Length, sizeof(Length), 1, File);
+            fwrite(Name.data(), sizeof(wchar_t), Length, File);
+        }
+
+        for (const ThreadCapture& Thread : Threads)
+        {
+            uint32_t Length = (uint32_t)Thread.Name.size();
+            uint64_t NumEvents = Thread.Events.size();
+            fwrite(&Thread.ThreadId, sizeof(Thread.ThreadId), 1, File);
+            fwrite(&Length, sizeof(Length), 1, File);
+            fwrite(Thread.Name.data(), sizeof(wchar_t), Length, File);
+            fwrite(&NumEvents, sizeof(NumEvents), 1, File);
+            fwrite(Thread.Events.data(), sizeof(TraceEvent), Thread.Events.size(), File);
+        }
+    }
+
+    struct TraceCapture
+    {
+        std::vector<std::wstring> ScopeNames;
+        std::vector<ThreadCapture> Threads;
+    };
+
+    void CaptureTrace( TraceCapture& Capture )
+    {
+        std::vector<ThreadBuffer*> Buffers;
+        uint32_t NumThreads = std::min(s_NumThreads.load(memory_order_acquire), kMaxThreads);
+        for (uint32_t i = 0; i < NumThreads; ++i)
+        {
+            // A slot is claimed before its buffer is published
+            ThreadBuffer* Buffer = s_Threads[i].load(memory_order_acquire);
+            if (Buffer != nullptr)
+                Buffers.push_back(Buffer);
+        }
+
+        Capture.Threads.resize(Buffers.size());
+        for (size_t i = 0; i < Buffers.size(); ++i)
+            CaptureThread(*Buffers[i], Capture.Threads[i]);
+
+        lock_guard<mutex> LockGuard(s_ScopeMutex);
+        Capture.ScopeNames = s_ScopeNames;
+        for (size_t i = 0; i < Buffers.size(); ++i)
+            Capture.Threads[i].Name = Buffers[i]->Name;
+    }
+
+    void WriteTrace( const std::wstring& FileName, const TraceCapture& Capture )
+    {
+        int64_t FirstTick = INT64_MAX;
+        for (const ThreadCapture& Thread : Capture.Threads)
+        {
+            if (!Thread.Events.empty())
+                FirstTick = std::min(FirstTick, Thread.Events.front().Tick);
+        }
+        if (FirstTick == INT64_MAX)
+            FirstTick = 0;
+
+        double MicrosecondsPerTick = SystemTime::TicksToSeconds(1) * 1000000.0;
+        int64_t TicksPerSecond = (int64_t)(1.0 / SystemTime::TicksToSeconds(1) + 0.5);
+
+        FILE* File = nullptr;
+        if (_wfopen_s(&File, (FileName + L".json").c_str(), L"w") == 0)
+        {
+            WriteChromeTrace(File, Capture.ScopeNames, Capture.Threads, FirstTick, MicrosecondsPerTick);
+            fclose(File);
+        }
+        else
+        {
+            Utility::Printf(L"Unable to write trace %s.json\n", FileName.c_str());
+        }
+
+        if (_wfopen_s(&File, (FileName + L".trace").c_str(), L"wb") == 0)
+        {
+            WriteBinaryCapture(File, Capture.ScopeNames, Capture.Threads, TicksPerSecond);
+            fclose(File);
+        }
+        else
+        {
+            Utility::Printf(L"Unable to write trace %s.trace\n", FileName.c_str());
+        }
+    }
+
+    // Set while a trace is written in the background.  Only one is written at a time, and hitches aren't
+    // looked for meanwhile since the writer competes with the frame for the CPU.
+    std::atomic<bool> s_ExportInFlight(false);
+    concurrency::task<void> s_ExportTask;
+    bool s_ExportedThisFrame = false;
+
+    void ExportInBackground( const std::wstring& FileName )
+    {
+        bool Expected = false;
+        if (!s_ExportInFlight.compare_exchange_strong(Expected, true))
+        {
+            Utility::Printf(L"Still writing the last trace, so %s was skipped\n", FileName.c_str());
+            return;
+        }
+
+        // Copy the ring buffers now so the trace ends with this frame, but leave the formatting and the disk
+        // to another thread
+        std::shared_ptr<TraceCapture> Capture = std::make_shared<TraceCapture>();
+        CaptureTrace(*Capture);
+        s_ExportedThisFrame = true;
+
+        s_ExportTask = concurrency::create_task([FileName, Capture]
+        {
+            WriteTrace(FileName, *Capture);
+            s_ExportInFlight.store(false, memory_order_release);
+        });
+    }
+
+    void ExportNow( void* )
+    {
+        ExportInBackground(L"Trace_" + std::to_wstring(s_FrameIndex));
+    }
+
+    CallbackTrigger ExportTrigger("Profiling/Trace/Export", ExportNow, nullptr);
+}
+
+void TraceProfiler::Initialize( void )
+{
+    s_GpuBuffer = CreateThreadBuffer(kGpuThreadId);
+    if (s_GpuBuffer != nullptr)
+        s_GpuBuffer->Name = L"GPU";
+
+    SetThreadName(L"Main Thread");
+    s_LastFrameTick = SystemTime::GetCurrentTick();
+}
+
+void TraceProfiler::Shutdown( void )
+{
+    if (s_ExportInFlight.load(memory_order_acquire))
+        s_ExportTask.wait();
+
+    // Threads may still hold their buffers until they exit, so they are only freed with the process
+    s_GpuBuffer = nullptr;
+}
+
+uint32_t TraceProfiler::RegisterScope( const std::wstring& Name )
+{
+    lock_guard<mutex> LockGuard(s_ScopeMutex);
+
+    auto Iter = s_ScopeLookup.find(Name);
+    if (Iter != s_ScopeLookup.end())
+        return Iter->second;
+
+    uint32_t ScopeId = (uint32_t)s_ScopeNames.size();
+    s_ScopeNames.push_back(Name);
+    s_ScopeLookup[Name] = ScopeId;
+    return ScopeId;
+}
+
+void TraceProfiler::SetThreadName( const std::wstring& Name )
+{
+    ThreadBuffer* Buffer = GetThreadBuffer();
+    if (Buffer == nullptr)
+        return;
+
+    lock_guard<mutex> LockGuard(s_ScopeMutex);
+    Buffer->Name = Name;
+}
+
+void TraceProfiler::BeginScope( uint32_t ScopeId )
+{
+    if (!Record)
+        return;
+
+    ThreadBuffer* Buffer = GetThreadBuffer();
+    if (Buffer != nullptr)
+        RecordEvent(Buffer, kScopeBegin, ScopeId, SystemTime::GetCurrentTick());
+}
+
+void TraceProfiler::EndScope( uint32_t ScopeId )
+{
+    // Ends are recorded even when recording was just turned off, since unmatched ones are dropped anyway
+    ThreadBuffer* Buffer = GetThreadBuffer();
+    if (Buffer != nullptr)
+        RecordEvent(Buffer, kScopeEnd, ScopeId, SystemTime::GetCurrentTick());
+}
+
+void TraceProfiler::AddGpuScope( uint32_t ScopeId, int64_t StartTick, int64_t EndTick )
+{
+    if (!Record || s_GpuBuffer == nullptr)
+        return;
+
+    RecordEvent(s_GpuBuffer, kScopeBegin, ScopeId, StartTick);
+    RecordEvent(s_GpuBuffer, kScopeEnd, ScopeId, EndTick);
+}
+
+void TraceProfiler::EndFrame( void )
+{
+    int64_t CurrentTick = SystemTime::GetCurrentTick();
+    float FrameTime = (float)SystemTime::TimeBetweenTicks(s_LastFrameTick, CurrentTick) * 1000.0f;
+
+    ThreadBuffer* Buffer = GetThreadBuffer();
+    if (Record && Buffer != nullptr)
+        RecordEvent(Buffer, kFrameEnd, (uint32_t)s_FrameIndex, CurrentTick);
+
+    // A frame that captured a trace is slow because of it, so it isn't taken for a hitch
+    bool IsExporting = s_ExportedThisFrame || s_ExportInFlight.load(memory_order_acquire);
+
+    if (s_FramesUntilHitchExport > 0 && --s_FramesUntilHitchExport == 0)
+        ExportInBackground(L"Hitch_" + std::to_wstring(s_HitchFrame));
+    else if (s_FramesUntilHitchExport == 0 && !IsExporting && Record && HitchThreshold > 0.0f && FrameTime > HitchThreshold)
+    {
+        s_HitchFrame = s_FrameIndex;
+        s_FramesUntilHitchExport = kHitchExportDelay;
+    }
+
+    ++s_FrameIndex;
+    s_ExportedThisFrame = false;
+
+    // Start the next frame after any capture above, so copying the buffers doesn't count against it
+    s_LastFrameTick = SystemTime::GetCurrentTick();
+}
+
+void TraceProfiler::Export( const std::wstring& FileName )
+{
+    TraceCapture Capture;
+    CaptureTrace(Capture);
+    WriteTrace(FileName, Capture);
+}
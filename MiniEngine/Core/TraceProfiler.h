@@ -0,0 +1,95 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// Records when scopes begin and end into a ring buffer per thread.  Recording a scope costs a
+// timestamp and a few stores, with no locks and no lookups, so it can be used on any thread and in
+// hot code.  Nothing is aggregated while recording.  When asked, or when a frame takes longer than
+// the hitch threshold, the last few seconds of every thread are written out by a background task
+// along with the GPU times of the profiler's blocks:
+//
+//   <name>.json   Chrome trace events, for chrome://tracing or ui.perfetto.dev
+//   <name>.trace  The same events in binary:
+//                   char[4] "MTRC", uint32 version, int64 ticks per second, uint32 scope count,
+//                   uint32 thread count, then per scope: uint32 length, wchar_t name[length],
+//                   then per thread: uint32 thread ID, uint32 name length, wchar_t name[length],
+//                   uint64 event count, TraceEvent events[count]
+//
+// The GPU track is thread ID 0.  Its events come in begin/end pairs.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace TraceProfiler
+{
+    enum TraceEventType
+    {
+        kScopeBegin,
+        kScopeEnd,
+        kFrameEnd,          // ScopeId holds the low bits of the frame number
+    };
+
+    struct TraceEvent
+    {
+        int64_t Tick;       // SystemTime::GetCurrentTick()
+        uint32_t ScopeId;
+        uint32_t Type;
+    };
+
+    // Call from the main thread, which it names
+    void Initialize( void );
+    void Shutdown( void );
+
+    // Interns a scope name.  Call it once per scope rather than per event.
+    uint32_t RegisterScope( const std::wstring& Name );
+
+    // Names the calling thread in exported traces
+    void SetThreadName( const std::wstring& Name );
+
+    void BeginScope( uint32_t ScopeId );
+    void EndScope( uint32_t ScopeId );
+
+    // GPU work, with its timestamps converted to CPU ticks.  Only one thread may add them.
+    void AddGpuScope( uint32_t ScopeId, int64_t StartTick, int64_t EndTick );
+
+    // Call once per frame from the main thread
+    void EndFrame( void );
+
+    // Writes what the ring buffers hold to FileName with ".json" and ".trace" appended, before returning
+    void Export( const std::wstring& FileName );
+}
+
+#ifdef RELEASE
+class TraceScope
+{
+public:
+    explicit TraceScope( uint32_t ) {}
+};
+#else
+class TraceScope
+{
+public:
+    explicit TraceScope( uint32_t ScopeId ) : m_ScopeId(ScopeId)
+    {
+        TraceProfiler::BeginScope(ScopeId);
+    }
+    ~TraceScope()
+    {
+        TraceProfiler::EndScope(m_ScopeId);
+    }
+
+private:
+    uint32_t m_ScopeId;
+};
+#endif
@@ -0,0 +1,142 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include "pch.h"
+#include "FileUtility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <psapi.h>
+
+using namespace std;
+
+void PrintHelp()
+{
+    printf("gzip_benchmark\n");
+
+    printf("usage:\n");
+    printf("gzip_benchmark input_directory [-repeat count] [-chunk output_directory]\n");
+    printf("decompresses every .gz file in input_directory and reports throughput and memory use.\n");
+    printf("-chunk also writes each file to output_directory in the chunked format that decompresses in parallel.\n");
+}
+
+static double ToMB(size_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+    if (argc < 2 || argc % 2 != 0)
+    {
+        PrintHelp();
+        return -1;
+    }
+
+    wstring inputDirectory = argv[1];
+    wstring chunkDirectory;
+    int repeatCount = 1;
+
+    for (int arg = 2; arg < argc; arg += 2)
+    {
+        if (0 == wcscmp(argv[arg], L"-repeat"))
+            repeatCount = max(1, _wtoi(argv[arg + 1]));
+        else if (0 == wcscmp(argv[arg], L"-chunk"))
+            chunkDirectory = argv[arg + 1];
+        else
+        {
+            PrintHelp();
+            return -1;
+        }
+    }
+
+    WIN32_FIND_DATAW findData;
+    HANDLE findHandle = FindFirstFileW((inputDirectory + L"\\*.gz").c_str(), &findData);
+    if (findHandle == INVALID_HANDLE_VALUE)
+    {
+        printf("no .gz files found in %ls\n", inputDirectory.c_str());
+        return -1;
+    }
+
+    size_t totalCompressed = 0;
+    size_t totalUncompressed = 0;
+    double totalSeconds = 0.0;
+    int failures = 0;
+
+    do
+    {
+        wstring fileName = inputDirectory + L"\\" + findData.cFileName;
+
+        unique_ptr<Utility::FileSource> source = Utility::MapFile(fileName);
+        if (source == nullptr || source->GetSize() == 0)
+        {
+            printf("%ls: can't open\n", findData.cFileName);
+            ++failures;
+            continue;
+        }
+
+        Utility::ByteArray data;
+        double bestSeconds = 0.0;
+        for (int i = 0; i < repeatCount; ++i)
+        {
+            data = nullptr;
+
+            auto startTime = chrono::high_resolution_clock::now();
+            data = Utility::InflateGzip(source->GetData(), source->GetSize());
+            double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+
+            bestSeconds = i == 0 ? seconds : min(bestSeconds, seconds);
+        }
+
+        if (data->size() == 0)
+        {
+            printf("%ls: failed to decompress\n", findData.cFileName);
+            ++failures;
+            continue;
+        }
+
+        PROCESS_MEMORY_COUNTERS memoryCounters = { sizeof(memoryCounters) };
+        GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters));
+
+        printf("%ls: %.2f MB -> %.2f MB in %.2f ms, %.1f MB/s, %.1f MB committed\n", findData.cFileName,
+            ToMB(source->GetSize()), ToMB(data->size()), bestSeconds * 1000.0, ToMB(data->size()) / bestSeconds,
+            ToMB(memoryCounters.PagefileUsage));
+
+        totalCompressed += source->GetSize();
+        totalUncompressed += data->size();
+        totalSeconds += bestSeconds;
+
+        if (!chunkDirectory.empty())
+        {
+            wstring chunkFileName = chunkDirectory + L"\\" + findData.cFileName;
+            if (!Utility::WriteChunkedGzip(chunkFileName, data->data(), data->size()))
+            {
+                printf("%ls: failed to write %ls\n", findData.cFileName, chunkFileName.c_str());
+                ++failures;
+            }
+        }
+    }
+    while (FindNextFileW(findHandle, &findData));
+
+    FindClose(findHandle);
+
+    PROCESS_MEMORY_COUNTERS memoryCounters = { sizeof(memoryCounters) };
+    GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters));
+
+    printf("\n");
+    printf("total: %.2f MB -> %.2f MB in %.2f ms, %.1f MB/s\n", ToMB(totalCompressed), ToMB(totalUncompressed),
+        totalSeconds * 1000.0, totalSeconds > 0.0 ? ToMB(totalUncompressed) / totalSeconds : 0.0);
+    printf("peak working set: %.1f MB, peak committed: %.1f MB\n", ToMB(memoryCounters.PeakWorkingSetSize),
+        ToMB(memoryCounters.PeakPagefileUsage));
+
+    return failures == 0 ? 0 : -1;
+}
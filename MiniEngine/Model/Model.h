@@ -20,6 +20,11 @@
 
 using namespace Math;
 
+namespace Utility
+{
+    class FileSource;
+}
+
 class Model
 {
 public:
@@ -97,6 +102,19 @@ public:
         attrib_formats
     };
 
+    enum
+    {
+        index_format_uint16 = 0,
+        index_format_uint32,
+
+        index_formats
+    };
+
+    static uint32_t GetIndexSize(unsigned int indexFormat)
+    {
+        return indexFormat == index_format_uint32 ? sizeof(uint32_t) : sizeof(uint16_t);
+    }
+
     struct BoundingBox
     {
         Vector3 min;
@@ -141,6 +159,11 @@ public:
 
         unsigned int vertexDataByteOffsetDepth;
         unsigned int vertexCountDepth;
+
+        // index_format_*, shared by the color and depth-only index data. 32-bit index
+        // data starts on a 4 byte boundary. Occupies what used to be tail padding so
+        // the on-disk size of a mesh is unchanged.
+        unsigned int indexFormat;
     };
     Mesh *m_pMesh;
 
@@ -187,6 +210,24 @@ public:
         return LoadH3D(filename);
     }
 
+    // Loads H3D data from any file source, parsing it in place and streaming the vertex and
+    // index data straight into upload memory
+    bool LoadH3D(const Utility::FileSource& source);
+
+    // The vertex and index blocks of an H3D file, pointing into its file source
+    struct H3DDataBlocks
+    {
+        const unsigned char* vertexData;
+        const unsigned char* indexData;
+        const unsigned char* vertexDataDepth;
+        const unsigned char* indexDataDepth;
+    };
+
+    // The part of LoadH3D that doesn't touch the GPU.  Reads the header and copies out the mesh
+    // and material tables, then locates the data blocks without reading them.  Fails on truncated
+    // files and on versions newer than this build.
+    bool ParseH3D(const Utility::FileSource& source, H3DDataBlocks& blocks);
+
     const BoundingBox& GetBoundingBox() const
     {
         return m_Header.boundingBox;
@@ -209,4 +250,5 @@ protected:
     void ReleaseTextures();
     void LoadTextures();
     D3D12_CPU_DESCRIPTOR_HANDLE* m_SRVs;
+    std::vector<const ManagedTexture*> m_TextureReferences;
 };
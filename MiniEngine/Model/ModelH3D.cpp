@@ -17,25 +17,113 @@
 #include "GraphicsCore.h"
 #include "DescriptorHeap.h"
 #include "CommandContext.h"
+#include "FileUtility.h"
+#include "SystemTime.h"
 #include <stdio.h>
+#include <psapi.h>
+
+// Files written before versioning start directly with the header. Their first word is the
+// mesh count, which can never be as large as the tag.
+static const uint32_t kH3DFileTag = 0x58443348; // 'H3DX'
+
+// 1: per-mesh index format
+static const uint32_t kH3DFileVersion = 1;
+
+static_assert(sizeof(Model::Mesh) == 336, "Model::Mesh is stored as-is in H3D files, changing its size breaks existing files");
 
 bool Model::LoadH3D(const char *filename)
 {
-    FILE *file = nullptr;
-    if (0 != fopen_s(&file, filename, "rb"))
+    int64_t startTick = SystemTime::GetCurrentTick();
+
+    std::unique_ptr<Utility::FileSource> source = Utility::MapFile(MakeWStr(filename));
+    if (source == nullptr)
         return false;
 
-    bool ok = false;
+    if (!LoadH3D(*source))
+        return false;
+
+    PROCESS_MEMORY_COUNTERS memoryCounters = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters));
+
+    Utility::Printf("Loaded %s: %.1f MB in %.1f ms, peak working set %.1f MB\n", filename,
+        source->GetSize() / (1024.0 * 1024.0),
+        SystemTime::TicksToMillisecs(SystemTime::GetCurrentTick() - startTick),
+        memoryCounters.PeakWorkingSetSize / (1024.0 * 1024.0));
+
+    return true;
+}
+
+bool Model::LoadH3D(const Utility::FileSource& source)
+{
+    H3DDataBlocks blocks;
+    if (!ParseH3D(source, blocks))
+        return false;
+
+    m_VertexBuffer.Create(L"VertexBuffer", m_Header.vertexDataByteSize / m_VertexStride, m_VertexStride);
+    CommandContext::InitializeBufferChunked(m_VertexBuffer, blocks.vertexData, m_Header.vertexDataByteSize);
+    m_IndexBuffer.Create(L"IndexBuffer", m_Header.indexDataByteSize / sizeof(uint16_t), sizeof(uint16_t));
+    CommandContext::InitializeBufferChunked(m_IndexBuffer, blocks.indexData, m_Header.indexDataByteSize);
+
+    m_VertexBufferDepth.Create(L"VertexBufferDepth", m_Header.vertexDataByteSizeDepth / m_VertexStrideDepth, m_VertexStrideDepth);
+    CommandContext::InitializeBufferChunked(m_VertexBufferDepth, blocks.vertexDataDepth, m_Header.vertexDataByteSizeDepth);
+    m_IndexBufferDepth.Create(L"IndexBufferDepth", m_Header.indexDataByteSize / sizeof(uint16_t), sizeof(uint16_t));
+    CommandContext::InitializeBufferChunked(m_IndexBufferDepth, blocks.indexDataDepth, m_Header.indexDataByteSize);
+
+    LoadTextures();
 
-    if (1 != fread(&m_Header, sizeof(Header), 1, file)) goto h3d_load_fail;
+    return true;
+}
+
+bool Model::ParseH3D(const Utility::FileSource& source, H3DDataBlocks& blocks)
+{
+    const unsigned char *fileData = source.GetData();
+    const size_t fileSize = source.GetSize();
+    size_t fileOffset = 0;
+
+    // Returns the next blockSize bytes of the file in place, or nullptr if the file is truncated
+    auto readBlock = [&](size_t blockSize) -> const unsigned char*
+    {
+        if (blockSize > fileSize - fileOffset)
+            return nullptr;
+        const unsigned char *block = fileData + fileOffset;
+        fileOffset += blockSize;
+        return block;
+    };
+
+    uint32_t fileVersion = 0;
+    if (fileSize >= sizeof(kH3DFileTag) && 0 == memcmp(fileData, &kH3DFileTag, sizeof(kH3DFileTag)))
+    {
+        const unsigned char *tagBlock = readBlock(sizeof(kH3DFileTag) + sizeof(fileVersion));
+        if (tagBlock == nullptr)
+            return false;
+        memcpy(&fileVersion, tagBlock + sizeof(kH3DFileTag), sizeof(fileVersion));
+        if (fileVersion > kH3DFileVersion)
+            return false;
+    }
+
+    const unsigned char *headerData = readBlock(sizeof(Header));
+    if (headerData == nullptr)
+        return false;
+    memcpy(&m_Header, headerData, sizeof(Header));
+
+    // The tables are tiny next to the vertex data and get modified after loading, so they are
+    // copied out. Everything below them is only ever read once, straight from the file.
+    const unsigned char *meshData = readBlock(sizeof(Mesh) * (size_t)m_Header.meshCount);
+    const unsigned char *materialData = meshData ? readBlock(sizeof(Material) * (size_t)m_Header.materialCount) : nullptr;
+    if (materialData == nullptr)
+        return false;
 
     m_pMesh = new Mesh [m_Header.meshCount];
     m_pMaterial = new Material [m_Header.materialCount];
+    memcpy(m_pMesh, meshData, sizeof(Mesh) * m_Header.meshCount);
+    memcpy(m_pMaterial, materialData, sizeof(Material) * m_Header.materialCount);
 
-    if (m_Header.meshCount > 0)
-        if (1 != fread(m_pMesh, sizeof(Mesh) * m_Header.meshCount, 1, file)) goto h3d_load_fail;
-    if (m_Header.materialCount > 0)
-        if (1 != fread(m_pMaterial, sizeof(Material) * m_Header.materialCount, 1, file)) goto h3d_load_fail;
+    // unversioned files only have 16-bit indices and garbage where the index format now lives
+    if (fileVersion < 1)
+    {
+        for (uint32_t meshIndex = 0; meshIndex < m_Header.meshCount; ++meshIndex)
+            m_pMesh[meshIndex].indexFormat = index_format_uint16;
+    }
 
     m_VertexStride = m_pMesh[0].vertexStride;
     m_VertexStrideDepth = m_pMesh[0].vertexStrideDepth;
@@ -47,6 +135,12 @@ bool Model::LoadH3D(const char *filename)
         ASSERT(mesh.vertexStrideDepth == m_VertexStrideDepth);
     }
     for (uint32_t meshIndex = 0; meshIndex < m_Header.meshCount; ++meshIndex)
+    {
+        const Mesh& mesh = m_pMesh[meshIndex];
+        ASSERT(mesh.indexFormat < index_formats);
+        ASSERT(mesh.indexDataByteOffset % GetIndexSize(mesh.indexFormat) == 0);
+    }
+    for (uint32_t meshIndex = 0; meshIndex < m_Header.meshCount; ++meshIndex)
     {
         const Mesh& mesh = m_pMesh[meshIndex];
 
@@ -64,45 +158,12 @@ bool Model::LoadH3D(const char *filename)
     }
 #endif
 
-    m_pVertexData = new unsigned char[ m_Header.vertexDataByteSize ];
-    m_pIndexData = new unsigned char[ m_Header.indexDataByteSize ];
-    m_pVertexDataDepth = new unsigned char[ m_Header.vertexDataByteSizeDepth ];
-    m_pIndexDataDepth = new unsigned char[ m_Header.indexDataByteSize ];
-
-    if (m_Header.vertexDataByteSize > 0)
-        if (1 != fread(m_pVertexData, m_Header.vertexDataByteSize, 1, file)) goto h3d_load_fail;
-    if (m_Header.indexDataByteSize > 0)
-        if (1 != fread(m_pIndexData, m_Header.indexDataByteSize, 1, file)) goto h3d_load_fail;
-
-    if (m_Header.vertexDataByteSizeDepth > 0)
-        if (1 != fread(m_pVertexDataDepth, m_Header.vertexDataByteSizeDepth, 1, file)) goto h3d_load_fail;
-    if (m_Header.indexDataByteSize > 0)
-        if (1 != fread(m_pIndexDataDepth, m_Header.indexDataByteSize, 1, file)) goto h3d_load_fail;
-
-    m_VertexBuffer.Create(L"VertexBuffer", m_Header.vertexDataByteSize / m_VertexStride, m_VertexStride, m_pVertexData);
-    m_IndexBuffer.Create(L"IndexBuffer", m_Header.indexDataByteSize / sizeof(uint16_t), sizeof(uint16_t), m_pIndexData);
-    delete [] m_pVertexData;
-    m_pVertexData = nullptr;
-    delete [] m_pIndexData;
-    m_pIndexData = nullptr;
-
-    m_VertexBufferDepth.Create(L"VertexBufferDepth", m_Header.vertexDataByteSizeDepth / m_VertexStrideDepth, m_VertexStrideDepth, m_pVertexDataDepth);
-    m_IndexBufferDepth.Create(L"IndexBufferDepth", m_Header.indexDataByteSize / sizeof(uint16_t), sizeof(uint16_t), m_pIndexDataDepth);
-    delete [] m_pVertexDataDepth;
-    m_pVertexDataDepth = nullptr;
-    delete [] m_pIndexDataDepth;
-    m_pIndexDataDepth = nullptr;
-
-    LoadTextures();
-
-    ok = true;
-
-h3d_load_fail:
-
-    if (EOF == fclose(file))
-        ok = false;
-
-    return ok;
+    blocks.vertexData = readBlock(m_Header.vertexDataByteSize);
+    blocks.indexData = readBlock(m_Header.indexDataByteSize);
+    blocks.vertexDataDepth = readBlock(m_Header.vertexDataByteSizeDepth);
+    blocks.indexDataDepth = readBlock(m_Header.indexDataByteSize);
+    return blocks.vertexData != nullptr && blocks.indexData != nullptr &&
+        blocks.vertexDataDepth != nullptr && blocks.indexDataDepth != nullptr;
 }
 
 bool Model::SaveH3D(const char *filename) const
@@ -113,6 +174,9 @@ bool Model::SaveH3D(const char *filename) const
 
     bool ok = false;
 
+    if (1 != fwrite(&kH3DFileTag, sizeof(kH3DFileTag), 1, file)) goto h3d_save_fail;
+    if (1 != fwrite(&kH3DFileVersion, sizeof(kH3DFileVersion), 1, file)) goto h3d_save_fail;
+
     if (1 != fwrite(&m_Header, sizeof(Header), 1, file)) goto h3d_save_fail;
 
     if (m_Header.meshCount > 0)
@@ -142,21 +206,12 @@ h3d_save_fail:
 
 void Model::ReleaseTextures()
 {
-    /*
-    if (m_Textures != nullptr)
-    {
-        for (uint32_t materialIdx = 0; materialIdx < m_Header.materialCount; ++materialIdx)
-        {
-            for (int n = 0; n < Material::texCount; n++)
-            {
-                if (m_Textures[materialIdx * Material::texCount + n])
-                    m_Textures[materialIdx * Material::texCount + n]->Release();
-                m_Textures[materialIdx * Material::texCount + n] = nullptr;
-            }
-        }
-        delete [] m_Textures;
-    }
-    */
+    for (const ManagedTexture* Texture : m_TextureReferences)
+        TextureManager::ReleaseTexture(Texture);
+    m_TextureReferences.clear();
+
+    delete [] m_SRVs;
+    m_SRVs = nullptr;
 }
 
 void Model::LoadTextures(void)
@@ -167,35 +222,39 @@ void Model::LoadTextures(void)
 
     const ManagedTexture* MatTextures[6] = {};
 
+    // Tries each path in turn, keeping a reference only to the texture that is used
+    auto LoadFirstValid = [this](std::initializer_list<std::string> Paths, bool sRGB) -> const ManagedTexture*
+    {
+        const ManagedTexture* Texture = nullptr;
+        for (const std::string& Path : Paths)
+        {
+            if (Texture != nullptr)
+                TextureManager::ReleaseTexture(Texture);
+            Texture = TextureManager::LoadFromFile(Path, sRGB);
+            if (Texture->IsValid())
+                break;
+        }
+        m_TextureReferences.push_back(Texture);
+        return Texture;
+    };
+
     for (uint32_t materialIdx = 0; materialIdx < m_Header.materialCount; ++materialIdx)
     {
         const Material& pMaterial = m_pMaterial[materialIdx];
 
         // Load diffuse
-        MatTextures[0] = TextureManager::LoadFromFile(pMaterial.texDiffusePath, true);
-        if (!MatTextures[0]->IsValid())
-            MatTextures[0] = TextureManager::LoadFromFile("default", true);
+        MatTextures[0] = LoadFirstValid({ pMaterial.texDiffusePath, "default" }, true);
 
         // Load specular
-        MatTextures[1] = TextureManager::LoadFromFile(pMaterial.texSpecularPath, true);
-        if (!MatTextures[1]->IsValid())
-        {
-            MatTextures[1] = TextureManager::LoadFromFile(std::string(pMaterial.texDiffusePath) + "_specular", true);
-            if (!MatTextures[1]->IsValid())
-                MatTextures[1] = TextureManager::LoadFromFile("default_specular", true);
-        }
+        MatTextures[1] = LoadFirstValid({ pMaterial.texSpecularPath,
+            std::string(pMaterial.texDiffusePath) + "_specular", "default_specular" }, true);
 
         // Load emissive
         //MatTextures[2] = TextureManager::LoadFromFile(pMaterial.texEmissivePath, true);
 
         // Load normal
-        MatTextures[3] = TextureManager::LoadFromFile(pMaterial.texNormalPath, false);
-        if (!MatTextures[3]->IsValid())
-        {
-            MatTextures[3] = TextureManager::LoadFromFile(std::string(pMaterial.texDiffusePath) + "_normal", false);
-            if (!MatTextures[3]->IsValid())
-                MatTextures[3] = TextureManager::LoadFromFile("default_normal", false);
-        }
+        MatTextures[3] = LoadFirstValid({ pMaterial.texNormalPath,
+            std::string(pMaterial.texDiffusePath) + "_normal", "default_normal" }, false);
 
         // Load lightmap
         //MatTextures[4] = TextureManager::LoadFromFile(pMaterial.texLightmapPath, true);
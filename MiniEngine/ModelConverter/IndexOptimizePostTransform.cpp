@@ -20,6 +20,8 @@
 #include <assert.h>
 #include <math.h>
 #include <algorithm>
+#include <limits>
+#include <vector>
 
 #include "IndexOptimizePostTransform.h"
 
@@ -70,8 +72,10 @@ namespace
 
         // Bonus points for having a low number of tris still to
         // use the vert, so we get rid of lone verts quickly.
-        float valenceBoost = powf ( static_cast<float>(numActiveFaces),
-            -FindVertexScore_ValenceBoostPower );
+        // x^-0.5 is the common case, keep powf out of the optimizer's inner loop
+        float valenceBoost = FindVertexScore_ValenceBoostPower == 0.5f
+            ? 1.0f / sqrtf ( static_cast<float>(numActiveFaces) )
+            : powf ( static_cast<float>(numActiveFaces), -FindVertexScore_ValenceBoostPower );
         score += FindVertexScore_ValenceBoostScale * valenceBoost;
 
         return score;
@@ -79,7 +83,7 @@ namespace
 
 
     enum {kMaxVertexCacheSize = 64};
-    enum {kMaxPrecomputedVertexValenceScores = 64};
+    enum {kMaxPrecomputedVertexValenceScores = 256};
     float s_vertexCacheScores[kMaxVertexCacheSize+1][kMaxVertexCacheSize];
     float s_vertexValenceScores[kMaxPrecomputedVertexValenceScores];
 
@@ -150,6 +154,26 @@ namespace
         IndexType  cachePos1;
         OptimizeVertexData() : score(0.f), activeFaceListStart(0), activeFaceListSize(0), cachePos0(0), cachePos1(0) { }
     };
+
+    // Working memory for OptimizeFaces. Kept per thread so optimizing many meshes, possibly
+    // in parallel, reuses the allocations of the previous mesh instead of making new ones.
+    template <typename IndexType>
+    struct OptimizeFacesScratch
+    {
+        std::vector<OptimizeVertexData<IndexType>> vertexDataList;
+        std::vector<IndexType> vertexRemap;
+        std::vector<uint32_t> activeFaceList;
+        std::vector<uint8_t> processedFaceList;
+        std::vector<unsigned int> faceSorted;
+        std::vector<unsigned int> faceReverseLookup;
+        std::vector<unsigned int> indexSorted;
+
+        static OptimizeFacesScratch& Get()
+        {
+            static thread_local OptimizeFacesScratch s_scratch;
+            return s_scratch;
+        }
+    };
 }
 
 template <typename T, typename IndexType>
@@ -222,21 +246,32 @@ struct FaceValenceSort
 template <typename IndexType>
 void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* newIndexList, uint16_t lruCacheSize)
 {
-    OptimizeVertexData<IndexType> *vertexDataList = new OptimizeVertexData<IndexType> [indexCount]; // upper bounds on size is indexCount
-    IndexType *vertexRemap = new IndexType [indexCount];
-    uint32_t *activeFaceList = new uint32_t [indexCount];
+    if (indexCount == 0)
+        return;
 
+    OptimizeFacesScratch<IndexType>& scratch = OptimizeFacesScratch<IndexType>::Get();
     uint32_t faceCount = indexCount / 3;
-    uint8_t *processedFaceList = new uint8_t [faceCount];
-    memset(processedFaceList, 0, sizeof(uint8_t) * faceCount);
-    unsigned int *faceSorted = new unsigned int [faceCount];
-    unsigned int *faceReverseLookup = new unsigned int [faceCount];
+
+    scratch.vertexDataList.assign(indexCount, OptimizeVertexData<IndexType>()); // upper bounds on size is indexCount
+    scratch.vertexRemap.resize(indexCount);
+    scratch.activeFaceList.resize(indexCount);
+    scratch.processedFaceList.assign(faceCount, 0);
+    scratch.faceSorted.resize(faceCount);
+    scratch.faceReverseLookup.resize(faceCount);
+    scratch.indexSorted.resize(indexCount);
+
+    OptimizeVertexData<IndexType> *vertexDataList = scratch.vertexDataList.data();
+    IndexType *vertexRemap = scratch.vertexRemap.data();
+    uint32_t *activeFaceList = scratch.activeFaceList.data();
+    uint8_t *processedFaceList = scratch.processedFaceList.data();
+    unsigned int *faceSorted = scratch.faceSorted.data();
+    unsigned int *faceReverseLookup = scratch.faceReverseLookup.data();
 
     // build the vertex remap table
     unsigned int uniqueVertexCount = 0;
     {
         typedef IndexSortCompareIndexed<unsigned int, IndexType> indexSorter;
-        unsigned int *indexSorted = new unsigned int [indexCount];
+        unsigned int *indexSorted = scratch.indexSorted.data();
 
         for (unsigned int i = 0; i < indexCount; i++)
         {
@@ -260,8 +295,6 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
                 vertexRemap[indexSorted[i]] = vertexRemap[indexSorted[i - 1]];
             }
         }
-
-        delete [] indexSorted;
     }
 
     // compute face count per vertex
@@ -453,11 +486,242 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
         std::swap(cache0, cache1);
         entriesInCache0 = std::min(entriesInCache1, lruCacheSize);
     }
+}
+
+//-----------------------------------------------------------------------------
+//  AnalyzeVertexCache
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+VertexCacheStatistics AnalyzeVertexCache(const IndexType* indexList, uint32_t indexCount, uint32_t cacheSize)
+{
+    VertexCacheStatistics stats = {};
+
+    uint32_t vertexCount = 0;
+    for (uint32_t i = 0; i < indexCount; ++i)
+    {
+        vertexCount = std::max(vertexCount, (uint32_t)indexList[i] + 1);
+    }
+
+    // a vertex is in the FIFO while fewer than cacheSize misses happened since it was loaded
+    std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+    uint32_t timestamp = cacheSize + 1;
 
-    delete [] vertexDataList;
-    delete [] vertexRemap;
-    delete [] activeFaceList;
-    delete [] processedFaceList;
-    delete [] faceSorted;
-    delete [] faceReverseLookup;
+    for (uint32_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t& vertexTimestamp = cacheTimestamps[indexList[i]];
+        if (vertexTimestamp == 0)
+        {
+            stats.uniqueVertexCount++;
+        }
+        if (timestamp - vertexTimestamp > cacheSize)
+        {
+            vertexTimestamp = timestamp++;
+            stats.transformedVertexCount++;
+        }
+    }
+
+    uint32_t faceCount = indexCount / 3;
+    stats.acmr = faceCount ? (float)stats.transformedVertexCount / faceCount : 0.0f;
+    stats.atvr = stats.uniqueVertexCount ? (float)stats.transformedVertexCount / stats.uniqueVertexCount : 0.0f;
+    return stats;
+}
+
+//-----------------------------------------------------------------------------
+//  AnalyzeVertexFetch
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+float AnalyzeVertexFetch(const IndexType* indexList, uint32_t indexCount, uint32_t vertexStride, uint32_t cacheSize)
+{
+    enum {kCacheLineSize = 64};
+    enum {kCacheLineCount = 64};
+
+    uint32_t vertexCount = 0;
+    for (uint32_t i = 0; i < indexCount; ++i)
+    {
+        vertexCount = std::max(vertexCount, (uint32_t)indexList[i] + 1);
+    }
+    if (vertexCount == 0)
+        return 0.0f;
+
+    // only vertices missing the post-transform cache are fetched, through a small cache of lines
+    std::vector<uint32_t> vertexTimestamps(vertexCount, 0);
+    uint32_t vertexTimestamp = cacheSize + 1;
+    std::vector<uint32_t> lineTimestamps(((uint64_t)vertexCount * vertexStride + kCacheLineSize - 1) / kCacheLineSize, 0);
+    uint32_t lineTimestamp = kCacheLineCount + 1;
+    std::vector<uint8_t> vertexUsed(vertexCount, 0);
+
+    uint64_t bytesFetched = 0;
+    uint64_t bytesUsed = 0;
+    for (uint32_t i = 0; i < indexCount; ++i)
+    {
+        IndexType index = indexList[i];
+        if (!vertexUsed[index])
+        {
+            vertexUsed[index] = 1;
+            bytesUsed += vertexStride;
+        }
+
+        if (vertexTimestamp - vertexTimestamps[index] <= cacheSize)
+            continue;
+        vertexTimestamps[index] = vertexTimestamp++;
+
+        uint64_t firstLine = (uint64_t)index * vertexStride / kCacheLineSize;
+        uint64_t lastLine = ((uint64_t)index * vertexStride + vertexStride - 1) / kCacheLineSize;
+        for (uint64_t line = firstLine; line <= lastLine; ++line)
+        {
+            if (lineTimestamp - lineTimestamps[line] > kCacheLineCount)
+            {
+                lineTimestamps[line] = lineTimestamp++;
+                bytesFetched += kCacheLineSize;
+            }
+        }
+    }
+
+    return (float)bytesFetched / (float)bytesUsed;
+}
+
+//-----------------------------------------------------------------------------
+//  OptimizeOverdraw
+//-----------------------------------------------------------------------------
+//  Cluster sorting from Sander, Nehab and Barczak, "Fast Triangle Reordering
+//  for Vertex Locality and Reduced Overdraw". The cache-optimized order is cut
+//  into clusters wherever the cache restarts, and again wherever the running
+//  ACMR of a cluster is within threshold of the ACMR of the whole cluster.
+//  Clusters are then drawn roughly front to back from every view by sorting
+//  them on how far they face away from the mesh center.
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+void OptimizeOverdraw(IndexType* indexList, uint32_t indexCount, const float* positions, uint32_t positionStride,
+    uint32_t cacheSize, float threshold)
+{
+    const uint32_t faceCount = indexCount / 3;
+    if (faceCount == 0)
+        return;
+
+    uint32_t vertexCount = 0;
+    for (uint32_t i = 0; i < indexCount; ++i)
+    {
+        vertexCount = std::max(vertexCount, (uint32_t)indexList[i] + 1);
+    }
+
+    // hard boundaries are faces where all three vertices miss the cache
+    std::vector<uint32_t> faceMisses(faceCount);
+    std::vector<uint32_t> clusters;
+    {
+        std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+        uint32_t timestamp = cacheSize + 1;
+        for (uint32_t f = 0; f < faceCount; ++f)
+        {
+            uint32_t misses = 0;
+            for (uint32_t v = 0; v < 3; ++v)
+            {
+                uint32_t& vertexTimestamp = cacheTimestamps[indexList[f * 3 + v]];
+                if (timestamp - vertexTimestamp > cacheSize)
+                {
+                    vertexTimestamp = timestamp++;
+                    misses++;
+                }
+            }
+            faceMisses[f] = misses;
+            if (f == 0 || misses == 3)
+                clusters.push_back(f);
+        }
+    }
+    clusters.push_back(faceCount);
+
+    // soft boundaries split hard clusters where locality is already good enough
+    std::vector<uint32_t> softClusters;
+    for (size_t c = 0; c + 1 < clusters.size(); ++c)
+    {
+        uint32_t start = clusters[c];
+        uint32_t end = clusters[c + 1];
+
+        uint32_t clusterMisses = 0;
+        for (uint32_t f = start; f < end; ++f)
+            clusterMisses += faceMisses[f];
+        float clusterAcmr = (float)clusterMisses / (end - start);
+
+        softClusters.push_back(start);
+        uint32_t runningMisses = 0;
+        uint32_t runningStart = start;
+        for (uint32_t f = start; f < end; ++f)
+        {
+            runningMisses += faceMisses[f];
+            if (f + 1 < end && (float)runningMisses / (f + 1 - runningStart) <= clusterAcmr * threshold)
+            {
+                softClusters.push_back(f + 1);
+                runningMisses = 0;
+                runningStart = f + 1;
+            }
+        }
+    }
+    softClusters.push_back(faceCount);
+
+    auto getPosition = [&](IndexType index) -> const float*
+    {
+        return (const float*)((const uint8_t*)positions + (size_t)index * positionStride);
+    };
+
+    // area weighted centroid of the whole mesh
+    float meshCenter[3] = {};
+    float meshArea = 0.0f;
+    const size_t clusterCount = softClusters.size() - 1;
+    std::vector<float> clusterCenters(clusterCount * 3, 0.0f);
+    std::vector<float> clusterNormals(clusterCount * 3, 0.0f);
+    std::vector<float> clusterAreas(clusterCount, 0.0f);
+    for (size_t c = 0; c < clusterCount; ++c)
+    {
+        for (uint32_t f = softClusters[c]; f < softClusters[c + 1]; ++f)
+        {
+            const float* p0 = getPosition(indexList[f * 3 + 0]);
+            const float* p1 = getPosition(indexList[f * 3 + 1]);
+            const float* p2 = getPosition(indexList[f * 3 + 2]);
+
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+            for (int k = 0; k < 3; ++k)
+            {
+                float faceCenter = (p0[k] + p1[k] + p2[k]) * (1.0f / 3.0f);
+                clusterCenters[c * 3 + k] += faceCenter * area;
+                clusterNormals[c * 3 + k] += n[k];
+                meshCenter[k] += faceCenter * area;
+            }
+            clusterAreas[c] += area;
+            meshArea += area;
+        }
+    }
+    for (int k = 0; k < 3; ++k)
+        meshCenter[k] = meshArea > 0.0f ? meshCenter[k] / meshArea : 0.0f;
+
+    std::vector<float> sortKeys(clusterCount);
+    std::vector<uint32_t> clusterOrder(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c)
+    {
+        const float* n = &clusterNormals[c * 3];
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        float key = 0.0f;
+        if (clusterAreas[c] > 0.0f && length > 0.0f)
+        {
+            for (int k = 0; k < 3; ++k)
+                key += (clusterCenters[c * 3 + k] / clusterAreas[c] - meshCenter[k]) * n[k];
+            key /= length;
+        }
+        sortKeys[c] = key;
+        clusterOrder[c] = (uint32_t)c;
+    }
+
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(),
+        [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<IndexType> sourceIndices(indexList, indexList + faceCount * 3);
+    IndexType* dst = indexList;
+    for (uint32_t c : clusterOrder)
+    {
+        const IndexType* begin = sourceIndices.data() + (size_t)softClusters[c] * 3;
+        const IndexType* end = sourceIndices.data() + (size_t)softClusters[c + 1] * 3;
+        dst = std::copy(begin, end, dst);
+    }
 }
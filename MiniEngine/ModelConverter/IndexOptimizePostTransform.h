@@ -32,3 +32,58 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
 
 template void OptimizeFaces<uint16_t>(const uint16_t* indexList, uint32_t indexCount, uint16_t* newIndexList, uint16_t lruCacheSize);
 template void OptimizeFaces<uint32_t>(const uint32_t* indexList, uint32_t indexCount, uint32_t* newIndexList, uint16_t lruCacheSize);
+
+struct VertexCacheStatistics
+{
+    uint32_t transformedVertexCount;
+    uint32_t uniqueVertexCount;
+    float acmr; // average cache miss ratio, transformed vertices per triangle (0.5 is ideal for a regular grid, 3 is worst)
+    float atvr; // average transformed vertex ratio, transformed vertices per unique vertex (1 is ideal)
+};
+
+//-----------------------------------------------------------------------------
+//  AnalyzeVertexCache
+//-----------------------------------------------------------------------------
+//  Simulates a FIFO post-transform cache of cacheSize entries over indexList
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+VertexCacheStatistics AnalyzeVertexCache(const IndexType* indexList, uint32_t indexCount, uint32_t cacheSize);
+
+template VertexCacheStatistics AnalyzeVertexCache<uint16_t>(const uint16_t* indexList, uint32_t indexCount, uint32_t cacheSize);
+template VertexCacheStatistics AnalyzeVertexCache<uint32_t>(const uint32_t* indexList, uint32_t indexCount, uint32_t cacheSize);
+
+//-----------------------------------------------------------------------------
+//  AnalyzeVertexFetch
+//-----------------------------------------------------------------------------
+//  Returns the vertex fetch overfetch ratio: bytes pulled through a small cache
+//  of 64 byte lines for post-transform cache misses, over the bytes of the
+//  referenced vertices (1 is ideal)
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+float AnalyzeVertexFetch(const IndexType* indexList, uint32_t indexCount, uint32_t vertexStride, uint32_t cacheSize);
+
+template float AnalyzeVertexFetch<uint16_t>(const uint16_t* indexList, uint32_t indexCount, uint32_t vertexStride, uint32_t cacheSize);
+template float AnalyzeVertexFetch<uint32_t>(const uint32_t* indexList, uint32_t indexCount, uint32_t vertexStride, uint32_t cacheSize);
+
+//-----------------------------------------------------------------------------
+//  OptimizeOverdraw
+//-----------------------------------------------------------------------------
+//  Reorders clusters of an index list already optimized by OptimizeFaces to
+//  reduce overdraw, in place.
+//  Parameters:
+//      positions, positionStride
+//          float3 vertex positions and the byte stride between them
+//      cacheSize
+//          the cache size that was passed to OptimizeFaces
+//      threshold
+//          how much worse than the vertex cache optimized order the result may
+//          get, e.g. 1.05 allows 5% higher ACMR
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+void OptimizeOverdraw(IndexType* indexList, uint32_t indexCount, const float* positions, uint32_t positionStride,
+    uint32_t cacheSize, float threshold);
+
+template void OptimizeOverdraw<uint16_t>(uint16_t* indexList, uint32_t indexCount, const float* positions, uint32_t positionStride,
+    uint32_t cacheSize, float threshold);
+template void OptimizeOverdraw<uint32_t>(uint32_t* indexList, uint32_t indexCount, const float* positions, uint32_t positionStride,
+    uint32_t cacheSize, float threshold);
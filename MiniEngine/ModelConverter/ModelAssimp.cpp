@@ -17,6 +17,23 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+template <typename IndexType>
+static void CopyFaceIndices(const aiMesh *srcMesh, IndexType *dstIndex, IndexType *dstIndexDepth)
+{
+    for (unsigned int f = 0; f < srcMesh->mNumFaces; f++)
+    {
+        assert(srcMesh->mFaces[f].mNumIndices == 3);
+
+        *dstIndex++ = (IndexType)srcMesh->mFaces[f].mIndices[0];
+        *dstIndex++ = (IndexType)srcMesh->mFaces[f].mIndices[1];
+        *dstIndex++ = (IndexType)srcMesh->mFaces[f].mIndices[2];
+
+        *dstIndexDepth++ = (IndexType)srcMesh->mFaces[f].mIndices[0];
+        *dstIndexDepth++ = (IndexType)srcMesh->mFaces[f].mIndices[1];
+        *dstIndexDepth++ = (IndexType)srcMesh->mFaces[f].mIndices[2];
+    }
+}
+
 const char* AssimpModel::s_FormatString[] =
 {
     "none",
@@ -95,9 +112,10 @@ bool AssimpModel::LoadAssimp(const char *filename)
     importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, 
         aiComponent_COLORS | aiComponent_LIGHTS | aiComponent_CAMERAS);
 
-    // max triangles and vertices per mesh, splits above this threshold
+    // max triangles and vertices per mesh, splits above this threshold. Meshes with more
+    // vertices than 16-bit indices can address are stored with 32-bit indices instead.
     importer.SetPropertyInteger(AI_CONFIG_PP_SLM_TRIANGLE_LIMIT, INT_MAX);
-    importer.SetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, 0xfffe); // avoid the primitive restart index
+    importer.SetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, INT_MAX);
 
     // remove points and lines
     importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
@@ -276,11 +294,16 @@ bool AssimpModel::LoadAssimp(const char *filename)
         dstMesh->vertexDataByteOffset = m_Header.vertexDataByteSize;
         dstMesh->vertexCount = srcMesh->mNumVertices;
 
+        // 0xffff is left out to avoid the primitive restart index
+        dstMesh->indexFormat = dstMesh->vertexCount > 0xffff ? index_format_uint32 : index_format_uint16;
+        uint32_t indexSize = GetIndexSize(dstMesh->indexFormat);
+        m_Header.indexDataByteSize = (m_Header.indexDataByteSize + indexSize - 1) & ~(indexSize - 1);
+
         dstMesh->indexDataByteOffset = m_Header.indexDataByteSize;
         dstMesh->indexCount = srcMesh->mNumFaces * 3;
 
         m_Header.vertexDataByteSize += dstMesh->vertexStride * dstMesh->vertexCount;
-        m_Header.indexDataByteSize += sizeof(uint16_t) * dstMesh->indexCount;
+        m_Header.indexDataByteSize += indexSize * dstMesh->indexCount;
 
         // depth-only rendering
         dstMesh->vertexDataByteOffsetDepth = m_Header.vertexDataByteSizeDepth;
@@ -293,6 +316,9 @@ bool AssimpModel::LoadAssimp(const char *filename)
     m_pIndexData = new unsigned char [m_Header.indexDataByteSize];
     m_pVertexDataDepth = new unsigned char [m_Header.vertexDataByteSizeDepth];
     m_pIndexDataDepth = new unsigned char [m_Header.indexDataByteSize];
+    // clear the alignment padding in front of 32-bit index data
+    memset(m_pIndexData, 0, m_Header.indexDataByteSize);
+    memset(m_pIndexDataDepth, 0, m_Header.indexDataByteSize);
     // second pass, fill in vertex and index data
     for (unsigned int meshIndex = 0; meshIndex < scene->mNumMeshes; meshIndex++)
     {
@@ -384,20 +410,12 @@ bool AssimpModel::LoadAssimp(const char *filename)
             dstBitangent = (float*)((unsigned char*)dstBitangent + dstMesh->vertexStride);
         }
 
-        uint16_t *dstIndex = (uint16_t*)(m_pIndexData + dstMesh->indexDataByteOffset);
-        uint16_t *dstIndexDepth = (uint16_t*)(m_pIndexDataDepth + dstMesh->indexDataByteOffset);
-        for (unsigned int f = 0; f < srcMesh->mNumFaces; f++)
-        {
-            assert(srcMesh->mFaces[f].mNumIndices == 3);
-
-            *dstIndex++ = srcMesh->mFaces[f].mIndices[0];
-            *dstIndex++ = srcMesh->mFaces[f].mIndices[1];
-            *dstIndex++ = srcMesh->mFaces[f].mIndices[2];
-
-            *dstIndexDepth++ = srcMesh->mFaces[f].mIndices[0];
-            *dstIndexDepth++ = srcMesh->mFaces[f].mIndices[1];
-            *dstIndexDepth++ = srcMesh->mFaces[f].mIndices[2];
-        }
+        unsigned char *dstIndex = m_pIndexData + dstMesh->indexDataByteOffset;
+        unsigned char *dstIndexDepth = m_pIndexDataDepth + dstMesh->indexDataByteOffset;
+        if (dstMesh->indexFormat == index_format_uint32)
+            CopyFaceIndices(srcMesh, (uint32_t*)dstIndex, (uint32_t*)dstIndexDepth);
+        else
+            CopyFaceIndices(srcMesh, (uint16_t*)dstIndex, (uint16_t*)dstIndexDepth);
     }
 
     ComputeAllBoundingBoxes();
@@ -17,6 +17,8 @@ class AssimpModel : public Model
 {
 public:
 
+    AssimpModel() : m_PositionWeldEpsilon(0.0f), m_OverdrawThreshold(0.0f) {}
+
     enum
     {
         format_none = 0,
@@ -30,6 +32,14 @@ public:
     virtual bool Load(const char* filename) override;
     bool Save(const char* filename) const;
 
+    // when non-zero, vertices whose positions fall in the same epsilon sized grid cell
+    // and whose other attributes match exactly are welded together
+    void SetPositionWeldEpsilon(float epsilon) { m_PositionWeldEpsilon = epsilon; }
+
+    // when non-zero, triangle clusters are reordered to reduce overdraw as long as the
+    // vertex cache miss ratio stays within this factor of the cache optimized order (e.g. 1.05)
+    void SetOverdrawThreshold(float threshold) { m_OverdrawThreshold = threshold; }
+
 private:
 
     bool LoadAssimp(const char *filename);
@@ -38,5 +48,8 @@ private:
     void OptimizeRemoveDuplicateVertices(bool depth);
     void OptimizePostTransform(bool depth);
     void OptimizePreTransform(bool depth);
+
+    float m_PositionWeldEpsilon;
+    float m_OverdrawThreshold;
 };
 
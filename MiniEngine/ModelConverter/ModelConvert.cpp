@@ -14,13 +14,15 @@
 #include "ModelAssimp.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void PrintHelp()
 {
     printf("model_convert\n");
 
     printf("usage:\n");
-    printf("model_convert input_file output_file\n");
+    printf("model_convert input_file output_file [-weld epsilon] [-overdraw threshold]\n");
 }
 
 void PrintModelStats(const Model *model)
@@ -70,7 +72,7 @@ void PrintModelStats(const Model *model)
 
         printf("mesh %u\n", meshIndex);
         printf("vertices: %u\n", mesh->vertexCount);
-        printf("indices: %u\n", mesh->indexCount);
+        printf("indices: %u (%s)\n", mesh->indexCount, mesh->indexFormat == Model::index_format_uint32 ? "uint32" : "uint16");
         printf("vertex stride: %u\n", mesh->vertexStride);
         for (int n = 0; n < Model::maxAttribs; n++)
         {
@@ -112,7 +114,7 @@ void PrintModelStats(const Model *model)
 
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    if (argc < 3 || (argc - 3) % 2 != 0)
     {
         PrintHelp();
         return -1;
@@ -126,6 +128,26 @@ int main(int argc, char **argv)
 
     AssimpModel model;
 
+    for (int arg = 3; arg < argc; arg += 2)
+    {
+        float value = (float)atof(argv[arg + 1]);
+        if (0 == strcmp(argv[arg], "-weld"))
+        {
+            printf("position weld epsilon %f\n", value);
+            model.SetPositionWeldEpsilon(value);
+        }
+        else if (0 == strcmp(argv[arg], "-overdraw"))
+        {
+            printf("overdraw threshold %f\n", value);
+            model.SetOverdrawThreshold(value);
+        }
+        else
+        {
+            PrintHelp();
+            return -1;
+        }
+    }
+
     printf("loading...\n");
     if (!model.Load(input_file))
     {
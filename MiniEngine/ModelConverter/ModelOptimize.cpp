@@ -15,72 +15,281 @@
 #include "IndexOptimizePostTransform.h"
 
 #include <string.h>
-
-void AssimpModel::OptimizeRemoveDuplicateVertices(bool depth)
+#include <cmath>
+#include <limits.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include <ppl.h>
+
+namespace
 {
-    unsigned char *deduplicatedVertexData = new unsigned char [depth ? m_Header.vertexDataByteSizeDepth : m_Header.vertexDataByteSize];
-    uint32_t deduplicatedVertexDataSize = 0;
-
-    for (unsigned int meshIndex = 0; meshIndex < m_Header.meshCount; meshIndex++)
+    inline uint64_t RotateLeft64(uint64_t x, int r)
     {
-        Mesh *mesh = m_pMesh + meshIndex;
-        unsigned int vertexStride = depth ? mesh->vertexStrideDepth : mesh->vertexStride;
-        unsigned char *meshVertexData = depth ? (m_pVertexDataDepth + mesh->vertexDataByteOffsetDepth) : (m_pVertexData + mesh->vertexDataByteOffset);
+        return (x << r) | (x >> (64 - r));
+    }
 
-        unsigned char *meshDeduplicatedVertexData = deduplicatedVertexData + deduplicatedVertexDataSize;
-        unsigned int deduplicatedCount = 0;
+    // 64-bit finalizer from MurmurHash3, gives full avalanche on the accumulated state
+    inline uint64_t HashFinalize64(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
 
-        unsigned int vertexCount = depth ? mesh->vertexCountDepth : mesh->vertexCount;
-        uint32_t *vertexRemap = new uint32_t [vertexCount];
-        memset(vertexRemap, (uint32_t)-1, sizeof(uint32_t) * vertexCount);
-        assert(vertexCount <= (uint32_t)-1);
+    // Hashes a vertex 8 bytes at a time, vertex strides are almost always a multiple of 4
+    uint64_t HashVertexBytes(const unsigned char *data, unsigned int size)
+    {
+        const uint64_t c1 = 0x87c37b91114253d5ull;
+        const uint64_t c2 = 0x4cf5ad432745937full;
 
-        for (unsigned int v1 = 0; v1 < vertexCount; v1++)
+        uint64_t h = size;
+        unsigned int n = 0;
+        for (; n + 8 <= size; n += 8)
+        {
+            uint64_t k;
+            memcpy(&k, data + n, 8);
+            h ^= RotateLeft64(k * c1, 31) * c2;
+            h = RotateLeft64(h, 27) * 5 + 0x52dce729;
+        }
+        if (n < size)
         {
-            if (vertexRemap[v1] != (uint32_t)-1)
-                continue; // this was already found to be a duplicate
+            uint64_t k = 0;
+            memcpy(&k, data + n, size - n);
+            h ^= RotateLeft64(k * c1, 31) * c2;
+        }
+        return HashFinalize64(h);
+    }
 
-            const unsigned char *v1Data = meshVertexData + v1 * vertexStride;
+    inline uint32_t NextPowerOfTwo(uint32_t x)
+    {
+        uint32_t p = 16;
+        while (p < x)
+            p <<= 1;
+        return p;
+    }
 
-            // this is a new unique vertex
-            uint32_t remappedSlot = deduplicatedCount++;
-            vertexRemap[v1] = remappedSlot;
-            memcpy(meshDeduplicatedVertexData + remappedSlot * vertexStride, v1Data, vertexStride);
+    // Builds a copy of the vertices where the position is replaced by the index of the
+    // epsilon sized grid cell it falls in. Vertices sharing a cell and all other attributes
+    // compare equal. Two positions closer than epsilon can still land in adjacent cells.
+    void QuantizePositions(const unsigned char *vertexData, unsigned int vertexCount, unsigned int vertexStride,
+        unsigned int positionOffset, float epsilon, std::vector<unsigned char> &keyData)
+    {
+        keyData.assign(vertexData, vertexData + (size_t)vertexCount * vertexStride);
 
-            // scan for duplicates
-            for (unsigned int v2 = v1 + 1; v2 < vertexCount; v2++)
+        const double invEpsilon = 1.0 / epsilon;
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            unsigned char *position = keyData.data() + (size_t)v * vertexStride + positionOffset;
+            for (int c = 0; c < 3; c++)
             {
-                if (vertexRemap[v2] != (uint32_t)-1)
-                    continue; // this was already found to be a duplicate of another vertex
+                float p;
+                memcpy(&p, position + c * sizeof(float), sizeof(float));
+
+                double cell = floor((double)p * invEpsilon + 0.5);
+                cell = cell < (double)INT_MIN ? (double)INT_MIN : (cell > (double)INT_MAX ? (double)INT_MAX : cell);
+                int32_t q = std::isnan(p) ? INT_MIN : (int32_t)cell;
+                memcpy(position + c * sizeof(float), &q, sizeof(q));
+            }
+        }
+    }
+
+    // Welds one mesh with an open addressing table keyed on the hash of the raw vertex
+    // bytes. The first occurrence of each vertex is kept and unique vertices stay in
+    // first-occurrence order, so the remap matches the old brute force search.
+    uint32_t DeduplicateMeshVertices(const unsigned char *vertexData, const unsigned char *keyData,
+        unsigned int vertexCount, unsigned int vertexStride,
+        unsigned char *dedupVertexData, uint32_t *vertexRemap)
+    {
+        struct Slot
+        {
+            uint32_t hashTag;
+            uint32_t vertex;
+        };
+        const uint32_t emptySlot = (uint32_t)-1;
+
+        const uint32_t tableSize = NextPowerOfTwo(vertexCount * 2);
+        const uint32_t tableMask = tableSize - 1;
+        std::vector<Slot> table(tableSize, Slot{ 0, emptySlot });
+
+        uint32_t dedupCount = 0;
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            const unsigned char *key = keyData + (size_t)v * vertexStride;
+            const uint64_t hash = HashVertexBytes(key, vertexStride);
+            const uint32_t hashTag = (uint32_t)(hash >> 32);
 
-                const unsigned char *v2Data = meshVertexData + v2 * vertexStride;
+            uint32_t slot = (uint32_t)hash & tableMask;
+            for (;;)
+            {
+                Slot &entry = table[slot];
+                if (entry.vertex == emptySlot)
+                {
+                    // this is a new unique vertex
+                    entry.hashTag = hashTag;
+                    entry.vertex = v;
+                    vertexRemap[v] = dedupCount;
+                    memcpy(dedupVertexData + (size_t)dedupCount * vertexStride, vertexData + (size_t)v * vertexStride, vertexStride);
+                    dedupCount++;
+                    break;
+                }
 
-                if (0 == memcmp(v1Data, v2Data, vertexStride))
+                if (entry.hashTag == hashTag &&
+                    0 == memcmp(key, keyData + (size_t)entry.vertex * vertexStride, vertexStride))
                 {
-                    vertexRemap[v2] = remappedSlot;
+                    vertexRemap[v] = vertexRemap[entry.vertex];
+                    break;
                 }
+
+                slot = (slot + 1) & tableMask;
             }
         }
+        return dedupCount;
+    }
 
-        unsigned int indexCount = mesh->indexCount;
-        uint16_t *indexArray = (uint16_t*)((depth ? m_pIndexDataDepth : m_pIndexData) + mesh->indexDataByteOffset);
+    template <typename IndexType>
+    void RemapIndices(IndexType *indexArray, unsigned int indexCount, const uint32_t *vertexRemap)
+    {
         for (unsigned int n = 0; n < indexCount; n++)
         {
-            indexArray[n] = vertexRemap[indexArray[n]];
+            indexArray[n] = (IndexType)vertexRemap[indexArray[n]];
         }
+    }
 
-        delete [] vertexRemap;
+    template <typename IndexType>
+    void OptimizeMeshFaces(IndexType *indexArray, unsigned int indexCount, uint16_t lruCacheSize)
+    {
+        IndexType *srcIndices = new IndexType [indexCount];
+        memcpy(srcIndices, indexArray, sizeof(IndexType) * indexCount);
+
+        OptimizeFaces<IndexType>(srcIndices, indexCount, indexArray, lruCacheSize);
+
+        delete [] srcIndices;
+    }
+
+    struct PostTransformReport
+    {
+        VertexCacheStatistics before;
+        VertexCacheStatistics after;
+        bool overdraw;
+        double milliseconds;
+    };
+
+    template <typename IndexType>
+    void OptimizeMeshPostTransform(IndexType *indexArray, unsigned int indexCount, uint16_t lruCacheSize,
+        uint16_t fifoCacheSize, const float *positions, unsigned int positionStride, float overdrawThreshold,
+        PostTransformReport &report)
+    {
+        report.before = AnalyzeVertexCache(indexArray, indexCount, fifoCacheSize);
+
+        OptimizeMeshFaces(indexArray, indexCount, lruCacheSize);
+
+        report.overdraw = positions != nullptr && overdrawThreshold > 0.0f;
+        if (report.overdraw)
+            OptimizeOverdraw(indexArray, indexCount, positions, positionStride, fifoCacheSize, overdrawThreshold);
+
+        report.after = AnalyzeVertexCache(indexArray, indexCount, fifoCacheSize);
+    }
+
+    template <typename IndexType>
+    void ReorderMeshVertices(IndexType *indexArray, unsigned int indexCount, const unsigned char *meshVertexData,
+        unsigned char *meshReorderedVertexData, unsigned int vertexStride, uint32_t *vertexRemap)
+    {
+        unsigned int reorderedCount = 0;
+        for (unsigned int n = 0; n < indexCount; n++)
+        {
+            IndexType index = indexArray[n];
+            if (vertexRemap[index] == (uint32_t)-1)
+            {
+                // not relocated yet
+                const unsigned char *vSrc = meshVertexData + (size_t)index * vertexStride;
+                unsigned char *vDst = meshReorderedVertexData + (size_t)reorderedCount * vertexStride;
+                memcpy(vDst, vSrc, vertexStride);
+
+                vertexRemap[index] = reorderedCount;
+                reorderedCount++;
+            }
+            indexArray[n] = (IndexType)vertexRemap[index];
+        }
+    }
+}
+
+void AssimpModel::OptimizeRemoveDuplicateVertices(bool depth)
+{
+    unsigned char *deduplicatedVertexData = new unsigned char [depth ? m_Header.vertexDataByteSizeDepth : m_Header.vertexDataByteSize];
+
+    struct MeshReport
+    {
+        uint32_t deduplicatedCount;
+        double milliseconds;
+    };
+    std::vector<MeshReport> reports(m_Header.meshCount);
+
+    // meshes are welded independently into the same offsets they had in the source data,
+    // which can only shrink, then packed together below
+    concurrency::parallel_for(0u, m_Header.meshCount, [&](unsigned int meshIndex)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        Mesh *mesh = m_pMesh + meshIndex;
+        unsigned int vertexStride = depth ? mesh->vertexStrideDepth : mesh->vertexStride;
+        unsigned int vertexDataByteOffset = depth ? mesh->vertexDataByteOffsetDepth : mesh->vertexDataByteOffset;
+        unsigned char *meshVertexData = (depth ? m_pVertexDataDepth : m_pVertexData) + vertexDataByteOffset;
+        const Attrib &position = (depth ? mesh->attribDepth : mesh->attrib)[attrib_position];
+
+        unsigned int vertexCount = depth ? mesh->vertexCountDepth : mesh->vertexCount;
+        std::vector<uint32_t> vertexRemap(vertexCount);
+
+        std::vector<unsigned char> keyData;
+        const unsigned char *meshKeyData = meshVertexData;
+        if (m_PositionWeldEpsilon > 0.0f &&
+            position.format == attrib_format_float && position.components == 3)
+        {
+            QuantizePositions(meshVertexData, vertexCount, vertexStride, position.offset, m_PositionWeldEpsilon, keyData);
+            meshKeyData = keyData.data();
+        }
+
+        uint32_t deduplicatedCount = DeduplicateMeshVertices(meshVertexData, meshKeyData, vertexCount, vertexStride,
+            deduplicatedVertexData + vertexDataByteOffset, vertexRemap.data());
+
+        unsigned char *indexData = (depth ? m_pIndexDataDepth : m_pIndexData) + mesh->indexDataByteOffset;
+        if (mesh->indexFormat == index_format_uint32)
+            RemapIndices((uint32_t*)indexData, mesh->indexCount, vertexRemap.data());
+        else
+            RemapIndices((uint16_t*)indexData, mesh->indexCount, vertexRemap.data());
+
+        reports[meshIndex].deduplicatedCount = deduplicatedCount;
+        reports[meshIndex].milliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - startTime).count();
+    });
+
+    uint32_t deduplicatedVertexDataSize = 0;
+    for (unsigned int meshIndex = 0; meshIndex < m_Header.meshCount; meshIndex++)
+    {
+        Mesh *mesh = m_pMesh + meshIndex;
+        unsigned int vertexStride = depth ? mesh->vertexStrideDepth : mesh->vertexStride;
+        unsigned int vertexCount = depth ? mesh->vertexCountDepth : mesh->vertexCount;
+        unsigned int &vertexDataByteOffset = depth ? mesh->vertexDataByteOffsetDepth : mesh->vertexDataByteOffset;
+        uint32_t deduplicatedCount = reports[meshIndex].deduplicatedCount;
+
+        printf("dedup mesh %u%s: %u -> %u vertices in %.3f ms\n", meshIndex, depth ? " (depth)" : "",
+            vertexCount, deduplicatedCount, reports[meshIndex].milliseconds);
+
+        memmove(deduplicatedVertexData + deduplicatedVertexDataSize, deduplicatedVertexData + vertexDataByteOffset,
+            deduplicatedCount * vertexStride);
 
         if (depth)
         {
             mesh->vertexCountDepth = deduplicatedCount;
-            mesh->vertexDataByteOffsetDepth = deduplicatedVertexDataSize;
         }
         else
         {
             mesh->vertexCount = deduplicatedCount;
-            mesh->vertexDataByteOffset = deduplicatedVertexDataSize;
         }
+        vertexDataByteOffset = deduplicatedVertexDataSize;
         deduplicatedVertexDataSize += deduplicatedCount * vertexStride;
     }
 
@@ -102,55 +311,82 @@ void AssimpModel::OptimizePostTransform(bool depth)
 {
     enum {lruCacheSize = 64};
 
-    for (unsigned int meshIndex = 0; meshIndex < m_Header.meshCount; meshIndex++)
+    // statistics and overdraw clustering use a FIFO cache closer to what hardware has
+    enum {fifoCacheSize = 16};
+
+    std::vector<PostTransformReport> reports(m_Header.meshCount);
+
+    concurrency::parallel_for(0u, m_Header.meshCount, [&](unsigned int meshIndex)
     {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
         Mesh *mesh = m_pMesh + meshIndex;
 
-        uint16_t *srcIndices = new uint16_t [mesh->indexCount];
-        uint16_t *dstIndices = (uint16_t*)((depth ? m_pIndexDataDepth : m_pIndexData) + mesh->indexDataByteOffset);
-        memcpy(srcIndices, dstIndices, sizeof(uint16_t) * mesh->indexCount);
+        const float *positions = nullptr;
+        unsigned int positionStride = depth ? mesh->vertexStrideDepth : mesh->vertexStride;
+        const Attrib &position = (depth ? mesh->attribDepth : mesh->attrib)[attrib_position];
+        if (position.format == attrib_format_float && position.components == 3)
+        {
+            positions = (const float *)((depth ? m_pVertexDataDepth + mesh->vertexDataByteOffsetDepth
+                : m_pVertexData + mesh->vertexDataByteOffset) + position.offset);
+        }
+
+        unsigned char *indexData = (depth ? m_pIndexDataDepth : m_pIndexData) + mesh->indexDataByteOffset;
+        if (mesh->indexFormat == index_format_uint32)
+            OptimizeMeshPostTransform((uint32_t*)indexData, mesh->indexCount, lruCacheSize, fifoCacheSize,
+                positions, positionStride, m_OverdrawThreshold, reports[meshIndex]);
+        else
+            OptimizeMeshPostTransform((uint16_t*)indexData, mesh->indexCount, lruCacheSize, fifoCacheSize,
+                positions, positionStride, m_OverdrawThreshold, reports[meshIndex]);
 
-        OptimizeFaces<uint16_t>(srcIndices, mesh->indexCount, dstIndices, lruCacheSize);
+        reports[meshIndex].milliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - startTime).count();
+    });
 
-        delete [] srcIndices;
+    for (unsigned int meshIndex = 0; meshIndex < m_Header.meshCount; meshIndex++)
+    {
+        const PostTransformReport &report = reports[meshIndex];
+        printf("post-transform mesh %u%s: acmr %.3f -> %.3f, atvr %.3f -> %.3f%s in %.3f ms\n",
+            meshIndex, depth ? " (depth)" : "",
+            report.before.acmr, report.after.acmr, report.before.atvr, report.after.atvr,
+            report.overdraw ? " (overdraw)" : "", report.milliseconds);
     }
 }
 
 void AssimpModel::OptimizePreTransform(bool depth)
 {
+    enum {fifoCacheSize = 16};
+
     unsigned char *reorderedVertexData = new unsigned char [depth ? m_Header.vertexDataByteSizeDepth : m_Header.vertexDataByteSize];
 
     for (unsigned int meshIndex = 0; meshIndex < m_Header.meshCount; meshIndex++)
     {
         Mesh *mesh = m_pMesh + meshIndex;
-        unsigned int indexCount = mesh->indexCount;
         unsigned int vertexStride = depth ? mesh->vertexStrideDepth : mesh->vertexStride;
         unsigned char *meshVertexData = depth ? (m_pVertexDataDepth + mesh->vertexDataByteOffsetDepth) : (m_pVertexData + mesh->vertexDataByteOffset);
 
         unsigned char *meshReorderedVertexData = reorderedVertexData + (depth ? mesh->vertexDataByteOffsetDepth : mesh->vertexDataByteOffset);
-        unsigned int reorderedCount = 0;
 
         unsigned int vertexCount = depth ? mesh->vertexCountDepth : mesh->vertexCount;
         uint32_t *vertexRemap = new uint32_t [vertexCount];
         memset(vertexRemap, (uint32_t)-1, sizeof(uint32_t) * vertexCount);
         assert(vertexCount <= (uint32_t)-1);
 
-        uint16_t *indexArray = (uint16_t*)((depth ? m_pIndexDataDepth : m_pIndexData) + mesh->indexDataByteOffset);
-        for (unsigned int n = 0; n < indexCount; n++)
-        {
-            uint16_t index = indexArray[n];
-            if (vertexRemap[index] == (uint32_t)-1)
-            {
-                // not relocated yet
-                const unsigned char *vSrc = meshVertexData + index * vertexStride;
-                unsigned char *vDst = meshReorderedVertexData + reorderedCount * vertexStride;
-                memcpy(vDst, vSrc, vertexStride);
+        unsigned char *indexData = (depth ? m_pIndexDataDepth : m_pIndexData) + mesh->indexDataByteOffset;
+        float overfetchBefore = mesh->indexFormat == index_format_uint32 ?
+            AnalyzeVertexFetch((const uint32_t*)indexData, mesh->indexCount, vertexStride, fifoCacheSize) :
+            AnalyzeVertexFetch((const uint16_t*)indexData, mesh->indexCount, vertexStride, fifoCacheSize);
 
-                vertexRemap[index] = reorderedCount;
-                reorderedCount++;
-            }
-            indexArray[n] = vertexRemap[index];
-        }
+        if (mesh->indexFormat == index_format_uint32)
+            ReorderMeshVertices((uint32_t*)indexData, mesh->indexCount, meshVertexData, meshReorderedVertexData, vertexStride, vertexRemap);
+        else
+            ReorderMeshVertices((uint16_t*)indexData, mesh->indexCount, meshVertexData, meshReorderedVertexData, vertexStride, vertexRemap);
+
+        float overfetch = mesh->indexFormat == index_format_uint32 ?
+            AnalyzeVertexFetch((const uint32_t*)indexData, mesh->indexCount, vertexStride, fifoCacheSize) :
+            AnalyzeVertexFetch((const uint16_t*)indexData, mesh->indexCount, vertexStride, fifoCacheSize);
+        printf("pre-transform mesh %u%s: vertex fetch overfetch %.3f -> %.3f\n", meshIndex, depth ? " (depth)" : "",
+            overfetchBefore, overfetch);
 
         delete [] vertexRemap;
     }
@@ -178,7 +414,7 @@ void AssimpModel::Optimize()
     OptimizePostTransform(false);
     OptimizePostTransform(true);
 
-    // re-order vertices for linear memory access
+    // re-order vertices in first use order for linear memory access during vertex fetch
     OptimizePreTransform(false);
     OptimizePreTransform(true);
 }
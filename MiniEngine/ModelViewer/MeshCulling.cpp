@@ -0,0 +1,434 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+
+#include "MeshCulling.h"
+#include "Model.h"
+#include "PipelineState.h"
+#include "RootSignature.h"
+#include "CommandContext.h"
+#include "CommandListManager.h"
+#include "GraphicsCore.h"
+#include "Camera.h"
+#include "BufferManager.h"
+#include "ReadbackBuffer.h"
+#include "EngineTuning.h"
+#include "EngineProfiling.h"
+
+#include "CompiledShaders/HiZDownsampleCS.h"
+
+using namespace Math;
+using namespace Graphics;
+
+namespace MeshCulling
+{
+    BoolVar FrustumCulling("Application/Culling/Frustum", true);
+    BoolVar OcclusionCulling("Application/Culling/Occlusion", false);
+
+    // Centers and half extents of four meshes' bounding boxes, one mesh per lane
+    struct BoundsBlock
+    {
+        XMVECTOR CenterX, CenterY, CenterZ;
+        XMVECTOR ExtentX, ExtentY, ExtentZ;
+    };
+
+    std::vector<BoundsBlock> s_Bounds;
+    std::vector<Vector3> s_BoxMin;
+    std::vector<Vector3> s_BoxMax;
+    uint32_t s_NumMeshes = 0;
+
+    enum { kHiZTileSize = 16, kNumReadbacks = 3 };
+
+    struct HiZReadback
+    {
+        ReadbackBuffer Buffer;
+        uint64_t FenceValue;            // Zero when there is nothing to read
+        Matrix4 ViewProjMatrix;
+        uint32_t DepthWidth, DepthHeight;
+    };
+
+    RootSignature s_HiZRootSig;
+    ComputePSO s_HiZDownsampleCS;
+    StructuredBuffer s_HiZBuffer;
+    HiZReadback s_Readbacks[kNumReadbacks];
+    HiZReadback* s_RecordedReadback = nullptr;
+    uint32_t s_NextReadback = 0;
+    uint32_t s_HiZCapacity = 0;
+
+    // The newest grid read back, followed by levels that halve it down to a single texel
+    std::vector<std::vector<float>> s_HiZLevels;
+    std::vector<uint32_t> s_LevelWidth;
+    std::vector<uint32_t> s_LevelHeight;
+    Matrix4 s_HiZViewProj;
+    uint32_t s_HiZDepthWidth = 0;
+    uint32_t s_HiZDepthHeight = 0;
+    bool s_ReverseZ = true;
+    bool s_HiZValid = false;
+
+    inline float Farther( float a, float b ) { return s_ReverseZ ? std::min(a, b) : std::max(a, b); }
+
+    void BuildHiZLevels( const float* Grid, uint32_t Width, uint32_t Height );
+    bool IsOccluded( Vector3 BoxMin, Vector3 BoxMax );
+}
+
+void MeshCulling::Initialize( const Model& model )
+{
+    s_NumMeshes = model.m_Header.meshCount;
+    s_Bounds.resize((s_NumMeshes + 3) / 4);
+    s_BoxMin.resize(s_NumMeshes);
+    s_BoxMax.resize(s_NumMeshes);
+
+    for (uint32_t Block = 0; Block < (uint32_t)s_Bounds.size(); ++Block)
+    {
+        __declspec(align(16)) float Center[3][4] = {};
+        __declspec(align(16)) float Extent[3][4] = {};
+
+        // Unused lanes of the last block are left empty and skipped when culling
+        for (uint32_t Lane = 0; Lane < 4 && Block * 4 + Lane < s_NumMeshes; ++Lane)
+        {
+            uint32_t MeshIndex = Block * 4 + Lane;
+            const Model::BoundingBox& Box = model.m_pMesh[MeshIndex].boundingBox;
+            s_BoxMin[MeshIndex] = Box.min;
+            s_BoxMax[MeshIndex] = Box.max;
+
+            XMFLOAT3 BoxCenter, BoxExtent;
+            XMStoreFloat3(&BoxCenter, (Box.min + Box.max) * 0.5f);
+            XMStoreFloat3(&BoxExtent, (Box.max - Box.min) * 0.5f);
+            Center[0][Lane] = BoxCenter.x;
+            Center[1][Lane] = BoxCenter.y;
+            Center[2][Lane] = BoxCenter.z;
+            Extent[0][Lane] = BoxExtent.x;
+            Extent[1][Lane] = BoxExtent.y;
+            Extent[2][Lane] = BoxExtent.z;
+        }
+
+        BoundsBlock& Bounds = s_Bounds[Block];
+        Bounds.CenterX = XMLoadFloat4A((const XMFLOAT4A*)Center[0]);
+        Bounds.CenterY = XMLoadFloat4A((const XMFLOAT4A*)Center[1]);
+        Bounds.CenterZ = XMLoadFloat4A((const XMFLOAT4A*)Center[2]);
+        Bounds.ExtentX = XMLoadFloat4A((const XMFLOAT4A*)Extent[0]);
+        Bounds.ExtentY = XMLoadFloat4A((const XMFLOAT4A*)Extent[1]);
+        Bounds.ExtentZ = XMLoadFloat4A((const XMFLOAT4A*)Extent[2]);
+    }
+
+    s_HiZRootSig.Reset(3, 0);
+    s_HiZRootSig[0].InitAsConstants(0, 4);
+    s_HiZRootSig[1].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 0, 1);
+    s_HiZRootSig[2].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 0, 1);
+    s_HiZRootSig.Finalize(L"HiZ Downsample");
+
+    s_HiZDownsampleCS.SetRootSignature(s_HiZRootSig);
+    s_HiZDownsampleCS.SetComputeShader(g_pHiZDownsampleCS, sizeof(g_pHiZDownsampleCS));
+    s_HiZDownsampleCS.Finalize();
+
+    for (uint32_t i = 0; i < kNumReadbacks; ++i)
+        s_Readbacks[i].FenceValue = 0;
+}
+
+void MeshCulling::Shutdown( void )
+{
+    s_HiZBuffer.Destroy();
+    for (uint32_t i = 0; i < kNumReadbacks; ++i)
+        s_Readbacks[i].Buffer.Destroy();
+    s_HiZCapacity = 0;
+}
+
+MeshCulling::CullingStats MeshCulling::CullMeshes( const Matrix4& ViewProjMat, bool TestOcclusion, std::vector<uint32_t>& DrawList )
+{
+    ScopedTimer _prof(L"Cull Meshes");
+
+    CullingStats Stats = { s_NumMeshes, 0, 0, 0 };
+    DrawList.clear();
+    DrawList.reserve(s_NumMeshes);
+
+    if (!FrustumCulling)
+    {
+        for (uint32_t i = 0; i < s_NumMeshes; ++i)
+            DrawList.push_back(i);
+        Stats.NumVisible = s_NumMeshes;
+        return Stats;
+    }
+
+    // Each clip plane of the combined matrix is a sum or difference of its columns (Gribb & Hartmann).  A box
+    // is outside a plane when the distance of its center plus its extent projected on the normal is negative,
+    // which holds for unnormalized planes too.
+    XMMATRIX Columns = XMMatrixTranspose(ViewProjMat);
+    XMVECTOR Planes[6] =
+    {
+        XMVectorAdd(Columns.r[3], Columns.r[0]),        // Left
+        XMVectorSubtract(Columns.r[3], Columns.r[0]),   // Right
+        XMVectorAdd(Columns.r[3], Columns.r[1]),        // Bottom
+        XMVectorSubtract(Columns.r[3], Columns.r[1]),   // Top
+        Columns.r[2],                                   // Z = 0
+        XMVectorSubtract(Columns.r[3], Columns.r[2]),   // Z = W
+    };
+
+    XMVECTOR NormalX[6], NormalY[6], NormalZ[6], AbsNormalX[6], AbsNormalY[6], AbsNormalZ[6], Offset[6];
+    for (int p = 0; p < 6; ++p)
+    {
+        NormalX[p] = XMVectorSplatX(Planes[p]);
+        NormalY[p] = XMVectorSplatY(Planes[p]);
+        NormalZ[p] = XMVectorSplatZ(Planes[p]);
+        Offset[p] = XMVectorSplatW(Planes[p]);
+        AbsNormalX[p] = XMVectorAbs(NormalX[p]);
+        AbsNormalY[p] = XMVectorAbs(NormalY[p]);
+        AbsNormalZ[p] = XMVectorAbs(NormalZ[p]);
+    }
+
+    bool UseHiZ = TestOcclusion && OcclusionCulling && s_HiZValid;
+
+    for (uint32_t Block = 0; Block < (uint32_t)s_Bounds.size(); ++Block)
+    {
+        const BoundsBlock& Bounds = s_Bounds[Block];
+        XMVECTOR Outside = XMVectorFalseInt();
+
+        for (int p = 0; p < 6; ++p)
+        {
+            XMVECTOR Distance = XMVectorMultiplyAdd(Bounds.CenterX, NormalX[p], Offset[p]);
+            Distance = XMVectorMultiplyAdd(Bounds.CenterY, NormalY[p], Distance);
+            Distance = XMVectorMultiplyAdd(Bounds.CenterZ, NormalZ[p], Distance);
+            Distance = XMVectorMultiplyAdd(Bounds.ExtentX, AbsNormalX[p], Distance);
+            Distance = XMVectorMultiplyAdd(Bounds.ExtentY, AbsNormalY[p], Distance);
+            Distance = XMVectorMultiplyAdd(Bounds.ExtentZ, AbsNormalZ[p], Distance);
+            Outside = XMVectorOrInt(Outside, XMVectorLess(Distance, XMVectorZero()));
+        }
+
+        __declspec(align(16)) uint32_t IsOutside[4];
+        XMStoreInt4A(IsOutside, Outside);
+
+        for (uint32_t Lane = 0; Lane < 4 && Block * 4 + Lane < s_NumMeshes; ++Lane)
+        {
+            uint32_t MeshIndex = Block * 4 + Lane;
+            if (IsOutside[Lane])
+                ++Stats.NumOutsideFrustum;
+            else if (UseHiZ && IsOccluded(s_BoxMin[MeshIndex], s_BoxMax[MeshIndex]))
+                ++Stats.NumOccluded;
+            else
+                DrawList.push_back(MeshIndex);
+        }
+    }
+
+    Stats.NumVisible = (uint32_t)DrawList.size();
+    return Stats;
+}
+
+bool MeshCulling::IsOccluded( Vector3 BoxMin, Vector3 BoxMax )
+{
+    // Find the screen rectangle and nearest depth of the box in the view the grid was made from
+    float MinX = FLT_MAX, MinY = FLT_MAX, MaxX = -FLT_MAX, MaxY = -FLT_MAX;
+    float NearestZ = s_ReverseZ ? 0.0f : 1.0f;
+
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        Vector3 Corner(
+            i & 1 ? BoxMax.GetX() : BoxMin.GetX(),
+            i & 2 ? BoxMax.GetY() : BoxMin.GetY(),
+            i & 4 ? BoxMax.GetZ() : BoxMin.GetZ());
+
+        XMFLOAT4 Clip;
+        XMStoreFloat4(&Clip, s_HiZViewProj * Corner);
+
+        // Boxes that reach behind the eye cover the whole screen
+        if (Clip.w <= 1e-5f)
+            return false;
+
+        float X = Clip.x / Clip.w;
+        float Y = Clip.y / Clip.w;
+        float Z = Clip.z / Clip.w;
+        MinX = std::min(MinX, X);
+        MaxX = std::max(MaxX, X);
+        MinY = std::min(MinY, Y);
+        MaxY = std::max(MaxY, Y);
+        NearestZ = s_ReverseZ ? std::max(NearestZ, Z) : std::min(NearestZ, Z);
+    }
+
+    // Nothing is known about boxes that were off screen in that view
+    if (MaxX < -1.0f || MinX > 1.0f || MaxY < -1.0f || MinY > 1.0f)
+        return false;
+
+    int32_t LastX = (int32_t)s_LevelWidth[0] - 1;
+    int32_t LastY = (int32_t)s_LevelHeight[0] - 1;
+    float TexelsPerUnitX = 0.5f * s_HiZDepthWidth / kHiZTileSize;
+    float TexelsPerUnitY = 0.5f * s_HiZDepthHeight / kHiZTileSize;
+
+    // The rectangle is clamped to the screen, so the texel coordinates are never negative
+    int32_t Left = std::min((int32_t)((std::max(MinX, -1.0f) + 1.0f) * TexelsPerUnitX), LastX);
+    int32_t Right = std::min((int32_t)((std::min(MaxX, 1.0f) + 1.0f) * TexelsPerUnitX), LastX);
+    int32_t Top = std::min((int32_t)((1.0f - std::min(MaxY, 1.0f)) * TexelsPerUnitY), LastY);
+    int32_t Bottom = std::min((int32_t)((1.0f - std::max(MinY, -1.0f)) * TexelsPerUnitY), LastY);
+
+    // Go up the hierarchy until the rectangle spans at most two texels each way
+    uint32_t Level = 0;
+    while ((Right - Left > 1 || Bottom - Top > 1) && Level + 1 < (uint32_t)s_HiZLevels.size())
+    {
+        Left >>= 1;
+        Right >>= 1;
+        Top >>= 1;
+        Bottom >>= 1;
+        ++Level;
+    }
+
+    const std::vector<float>& Texels = s_HiZLevels[Level];
+    uint32_t Width = s_LevelWidth[Level];
+
+    float FarthestZ = s_ReverseZ ? 1.0f : 0.0f;
+    for (int32_t y = Top; y <= Bottom; ++y)
+    {
+        for (int32_t x = Left; x <= Right; ++x)
+            FarthestZ = Farther(FarthestZ, Texels[y * Width + x]);
+    }
+
+    return s_ReverseZ ? NearestZ < FarthestZ : NearestZ > FarthestZ;
+}
+
+void MeshCulling::BuildHiZLevels( const float* Grid, uint32_t Width, uint32_t Height )
+{
+    s_HiZLevels.resize(1);
+    s_LevelWidth.assign(1, Width);
+    s_LevelHeight.assign(1, Height);
+    s_HiZLevels[0].assign(Grid, Grid + Width * Height);
+
+    while (Width > 1 || Height > 1)
+    {
+        uint32_t NextWidth = (Width + 1) / 2;
+        uint32_t NextHeight = (Height + 1) / 2;
+
+        s_HiZLevels.emplace_back(NextWidth * NextHeight);
+        const std::vector<float>& Src = s_HiZLevels[s_HiZLevels.size() - 2];
+        std::vector<float>& Dest = s_HiZLevels.back();
+
+        // Odd rows and columns fold into the last texel
+        for (uint32_t y = 0; y < NextHeight; ++y)
+        {
+            uint32_t y1 = std::min(y * 2 + 1, Height - 1);
+            for (uint32_t x = 0; x < NextWidth; ++x)
+            {
+                uint32_t x1 = std::min(x * 2 + 1, Width - 1);
+                float Depth = Farther(Src[y * 2 * Width + x * 2], Src[y * 2 * Width + x1]);
+                Depth = Farther(Depth, Farther(Src[y1 * Width + x * 2], Src[y1 * Width + x1]));
+                Dest[y * NextWidth + x] = Depth;
+            }
+        }
+
+        s_LevelWidth.push_back(NextWidth);
+        s_LevelHeight.push_back(NextHeight);
+        Width = NextWidth;
+        Height = NextHeight;
+    }
+}
+
+void MeshCulling::ReadHiZ( void )
+{
+    if (!OcclusionCulling)
+    {
+        s_HiZValid = false;
+        return;
+    }
+
+    HiZReadback* Newest = nullptr;
+    for (uint32_t i = 0; i < kNumReadbacks; ++i)
+    {
+        HiZReadback& Readback = s_Readbacks[i];
+        if (Readback.FenceValue == 0 || !g_CommandManager.IsFenceComplete(Readback.FenceValue))
+            continue;
+
+        if (Newest == nullptr || Readback.FenceValue > Newest->FenceValue)
+            Newest = &Readback;
+    }
+
+    if (Newest == nullptr)
+        return;
+
+    uint32_t Width = Math::DivideByMultiple(Newest->DepthWidth, kHiZTileSize);
+    uint32_t Height = Math::DivideByMultiple(Newest->DepthHeight, kHiZTileSize);
+
+    BuildHiZLevels((const float*)Newest->Buffer.Map(), Width, Height);
+    Newest->Buffer.Unmap();
+
+    s_HiZViewProj = Newest->ViewProjMatrix;
+    s_HiZDepthWidth = Newest->DepthWidth;
+    s_HiZDepthHeight = Newest->DepthHeight;
+    s_HiZValid = true;
+
+    // Older grids are of no further use
+    uint64_t NewestFence = Newest->FenceValue;
+    for (uint32_t i = 0; i < kNumReadbacks; ++i)
+    {
+        if (s_Readbacks[i].FenceValue <= NewestFence)
+            s_Readbacks[i].FenceValue = 0;
+    }
+}
+
+void MeshCulling::GenerateHiZ( GraphicsContext& gfxContext, const Camera& camera )
+{
+    if (!OcclusionCulling)
+        return;
+
+    // The GPU can't be more than a few frames behind, but don't overwrite a grid it is still writing
+    HiZReadback& Readback = s_Readbacks[s_NextReadback];
+    if (Readback.FenceValue != 0 && !g_CommandManager.IsFenceComplete(Readback.FenceValue))
+        return;
+
+    uint32_t DepthWidth = g_SceneDepthBuffer.GetWidth();
+    uint32_t DepthHeight = g_SceneDepthBuffer.GetHeight();
+    uint32_t Width = Math::DivideByMultiple(DepthWidth, kHiZTileSize);
+    uint32_t Height = Math::DivideByMultiple(DepthHeight, kHiZTileSize);
+
+    // The grid grows with the resolution, which rarely changes
+    if (Width * Height > s_HiZCapacity)
+    {
+        g_CommandManager.IdleGPU();
+        s_HiZCapacity = Width * Height;
+        s_HiZBuffer.Create(L"HiZ Grid", s_HiZCapacity, sizeof(float));
+        for (uint32_t i = 0; i < kNumReadbacks; ++i)
+        {
+            s_Readbacks[i].Buffer.Create(L"HiZ Readback", s_HiZCapacity, sizeof(float));
+            s_Readbacks[i].FenceValue = 0;
+        }
+    }
+
+    ScopedTimer _prof(L"Generate HiZ", gfxContext);
+
+    ComputeContext& Context = gfxContext.GetComputeContext();
+
+    s_ReverseZ = camera.GetClearDepth() == 0.0f;
+
+    Context.SetRootSignature(s_HiZRootSig);
+    Context.SetPipelineState(s_HiZDownsampleCS);
+    Context.TransitionResource(g_SceneDepthBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+    Context.TransitionResource(s_HiZBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, true);
+    Context.SetConstants(0, DepthWidth, DepthHeight, Width, s_ReverseZ ? 1u : 0u);
+    Context.SetDynamicDescriptor(1, 0, g_SceneDepthBuffer.GetDepthSRV());
+    Context.SetDynamicDescriptor(2, 0, s_HiZBuffer.GetUAV());
+    Context.Dispatch(Width, Height, 1);
+
+    Context.TransitionResource(s_HiZBuffer, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    Context.TransitionResource(Readback.Buffer, D3D12_RESOURCE_STATE_COPY_DEST, true);
+    Context.CopyBufferRegion(Readback.Buffer, 0, s_HiZBuffer, 0, Width * Height * sizeof(float));
+
+    // The fence is known once the frame is submitted
+    Readback.FenceValue = 0;
+    Readback.ViewProjMatrix = camera.GetViewProjMatrix();
+    Readback.DepthWidth = DepthWidth;
+    Readback.DepthHeight = DepthHeight;
+    s_RecordedReadback = &Readback;
+    s_NextReadback = (s_NextReadback + 1) % kNumReadbacks;
+}
+
+void MeshCulling::EndFrame( uint64_t FenceValue )
+{
+    if (s_RecordedReadback != nullptr)
+    {
+        s_RecordedReadback->FenceValue = FenceValue;
+        s_RecordedReadback = nullptr;
+    }
+}
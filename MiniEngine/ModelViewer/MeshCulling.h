@@ -0,0 +1,61 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// Culls the model's meshes against a view or shadow frustum, four bounding boxes at a time, and
+// optionally against a coarse depth grid from an earlier frame.  The grid is made on the GPU after
+// the depth prepass and read back a few frames later, so occlusion is tested in the view the grid
+// was made from.  A mesh that has just come into view can be missing for a frame or two.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class Model;
+class GraphicsContext;
+class BoolVar;
+namespace Math
+{
+    class Matrix4;
+    class Camera;
+}
+
+namespace MeshCulling
+{
+    extern BoolVar FrustumCulling;
+    extern BoolVar OcclusionCulling;
+
+    struct CullingStats
+    {
+        uint32_t NumMeshes;
+        uint32_t NumVisible;
+        uint32_t NumOutsideFrustum;
+        uint32_t NumOccluded;
+    };
+
+    void Initialize( const Model& model );
+    void Shutdown( void );
+
+    // Fills DrawList with the indices of the meshes that may be visible, in mesh order.  Occlusion is only
+    // tested when TestOcclusion is set, and only makes sense for the camera the depth grid is made for.
+    CullingStats CullMeshes( const Math::Matrix4& ViewProjMat, bool TestOcclusion, std::vector<uint32_t>& DrawList );
+
+    // Takes the newest depth grid the GPU has finished.  Call once per frame before culling.
+    void ReadHiZ( void );
+
+    // Reduces the scene depth buffer after the depth prepass and queues it for readback
+    void GenerateHiZ( GraphicsContext& gfxContext, const Math::Camera& camera );
+
+    // Pass the fence of the frame's last submission
+    void EndFrame( uint64_t FenceValue );
+}
@@ -32,7 +32,10 @@
 #include "ShadowCamera.h"
 #include "ParticleEffectManager.h"
 #include "GameInput.h"
+#include "ParallelCommandRecorder.h"
+#include "PSOCompiler.h"
 #include "./ForwardPlusLighting.h"
+#include "./MeshCulling.h"
 
 // To enable wave intrinsics, uncomment this macro and #define DXIL in Core/GraphcisCore.cpp.
 // Run CompileSM6Test.bat to compile the relevant shaders with DXC.
@@ -42,6 +45,8 @@
 #include "CompiledShaders/DepthViewerPS.h"
 #include "CompiledShaders/ModelViewerVS.h"
 #include "CompiledShaders/ModelViewerPS.h"
+#include "CompiledShaders/DepthViewerBindlessPS.h"
+#include "CompiledShaders/ModelViewerBindlessPS.h"
 #ifdef _WAVE_OP
 #include "CompiledShaders/DepthViewerVS_SM6.h"
 #include "CompiledShaders/ModelViewerVS_SM6.h"
@@ -64,14 +69,17 @@ public:
 
     virtual void Update( float deltaT ) override;
     virtual void RenderScene( void ) override;
+    virtual void RenderUI( class GraphicsContext& ) override;
 
 private:
 
     void RenderLightShadows(GraphicsContext& gfxContext);
 
     enum eObjectFilter { kOpaque = 0x1, kCutout = 0x2, kTransparent = 0x4, kAll = 0xF, kNone = 0x0 };
-    void RenderObjects( GraphicsContext& Context, const Matrix4& ViewProjMat, eObjectFilter Filter = kAll );
+    void RenderObjects( GraphicsContext& Context, const Matrix4& ViewProjMat, const std::vector<uint32_t>& DrawList,
+        eObjectFilter Filter = kAll, uint32_t First = 0, uint32_t Count = 0xFFFFFFFFul );
     void CreateParticleEffects();
+    bool AreBindlessPSOsReady();
     Camera m_Camera;
     std::auto_ptr<CameraController> m_CameraController;
     Matrix4 m_ViewProjMatrix;
@@ -79,17 +87,27 @@ private:
     D3D12_RECT m_MainScissor;
 
     RootSignature m_RootSig;
+    RootSignature m_BindlessRootSig;    // Only created with resource binding tier 2 or better
     GraphicsPSO m_DepthPSO;
     GraphicsPSO m_CutoutDepthPSO;
     GraphicsPSO m_ModelPSO;
-#ifdef _WAVE_OP
-    GraphicsPSO m_DepthWaveOpsPSO;
-    GraphicsPSO m_ModelWaveOpsPSO;
-#endif
     GraphicsPSO m_CutoutModelPSO;
     GraphicsPSO m_ShadowPSO;
     GraphicsPSO m_CutoutShadowPSO;
-    GraphicsPSO m_WaveTileCountPSO;
+
+    // Optional variants compile in the background.  Until they're ready, the PSOs above are used instead.
+#ifdef _WAVE_OP
+    PSOCompiler::Handle<GraphicsPSO> m_DepthWaveOpsPSO;
+    PSOCompiler::Handle<GraphicsPSO> m_ModelWaveOpsPSO;
+#endif
+    PSOCompiler::Handle<GraphicsPSO> m_WaveTileCountPSO;
+
+    // Variants that index material textures in the bindless heap, with m_BindlessRootSig.  They bind
+    // differently, so they are only used once all of them are ready.
+    PSOCompiler::Handle<GraphicsPSO> m_BindlessCutoutDepthPSO;
+    PSOCompiler::Handle<GraphicsPSO> m_BindlessModelPSO;
+    PSOCompiler::Handle<GraphicsPSO> m_BindlessCutoutModelPSO;
+    PSOCompiler::Handle<GraphicsPSO> m_BindlessCutoutShadowPSO;
 
     D3D12_CPU_DESCRIPTOR_HANDLE m_DefaultSampler;
     D3D12_CPU_DESCRIPTOR_HANDLE m_ShadowSampler;
@@ -98,6 +116,18 @@ private:
     D3D12_CPU_DESCRIPTOR_HANDLE m_ExtraTextures[6];
     Model m_Model;
     std::vector<bool> m_pMaterialIsCutout;
+    uint32_t m_MaterialTextureIndex;    // First of the model's material textures in the bindless heap
+
+    bool m_BindlessSupported;
+    bool m_UseBindless;                 // Latched at the start of each frame
+    uint64_t m_DescriptorsCopied;       // By the last frame
+    uint64_t m_LastDescriptorCopyCount;
+    uint32_t m_NumColorContexts;        // The color pass was recorded on this many command lists
+
+    // Meshes left to draw after culling, for the camera and each kind of shadow
+    enum eCullingPass { kMainView, kSunShadow, kLightShadow, kNumCullingPasses };
+    std::vector<uint32_t> m_DrawList[kNumCullingPasses];
+    MeshCulling::CullingStats m_CullingStats[kNumCullingPasses];
 
     Vector3 m_SunDirection;
     ShadowCamera m_SunShadow;
@@ -114,6 +144,8 @@ NumVar ShadowDimY("Application/Lighting/Shadow Dim Y", 3000, 1000, 10000, 100 );
 NumVar ShadowDimZ("Application/Lighting/Shadow Dim Z", 3000, 1000, 10000, 100 );
 
 BoolVar ShowWaveTileCounts("Application/Forward+/Show Wave Tile Counts", false);
+BoolVar UseBindlessMaterials("Application/Bindless Materials", false);
+BoolVar ParallelRecording("Application/Parallel Recording", false);
 #ifdef _WAVE_OP
 BoolVar EnableWaveOps("Application/Forward+/Enable Wave Ops", true);
 #endif
@@ -133,6 +165,23 @@ void ModelViewer::Startup( void )
     m_RootSig[4].InitAsConstants(1, 2, D3D12_SHADER_VISIBILITY_VERTEX);
     m_RootSig.Finalize(L"ModelViewer", D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
+    // The same layout plus an unbounded table over the bindless heap, which tier 1 hardware can't create
+    m_BindlessSupported = g_ResourceBindingTier >= D3D12_RESOURCE_BINDING_TIER_2;
+    if (m_BindlessSupported)
+    {
+        m_BindlessRootSig.Reset(6, 2);
+        m_BindlessRootSig.InitStaticSampler(0, DefaultSamplerDesc, D3D12_SHADER_VISIBILITY_PIXEL);
+        m_BindlessRootSig.InitStaticSampler(1, SamplerShadowDesc, D3D12_SHADER_VISIBILITY_PIXEL);
+        m_BindlessRootSig[0].InitAsConstantBuffer(0, D3D12_SHADER_VISIBILITY_VERTEX);
+        m_BindlessRootSig[1].InitAsConstantBuffer(0, D3D12_SHADER_VISIBILITY_PIXEL);
+        m_BindlessRootSig[2].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 0, 6, D3D12_SHADER_VISIBILITY_PIXEL);
+        m_BindlessRootSig[3].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 64, 6, D3D12_SHADER_VISIBILITY_PIXEL);
+        m_BindlessRootSig[4].InitAsConstants(1, 2);
+        m_BindlessRootSig[5].InitAsDescriptorTable(1, D3D12_SHADER_VISIBILITY_PIXEL);
+        m_BindlessRootSig[5].SetTableRange(0, D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 0, UINT_MAX, 1);
+        m_BindlessRootSig.Finalize(L"ModelViewer Bindless", D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+    }
+
     DXGI_FORMAT ColorFormat = g_SceneColorBuffer.GetFormat();
     DXGI_FORMAT DepthFormat = g_SceneDepthBuffer.GetFormat();
 
@@ -183,25 +232,48 @@ void ModelViewer::Startup( void )
     m_ModelPSO.SetPixelShader( g_pModelViewerPS, sizeof(g_pModelViewerPS) );
     m_ModelPSO.Finalize();
 
-#ifdef _WAVE_OP
-    m_DepthWaveOpsPSO = m_DepthPSO;
-    m_DepthWaveOpsPSO.SetVertexShader( g_pDepthViewerVS_SM6, sizeof(g_pDepthViewerVS_SM6) );
-    m_DepthWaveOpsPSO.Finalize();
-
-    m_ModelWaveOpsPSO = m_ModelPSO;
-    m_ModelWaveOpsPSO.SetVertexShader( g_pModelViewerVS_SM6, sizeof(g_pModelViewerVS_SM6) );
-    m_ModelWaveOpsPSO.SetPixelShader( g_pModelViewerPS_SM6, sizeof(g_pModelViewerPS_SM6) );
-    m_ModelWaveOpsPSO.Finalize();
-#endif
-
     m_CutoutModelPSO = m_ModelPSO;
     m_CutoutModelPSO.SetRasterizerState(RasterizerTwoSided);
     m_CutoutModelPSO.Finalize();
 
+#ifdef _WAVE_OP
+    GraphicsPSO DepthWaveOpsPSO = m_DepthPSO;
+    DepthWaveOpsPSO.SetVertexShader( g_pDepthViewerVS_SM6, sizeof(g_pDepthViewerVS_SM6) );
+    m_DepthWaveOpsPSO = PSOCompiler::Compile(DepthWaveOpsPSO);
+
+    GraphicsPSO ModelWaveOpsPSO = m_ModelPSO;
+    ModelWaveOpsPSO.SetVertexShader( g_pModelViewerVS_SM6, sizeof(g_pModelViewerVS_SM6) );
+    ModelWaveOpsPSO.SetPixelShader( g_pModelViewerPS_SM6, sizeof(g_pModelViewerPS_SM6) );
+    m_ModelWaveOpsPSO = PSOCompiler::Compile(ModelWaveOpsPSO);
+#endif
+
     // A debug shader for counting lights in a tile
-    m_WaveTileCountPSO = m_ModelPSO;
-    m_WaveTileCountPSO.SetPixelShader(g_pWaveTileCountPS, sizeof(g_pWaveTileCountPS));
-    m_WaveTileCountPSO.Finalize();
+    GraphicsPSO WaveTileCountPSO = m_ModelPSO;
+    WaveTileCountPSO.SetPixelShader(g_pWaveTileCountPS, sizeof(g_pWaveTileCountPS));
+    m_WaveTileCountPSO = PSOCompiler::Compile(WaveTileCountPSO);
+
+    if (m_BindlessSupported)
+    {
+        GraphicsPSO BindlessPSO = m_CutoutDepthPSO;
+        BindlessPSO.SetRootSignature(m_BindlessRootSig);
+        BindlessPSO.SetPixelShader(g_pDepthViewerBindlessPS, sizeof(g_pDepthViewerBindlessPS));
+        m_BindlessCutoutDepthPSO = PSOCompiler::Compile(BindlessPSO);
+
+        BindlessPSO = m_CutoutShadowPSO;
+        BindlessPSO.SetRootSignature(m_BindlessRootSig);
+        BindlessPSO.SetPixelShader(g_pDepthViewerBindlessPS, sizeof(g_pDepthViewerBindlessPS));
+        m_BindlessCutoutShadowPSO = PSOCompiler::Compile(BindlessPSO);
+
+        BindlessPSO = m_ModelPSO;
+        BindlessPSO.SetRootSignature(m_BindlessRootSig);
+        BindlessPSO.SetPixelShader(g_pModelViewerBindlessPS, sizeof(g_pModelViewerBindlessPS));
+        m_BindlessModelPSO = PSOCompiler::Compile(BindlessPSO);
+
+        BindlessPSO = m_CutoutModelPSO;
+        BindlessPSO.SetRootSignature(m_BindlessRootSig);
+        BindlessPSO.SetPixelShader(g_pModelViewerBindlessPS, sizeof(g_pModelViewerBindlessPS));
+        m_BindlessCutoutModelPSO = PSOCompiler::Compile(BindlessPSO);
+    }
 
     Lighting::InitializeResources();
 
@@ -212,6 +284,9 @@ void ModelViewer::Startup( void )
     ASSERT(m_Model.Load("Models/sponza.h3d"), "Failed to load model");
     ASSERT(m_Model.m_Header.meshCount > 0, "Model contains no meshes");
 
+    MeshCulling::Initialize(m_Model);
+    ZeroMemory(m_CullingStats, sizeof(m_CullingStats));
+
     // The caller of this function can override which materials are considered cutouts
     m_pMaterialIsCutout.resize(m_Model.m_Header.materialCount);
     for (uint32_t i = 0; i < m_Model.m_Header.materialCount; ++i)
@@ -229,6 +304,15 @@ void ModelViewer::Startup( void )
         }
     }
 
+    // Each material's six textures get stable, consecutive slots in the bindless heap
+    m_MaterialTextureIndex = g_BindlessDescriptorHeap.Register(m_Model.GetSRVs(0), m_Model.m_Header.materialCount * 6);
+
+    m_UseBindless = false;
+    m_DescriptorsCopied = 0;
+    m_NumColorContexts = 1;
+    m_LastDescriptorCopyCount = DynamicDescriptorHeap::GetNumDescriptorsCopied() +
+        g_BindlessDescriptorHeap.GetNumDescriptorsCopied();
+
     CreateParticleEffects();
 
     float modelRadius = Length(m_Model.m_Header.boundingBox.max - m_Model.m_Header.boundingBox.min) * .5f;
@@ -254,8 +338,11 @@ void ModelViewer::Startup( void )
 
 void ModelViewer::Cleanup( void )
 {
+    // The GPU is idle by now
+    g_BindlessDescriptorHeap.Free(m_MaterialTextureIndex, m_Model.m_Header.materialCount * 6);
     m_Model.Clear();
     Lighting::Shutdown();
+    MeshCulling::Shutdown();
 }
 
 namespace Graphics
@@ -302,7 +389,23 @@ void ModelViewer::Update( float deltaT )
     m_MainScissor.bottom = (LONG)g_SceneColorBuffer.GetHeight();
 }
 
-void ModelViewer::RenderObjects( GraphicsContext& gfxContext, const Matrix4& ViewProjMat, eObjectFilter Filter )
+bool ModelViewer::AreBindlessPSOsReady()
+{
+    if (!m_BindlessSupported)
+        return false;
+
+    // Asks for every one of them, so that any still queued are moved to the front
+    bool Ready = true;
+    for (const PSOCompiler::Handle<GraphicsPSO>* Handle :
+        { &m_BindlessCutoutDepthPSO, &m_BindlessModelPSO, &m_BindlessCutoutModelPSO, &m_BindlessCutoutShadowPSO })
+    {
+        Ready = Handle->TryGet() != nullptr && Ready;
+    }
+    return Ready;
+}
+
+void ModelViewer::RenderObjects( GraphicsContext& gfxContext, const Matrix4& ViewProjMat, const std::vector<uint32_t>& DrawList,
+    eObjectFilter Filter, uint32_t First, uint32_t Count )
 {
     struct VSConstants
     {
@@ -316,16 +419,29 @@ void ModelViewer::RenderObjects( GraphicsContext& gfxContext, const Matrix4& Vie
 
     gfxContext.SetDynamicConstantBufferView(0, sizeof(vsConstants), &vsConstants);
 
+    // Shaders index the material textures with the material in the root constants, so nothing is copied per draw
+    if (m_UseBindless)
+    {
+        gfxContext.SetDescriptorHeap(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, g_BindlessDescriptorHeap.GetHeapPointer());
+        gfxContext.SetDescriptorTable(5, g_BindlessDescriptorHeap.GetGpuHandle(m_MaterialTextureIndex));
+    }
+
     uint32_t materialIdx = 0xFFFFFFFFul;
 
     uint32_t VertexStride = m_Model.m_VertexStride;
 
-    for (uint32_t meshIndex = 0; meshIndex < m_Model.m_Header.meshCount; meshIndex++)
+    // meshes with 16-bit and 32-bit indices share one buffer, rebind only when the format changes
+    uint32_t indexFormat = 0xFFFFFFFFul;
+
+    uint32_t NumDraws = (uint32_t)DrawList.size();
+    uint32_t End = std::min(NumDraws, First + std::min(Count, NumDraws));
+
+    for (uint32_t drawIndex = First; drawIndex < End; drawIndex++)
     {
-        const Model::Mesh& mesh = m_Model.m_pMesh[meshIndex];
+        const Model::Mesh& mesh = m_Model.m_pMesh[DrawList[drawIndex]];
 
         uint32_t indexCount = mesh.indexCount;
-        uint32_t startIndex = mesh.indexDataByteOffset / sizeof(uint16_t);
+        uint32_t startIndex = mesh.indexDataByteOffset / Model::GetIndexSize(mesh.indexFormat);
         uint32_t baseVertex = mesh.vertexDataByteOffset / VertexStride;
 
         if (mesh.materialIndex != materialIdx)
@@ -335,7 +451,16 @@ void ModelViewer::RenderObjects( GraphicsContext& gfxContext, const Matrix4& Vie
                 continue;
 
             materialIdx = mesh.materialIndex;
-            gfxContext.SetDynamicDescriptors(2, 0, 6, m_Model.GetSRVs(materialIdx) );
+            if (!m_UseBindless)
+                gfxContext.SetDynamicDescriptors(2, 0, 6, m_Model.GetSRVs(materialIdx) );
+        }
+
+        if (mesh.indexFormat != indexFormat)
+        {
+            indexFormat = mesh.indexFormat;
+            const ByteAddressBuffer& indexBuffer = m_Model.m_IndexBuffer;
+            gfxContext.SetIndexBuffer(indexBuffer.IndexBufferView(0, (uint32_t)indexBuffer.GetBufferSize(),
+                indexFormat == Model::index_format_uint32));
         }
 
         gfxContext.SetConstants(4, baseVertex, materialIdx);
@@ -352,23 +477,32 @@ void ModelViewer::RenderLightShadows(GraphicsContext& gfxContext)
 
     static uint32_t LightIndex = 0;
     if (LightIndex >= MaxLights)
+    {
+        ZeroMemory(&m_CullingStats[kLightShadow], sizeof(MeshCulling::CullingStats));
         return;
+    }
+
+    const std::vector<uint32_t>& DrawList = m_DrawList[kLightShadow];
+    m_CullingStats[kLightShadow] = MeshCulling::CullMeshes(m_LightShadowMatrix[LightIndex], false, m_DrawList[kLightShadow]);
 
     m_LightShadowTempBuffer.BeginRendering(gfxContext);
     {
         gfxContext.SetPipelineState(m_ShadowPSO);
-        RenderObjects(gfxContext, m_LightShadowMatrix[LightIndex], kOpaque);
-        gfxContext.SetPipelineState(m_CutoutShadowPSO);
-        RenderObjects(gfxContext, m_LightShadowMatrix[LightIndex], kCutout);
+        RenderObjects(gfxContext, m_LightShadowMatrix[LightIndex], DrawList, kOpaque);
+        gfxContext.SetPipelineState(m_UseBindless ? m_BindlessCutoutShadowPSO.Wait() : m_CutoutShadowPSO);
+        RenderObjects(gfxContext, m_LightShadowMatrix[LightIndex], DrawList, kCutout);
     }
     m_LightShadowTempBuffer.EndRendering(gfxContext);
 
+    // Only the slice being replaced leaves the shader resource state
     gfxContext.TransitionResource(m_LightShadowTempBuffer, D3D12_RESOURCE_STATE_GENERIC_READ);
-    gfxContext.TransitionResource(m_LightShadowArray, D3D12_RESOURCE_STATE_COPY_DEST);
+    gfxContext.TransitionSubresource(m_LightShadowArray, LightIndex, D3D12_RESOURCE_STATE_COPY_DEST);
 
     gfxContext.CopySubresource(m_LightShadowArray, LightIndex, m_LightShadowTempBuffer, 0);
 
-    gfxContext.TransitionResource(m_LightShadowArray, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+    // Nothing reads the array until the color pass, so let the transition overlap the depth prepass, SSAO,
+    // and light culling
+    gfxContext.BeginResourceTransition(m_LightShadowArray, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 
     ++LightIndex;
 }
@@ -391,6 +525,22 @@ void ModelViewer::RenderScene( void )
         s_ShowLightCounts = ShowWaveTileCounts;
     }
 
+    // Everything copied since the last frame started, including by post effects and the UI
+    uint64_t DescriptorCopyCount = DynamicDescriptorHeap::GetNumDescriptorsCopied() +
+        g_BindlessDescriptorHeap.GetNumDescriptorsCopied();
+    m_DescriptorsCopied = DescriptorCopyCount - m_LastDescriptorCopyCount;
+    m_LastDescriptorCopyCount = DescriptorCopyCount;
+
+#ifdef _WAVE_OP
+    // The wave op shaders only read material textures from descriptor tables
+    m_UseBindless = m_BindlessSupported && UseBindlessMaterials && !EnableWaveOps && AreBindlessPSOsReady();
+#else
+    m_UseBindless = m_BindlessSupported && UseBindlessMaterials && AreBindlessPSOsReady();
+#endif
+
+    MeshCulling::ReadHiZ();
+    m_CullingStats[kMainView] = MeshCulling::CullMeshes(m_ViewProjMatrix, true, m_DrawList[kMainView]);
+
     GraphicsContext& gfxContext = GraphicsContext::Begin(L"Scene Render");
 
     ParticleEffects::Update(gfxContext.GetComputeContext(), Graphics::GetFrameTime());
@@ -423,15 +573,15 @@ void ModelViewer::RenderScene( void )
     psConstants.FrameIndexMod2 = FrameIndex;
 
     // Set the default state for command lists
-    auto pfnSetupGraphicsState = [&](void)
+    auto pfnSetupGraphicsState = [&](GraphicsContext& Context)
     {
-        gfxContext.SetRootSignature(m_RootSig);
-        gfxContext.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-        gfxContext.SetIndexBuffer(m_Model.m_IndexBuffer.IndexBufferView());
-        gfxContext.SetVertexBuffer(0, m_Model.m_VertexBuffer.VertexBufferView());
+        Context.SetRootSignature(m_UseBindless ? m_BindlessRootSig : m_RootSig);
+        Context.SetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        Context.SetIndexBuffer(m_Model.m_IndexBuffer.IndexBufferView());
+        Context.SetVertexBuffer(0, m_Model.m_VertexBuffer.VertexBufferView());
     };
 
-    pfnSetupGraphicsState();
+    pfnSetupGraphicsState(gfxContext);
 
     RenderLightShadows(gfxContext);
 
@@ -446,22 +596,24 @@ void ModelViewer::RenderScene( void )
             gfxContext.ClearDepth(g_SceneDepthBuffer);
 
 #ifdef _WAVE_OP
-            gfxContext.SetPipelineState(EnableWaveOps ? m_DepthWaveOpsPSO : m_DepthPSO );
+            gfxContext.SetPipelineState(EnableWaveOps ? m_DepthWaveOpsPSO.Get(m_DepthPSO) : m_DepthPSO );
 #else
             gfxContext.SetPipelineState(m_DepthPSO);
 #endif
             gfxContext.SetDepthStencilTarget(g_SceneDepthBuffer.GetDSV());
             gfxContext.SetViewportAndScissor(m_MainViewport, m_MainScissor);
-            RenderObjects(gfxContext, m_ViewProjMatrix, kOpaque );
+            RenderObjects(gfxContext, m_ViewProjMatrix, m_DrawList[kMainView], kOpaque );
         }
 
         {
             ScopedTimer _prof2(L"Cutout", gfxContext);
-            gfxContext.SetPipelineState(m_CutoutDepthPSO);
-            RenderObjects(gfxContext, m_ViewProjMatrix, kCutout );
+            gfxContext.SetPipelineState(m_UseBindless ? m_BindlessCutoutDepthPSO.Wait() : m_CutoutDepthPSO);
+            RenderObjects(gfxContext, m_ViewProjMatrix, m_DrawList[kMainView], kCutout );
         }
     }
 
+    MeshCulling::GenerateHiZ(gfxContext, m_Camera);
+
     SSAO::Render(gfxContext, m_Camera);
 
     Lighting::FillLightGrid(gfxContext, m_Camera);
@@ -473,7 +625,7 @@ void ModelViewer::RenderScene( void )
         gfxContext.TransitionResource(g_SceneColorBuffer, D3D12_RESOURCE_STATE_RENDER_TARGET, true);
         gfxContext.ClearColor(g_SceneColorBuffer);
 
-        pfnSetupGraphicsState();
+        pfnSetupGraphicsState(gfxContext);
 
         {
             ScopedTimer _prof3(L"Render Shadow Map", gfxContext);
@@ -481,18 +633,20 @@ void ModelViewer::RenderScene( void )
             m_SunShadow.UpdateMatrix(-m_SunDirection, Vector3(0, -500.0f, 0), Vector3(ShadowDimX, ShadowDimY, ShadowDimZ),
                 (uint32_t)g_ShadowBuffer.GetWidth(), (uint32_t)g_ShadowBuffer.GetHeight(), 16);
 
+            m_CullingStats[kSunShadow] = MeshCulling::CullMeshes(m_SunShadow.GetViewProjMatrix(), false, m_DrawList[kSunShadow]);
+
             g_ShadowBuffer.BeginRendering(gfxContext);
             gfxContext.SetPipelineState(m_ShadowPSO);
-            RenderObjects(gfxContext, m_SunShadow.GetViewProjMatrix(), kOpaque);
-            gfxContext.SetPipelineState(m_CutoutShadowPSO);
-            RenderObjects(gfxContext, m_SunShadow.GetViewProjMatrix(), kCutout);
+            RenderObjects(gfxContext, m_SunShadow.GetViewProjMatrix(), m_DrawList[kSunShadow], kOpaque);
+            gfxContext.SetPipelineState(m_UseBindless ? m_BindlessCutoutShadowPSO.Wait() : m_CutoutShadowPSO);
+            RenderObjects(gfxContext, m_SunShadow.GetViewProjMatrix(), m_DrawList[kSunShadow], kCutout);
             g_ShadowBuffer.EndRendering(gfxContext);
         }
 
         if (SSAO::AsyncCompute)
         {
             gfxContext.Flush();
-            pfnSetupGraphicsState();
+            pfnSetupGraphicsState(gfxContext);
 
             // Make the 3D queue wait for the Compute queue to finish SSAO
             g_CommandManager.GetGraphicsQueue().StallForProducer(g_CommandManager.GetComputeQueue());
@@ -502,25 +656,40 @@ void ModelViewer::RenderScene( void )
             ScopedTimer _prof4(L"Render Color", gfxContext);
 
             gfxContext.TransitionResource(g_SSAOFullScreen, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+            gfxContext.TransitionResource(g_SceneDepthBuffer, D3D12_RESOURCE_STATE_DEPTH_READ);
+            gfxContext.TransitionResource(Lighting::m_LightShadowArray, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 
-            gfxContext.SetDynamicDescriptors(3, 0, _countof(m_ExtraTextures), m_ExtraTextures);
-            gfxContext.SetDynamicConstantBufferView(1, sizeof(psConstants), &psConstants);
+            // Meshes can be drawn in any order, so slices of them may be recorded on separate command lists
+            auto pfnSetupColorPass = [&](GraphicsContext& Context)
+            {
+                pfnSetupGraphicsState(Context);
+                Context.SetDynamicDescriptors(3, 0, _countof(m_ExtraTextures), m_ExtraTextures);
+                Context.SetDynamicConstantBufferView(1, sizeof(psConstants), &psConstants);
+                Context.SetRenderTarget(g_SceneColorBuffer.GetRTV(), g_SceneDepthBuffer.GetDSV_DepthReadOnly());
+                Context.SetViewportAndScissor(m_MainViewport, m_MainScissor);
+            };
+
+            auto pfnRenderColor = [&](GraphicsContext& Context, uint32_t First, uint32_t Count)
+            {
 #ifdef _WAVE_OP
-            gfxContext.SetPipelineState(EnableWaveOps ? m_ModelWaveOpsPSO : m_ModelPSO );
+                Context.SetPipelineState(EnableWaveOps ? m_ModelWaveOpsPSO.Get(m_ModelPSO) : m_UseBindless ? m_BindlessModelPSO.Wait() : m_ModelPSO );
 #else
-            gfxContext.SetPipelineState(ShowWaveTileCounts ? m_WaveTileCountPSO : m_ModelPSO);
+                if (ShowWaveTileCounts)
+                    Context.SetPipelineState(m_WaveTileCountPSO.Get(m_ModelPSO));
+                else
+                    Context.SetPipelineState(m_UseBindless ? m_BindlessModelPSO.Wait() : m_ModelPSO);
 #endif
-            gfxContext.TransitionResource(g_SceneDepthBuffer, D3D12_RESOURCE_STATE_DEPTH_READ);
-            gfxContext.SetRenderTarget(g_SceneColorBuffer.GetRTV(), g_SceneDepthBuffer.GetDSV_DepthReadOnly());
-            gfxContext.SetViewportAndScissor(m_MainViewport, m_MainScissor);
+                RenderObjects( Context, m_ViewProjMatrix, m_DrawList[kMainView], kOpaque, First, Count );
 
-            RenderObjects( gfxContext, m_ViewProjMatrix, kOpaque );
+                if (!ShowWaveTileCounts)
+                {
+                    Context.SetPipelineState(m_UseBindless ? m_BindlessCutoutModelPSO.Wait() : m_CutoutModelPSO);
+                    RenderObjects( Context, m_ViewProjMatrix, m_DrawList[kMainView], kCutout, First, Count );
+                }
+            };
 
-            if (!ShowWaveTileCounts)
-            {
-                gfxContext.SetPipelineState(m_CutoutModelPSO);
-                RenderObjects( gfxContext, m_ViewProjMatrix, kCutout );
-            }
+            m_NumColorContexts = ParallelCommandRecorder::Record(gfxContext, (uint32_t)m_DrawList[kMainView].size(),
+                pfnSetupColorPass, pfnRenderColor, ParallelRecording ? 0 : 1);
         }
 
     }
@@ -540,7 +709,40 @@ void ModelViewer::RenderScene( void )
     else
         MotionBlur::RenderObjectBlur(gfxContext, g_VelocityBuffer);
 
-    gfxContext.Finish();
+    MeshCulling::EndFrame(gfxContext.Finish());
+}
+
+void ModelViewer::RenderUI( class GraphicsContext& gfxContext )
+{
+    TextContext Text(gfxContext);
+    Text.Begin();
+    Text.ResetCursor(1400.0f, 10.0f);
+    Text.DrawFormattedString("%s materials:  %llu descriptors copied per frame\n",
+        m_UseBindless ? "Bindless" : "Dynamic", m_DescriptorsCopied);
+    Text.DrawFormattedString("Color pass:  recorded on %u command lists\n", m_NumColorContexts);
+
+    static const char* s_CullingPassNames[kNumCullingPasses] = { "Main view", "Sun shadow", "Light shadow" };
+    for (uint32_t i = 0; i < kNumCullingPasses; ++i)
+    {
+        const MeshCulling::CullingStats& Stats = m_CullingStats[i];
+        Text.DrawFormattedString("%s:  %u of %u meshes drawn, %u outside frustum, %u occluded\n", s_CullingPassNames[i],
+            Stats.NumVisible, Stats.NumMeshes, Stats.NumOutsideFrustum, Stats.NumOccluded);
+    }
+
+    LinearAllocatorStats Upload = LinearAllocator::GetStats(kCpuWritable);
+    Text.DrawFormattedString("Upload pages:  %u live, %u retired, %u created, %u large reused\n",
+        Upload.PagesLive, Upload.PagesRetired, Upload.PagesCreated + Upload.LargePagesCreated, Upload.LargePagesReused);
+    Text.DrawFormattedString("Upload bytes:  %llu KB allocated, %llu KB wasted to alignment\n",
+        Upload.BytesAllocated / 1024, Upload.BytesWastedToAlignment / 1024);
+
+    ResourceBarrierStats Barriers = ResourceStateTracker::GetStats();
+    Text.DrawFormattedString("Barriers:  %u transitions, %u split, %u UAV, %u in %u calls\n",
+        Barriers.Transitions, Barriers.SplitBegins, Barriers.UAVBarriers,
+        Barriers.Transitions + Barriers.SplitBegins + Barriers.SplitEnds + Barriers.UAVBarriers + Barriers.AliasingBarriers + Barriers.SubmitFixups,
+        Barriers.BarrierCalls);
+    Text.DrawFormattedString("Barriers avoided:  %u merged, %u skipped;  %u submit fixups\n",
+        Barriers.Merged, Barriers.Skipped, Barriers.SubmitFixups);
+    Text.End();
 }
 
 void ModelViewer::CreateParticleEffects()
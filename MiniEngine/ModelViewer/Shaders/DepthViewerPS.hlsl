@@ -19,10 +19,26 @@ struct VSOutput
     float2 uv : TexCoord0;
 };
 
+#ifdef BINDLESS_MATERIALS
+Texture2D<float4>    materialTextures[]    : register(t0, space1);
+
+cbuffer MaterialConstants : register(b1)
+{
+    uint BaseVertex;
+    uint MaterialIndex;
+}
+
+#define texDiffuse materialTextures[MaterialIndex * 6]
+#else
 Texture2D<float4>    texDiffuse        : register(t0);
+#endif
 SamplerState        sampler0        : register(s0);
 
+#ifdef BINDLESS_MATERIALS
+[RootSignature(ModelViewer_BindlessRootSig)]
+#else
 [RootSignature(ModelViewer_RootSig)]
+#endif
 void main(VSOutput vsOutput)
 {
     if (texDiffuse.Sample(sampler0, vsOutput.uv).a < 0.5)
@@ -0,0 +1,70 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+// Author:  James Stanard
+//
+// Reduces each 16x16 tile of the depth buffer to its farthest depth.  The CPU reads the grid back
+// and builds the coarser levels of the hierarchy itself.
+
+#define _RootSig \
+    "RootFlags(0), " \
+    "RootConstants(b0, num32BitConstants = 4), " \
+    "DescriptorTable(SRV(t0, numDescriptors = 1))," \
+    "DescriptorTable(UAV(u0, numDescriptors = 1))"
+
+Texture2D<float> DepthBuffer : register(t0);
+RWStructuredBuffer<float> HiZ : register(u0);
+
+cbuffer CB0 : register(b0)
+{
+    uint2 DepthSize;
+    uint HiZWidth;
+    uint ReverseZ;
+}
+
+groupshared float FarthestDepth[64];
+
+float Farther( float a, float b )
+{
+    return ReverseZ ? min(a, b) : max(a, b);
+}
+
+[RootSignature(_RootSig)]
+[numthreads( 8, 8, 1 )]
+void main( uint3 Gid : SV_GroupID, uint GI : SV_GroupIndex, uint3 GTid : SV_GroupThreadID )
+{
+    // Start at the near plane so that pixels past the edge of the screen hide nothing
+    float Depth = ReverseZ ? 1.0 : 0.0;
+
+    // Each thread reduces a 2x2 quad of the tile
+    uint2 Corner = Gid.xy * 16 + GTid.xy * 2;
+
+    [unroll]
+    for (uint i = 0; i < 4; ++i)
+    {
+        uint2 Pixel = Corner + uint2(i & 1, i >> 1);
+        if (all(Pixel < DepthSize))
+            Depth = Farther(Depth, DepthBuffer[Pixel]);
+    }
+
+    FarthestDepth[GI] = Depth;
+    GroupMemoryBarrierWithGroupSync();
+
+    [unroll]
+    for (uint Stride = 32; Stride > 0; Stride >>= 1)
+    {
+        if (GI < Stride)
+            FarthestDepth[GI] = Farther(FarthestDepth[GI], FarthestDepth[GI + Stride]);
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (GI == 0)
+        HiZ[Gid.y * HiZWidth + Gid.x] = FarthestDepth[0];
+}
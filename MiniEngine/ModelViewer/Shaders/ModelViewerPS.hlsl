@@ -33,12 +33,27 @@ struct VSOutput
     sample float3 bitangent : Bitangent;
 };
 
+#ifdef BINDLESS_MATERIALS
+// Every material's six textures, in material order, indexed with the material from the root constants
+Texture2D<float3> materialTextures[] : register(t0, space1);
+
+cbuffer MaterialConstants : register(b1)
+{
+    uint BaseVertex;
+    uint MaterialIndex;
+}
+
+#define texDiffuse materialTextures[MaterialIndex * 6 + 0]
+#define texSpecular materialTextures[MaterialIndex * 6 + 1]
+#define texNormal materialTextures[MaterialIndex * 6 + 3]
+#else
 Texture2D<float3> texDiffuse        : register(t0);
 Texture2D<float3> texSpecular        : register(t1);
 //Texture2D<float4> texEmissive        : register(t2);
 Texture2D<float3> texNormal            : register(t3);
 //Texture2D<float4> texLightmap        : register(t4);
 //Texture2D<float4> texReflection    : register(t5);
+#endif
 Texture2D<float> texSSAO            : register(t64);
 Texture2D<float> texShadow            : register(t65);
 
@@ -327,7 +342,11 @@ uint PullNextBit( inout uint bits )
     return bitIndex;
 }
 
+#ifdef BINDLESS_MATERIALS
+[RootSignature(ModelViewer_BindlessRootSig)]
+#else
 [RootSignature(ModelViewer_RootSig)]
+#endif
 float3 main(VSOutput vsOutput) : SV_Target0
 {
     uint2 pixelPos = vsOutput.position.xy;
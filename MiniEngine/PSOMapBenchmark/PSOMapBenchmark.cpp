@@ -0,0 +1,254 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include "pch.h"
+#include "Hash.h"
+#include "CompileOnceMap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+
+using namespace std;
+
+void PrintHelp()
+{
+    printf("pso_map_benchmark\n");
+
+    printf("usage:\n");
+    printf("pso_map_benchmark [-threads count] [-descs count] [-compile microseconds] [-repeat count]\n");
+    printf("finalizes pipeline state descs from many threads through the PSO hash map, comparing it with\n");
+    printf("the single mutex map it replaced.  Compiles are simulated by spinning for the given time.\n");
+    printf("distinct: every desc is finalized once, split across the threads.\n");
+    printf("duplicate: every thread finalizes every desc, starting at a different point.\n");
+}
+
+// The map PipelineState.cpp used before, one mutex in front of a std::map with threads spinning
+// on an entry until its compile finishes
+class MutexPSOMap
+{
+public:
+    template <typename CreateFunc>
+    const void* GetOrCreate(size_t hash, CreateFunc create)
+    {
+        atomic<const void*>* entry = nullptr;
+        bool firstCompile = false;
+        {
+            lock_guard<mutex> lock(m_Mutex);
+            auto iter = m_Map.find(hash);
+            if (iter == m_Map.end())
+            {
+                firstCompile = true;
+                entry = &m_Map[hash];
+            }
+            else
+                entry = &iter->second;
+        }
+
+        if (firstCompile)
+        {
+            const void* value = create();
+            entry->store(value);
+            return value;
+        }
+
+        const void* value;
+        while ((value = entry->load()) == nullptr)
+            this_thread::yield();
+        return value;
+    }
+
+private:
+    mutex m_Mutex;
+    map< size_t, atomic<const void*> > m_Map;
+};
+
+struct BenchmarkResult
+{
+    double Seconds;
+    uint32_t Compiles;
+    uint32_t Mismatches;
+};
+
+static void SimulateCompile(uint32_t microseconds)
+{
+    auto start = chrono::high_resolution_clock::now();
+    while (chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count() < microseconds)
+        ;
+}
+
+// The VS2017 runtime's operator new ignores alignment beyond 16 bytes (C4316), and the compile-once map
+// keeps its shards on separate cache lines, so it is placed in aligned memory by hand
+template <typename T>
+struct AlignedDelete
+{
+    void operator()(T* p) const
+    {
+        p->~T();
+        _aligned_free(p);
+    }
+};
+
+template <typename T>
+static unique_ptr<T, AlignedDelete<T> > MakeAligned()
+{
+    void* memory = _aligned_malloc(sizeof(T), alignof(T));
+    if (memory == nullptr)
+        throw bad_alloc();
+    return unique_ptr<T, AlignedDelete<T> >(new (memory) T);
+}
+
+template <typename MapType>
+static BenchmarkResult Run(const vector<D3D12_GRAPHICS_PIPELINE_STATE_DESC>& descs, uint32_t threadCount,
+    bool duplicates, uint32_t compileMicroseconds)
+{
+    auto psoMap = MakeAligned<MapType>();
+    atomic<uint32_t> compiles(0);
+    atomic<uint32_t> mismatches(0);
+    atomic<uint32_t> readyThreads(0);
+    atomic<bool> start(false);
+
+    auto worker = [&](uint32_t threadIndex)
+    {
+        size_t descCount = descs.size();
+        size_t first = duplicates ? threadIndex * descCount / threadCount : threadIndex;
+        size_t step = duplicates ? 1 : threadCount;
+        size_t count = duplicates ? descCount : (descCount - threadIndex + threadCount - 1) / threadCount;
+
+        ++readyThreads;
+        while (!start)
+            this_thread::yield();
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            // Hash the desc the way GraphicsPSO::Finalize does
+            const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc = descs[(first + i * step) % descCount];
+            size_t hash = Utility::HashState(&desc);
+
+            const void* result = psoMap->GetOrCreate(hash, [&]()
+            {
+                SimulateCompile(compileMicroseconds);
+                ++compiles;
+                return (const void*)&desc;
+            });
+
+            if (result != &desc)
+                ++mismatches;
+        }
+    };
+
+    vector<thread> threads;
+    for (uint32_t i = 0; i < threadCount; ++i)
+        threads.emplace_back(worker, i);
+
+    while (readyThreads < threadCount)
+        this_thread::yield();
+
+    auto startTime = chrono::high_resolution_clock::now();
+    start = true;
+
+    for (thread& t : threads)
+        t.join();
+
+    BenchmarkResult result;
+    result.Seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+    result.Compiles = compiles;
+    result.Mismatches = mismatches;
+    return result;
+}
+
+template <typename MapType>
+static bool Report(const char* name, const vector<D3D12_GRAPHICS_PIPELINE_STATE_DESC>& descs, uint32_t threadCount,
+    bool duplicates, uint32_t compileMicroseconds, int repeatCount)
+{
+    BenchmarkResult best = {};
+    for (int i = 0; i < repeatCount; ++i)
+    {
+        BenchmarkResult result = Run<MapType>(descs, threadCount, duplicates, compileMicroseconds);
+        if (i == 0 || result.Seconds < best.Seconds)
+            best = result;
+    }
+
+    size_t finalizes = duplicates ? descs.size() * threadCount : descs.size();
+
+    printf("%-10s %-16s %10.2f ms %12.0f finalizes/s %8u compiles %8u mismatches\n", duplicates ? "duplicate" : "distinct",
+        name, best.Seconds * 1000.0, finalizes / best.Seconds, best.Compiles, best.Mismatches);
+
+    return best.Compiles == descs.size() && best.Mismatches == 0;
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+    if (argc % 2 != 1)
+    {
+        PrintHelp();
+        return -1;
+    }
+
+    uint32_t threadCount = max(1u, thread::hardware_concurrency());
+    uint32_t descCount = 4096;
+    uint32_t compileMicroseconds = 50;
+    int repeatCount = 3;
+
+    for (int arg = 1; arg < argc; arg += 2)
+    {
+        if (0 == wcscmp(argv[arg], L"-threads"))
+            threadCount = max(1, _wtoi(argv[arg + 1]));
+        else if (0 == wcscmp(argv[arg], L"-descs"))
+            descCount = max(1, _wtoi(argv[arg + 1]));
+        else if (0 == wcscmp(argv[arg], L"-compile"))
+            compileMicroseconds = max(0, _wtoi(argv[arg + 1]));
+        else if (0 == wcscmp(argv[arg], L"-repeat"))
+            repeatCount = max(1, _wtoi(argv[arg + 1]));
+        else
+        {
+            PrintHelp();
+            return -1;
+        }
+    }
+
+    // Distinct descs that differ the way real ones do, in a few fields scattered through the struct
+    vector<D3D12_GRAPHICS_PIPELINE_STATE_DESC> descs(descCount);
+    for (uint32_t i = 0; i < descCount; ++i)
+    {
+        D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc = descs[i];
+        ZeroMemory(&desc, sizeof(desc));
+        desc.NodeMask = 1;
+        desc.SampleMask = 0xFFFFFFFFu;
+        desc.SampleDesc.Count = 1;
+        desc.VS.pShaderBytecode = (const void*)(uintptr_t)(0x10000 + (i % 64) * 0x100);
+        desc.PS.pShaderBytecode = (const void*)(uintptr_t)(0x20000 + (i / 64) * 0x100);
+        desc.RasterizerState.CullMode = (D3D12_CULL_MODE)(1 + i % 3);
+        desc.NumRenderTargets = 1;
+        desc.RTVFormats[0] = DXGI_FORMAT_R11G11B10_FLOAT;
+        desc.DSVFormat = DXGI_FORMAT_D32_FLOAT;
+        desc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+    }
+
+    printf("%u threads, %u descs, %u us per compile, best of %d\n\n", threadCount, descCount, compileMicroseconds, repeatCount);
+
+    bool passed = true;
+    for (int duplicates = 0; duplicates < 2; ++duplicates)
+    {
+        passed &= Report<MutexPSOMap>("mutex map", descs, threadCount, duplicates != 0, compileMicroseconds, repeatCount);
+        passed &= Report< CompileOnceMap<const void*> >("compile once map", descs, threadCount, duplicates != 0, compileMicroseconds, repeatCount);
+    }
+
+    if (!passed)
+        printf("\nerror: a desc was compiled more than once or returned the wrong pipeline\n");
+
+    return passed ? 0 : -1;
+}
@@ -0,0 +1,267 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+
+#include "stdafx.h"
+#include "DescriptorHeap.h"
+#include <thread>
+#include <future>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace MiniEngineUnitTests
+{
+    // Hands out made-up address ranges instead of real heaps, and completes fences when told to
+    class FakeDescriptorHeapBackend : public DescriptorHeapBackend
+    {
+    public:
+        static const uint32_t kDescriptorSize = 32;
+
+        FakeDescriptorHeapBackend() : CompletedFence(0), HeapsCreated(0), m_NextAddress(0x100000) {}
+
+        virtual uint32_t GetDescriptorSize( D3D12_DESCRIPTOR_HEAP_TYPE ) override
+        {
+            return kDescriptorSize;
+        }
+
+        virtual Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> CreateHeap( const D3D12_DESCRIPTOR_HEAP_DESC& Desc,
+            D3D12_CPU_DESCRIPTOR_HANDLE& CpuStart, D3D12_GPU_DESCRIPTOR_HANDLE& GpuStart ) override
+        {
+            CpuStart.ptr = m_NextAddress;
+            if (Desc.Flags & D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE)
+                GpuStart.ptr = m_NextAddress;
+            else
+                GpuStart.ptr = D3D12_GPU_VIRTUAL_ADDRESS_UNKNOWN;
+
+            // Leave a gap so that handles just past the end of one heap don't belong to the next
+            m_NextAddress += (SIZE_T)(Desc.NumDescriptors + 16) * kDescriptorSize;
+            ++HeapsCreated;
+            return nullptr;
+        }
+
+        virtual bool IsFenceComplete( uint64_t FenceValue ) override
+        {
+            return FenceValue <= CompletedFence;
+        }
+
+        uint64_t CompletedFence;
+        uint32_t HeapsCreated;
+
+    private:
+        SIZE_T m_NextAddress;
+    };
+
+    static const D3D12_DESCRIPTOR_HEAP_TYPE kType = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+
+    TEST_CLASS(DescriptorAllocatorTests)
+    {
+    public:
+        TEST_METHOD(RangeAllocatorBestFit)
+        {
+            DescriptorRangeAllocator Ranges;
+            Ranges.Reset(16);
+
+            uint32_t A = Ranges.Allocate(2);
+            uint32_t B = Ranges.Allocate(8);
+            uint32_t C = Ranges.Allocate(2);
+            Assert::AreEqual(0u, A);
+            Assert::AreEqual(2u, B);
+            Assert::AreEqual(10u, C);
+
+            // Two free ranges, 0-1 and 12-15.  The smaller one that fits is taken.
+            Ranges.Free(A, 2);
+            Assert::AreEqual(2u, Ranges.GetFreeRangeCount());
+            Assert::AreEqual(0u, Ranges.Allocate(2));
+            Assert::AreEqual(12u, Ranges.Allocate(3));
+
+            Assert::AreEqual(DescriptorRangeAllocator::kInvalidOffset, Ranges.Allocate(2));
+            Assert::AreEqual(1u, Ranges.GetFreeCount());
+        }
+
+        TEST_METHOD(RangeAllocatorCoalesces)
+        {
+            DescriptorRangeAllocator Ranges;
+            Ranges.Reset(16);
+            for (uint32_t i = 0; i < 4; ++i)
+                Assert::AreEqual(i * 4, Ranges.Allocate(4));
+
+            // Free out of order so that ranges merge on either side
+            Ranges.Free(4, 4);
+            Ranges.Free(12, 4);
+            Assert::AreEqual(2u, Ranges.GetFreeRangeCount());
+            Ranges.Free(8, 4);
+            Assert::AreEqual(1u, Ranges.GetFreeRangeCount());
+            Assert::AreEqual(12u, Ranges.GetLargestFreeRange());
+            Ranges.Free(0, 4);
+            Assert::AreEqual(1u, Ranges.GetFreeRangeCount());
+            Assert::AreEqual(16u, Ranges.GetLargestFreeRange());
+            Assert::AreEqual(16u, Ranges.GetFreeCount());
+        }
+
+        TEST_METHOD(AllocatorReusesFreedDescriptors)
+        {
+            FakeDescriptorHeapBackend Backend;
+            DescriptorAllocator Allocator(kType, &Backend, 8, false);
+
+            D3D12_CPU_DESCRIPTOR_HANDLE Handles[8];
+            for (uint32_t i = 0; i < 8; ++i)
+            {
+                Handles[i] = Allocator.Allocate(1);
+                if (i > 0)
+                    Assert::AreEqual((SIZE_T)FakeDescriptorHeapBackend::kDescriptorSize, Handles[i].ptr - Handles[i - 1].ptr);
+            }
+
+            for (uint32_t i = 2; i < 6; ++i)
+                Allocator.Free(Handles[i]);
+
+            // A range of four fits in the hole without a new heap
+            D3D12_CPU_DESCRIPTOR_HANDLE Range = Allocator.Allocate(4);
+            Assert::AreEqual(Handles[2].ptr, Range.ptr);
+            Assert::AreEqual(1u, Backend.HeapsCreated);
+
+            DescriptorAllocatorStats Stats = Allocator.GetStats();
+            Assert::AreEqual(1u, Stats.NumHeaps);
+            Assert::AreEqual(8u, Stats.AllocatedDescriptors);
+            Assert::AreEqual(1.0f, Stats.Occupancy);
+        }
+
+        TEST_METHOD(AllocatorGrowsForLargeRequests)
+        {
+            FakeDescriptorHeapBackend Backend;
+            DescriptorAllocator Allocator(kType, &Backend, 8, false);
+
+            Allocator.Allocate(6);
+            Allocator.Allocate(20);
+            Allocator.Allocate(2);
+
+            // The second request needed a heap of its own, the third still fit in the first
+            DescriptorAllocatorStats Stats = Allocator.GetStats();
+            Assert::AreEqual(2u, Stats.NumHeaps);
+            Assert::AreEqual(28u, Stats.TotalDescriptors);
+            Assert::AreEqual(28u, Stats.AllocatedDescriptors);
+        }
+
+        TEST_METHOD(AllocatorDefersFencedFrees)
+        {
+            FakeDescriptorHeapBackend Backend;
+            DescriptorAllocator Allocator(kType, &Backend, 4, false);
+
+            D3D12_CPU_DESCRIPTOR_HANDLE Handles[4];
+            for (uint32_t i = 0; i < 4; ++i)
+                Handles[i] = Allocator.Allocate(1);
+
+            Allocator.Free(Handles[1], 1, 5);
+            Assert::AreEqual(1u, Allocator.GetStats().PendingFreeDescriptors);
+
+            // Still in use by the GPU, so the next allocation needs a new heap
+            D3D12_CPU_DESCRIPTOR_HANDLE Next = Allocator.Allocate(1);
+            Assert::AreNotEqual(Handles[1].ptr, Next.ptr);
+            Assert::AreEqual(2u, Backend.HeapsCreated);
+
+            // Once the fence passes, the descriptor is reclaimed by the next allocation
+            Backend.CompletedFence = 5;
+            Allocator.Allocate(3);
+            Assert::AreEqual(0u, Allocator.GetStats().PendingFreeDescriptors);
+            Allocator.Allocate(1);
+            Assert::AreEqual(2u, Backend.HeapsCreated);
+
+            // Fences that have already completed free right away
+            Allocator.Free(Handles[2], 1, 4);
+            Assert::AreEqual(0u, Allocator.GetStats().PendingFreeDescriptors);
+            Assert::AreEqual(Handles[2].ptr, Allocator.Allocate(1).ptr);
+        }
+
+        TEST_METHOD(AllocatorReportsFragmentation)
+        {
+            FakeDescriptorHeapBackend Backend;
+            DescriptorAllocator Allocator(kType, &Backend, 8, false);
+
+            D3D12_CPU_DESCRIPTOR_HANDLE Handles[8];
+            for (uint32_t i = 0; i < 8; ++i)
+                Handles[i] = Allocator.Allocate(1);
+            for (uint32_t i = 0; i < 8; i += 2)
+                Allocator.Free(Handles[i]);
+
+            DescriptorAllocatorStats Stats = Allocator.GetStats();
+            Assert::AreEqual(4u, Stats.AllocatedDescriptors);
+            Assert::AreEqual(4u, Stats.FreeRanges);
+            Assert::AreEqual(1u, Stats.LargestFreeRange);
+            Assert::AreEqual(0.5f, Stats.Occupancy, 0.0001f);
+            Assert::AreEqual(0.75f, Stats.Fragmentation, 0.0001f);
+        }
+
+        TEST_METHOD(ThreadCacheReturnedOnThreadExit)
+        {
+            FakeDescriptorHeapBackend Backend;
+            DescriptorAllocator Allocator(kType, &Backend, 1024, true);
+
+            Allocator.Allocate(1);
+            DescriptorAllocatorStats Before = Allocator.GetStats();
+            Assert::IsTrue(Before.ThreadCachedDescriptors > 0, L"Single descriptors should come from the thread cache");
+
+            std::thread Worker([&Allocator]
+            {
+                D3D12_CPU_DESCRIPTOR_HANDLE Handle = Allocator.Allocate(1);
+                Allocator.Free(Handle);
+            });
+            Worker.join();
+
+            DescriptorAllocatorStats After = Allocator.GetStats();
+            Assert::AreEqual(Before.ThreadCachedDescriptors, After.ThreadCachedDescriptors);
+            Assert::AreEqual(Before.AllocatedDescriptors, After.AllocatedDescriptors);
+        }
+
+        TEST_METHOD(ThreadCacheOutlivesAllocator)
+        {
+            FakeDescriptorHeapBackend Backend;
+            std::unique_ptr<DescriptorAllocator> Allocator(new DescriptorAllocator(kType, &Backend, 1024, true));
+
+            std::promise<void> Allocated;
+            std::promise<void> Deleted;
+            std::future<void> DeletedFuture = Deleted.get_future();
+
+            // The thread exits with descriptors cached for an allocator that no longer exists
+            std::thread Worker([&]
+            {
+                Allocator->Allocate(1);
+                Allocated.set_value();
+                DeletedFuture.wait();
+            });
+
+            Allocated.get_future().wait();
+            Allocator.reset();
+            Deleted.set_value();
+            Worker.join();
+        }
+
+        TEST_METHOD(UserHeapDefersFencedFrees)
+        {
+            FakeDescriptorHeapBackend Backend;
+            UserDescriptorHeap Heap(kType, 8, &Backend);
+            Heap.Create(L"Test heap");
+
+            DescriptorHandle First = Heap.Alloc(4);
+            DescriptorHandle Second = Heap.Alloc(4);
+            Assert::IsTrue(First.IsShaderVisible());
+            Assert::AreEqual(4u, Heap.GetOffsetOfHandle(Second));
+            Assert::IsFalse(Heap.HasAvailableSpace(1));
+
+            Heap.Free(First, 4, 3);
+            Assert::AreEqual(3ull, Heap.GetOldestPendingFreeFence());
+            Assert::AreEqual(4u, Heap.GetStats().PendingFreeDescriptors);
+            Assert::IsFalse(Heap.HasAvailableSpace(1));
+
+            Backend.CompletedFence = 3;
+            Assert::IsTrue(Heap.HasAvailableSpace(4));
+            Assert::AreEqual(0ull, Heap.GetOldestPendingFreeFence());
+            Assert::AreEqual(0u, Heap.GetOffsetOfHandle(Heap.Alloc(4)));
+
+            Heap.Destroy();
+        }
+    };
+}
@@ -0,0 +1,253 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+
+#include "stdafx.h"
+#include "Model.h"
+#include "FileUtility.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace MiniEngineUnitTests
+{
+    // Must match ModelH3D.cpp
+    static const uint32_t kH3DFileTag = 0x58443348;
+    static const uint32_t kH3DFileVersion = 1;
+
+    static const uint32_t kVertexCount = 3;
+    static const uint32_t kVertexStride = 14 * sizeof(float);
+    static const uint32_t kVertexStrideDepth = 3 * sizeof(float);
+
+    // Where the parser should find each block, relative to the start of the file
+    struct H3DLayout
+    {
+        size_t vertexData;
+        size_t indexData;
+        size_t vertexDataDepth;
+        size_t indexDataDepth;
+        size_t fileSize;
+    };
+
+    // Builds a one mesh, one material H3D file in memory.  The mesh has the layout LoadH3D
+    // asserts on, and every data byte is its own offset so misplaced blocks show up.
+    Utility::ByteArray BuildH3D(bool versioned, uint32_t version, uint32_t indexFormat, H3DLayout* layout = nullptr)
+    {
+        const uint32_t indexSize = indexFormat == Model::index_format_uint32 ? 4 : 2;
+
+        Model::Header header = {};
+        header.meshCount = 1;
+        header.materialCount = 1;
+        header.vertexDataByteSize = kVertexCount * kVertexStride;
+        header.indexDataByteSize = kVertexCount * indexSize;
+        header.vertexDataByteSizeDepth = kVertexCount * kVertexStrideDepth;
+        header.boundingBox.min = Math::Vector3(-1.0f, -2.0f, -3.0f);
+        header.boundingBox.max = Math::Vector3(1.0f, 2.0f, 3.0f);
+
+        Model::Mesh mesh = {};
+        mesh.attribsEnabled = Model::attrib_mask_position | Model::attrib_mask_texcoord0 |
+            Model::attrib_mask_normal | Model::attrib_mask_tangent | Model::attrib_mask_bitangent;
+        mesh.attribsEnabledDepth = Model::attrib_mask_position;
+        mesh.vertexStride = kVertexStride;
+        mesh.vertexStrideDepth = kVertexStrideDepth;
+        const uint16_t components[] = { 3, 2, 3, 3, 3 };
+        uint16_t offset = 0;
+        for (int i = 0; i < 5; ++i)
+        {
+            mesh.attrib[i].offset = offset;
+            mesh.attrib[i].components = components[i];
+            mesh.attrib[i].format = Model::attrib_format_float;
+            offset += components[i] * sizeof(float);
+        }
+        mesh.attribDepth[0] = mesh.attrib[0];
+        mesh.vertexCount = kVertexCount;
+        mesh.indexCount = kVertexCount;
+        mesh.vertexCountDepth = kVertexCount;
+        // Garbage where unversioned files have tail padding
+        mesh.indexFormat = versioned ? indexFormat : 0xCDCDCDCD;
+
+        Model::Material material = {};
+        material.opacity = 1.0f;
+        strcpy_s(material.name, "fixture");
+        strcpy_s(material.texDiffusePath, "fixture_diffuse");
+
+        auto file = std::make_shared<std::vector<byte>>();
+        auto append = [&](const void* data, size_t size)
+        {
+            const byte* bytes = (const byte*)data;
+            file->insert(file->end(), bytes, bytes + size);
+        };
+        auto appendData = [&](size_t size) -> size_t
+        {
+            size_t start = file->size();
+            for (size_t i = 0; i < size; ++i)
+                file->push_back((byte)(start + i));
+            return start;
+        };
+
+        if (versioned)
+        {
+            append(&kH3DFileTag, sizeof(kH3DFileTag));
+            append(&version, sizeof(version));
+        }
+        append(&header, sizeof(header));
+        append(&mesh, sizeof(mesh));
+        append(&material, sizeof(material));
+
+        H3DLayout fileLayout;
+        fileLayout.vertexData = appendData(header.vertexDataByteSize);
+        fileLayout.indexData = appendData(header.indexDataByteSize);
+        fileLayout.vertexDataDepth = appendData(header.vertexDataByteSizeDepth);
+        fileLayout.indexDataDepth = appendData(header.indexDataByteSize);
+        fileLayout.fileSize = file->size();
+        if (layout != nullptr)
+            *layout = fileLayout;
+
+        return file;
+    }
+
+    void CheckBlocks(const Utility::FileSource& source, const Model::H3DDataBlocks& blocks, const H3DLayout& layout)
+    {
+        const unsigned char* base = source.GetData();
+        Assert::IsTrue(blocks.vertexData == base + layout.vertexData, L"Vertex data at the wrong offset");
+        Assert::IsTrue(blocks.indexData == base + layout.indexData, L"Index data at the wrong offset");
+        Assert::IsTrue(blocks.vertexDataDepth == base + layout.vertexDataDepth, L"Depth vertex data at the wrong offset");
+        Assert::IsTrue(blocks.indexDataDepth == base + layout.indexDataDepth, L"Depth index data at the wrong offset");
+    }
+
+    // Writes bytes to a new temporary file and returns its name
+    std::wstring WriteTempFile(const std::vector<byte>& data)
+    {
+        wchar_t tempPath[MAX_PATH];
+        wchar_t fileName[MAX_PATH];
+        Assert::IsTrue(GetTempPathW(MAX_PATH, tempPath) != 0, L"No temp path");
+        Assert::IsTrue(GetTempFileNameW(tempPath, L"h3d", 0, fileName) != 0, L"Can't create a temp file");
+
+        std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+        if (!data.empty())
+            file.write((const char*)data.data(), data.size());
+        file.close();
+        Assert::IsTrue(!file.fail(), L"Can't write the temp file");
+        return fileName;
+    }
+
+    TEST_CLASS(ModelH3DTests)
+    {
+    public:
+        TEST_METHOD(ParseVersionedFile)
+        {
+            H3DLayout layout;
+            auto source = Utility::MakeFileSource(BuildH3D(true, kH3DFileVersion, Model::index_format_uint32, &layout));
+
+            Model model;
+            Model::H3DDataBlocks blocks;
+            Assert::IsTrue(model.ParseH3D(*source, blocks), L"Valid file rejected");
+
+            Assert::AreEqual(1u, model.m_Header.meshCount);
+            Assert::AreEqual(1u, model.m_Header.materialCount);
+            Assert::AreEqual(kVertexCount * kVertexStride, model.m_Header.vertexDataByteSize);
+            Assert::AreEqual(kVertexCount * 4u, model.m_Header.indexDataByteSize);
+            Assert::AreEqual(3.0f, (float)model.GetBoundingBox().max.GetZ());
+            Assert::AreEqual((unsigned int)Model::index_format_uint32, model.m_pMesh[0].indexFormat);
+            Assert::AreEqual(kVertexStride, model.m_VertexStride);
+            Assert::AreEqual(kVertexStrideDepth, model.m_VertexStrideDepth);
+            Assert::AreEqual("fixture", model.m_pMaterial[0].name);
+            Assert::AreEqual("fixture_diffuse", model.m_pMaterial[0].texDiffusePath);
+            Assert::AreEqual(layout.fileSize, source->GetSize());
+            CheckBlocks(*source, blocks, layout);
+        }
+
+        TEST_METHOD(ParseUnversionedFileForces16BitIndices)
+        {
+            H3DLayout layout;
+            auto source = Utility::MakeFileSource(BuildH3D(false, 0, Model::index_format_uint16, &layout));
+
+            Model model;
+            Model::H3DDataBlocks blocks;
+            Assert::IsTrue(model.ParseH3D(*source, blocks), L"Unversioned file rejected");
+            Assert::AreEqual((unsigned int)Model::index_format_uint16, model.m_pMesh[0].indexFormat);
+            CheckBlocks(*source, blocks, layout);
+        }
+
+        TEST_METHOD(RejectNewerVersion)
+        {
+            auto source = Utility::MakeFileSource(BuildH3D(true, kH3DFileVersion + 1, Model::index_format_uint16));
+
+            Model model;
+            Model::H3DDataBlocks blocks;
+            Assert::IsFalse(model.ParseH3D(*source, blocks), L"File from a newer version accepted");
+        }
+
+        TEST_METHOD(RejectTruncatedFiles)
+        {
+            for (bool versioned : { true, false })
+            {
+                Utility::ByteArray full = BuildH3D(versioned, kH3DFileVersion, Model::index_format_uint16);
+                for (size_t size = 0; size < full->size(); ++size)
+                {
+                    auto truncated = std::make_shared<std::vector<byte>>(full->begin(), full->begin() + size);
+                    auto source = Utility::MakeFileSource(truncated);
+
+                    Model model;
+                    Model::H3DDataBlocks blocks;
+                    if (model.ParseH3D(*source, blocks))
+                    {
+                        std::wstringstream message;
+                        message << (versioned ? L"Versioned" : L"Unversioned") << L" file truncated to " << size
+                            << L" of " << full->size() << L" bytes accepted";
+                        Assert::Fail(message.str().c_str());
+                    }
+                }
+            }
+        }
+
+        TEST_METHOD(MappedFileMatchesMemory)
+        {
+            H3DLayout layout;
+            Utility::ByteArray data = BuildH3D(true, kH3DFileVersion, Model::index_format_uint16, &layout);
+            std::wstring fileName = WriteTempFile(*data);
+
+            {
+                auto mapped = Utility::MapFile(fileName);
+                Assert::IsNotNull(mapped.get(), L"Can't map the temp file");
+                Assert::AreEqual(data->size(), mapped->GetSize());
+                Assert::IsTrue(0 == memcmp(mapped->GetData(), data->data(), data->size()), L"Mapped bytes differ");
+
+                Model model;
+                Model::H3DDataBlocks blocks;
+                Assert::IsTrue(model.ParseH3D(*mapped, blocks), L"Mapped file rejected");
+                Assert::AreEqual(kVertexStride, model.m_VertexStride);
+                CheckBlocks(*mapped, blocks, layout);
+            }
+
+            // The view has to be unmapped before the file can go
+            DeleteFileW(fileName.c_str());
+        }
+
+        TEST_METHOD(MapEmptyFile)
+        {
+            std::wstring fileName = WriteTempFile(std::vector<byte>());
+
+            {
+                auto mapped = Utility::MapFile(fileName);
+                Assert::IsNotNull(mapped.get(), L"Empty files should still open");
+                Assert::AreEqual((size_t)0, mapped->GetSize());
+
+                Model model;
+                Model::H3DDataBlocks blocks;
+                Assert::IsFalse(model.ParseH3D(*mapped, blocks), L"Empty file accepted");
+            }
+
+            DeleteFileW(fileName.c_str());
+        }
+
+        TEST_METHOD(MapMissingFile)
+        {
+            Assert::IsNull(Utility::MapFile(L"this_file_does_not_exist.h3d").get());
+        }
+    };
+}
@@ -0,0 +1,261 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+
+#include "stdafx.h"
+#include "PipelineStateCache.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace PipelineStateCache;
+using namespace std;
+
+namespace MiniEngineUnitTests
+{
+    // Fake shader bytecode.  The keys only look at the bytes.
+    static const byte kVertexShader[] = { 'D', 'X', 'B', 'C', 1, 2, 3, 4, 5, 6, 7, 8 };
+    static const byte kPixelShader[] = { 'D', 'X', 'B', 'C', 8, 7, 6, 5, 4, 3, 2, 1 };
+
+    static const D3D12_INPUT_ELEMENT_DESC kInputLayout[] =
+    {
+        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    };
+
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC MakeGraphicsDesc(const void* VS, const void* PS, const D3D12_INPUT_ELEMENT_DESC* Layout)
+    {
+        D3D12_GRAPHICS_PIPELINE_STATE_DESC Desc = {};
+        Desc.pRootSignature = (ID3D12RootSignature*)(uintptr_t)0x1000;
+        Desc.VS = { VS, sizeof(kVertexShader) };
+        Desc.PS = { PS, sizeof(kPixelShader) };
+        Desc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+        Desc.SampleMask = UINT_MAX;
+        Desc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+        Desc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+        Desc.InputLayout = { Layout, _countof(kInputLayout) };
+        Desc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+        Desc.NumRenderTargets = 1;
+        Desc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+        Desc.DSVFormat = DXGI_FORMAT_D32_FLOAT;
+        Desc.SampleDesc.Count = 1;
+        return Desc;
+    }
+
+    AdapterIdentity MakeAdapter(uint32_t DeviceId)
+    {
+        AdapterIdentity Adapter = {};
+        Adapter.VendorId = 0x10DE;
+        Adapter.DeviceId = DeviceId;
+        Adapter.DriverVersion = 0x0017001100010000ULL;
+        return Adapter;
+    }
+
+    TEST_CLASS(PipelineStateCacheTests)
+    {
+    public:
+        TEST_METHOD(HashBytesIsFnv1a)
+        {
+            // Published FNV-1a test vectors.  Keys are written to disk, so the hash may never change.
+            Assert::AreEqual(0xcbf29ce484222325ULL, HashBytes("", 0));
+            Assert::AreEqual(0xaf63dc4c8601ec8cULL, HashBytes("a", 1));
+            Assert::AreEqual(0x85944171f73967e8ULL, HashBytes("foobar", 6));
+
+            // Chaining is the same as hashing everything at once
+            Assert::AreEqual(HashBytes("foobar", 6), HashBytes("bar", 3, HashBytes("foo", 3)));
+        }
+
+        TEST_METHOD(GraphicsKeyIgnoresPointers)
+        {
+            // Same contents at different addresses
+            vector<byte> VS(kVertexShader, kVertexShader + sizeof(kVertexShader));
+            vector<byte> PS(kPixelShader, kPixelShader + sizeof(kPixelShader));
+            vector<D3D12_INPUT_ELEMENT_DESC> Layout(kInputLayout, kInputLayout + _countof(kInputLayout));
+            string Position = "POSITION";
+            Layout[0].SemanticName = Position.c_str();
+
+            D3D12_GRAPHICS_PIPELINE_STATE_DESC A = MakeGraphicsDesc(kVertexShader, kPixelShader, kInputLayout);
+            D3D12_GRAPHICS_PIPELINE_STATE_DESC B = MakeGraphicsDesc(VS.data(), PS.data(), Layout.data());
+            B.pRootSignature = (ID3D12RootSignature*)(uintptr_t)0x2000;
+
+            Assert::IsTrue(ComputeKey(A, 42) == ComputeKey(B, 42), L"Key depends on pointer values");
+            Assert::IsTrue(GetPipelineName(ComputeKey(A, 42)) == GetPipelineName(ComputeKey(B, 42)));
+        }
+
+        TEST_METHOD(GraphicsKeySeesEveryInput)
+        {
+            D3D12_GRAPHICS_PIPELINE_STATE_DESC Base = MakeGraphicsDesc(kVertexShader, kPixelShader, kInputLayout);
+            CacheKey BaseKey = ComputeKey(Base, 42);
+
+            // Fixed function state
+            D3D12_GRAPHICS_PIPELINE_STATE_DESC Culled = Base;
+            Culled.RasterizerState.CullMode = D3D12_CULL_MODE_FRONT;
+            CacheKey CulledKey = ComputeKey(Culled, 42);
+            Assert::IsTrue(CulledKey.DescHash != BaseKey.DescHash, L"Rasterizer state not hashed");
+            Assert::IsTrue(CulledKey.ShaderHash == BaseKey.ShaderHash, L"Shader hash depends on fixed function state");
+
+            // Root signature
+            Assert::IsTrue(ComputeKey(Base, 43).DescHash != BaseKey.DescHash, L"Root signature not hashed");
+
+            // Shader contents
+            D3D12_GRAPHICS_PIPELINE_STATE_DESC Swapped = MakeGraphicsDesc(kPixelShader, kVertexShader, kInputLayout);
+            CacheKey SwappedKey = ComputeKey(Swapped, 42);
+            Assert::IsTrue(SwappedKey.ShaderHash != BaseKey.ShaderHash, L"Shader stages not told apart");
+            Assert::IsTrue(SwappedKey.DescHash == BaseKey.DescHash, L"Desc hash depends on shader contents");
+
+            // Input layout semantics are compared by name
+            vector<D3D12_INPUT_ELEMENT_DESC> Layout(kInputLayout, kInputLayout + _countof(kInputLayout));
+            Layout[1].SemanticName = "NORMAL";
+            D3D12_GRAPHICS_PIPELINE_STATE_DESC Renamed = MakeGraphicsDesc(kVertexShader, kPixelShader, Layout.data());
+            Assert::IsTrue(ComputeKey(Renamed, 42).DescHash != BaseKey.DescHash, L"Semantic names not hashed");
+
+            // A cached blob handed to the runtime isn't part of the pipeline
+            D3D12_GRAPHICS_PIPELINE_STATE_DESC WithBlob = Base;
+            WithBlob.CachedPSO.pCachedBlob = kPixelShader;
+            WithBlob.CachedPSO.CachedBlobSizeInBytes = sizeof(kPixelShader);
+            Assert::IsTrue(ComputeKey(WithBlob, 42) == BaseKey, L"Cached blob changes the key");
+        }
+
+        TEST_METHOD(ComputeKeyIgnoresPointers)
+        {
+            vector<byte> CS(kVertexShader, kVertexShader + sizeof(kVertexShader));
+
+            D3D12_COMPUTE_PIPELINE_STATE_DESC A = {};
+            A.pRootSignature = (ID3D12RootSignature*)(uintptr_t)0x1000;
+            A.CS = { kVertexShader, sizeof(kVertexShader) };
+
+            D3D12_COMPUTE_PIPELINE_STATE_DESC B = A;
+            B.pRootSignature = (ID3D12RootSignature*)(uintptr_t)0x2000;
+            B.CS.pShaderBytecode = CS.data();
+            Assert::IsTrue(ComputeKey(A, 7) == ComputeKey(B, 7), L"Key depends on pointer values");
+
+            B.CS.pShaderBytecode = kPixelShader;
+            Assert::IsTrue(ComputeKey(A, 7) != ComputeKey(B, 7), L"Shader contents not hashed");
+            Assert::IsTrue(ComputeKey(A, 7) != ComputeKey(A, 8), L"Root signature not hashed");
+        }
+
+        TEST_METHOD(PipelineNameIsHexKey)
+        {
+            CacheKey Key = { 0x0123456789abcdefULL, 0xfedcba9876543210ULL };
+            Assert::AreEqual(std::wstring(L"0123456789abcdeffedcba9876543210"), GetPipelineName(Key));
+        }
+
+        TEST_METHOD(CacheFileRoundTrip)
+        {
+            static const byte Blob[] = { 1, 2, 3, 4, 5, 6, 7 };
+            static const byte Library[] = { 9, 8, 7, 6, 5 };
+
+            CacheFileContents Written;
+            Written.Entries.push_back({ { 1, 2 }, 1.5f, Blob, sizeof(Blob) });
+            Written.Entries.push_back({ { 3, 4 }, 2.5f, nullptr, 0 });
+            Written.Entries.push_back({ { 5, 6 }, 3.5f, Blob, 3 });
+            Written.Library = Library;
+            Written.LibrarySize = sizeof(Library);
+
+            vector<byte> File = WriteCacheFile(MakeAdapter(1), Written);
+
+            CacheFileContents Read;
+            Assert::IsTrue(ReadCacheFile(File.data(), File.size(), MakeAdapter(1), Read), L"Valid file rejected");
+            Assert::AreEqual(Written.Entries.size(), Read.Entries.size());
+
+            for (size_t i = 0; i < Written.Entries.size(); ++i)
+            {
+                const CacheEntry& Expected = Written.Entries[i];
+                const CacheEntry& Actual = Read.Entries[i];
+                Assert::IsTrue(Expected.Key == Actual.Key);
+                Assert::AreEqual(Expected.CompileTimeMs, Actual.CompileTimeMs);
+                Assert::AreEqual(Expected.BlobSize, Actual.BlobSize);
+
+                if (Expected.BlobSize == 0)
+                {
+                    Assert::IsNull(Actual.Blob);
+                    continue;
+                }
+
+                // Blobs are parsed in place and aligned for the runtime
+                const byte* ActualBlob = (const byte*)Actual.Blob;
+                Assert::IsTrue(ActualBlob >= File.data() && ActualBlob + Actual.BlobSize <= File.data() + File.size());
+                Assert::AreEqual((size_t)0, (size_t)(ActualBlob - File.data()) % 16);
+                Assert::IsTrue(0 == memcmp(Expected.Blob, Actual.Blob, Expected.BlobSize), L"Blob contents differ");
+            }
+
+            Assert::AreEqual(sizeof(Library), Read.LibrarySize);
+            Assert::IsTrue(0 == memcmp(Library, Read.Library, sizeof(Library)), L"Library contents differ");
+        }
+
+        TEST_METHOD(EmptyCacheFileRoundTrip)
+        {
+            vector<byte> File = WriteCacheFile(MakeAdapter(1), CacheFileContents());
+
+            CacheFileContents Read;
+            Assert::IsTrue(ReadCacheFile(File.data(), File.size(), MakeAdapter(1), Read), L"Empty cache rejected");
+            Assert::IsTrue(Read.Entries.empty());
+            Assert::IsNull(Read.Library);
+            Assert::AreEqual((size_t)0, Read.LibrarySize);
+        }
+
+        TEST_METHOD(RejectOtherAdapter)
+        {
+            vector<byte> File = WriteCacheFile(MakeAdapter(1), CacheFileContents());
+
+            CacheFileContents Read;
+            Assert::IsFalse(ReadCacheFile(File.data(), File.size(), MakeAdapter(2), Read), L"Other device accepted");
+
+            AdapterIdentity NewDriver = MakeAdapter(1);
+            ++NewDriver.DriverVersion;
+            Assert::IsFalse(ReadCacheFile(File.data(), File.size(), NewDriver, Read), L"Other driver accepted");
+        }
+
+        TEST_METHOD(RejectDamagedFiles)
+        {
+            static const byte Blob[] = { 1, 2, 3, 4, 5, 6, 7 };
+            static const byte Library[] = { 9, 8, 7, 6, 5 };
+
+            CacheFileContents Written;
+            Written.Entries.push_back({ { 1, 2 }, 1.5f, Blob, sizeof(Blob) });
+            Written.Library = Library;
+            Written.LibrarySize = sizeof(Library);
+            const vector<byte> File = WriteCacheFile(MakeAdapter(1), Written);
+
+            CacheFileContents Read;
+            Assert::IsFalse(ReadCacheFile(nullptr, 0, MakeAdapter(1), Read), L"Missing file accepted");
+
+            for (size_t Size = 0; Size < File.size(); ++Size)
+            {
+                vector<byte> Truncated(File.begin(), File.begin() + Size);
+                if (ReadCacheFile(Truncated.data(), Truncated.size(), MakeAdapter(1), Read))
+                {
+                    std::wstringstream Message;
+                    Message << L"File truncated to " << Size << L" of " << File.size() << L" bytes accepted";
+                    Assert::Fail(Message.str().c_str());
+                }
+                Assert::IsTrue(Read.Entries.empty() && Read.Library == nullptr, L"Rejected file left contents behind");
+            }
+
+            vector<byte> OtherMagic = File;
+            OtherMagic[0] ^= 0x40;
+            Assert::IsFalse(ReadCacheFile(OtherMagic.data(), OtherMagic.size(), MakeAdapter(1), Read), L"Bad magic accepted");
+
+            vector<byte> OtherVersion = File;
+            OtherVersion[4] ^= 0x40;
+            Assert::IsFalse(ReadCacheFile(OtherVersion.data(), OtherVersion.size(), MakeAdapter(1), Read), L"Other version accepted");
+
+            // Everything after the header is covered by the checksum, which is the header's last field
+            const size_t HeaderSize = 64;
+            for (size_t Offset = HeaderSize - sizeof(uint64_t); Offset < File.size(); ++Offset)
+            {
+                vector<byte> Corrupt = File;
+                Corrupt[Offset] ^= 0x40;
+                if (ReadCacheFile(Corrupt.data(), Corrupt.size(), MakeAdapter(1), Read))
+                {
+                    std::wstringstream Message;
+                    Message << L"File with byte " << Offset << L" flipped accepted";
+                    Assert::Fail(Message.str().c_str());
+                }
+            }
+        }
+    };
+}
@@ -340,6 +340,17 @@ void D3D12RaytracingRealTimeDenoisedAmbientOcclusion::UpdateUI()
         PrintComponentInfo(L"Pathtracing", m_pathtracer.Width(), m_pathtracer.Height(), m_sampleGpuTimes[Sample_GPUTime::Pathtracing].GetAverageMS());
         PrintComponentInfo(L"AO raytracing", m_RTAO.RaytracingWidth(), m_RTAO.RaytracingHeight(), m_sampleGpuTimes[Sample_GPUTime::AOraytracing].GetAverageMS());
         PrintComponentInfo(L"AO denoising", m_denoiser.DenoisingWidth(), m_denoiser.DenoisingHeight(), m_sampleGpuTimes[Sample_GPUTime::AOdenoising].GetAverageMS());
+        // Prints <AS build GPU time>, <BLAS builds> in <batches>, <TLAS build>, <compaction memory saved>
+        auto& accelerationStructure = m_scene.AccelerationStructure();
+        if (accelerationStructure)
+        {
+            const wchar_t* topLevelASBuildNames[TopLevelASBuild::Count] = { L"skipped", L"refit", L"rebuild" };
+            auto& buildStatistics = accelerationStructure->GetBuildStatistics();
+            wLabel << L"Acceleration structures: " << setprecision(2) << fixed << buildStatistics.buildGpuTimeMS << L"ms, "
+                << buildStatistics.numBottomLevelASBuilds << L" BLAS builds in " << buildStatistics.numBottomLevelASBuildBatches << L" batches, "
+                << L"TLAS " << topLevelASBuildNames[buildStatistics.topLevelASBuild] << L", "
+                << L"compaction saved " << static_cast<double>(buildStatistics.compactionMemorySavedInBytes) / (1 << 20) << L"MB" << L"\n";
+        }
         labels.push_back(wLabel.str());
     }
     // Engine tuning.
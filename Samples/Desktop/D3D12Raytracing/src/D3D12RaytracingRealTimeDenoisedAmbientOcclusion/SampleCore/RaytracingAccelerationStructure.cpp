@@ -13,8 +13,22 @@
 #include "RaytracingAccelerationStructure.h"
 #include "D3D12RaytracingRealTimeDenoisedAmbientOcclusion.h"
 #include "EngineProfiling.h"
+#include "EngineTuning.h"
+#include "GpuTimeManager.h"
 
 using namespace std;
+using namespace DX;
+
+namespace AccelerationStructure_Args
+{
+    // The scratch pool is sized for this many bottom-level AS builds when the top-level AS is initialized.
+    IntVar MaxBottomLevelASBuildsPerBatch(L"Scene/Acceleration structure/Max BLAS builds per batch", 8, 1, 32);
+    BoolVar CompactStaticBottomLevelAS(L"Scene/Acceleration structure/Compact static BLAS", true);
+
+    // Refit the top-level AS while no instance has moved further than this since the last rebuild. 0 always rebuilds.
+    NumVar TopLevelASMaxRefitInstanceMotion(L"Scene/Acceleration structure/TLAS max refit instance motion", 2.f, 0.f, 100.f, 0.25f);
+    IntVar TopLevelASMaxRefits(L"Scene/Acceleration structure/TLAS max refits between rebuilds", 60, 0, 1000);
+}
 
 
 void AccelerationStructure::ReleaseD3DResources()
@@ -121,13 +135,18 @@ void BottomLevelAccelerationStructure::Initialize(
 }
 
 // The caller must add a UAV barrier before using the resource.
+// If compactedSizeGPUAddress is set, the compacted size is written there, it must be in the UAV state.
 void BottomLevelAccelerationStructure::Build(
     ID3D12GraphicsCommandList4* commandList, 
-    ID3D12Resource* scratch, 
+    D3D12_GPU_VIRTUAL_ADDRESS scratch, 
+    UINT64 scratchSizeInBytes, 
     ID3D12DescriptorHeap* descriptorHeap, 
-    D3D12_GPU_VIRTUAL_ADDRESS baseGeometryTransformGPUAddress)
+    D3D12_GPU_VIRTUAL_ADDRESS baseGeometryTransformGPUAddress,
+    D3D12_GPU_VIRTUAL_ADDRESS compactedSizeGPUAddress)
 {
-	ThrowIfFalse(m_prebuildInfo.ScratchDataSizeInBytes <= scratch->GetDesc().Width, L"Insufficient scratch buffer size provided!");
+    UINT64 requiredScratchSize = IsUpdateOnBuild() ? m_prebuildInfo.UpdateScratchDataSizeInBytes : m_prebuildInfo.ScratchDataSizeInBytes;
+	ThrowIfFalse(requiredScratchSize <= scratchSizeInBytes, L"Insufficient scratch buffer size provided!");
+	ThrowIfFalse(!m_isCompacted, L"A compacted AS is too small to be rebuilt, decompact it first!");
 	
     if (baseGeometryTransformGPUAddress > 0)
     {
@@ -145,7 +164,7 @@ void BottomLevelAccelerationStructure::Build(
         bottomLevelInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
         bottomLevelInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
         bottomLevelInputs.Flags = m_buildFlags;
-		if (m_isBuilt && m_allowUpdate && m_updateOnBuild)
+		if (IsUpdateOnBuild())
 		{
             bottomLevelInputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
             bottomLevelBuildDesc.SourceAccelerationStructureData = m_accelerationStructure->GetGPUVirtualAddress();
@@ -153,17 +172,50 @@ void BottomLevelAccelerationStructure::Build(
         bottomLevelInputs.NumDescs = static_cast<UINT>(m_cacheGeometryDescs[currentID].size());
         bottomLevelInputs.pGeometryDescs = m_cacheGeometryDescs[currentID].data();
 
-		bottomLevelBuildDesc.ScratchAccelerationStructureData = scratch->GetGPUVirtualAddress();
+		bottomLevelBuildDesc.ScratchAccelerationStructureData = scratch;
 		bottomLevelBuildDesc.DestAccelerationStructureData = m_accelerationStructure->GetGPUVirtualAddress();
 	}
 
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildInfoDesc = {};
+    postbuildInfoDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+    postbuildInfoDesc.DestBuffer = compactedSizeGPUAddress;
+    UINT numPostbuildInfoDescs = compactedSizeGPUAddress ? 1 : 0;
+
 	commandList->SetDescriptorHeaps(1, &descriptorHeap);
-    commandList->BuildRaytracingAccelerationStructure(&bottomLevelBuildDesc, 0, nullptr);
+    commandList->BuildRaytracingAccelerationStructure(&bottomLevelBuildDesc, numPostbuildInfoDescs, &postbuildInfoDesc);
 
 	m_isDirty = false;
     m_isBuilt = true;
 }
 
+// Copies the AS into a resource of its compacted size.
+// The compacted size is only known once the GPU has finished the first build.
+ComPtr<ID3D12Resource> BottomLevelAccelerationStructure::Compact(ID3D12Device5* device, ID3D12GraphicsCommandList4* commandList, UINT64 compactedSizeInBytes)
+{
+    ThrowIfFalse(AllowsCompaction() && m_isBuilt && !m_isCompacted);
+
+    ComPtr<ID3D12Resource> uncompactedAccelerationStructure = m_accelerationStructure;
+    AllocateUAVBuffer(device, compactedSizeInBytes, &m_accelerationStructure, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, m_name.c_str());
+    commandList->CopyRaytracingAccelerationStructure(
+        m_accelerationStructure->GetGPUVirtualAddress(), 
+        uncompactedAccelerationStructure->GetGPUVirtualAddress(), 
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+
+    m_isCompacted = true;
+    return uncompactedAccelerationStructure;
+}
+
+// Reallocates a full size resource so that the AS can be rebuilt.
+ComPtr<ID3D12Resource> BottomLevelAccelerationStructure::Decompact(ID3D12Device5* device)
+{
+    ComPtr<ID3D12Resource> compactedAccelerationStructure = m_accelerationStructure;
+    AllocateResource(device);
+
+    m_isCompacted = false;
+    m_isBuilt = false;
+    return compactedAccelerationStructure;
+}
+
 void TopLevelAccelerationStructure::ComputePrebuildInfo(ID3D12Device5* device, UINT numBottomLevelASInstanceDescs)
 {
 	// Get the size requirements for the scratch and AS buffers.
@@ -211,9 +263,10 @@ void TopLevelAccelerationStructure::Build(ID3D12GraphicsCommandList4* commandLis
         topLevelInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
         topLevelInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
         topLevelInputs.Flags = m_buildFlags;
-        if (m_isBuilt && m_allowUpdate && m_updateOnBuild)
+        if (m_isBuilt && m_allowUpdate && (bUpdate || m_updateOnBuild))
         {
             topLevelInputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+            topLevelBuildDesc.SourceAccelerationStructureData = m_accelerationStructure->GetGPUVirtualAddress();
         }
         topLevelInputs.NumDescs = numBottomLevelASInstanceDescs;
 
@@ -228,9 +281,11 @@ void TopLevelAccelerationStructure::Build(ID3D12GraphicsCommandList4* commandLis
     m_isBuilt = true;
 }
 
-RaytracingAccelerationStructureManager::RaytracingAccelerationStructureManager(ID3D12Device5* device, UINT numBottomLevelInstances, UINT frameCount)
+RaytracingAccelerationStructureManager::RaytracingAccelerationStructureManager(ID3D12Device5* device, UINT numBottomLevelInstances, UINT frameCount) :
+    m_frameCount(frameCount)
 {
     m_bottomLevelASInstanceDescs.Create(device, numBottomLevelInstances, frameCount, L"Bottom-Level Acceleration Structure Instance descs.");
+    m_buildGpuTimerIndex = GpuTimeManager::instance().NewTimer();
 }
 
 // Adds a bottom-level Acceleration Structure.
@@ -248,6 +303,13 @@ void RaytracingAccelerationStructureManager::AddBottomLevelAS(
 
     auto& bottomLevelAS = m_vBottomLevelAS[bottomLevelASGeometry.GetName()];
 
+    // Static bottom-level AS are compacted after their first build.
+    if (!allowUpdate && AccelerationStructure_Args::CompactStaticBottomLevelAS)
+    {
+        buildFlags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+        m_compactedSizeIndices[bottomLevelASGeometry.GetName()] = static_cast<UINT>(m_compactedSizeIndices.size());
+    }
+
     bottomLevelAS.Initialize(device, buildFlags, bottomLevelASGeometry, allowUpdate);
 
     m_ASmemoryFootprint += bottomLevelAS.RequiredResultDataSizeInBytes();
@@ -289,6 +351,13 @@ UINT RaytracingAccelerationStructureManager::GetMaxInstanceContributionToHitGrou
     return maxInstanceContributionToHitGroupIndex;
 };
 
+// Scratch ranges handed out of the scratch pool have to start on an AS byte alignment boundary.
+static UINT64 AlignScratchSize(UINT64 sizeInBytes)
+{
+    const UINT64 alignment = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT;
+    return (sizeInBytes + alignment - 1) & ~(alignment - 1);
+}
+
 // Initializes the top-level Acceleration Structure.
 void RaytracingAccelerationStructureManager::InitializeTopLevelAS(
     ID3D12Device5* device,
@@ -300,9 +369,162 @@ void RaytracingAccelerationStructureManager::InitializeTopLevelAS(
     m_topLevelAS.Initialize(device, GetNumberOfBottomLevelASInstances(), buildFlags, allowUpdate, performUpdateOnBuild, resourceName);
 
     m_ASmemoryFootprint += m_topLevelAS.RequiredResultDataSizeInBytes();
-    m_scratchResourceSize = max(m_topLevelAS.RequiredScratchSize(), m_scratchResourceSize);
 
+    // Size the scratch pool so that a batch of the largest bottom-level AS builds can each get their own range of it.
+    {
+        vector<UINT64> bottomLevelASScratchSizes;
+        for (auto& bottomLevelASpair : m_vBottomLevelAS)
+        {
+            bottomLevelASScratchSizes.push_back(AlignScratchSize(bottomLevelASpair.second.RequiredScratchSize()));
+        }
+        sort(bottomLevelASScratchSizes.begin(), bottomLevelASScratchSizes.end(), greater<UINT64>());
+
+        size_t maxBuildsPerBatch = min(bottomLevelASScratchSizes.size(), static_cast<size_t>(AccelerationStructure_Args::MaxBottomLevelASBuildsPerBatch));
+        UINT64 batchScratchSize = accumulate(bottomLevelASScratchSizes.begin(), bottomLevelASScratchSizes.begin() + maxBuildsPerBatch, 0ull);
+
+        m_scratchResourceSize = max(m_topLevelAS.RequiredScratchSize(), batchScratchSize);
+    }
     AllocateUAVBuffer(device, m_scratchResourceSize, &m_accelerationStructureScratch, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, L"Acceleration structure scratch resource");
+
+    if (!m_compactedSizeIndices.empty())
+    {
+        UINT64 compactedSizesSize = m_compactedSizeIndices.size() * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC);
+        AllocateUAVBuffer(device, compactedSizesSize, &m_compactedSizes, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, L"Acceleration structure compacted sizes");
+        AllocateReadBackBuffer(device, compactedSizesSize, &m_compactedSizesReadback, D3D12_RESOURCE_STATE_COPY_DEST, L"Readback buffer - Acceleration structure compacted sizes");
+    }
+}
+
+// Points the instances of a bottom-level AS at its new resource.
+// The old resource is released once the GPU is done with the frames that may still use it.
+void RaytracingAccelerationStructureManager::SwapBottomLevelASResource(
+    D3D12_GPU_VIRTUAL_ADDRESS oldAddress, 
+    D3D12_GPU_VIRTUAL_ADDRESS newAddress, 
+    ComPtr<ID3D12Resource> oldResource)
+{
+    for (UINT i = 0; i < m_numBottomLevelASInstances; i++)
+    {
+        auto& instanceDesc = m_bottomLevelASInstanceDescs[i];
+        if (instanceDesc.AccelerationStructure == oldAddress)
+        {
+            instanceDesc.AccelerationStructure = newAddress;
+        }
+    }
+
+    m_pendingReleases.push_back({ oldResource, m_frameID + m_frameCount });
+}
+
+// Compacts the bottom-level AS whose compacted sizes were written FrameCount frames ago.
+void RaytracingAccelerationStructureManager::CompactBottomLevelAS(ID3D12GraphicsCommandList4* commandList, vector<D3D12_RESOURCE_BARRIER>* barriers)
+{
+    m_pendingReleases.remove_if([&](const PendingRelease& pendingRelease) { return pendingRelease.frameID <= m_frameID; });
+
+    auto readyEnd = partition(m_pendingCompactions.begin(), m_pendingCompactions.end(), 
+        [&](const PendingCompaction& pendingCompaction) { return pendingCompaction.frameID + m_frameCount > m_frameID; });
+    if (readyEnd == m_pendingCompactions.end())
+    {
+        return;
+    }
+
+    ScopedTimer _prof(L"Compaction", commandList);
+
+    ComPtr<ID3D12Device5> device;
+    ThrowIfFailed(commandList->GetDevice(IID_PPV_ARGS(&device)));
+
+    typedef D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC CompactedSizeDesc;
+    CompactedSizeDesc* compactedSizes;
+    UINT64 compactedSizesSize = m_compactedSizeIndices.size() * sizeof(CompactedSizeDesc);
+    ThrowIfFailed(m_compactedSizesReadback->Map(0, &CD3DX12_RANGE(0, static_cast<SIZE_T>(compactedSizesSize)), reinterpret_cast<void**>(&compactedSizes)));
+
+    for (auto pendingCompaction = readyEnd; pendingCompaction != m_pendingCompactions.end(); pendingCompaction++)
+    {
+        auto& bottomLevelAS = *pendingCompaction->bottomLevelAS;
+        UINT64 compactedSize = compactedSizes[pendingCompaction->compactedSizeIndex].CompactedSizeInBytes;
+
+        // The AS may have been rebuilt in between, it's compacted the next time around.
+        if (bottomLevelAS.IsDirty() || bottomLevelAS.IsCompacted() || compactedSize == 0)
+        {
+            continue;
+        }
+
+        D3D12_GPU_VIRTUAL_ADDRESS oldAddress = bottomLevelAS.GetResource()->GetGPUVirtualAddress();
+        ComPtr<ID3D12Resource> oldResource = bottomLevelAS.Compact(device.Get(), commandList, compactedSize);
+        SwapBottomLevelASResource(oldAddress, bottomLevelAS.GetResource()->GetGPUVirtualAddress(), oldResource);
+        barriers->push_back(CD3DX12_RESOURCE_BARRIER::UAV(bottomLevelAS.GetResource()));
+
+        UINT64 memorySaved = bottomLevelAS.RequiredResultDataSizeInBytes() - compactedSize;
+        m_ASmemoryFootprint -= memorySaved;
+        m_buildStatistics.compactionMemorySavedInBytes += memorySaved;
+        m_buildStatistics.numCompactedBottomLevelAS++;
+        m_buildStatistics.numBottomLevelASCompactions++;
+    }
+
+    m_compactedSizesReadback->Unmap(0, &CD3DX12_RANGE(0, 0));
+    m_pendingCompactions.erase(readyEnd, m_pendingCompactions.end());
+}
+
+// How far an instance has moved between two transforms,
+// as the furthest its origin or the tip of one of its unit axes has moved.
+static float InstanceMotion(const D3D12_RAYTRACING_INSTANCE_DESC& instanceDesc, const D3D12_RAYTRACING_INSTANCE_DESC& prevInstanceDesc)
+{
+    float maxDistanceSquared = 0;
+    for (UINT point = 0; point < 4; point++)
+    {
+        float distanceSquared = 0;
+        for (UINT row = 0; row < 3; row++)
+        {
+            float delta = instanceDesc.Transform[row][3] - prevInstanceDesc.Transform[row][3];
+            if (point < 3)
+            {
+                delta += instanceDesc.Transform[row][point] - prevInstanceDesc.Transform[row][point];
+            }
+            distanceSquared += delta * delta;
+        }
+        maxDistanceSquared = max(maxDistanceSquared, distanceSquared);
+    }
+    return sqrtf(maxDistanceSquared);
+}
+
+// Refits the top-level AS while instances stay close to where they were when it was last rebuilt.
+// Refits don't reorganize the tree, so its quality degrades the further instances move.
+TopLevelASBuild::Type RaytracingAccelerationStructureManager::ChooseTopLevelASBuild(bool bForceBuild, bool bottomLevelASChanged)
+{
+    m_buildStatistics.topLevelASMaxInstanceMotion = 0;
+    if (bForceBuild || !m_topLevelAS.IsBuilt() || !m_topLevelAS.AllowsUpdate() ||
+        m_topLevelASRebuiltInstanceDescs.size() != m_numBottomLevelASInstances)
+    {
+        return TopLevelASBuild::Rebuild;
+    }
+
+    bool instancesChanged = false;
+    float maxInstanceMotion = 0;
+    for (UINT i = 0; i < m_numBottomLevelASInstances; i++)
+    {
+        auto& instanceDesc = m_bottomLevelASInstanceDescs[i];
+        auto& rebuiltInstanceDesc = m_topLevelASRebuiltInstanceDescs[i];
+
+        // Switching bottom-level AS, e.g. a LOD change, can change an instance's bounds arbitrarily.
+        if (instanceDesc.AccelerationStructure != rebuiltInstanceDesc.AccelerationStructure ||
+            instanceDesc.InstanceMask != rebuiltInstanceDesc.InstanceMask ||
+            instanceDesc.Flags != rebuiltInstanceDesc.Flags)
+        {
+            return TopLevelASBuild::Rebuild;
+        }
+
+        instancesChanged = instancesChanged || memcmp(&instanceDesc, &m_topLevelASBuiltInstanceDescs[i], sizeof(instanceDesc)) != 0;
+        maxInstanceMotion = max(maxInstanceMotion, InstanceMotion(instanceDesc, rebuiltInstanceDesc));
+    }
+    m_buildStatistics.topLevelASMaxInstanceMotion = maxInstanceMotion;
+
+    if (!instancesChanged && !bottomLevelASChanged)
+    {
+        return TopLevelASBuild::Skipped;
+    }
+    if (maxInstanceMotion > AccelerationStructure_Args::TopLevelASMaxRefitInstanceMotion ||
+        m_numTopLevelASRefitsSinceRebuild >= static_cast<UINT>(static_cast<int>(AccelerationStructure_Args::TopLevelASMaxRefits)))
+    {
+        return TopLevelASBuild::Rebuild;
+    }
+    return TopLevelASBuild::Refit;
 }
 
 // Builds all bottom-level and top-level Acceleration Structures.
@@ -313,39 +535,150 @@ void RaytracingAccelerationStructureManager::Build(
     bool bForceBuild)
 {
     ScopedTimer _prof(L"Acceleration Structure build", commandList);
+    GpuTimeManager::instance().Start(commandList, m_buildGpuTimerIndex);
 
-    m_bottomLevelASInstanceDescs.CopyStagingToGpu(frameIndex);
+    m_buildStatistics.numBottomLevelASBuilds = 0;
+    m_buildStatistics.numBottomLevelASBuildBatches = 0;
+    m_buildStatistics.numBottomLevelASCompactions = 0;
+
+    // UAV barriers for the bottom-level AS written this frame, the top-level AS build reads them.
+    vector<D3D12_RESOURCE_BARRIER> bottomLevelASBarriers;
+
+    // Compaction has to be done before the instance descs are copied to the GPU, it moves the bottom-level AS.
+    CompactBottomLevelAS(commandList, &bottomLevelASBarriers);
 
     // Build all bottom-level AS.
+    // Each build in a batch gets its own range of the scratch pool so that the GPU can overlap them,
+    // only the batches themselves are separated by a UAV barrier on the scratch pool.
     {
         ScopedTimer _prof(L"Bottom Level AS", commandList);
+
+        ComPtr<ID3D12Device5> device;
+        vector<UINT> compactedSizeIndices;
+        UINT maxBuildsPerBatch = static_cast<UINT>(static_cast<int>(AccelerationStructure_Args::MaxBottomLevelASBuildsPerBatch));
+        UINT numBuildsInBatch = 0;
+        UINT64 batchScratchSize = 0;
+
         for (auto& bottomLevelASpair : m_vBottomLevelAS)
         {
             auto& bottomLevelAS = bottomLevelASpair.second;
-            if (bForceBuild || bottomLevelAS.IsDirty())
+            if (!bForceBuild && !bottomLevelAS.IsDirty())
+            {
+                continue;
+            }
+
+            if (bottomLevelAS.IsCompacted())
+            {
+                if (!device)
+                {
+                    ThrowIfFailed(commandList->GetDevice(IID_PPV_ARGS(&device)));
+                }
+                D3D12_GPU_VIRTUAL_ADDRESS oldAddress = bottomLevelAS.GetResource()->GetGPUVirtualAddress();
+                UINT64 compactedSize = bottomLevelAS.ResourceSize();
+                ComPtr<ID3D12Resource> oldResource = bottomLevelAS.Decompact(device.Get());
+                SwapBottomLevelASResource(oldAddress, bottomLevelAS.GetResource()->GetGPUVirtualAddress(), oldResource);
+
+                UINT64 memorySaved = bottomLevelAS.RequiredResultDataSizeInBytes() - compactedSize;
+                m_ASmemoryFootprint += memorySaved;
+                m_buildStatistics.compactionMemorySavedInBytes -= memorySaved;
+                m_buildStatistics.numCompactedBottomLevelAS--;
+            }
+
+            auto& prebuildInfo = bottomLevelAS.PrebuildInfo();
+            UINT64 scratchSize = AlignScratchSize(bottomLevelAS.IsUpdateOnBuild() ? prebuildInfo.UpdateScratchDataSizeInBytes : prebuildInfo.ScratchDataSizeInBytes);
+            if (numBuildsInBatch == maxBuildsPerBatch || batchScratchSize + scratchSize > m_scratchResourceSize)
+            {
+                commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(m_accelerationStructureScratch.Get()));
+                numBuildsInBatch = 0;
+                batchScratchSize = 0;
+            }
+            if (numBuildsInBatch == 0)
+            {
+                m_buildStatistics.numBottomLevelASBuildBatches++;
+            }
+
+            // Static bottom-level AS write out their compacted size on their first build.
+            D3D12_GPU_VIRTUAL_ADDRESS compactedSizeGpuAddress = 0;
+            auto compactedSizeIndex = m_compactedSizeIndices.find(bottomLevelASpair.first);
+            if (compactedSizeIndex != m_compactedSizeIndices.end())
+            {
+                compactedSizeGpuAddress = m_compactedSizes->GetGPUVirtualAddress() + compactedSizeIndex->second * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC);
+                compactedSizeIndices.push_back(compactedSizeIndex->second);
+                m_pendingCompactions.erase(
+                    remove_if(m_pendingCompactions.begin(), m_pendingCompactions.end(), [&](const PendingCompaction& pendingCompaction) { return pendingCompaction.bottomLevelAS == &bottomLevelAS; }),
+                    m_pendingCompactions.end());
+                m_pendingCompactions.push_back({ &bottomLevelAS, compactedSizeIndex->second, m_frameID });
+            }
+
             {
                 ScopedTimer _prof(bottomLevelAS.GetName(), commandList);
 
                 D3D12_GPU_VIRTUAL_ADDRESS baseGeometryTransformGpuAddress = 0;
-                bottomLevelAS.Build(commandList, m_accelerationStructureScratch.Get(), descriptorHeap, baseGeometryTransformGpuAddress);
+                D3D12_GPU_VIRTUAL_ADDRESS scratch = m_accelerationStructureScratch->GetGPUVirtualAddress() + batchScratchSize;
+                bottomLevelAS.Build(commandList, scratch, scratchSize, descriptorHeap, baseGeometryTransformGpuAddress, compactedSizeGpuAddress);
+            }
+            bottomLevelASBarriers.push_back(CD3DX12_RESOURCE_BARRIER::UAV(bottomLevelAS.GetResource()));
 
-                // Since a single scratch resource is reused, put a barrier in-between each call.
-                // PEFORMANCE tip: use separate scratch memory per BLAS build to allow a GPU driver to overlap build calls.
-                commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(bottomLevelAS.GetResource()));
+            numBuildsInBatch++;
+            batchScratchSize += scratchSize;
+            m_buildStatistics.numBottomLevelASBuilds++;
+        }
+
+        // Copy the compacted sizes written this frame to the readback buffer.
+        if (!compactedSizeIndices.empty())
+        {
+            typedef D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC CompactedSizeDesc;
+            commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_compactedSizes.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+            for (UINT compactedSizeIndex : compactedSizeIndices)
+            {
+                UINT64 offset = compactedSizeIndex * sizeof(CompactedSizeDesc);
+                commandList->CopyBufferRegion(m_compactedSizesReadback.Get(), offset, m_compactedSizes.Get(), offset, sizeof(CompactedSizeDesc));
             }
+            commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_compactedSizes.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+        }
+
+        if (m_buildStatistics.numBottomLevelASBuilds > 0)
+        {
+            bottomLevelASBarriers.push_back(CD3DX12_RESOURCE_BARRIER::UAV(m_accelerationStructureScratch.Get()));
+        }
+        if (!bottomLevelASBarriers.empty())
+        {
+            commandList->ResourceBarrier(static_cast<UINT>(bottomLevelASBarriers.size()), bottomLevelASBarriers.data());
         }
     }
+
+    m_bottomLevelASInstanceDescs.CopyStagingToGpu(frameIndex);
     
     // Build the top-level AS.
     {
         ScopedTimer _prof(L"Top Level AS", commandList);
 
-        bool performUpdate = false; // Always rebuild top-level Acceleration Structure.
-        D3D12_GPU_VIRTUAL_ADDRESS instanceDescs = m_bottomLevelASInstanceDescs.GpuVirtualAddress(frameIndex);
-        m_topLevelAS.Build(commandList, GetNumberOfBottomLevelASInstances(), instanceDescs, m_accelerationStructureScratch.Get(), descriptorHeap, performUpdate);
+        TopLevelASBuild::Type topLevelASBuild = ChooseTopLevelASBuild(bForceBuild, !bottomLevelASBarriers.empty());
+        if (topLevelASBuild != TopLevelASBuild::Skipped)
+        {
+            bool performUpdate = topLevelASBuild == TopLevelASBuild::Refit;
+            D3D12_GPU_VIRTUAL_ADDRESS instanceDescs = m_bottomLevelASInstanceDescs.GpuVirtualAddress(frameIndex);
+            m_topLevelAS.Build(commandList, GetNumberOfBottomLevelASInstances(), instanceDescs, m_accelerationStructureScratch.Get(), descriptorHeap, performUpdate);
 
-        commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(m_topLevelAS.GetResource()));
+            commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(m_topLevelAS.GetResource()));
+
+            m_topLevelASBuiltInstanceDescs.assign(m_bottomLevelASInstanceDescs.begin(), m_bottomLevelASInstanceDescs.begin() + m_numBottomLevelASInstances);
+            if (performUpdate)
+            {
+                m_numTopLevelASRefitsSinceRebuild++;
+            }
+            else
+            {
+                m_topLevelASRebuiltInstanceDescs = m_topLevelASBuiltInstanceDescs;
+                m_numTopLevelASRefitsSinceRebuild = 0;
+            }
+        }
+        m_buildStatistics.topLevelASBuild = topLevelASBuild;
     }
+
+    GpuTimeManager::instance().Stop(commandList, m_buildGpuTimerIndex);
+    m_buildStatistics.buildGpuTimeMS = GpuTimeManager::instance().GetAverageMS(m_buildGpuTimerIndex);
+    m_frameID++;
 }
 
 void BottomLevelAccelerationStructureInstanceDesc::SetTransform(const XMMATRIX& transform)
@@ -38,6 +38,8 @@ public:
 
     void SetDirty(bool isDirty) { m_isDirty = isDirty; }
     bool IsDirty() { return m_isDirty; }
+    bool IsBuilt() { return m_isBuilt; }
+    bool AllowsUpdate() { return m_allowUpdate; }
     UINT64 ResourceSize() { return GetResource()->GetDesc().Width; }
 
 protected:
@@ -82,7 +84,14 @@ public:
 	~BottomLevelAccelerationStructure() {}
 
     void Initialize(ID3D12Device5* device, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags, BottomLevelAccelerationStructureGeometry& bottomLevelASGeometry, bool allowUpdate = false, bool bUpdateOnBuild = false);
-    void Build(ID3D12GraphicsCommandList4* commandList, ID3D12Resource* scratch, ID3D12DescriptorHeap* descriptorHeap, D3D12_GPU_VIRTUAL_ADDRESS baseGeometryTransformGPUAddress = 0);
+    void Build(ID3D12GraphicsCommandList4* commandList, D3D12_GPU_VIRTUAL_ADDRESS scratch, UINT64 scratchSizeInBytes, ID3D12DescriptorHeap* descriptorHeap, D3D12_GPU_VIRTUAL_ADDRESS baseGeometryTransformGPUAddress = 0, D3D12_GPU_VIRTUAL_ADDRESS compactedSizeGPUAddress = 0);
+    bool IsUpdateOnBuild() { return m_isBuilt && m_allowUpdate && m_updateOnBuild; }
+
+    // Compaction swaps the AS resource, the returned resource must be kept alive until the GPU is done with it.
+    bool AllowsCompaction() { return (m_buildFlags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION) != 0; }
+    bool IsCompacted() { return m_isCompacted; }
+    ComPtr<ID3D12Resource> Compact(ID3D12Device5* device, ID3D12GraphicsCommandList4* commandList, UINT64 compactedSizeInBytes);
+    ComPtr<ID3D12Resource> Decompact(ID3D12Device5* device);
 
     void UpdateGeometryDescsTransform(D3D12_GPU_VIRTUAL_ADDRESS baseGeometryTransformGPUAddress);
     
@@ -98,6 +107,7 @@ private:
     std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> m_cacheGeometryDescs[3];
     DirectX::XMMATRIX m_transform;
     UINT m_instanceContributionToHitGroupIndex = 0;
+    bool m_isCompacted = false;
 
 	void BuildGeometryDescs(BottomLevelAccelerationStructureGeometry& bottomLevelASGeometry);
 	void ComputePrebuildInfo(ID3D12Device5* device);
@@ -125,6 +135,26 @@ struct BottomLevelAccelerationStructureInstanceDesc : public D3D12_RAYTRACING_IN
 static_assert(sizeof(BottomLevelAccelerationStructureInstanceDesc) == sizeof(D3D12_RAYTRACING_INSTANCE_DESC), L"This is a wrapper used in place of the desc. It has to have the same size");
 
 
+namespace TopLevelASBuild {
+    enum Type { Skipped = 0, Refit, Rebuild, Count };
+}
+
+struct AccelerationStructureBuildStatistics
+{
+    // Last frame.
+    UINT numBottomLevelASBuilds = 0;
+    UINT numBottomLevelASBuildBatches = 0;
+    UINT numBottomLevelASCompactions = 0;
+    TopLevelASBuild::Type topLevelASBuild = TopLevelASBuild::Skipped;
+    float topLevelASMaxInstanceMotion = 0;
+
+    // Since the manager was created.
+    UINT numCompactedBottomLevelAS = 0;
+    UINT64 compactionMemorySavedInBytes = 0;
+
+    float buildGpuTimeMS = 0;   // Running average.
+};
+
 class RaytracingAccelerationStructureManager
 {
 public:
@@ -143,6 +173,7 @@ public:
     UINT64 GetASMemoryFootprint() { return m_ASmemoryFootprint; }
     UINT GetNumberOfBottomLevelASInstances() { return static_cast<UINT>(m_bottomLevelASInstanceDescs.NumElements()); }
     UINT GetMaxInstanceContributionToHitGroupIndex();
+    const AccelerationStructureBuildStatistics& GetBuildStatistics() { return m_buildStatistics; }
 
 private:
     TopLevelAccelerationStructure m_topLevelAS;
@@ -152,4 +183,37 @@ private:
     ComPtr<ID3D12Resource>	m_accelerationStructureScratch;
     UINT64 m_scratchResourceSize = 0;
     UINT64 m_ASmemoryFootprint = 0;
+
+    // Compaction of static bottom-level AS.
+    // Compacted sizes are written on the first build and read back FrameCount frames later.
+    struct PendingCompaction
+    {
+        BottomLevelAccelerationStructure* bottomLevelAS;
+        UINT compactedSizeIndex;
+        UINT64 frameID;
+    };
+    struct PendingRelease
+    {
+        ComPtr<ID3D12Resource> resource;
+        UINT64 frameID;
+    };
+    std::map<std::wstring, UINT> m_compactedSizeIndices;
+    ComPtr<ID3D12Resource> m_compactedSizes;
+    ComPtr<ID3D12Resource> m_compactedSizesReadback;
+    std::vector<PendingCompaction> m_pendingCompactions;
+    std::list<PendingRelease> m_pendingReleases;
+
+    // Instances as of the last top-level AS build and the last rebuild, to measure instance motion.
+    std::vector<BottomLevelAccelerationStructureInstanceDesc> m_topLevelASBuiltInstanceDescs;
+    std::vector<BottomLevelAccelerationStructureInstanceDesc> m_topLevelASRebuiltInstanceDescs;
+    UINT m_numTopLevelASRefitsSinceRebuild = 0;
+
+    UINT m_frameCount = 0;
+    UINT64 m_frameID = 0;
+    UINT m_buildGpuTimerIndex = 0;
+    AccelerationStructureBuildStatistics m_buildStatistics;
+
+    void CompactBottomLevelAS(ID3D12GraphicsCommandList4* commandList, std::vector<D3D12_RESOURCE_BARRIER>* barriers);
+    void SwapBottomLevelASResource(D3D12_GPU_VIRTUAL_ADDRESS oldAddress, D3D12_GPU_VIRTUAL_ADDRESS newAddress, ComPtr<ID3D12Resource> oldResource);
+    TopLevelASBuild::Type ChooseTopLevelASBuild(bool bForceBuild, bool bottomLevelASChanged);
 };
\ No newline at end of file
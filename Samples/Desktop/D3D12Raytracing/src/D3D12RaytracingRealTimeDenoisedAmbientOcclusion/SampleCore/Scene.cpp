@@ -702,7 +702,7 @@ void Scene::InitializeAccelerationStructures()
 #endif
     // Initialize the top-level AS.
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
-    bool allowUpdate = false;
+    bool allowUpdate = true;    // Lets the manager refit the top-level AS while instances move little.
     bool performUpdateOnBuild = false;
     m_accelerationStructure->InitializeTopLevelAS(device, buildFlags, allowUpdate, performUpdateOnBuild, L"Top-Level Acceleration Structure");
 }